@@ -1,4 +1,5 @@
 #include "Microphone_PDM.h"
+#include "MicTcpSink.h"
 
 
 SYSTEM_THREAD(ENABLED);
@@ -11,14 +12,23 @@ SerialLogHandler logHandler;
 // off automatically. The limit really is only the disk space available to receive the file.
 const unsigned long MAX_RECORDING_LENGTH_MS = 30000;
 
+// After recording stops, how long to wait for the queued audio to be sent before closing the connection
+const unsigned long DRAIN_TIMEOUT_MS = 5000;
+
 // This is the IP Address and port that the server.js node server is running on.
 IPAddress serverAddr = IPAddress(192,168,2,6); // **UPDATE THIS**
 int serverPort = 7123;
 
 TCPClient client;
 unsigned long recordingStart;
+unsigned long drainStart;
+
+// Queues the samples and sends them in larger, non-blocking writes so a slow network doesn't
+// stall the loop and cause the DMA buffers to overflow
+MicTcpClientTransport transport(client);
+MicTcpSink tcpSink;
 
-enum State { STATE_WAITING, STATE_CONNECT, STATE_RUNNING, STATE_FINISH };
+enum State { STATE_WAITING, STATE_CONNECT, STATE_RUNNING, STATE_FINISH, STATE_DRAIN };
 State state = STATE_WAITING;
 
 // Forward declarations
@@ -79,6 +89,9 @@ void loop() {
 			recordingStart = millis();
 			digitalWrite(D7, HIGH);
 
+			tcpSink.clear();
+			tcpSink.withTransport(&transport);
+
 			state = STATE_RUNNING;
 		}
 		else {
@@ -89,9 +102,14 @@ void loop() {
 
 	case STATE_RUNNING:
 		Microphone_PDM::instance().noCopySamples([](void *pSamples, size_t numSamples) {
-		    client.write((const uint8_t *)pSamples, Microphone_PDM::instance().getBufferSizeInBytes());
+		    tcpSink.write(pSamples, Microphone_PDM::instance().getBufferSizeInBytes());
 		});
 
+		if (tcpSink.loop() < 0) {
+			Log.info("connection lost");
+			state = STATE_FINISH;
+		}
+
 		if (millis() - recordingStart >= MAX_RECORDING_LENGTH_MS) {
 			state = STATE_FINISH;
 		}
@@ -99,9 +117,18 @@ void loop() {
 
 	case STATE_FINISH:
 		digitalWrite(D7, LOW);
-		client.stop();
-		Log.info("stopping");
-		state = STATE_WAITING;
+		drainStart = millis();
+		state = STATE_DRAIN;
+		break;
+
+	case STATE_DRAIN:
+		// tcpSink.loop() doesn't block, so keep calling it until the queue is sent. Stopping the
+		// client before then would discard the end of the recording.
+		if (tcpSink.loop() < 0 || tcpSink.getQueuedBytes() == 0 || millis() - drainStart >= DRAIN_TIMEOUT_MS) {
+			client.stop();
+			Log.info("stopping dropped=%lu bytes unsent=%lu bytes", (unsigned long) tcpSink.getStats().bytesDropped, (unsigned long) tcpSink.getQueuedBytes());
+			state = STATE_WAITING;
+		}
 		break;
 	}
 }
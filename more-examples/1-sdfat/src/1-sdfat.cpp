@@ -1,7 +1,7 @@
 #include "Microphone_PDM.h"
+#include "MicWavFileWriter.h"
 
 #include "SdFatSequentialFileRK.h"
-#include "SdFatWavRK.h"
 
 SYSTEM_THREAD(ENABLED);
 
@@ -16,9 +16,27 @@ PrintFile curFile;
 SPISettings spiSettings(12 * MHZ, MSBFIRST, SPI_MODE0);
 SdFatSequentialFile sequentialFile(sd, SD_CHIP_SELECT, spiSettings);
 
-// This writes wav files to SD card
-// It's actually 16025. You could set that here if instead.
-SdFatWavWriter wavWriter(1, 16000, 16);
+// Adapts an SdFat file to the interface used by MicWavFileWriter
+class SdFatMicFile : public MicFile {
+public:
+	SdFatMicFile(PrintFile &file) : file(file) {};
+
+	virtual int write(const void *buf, size_t len) { return (int) file.write((const uint8_t *)buf, len); };
+	virtual int read(void *buf, size_t len) { return file.read(buf, len); };
+	virtual bool seek(uint64_t pos) { return file.seekSet((uint32_t) pos); };
+	virtual bool sync() { return file.sync(); };
+
+protected:
+	PrintFile &file;
+};
+SdFatMicFile micFile(curFile);
+
+// This writes wav files to SD card. The header is updated every 64 KB (about 2 seconds) so the
+// file is still usable if power is lost while recording.
+MicWavFileWriter wavWriter;
+
+// Stored in the bext chunk of each file so recordings can be traced to the device
+String deviceId;
 
 // If you don't hit the setup button to stop recording, this is how long to go before turning it
 // off automatically. The limit really is only the disk space available to receive the file.
@@ -41,6 +59,8 @@ void setup() {
 	// Blue D7 LED indicates recording is on
 	pinMode(D7, OUTPUT);
 
+	deviceId = System.deviceID();
+
 	// Optional, just for testing so I can see the logs below
 	waitFor(Serial.isConnected, 10000);
 
@@ -93,8 +113,12 @@ void loop() {
 		break;
 
 	case STATE_RUNNING:
-		Microphone_PDM::instance().noCopySamples([](void *pSamples, size_t numSamples) {
-			curFile.write((uint8_t *)pSamples, Microphone_PDM::instance().getBufferSizeInBytes());
+		// Passing the page lets the writer record the time of the first sample in the bext chunk
+		Microphone_PDM::instance().noCopySamplesWithInfo([](const Microphone_PDM_Page &page) {
+			if (!wavWriter.write(page)) {
+				Log.info("failed to write to SD card");
+				state = STATE_FINISH;
+			}
 		});
 
 
@@ -104,11 +128,12 @@ void loop() {
 		break;
 
 	case STATE_FINISH:
-		Log.info("stopping");
+		// A failed header update doesn't stop recording, as finalize() writes the header again
+		Log.info("stopping headerUpdateErrors=%lu", (unsigned long) wavWriter.getHeaderUpdateErrors());
 		digitalWrite(D7, LOW);
 
 		// Write the actual length to the wave file header
-		wavWriter.updateHeaderFromLength(&curFile);
+		wavWriter.finalize();
 
 		// Close file
 		curFile.close();
@@ -142,7 +167,12 @@ bool openNewFile() {
 		char name[14];
 		curFile.getName(name, sizeof(name));
 
-		if (wavWriter.startFile(&curFile)) {
+		// Starting the samples at offset 512 keeps each 512-byte buffer in a single SD card sector
+		wavWriter.withFormat(1, 16000, 16)
+			.withDataAlignment(512)
+			.withBext(NULL, "Microphone_PDM", deviceId.c_str());
+
+		if (wavWriter.begin(&micFile)) {
 			Log.info("file opened successfully %s", name);
 
 			success = true;
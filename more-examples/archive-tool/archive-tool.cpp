@@ -0,0 +1,472 @@
+// Host tool for MicArchive files: generate test archives, check them, extract audio, and measure seeks
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -I../../src archive-tool.cpp ../../src/MicArchive.cpp ../../src/MicStreamFraming.cpp
+//     ../../src/MicRtpSink.cpp ../../src/MicWavFileWriter.cpp ../../src/MicWavHeader.cpp ../../src/MicFile.cpp -o archive-tool
+//
+// Run:
+// ./archive-tool generate test.mpda --hours 24 --drop-every 600
+// ./archive-tool info test.mpda
+// ./archive-tool verify test.mpda
+// ./archive-tool extract test.mpda out.wav --offset 3600 --seconds 10
+// ./archive-tool bench test.mpda --seeks 10000
+// ./archive-tool corrupt test.mpda 1000
+
+#include "MicArchive.h"
+#include "MicWavFileWriter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+// Samples per channel in each simulated Microphone_PDM buffer
+static const size_t PAGE_FRAMES = 512;
+
+static void usage() {
+	fprintf(stderr,
+		"usage:\n"
+		"  archive-tool generate FILE [--hours 1] [--rate 16000] [--channels 1] [--pcmu] [--block-ms 250]\n"
+		"                             [--index 240] [--drop-every 0] [--start UNIXTIME]\n"
+		"  archive-tool info FILE\n"
+		"  archive-tool verify FILE\n"
+		"  archive-tool extract FILE OUT.wav [--offset SECONDS | --time UNIXTIME] [--seconds 10]\n"
+		"  archive-tool bench FILE [--seeks 10000]\n"
+		"  archive-tool corrupt FILE BLOCK [BYTE_OFFSET]\n");
+	exit(1);
+}
+
+// Returns the value of --name, or defaultValue
+static std::string getOption(int argc, char *argv[], const char *name, const char *defaultValue) {
+	for(int ii = 1; ii < argc; ii++) {
+		if (strcmp(argv[ii], name) == 0) {
+			if (ii + 1 >= argc) {
+				usage();
+			}
+			return argv[ii + 1];
+		}
+	}
+	return defaultValue;
+}
+
+static bool hasFlag(int argc, char *argv[], const char *name) {
+	for(int ii = 1; ii < argc; ii++) {
+		if (strcmp(argv[ii], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool openArchive(MicPosixFile &file, MicArchiveReader &reader, const char *path) {
+	if (!file.open(path)) {
+		fprintf(stderr, "could not open %s\n", path);
+		return false;
+	}
+	if (!reader.open(&file)) {
+		fprintf(stderr, "%s is not an archive, or its file header is damaged\n", path);
+		return false;
+	}
+	return true;
+}
+
+static std::string formatTime(uint64_t timeUs) {
+	if (timeUs == 0) {
+		return "unknown";
+	}
+	time_t secs = (time_t)(timeUs / 1000000);
+	struct tm tm;
+	gmtime_r(&secs, &tm);
+
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%06u UTC", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)(timeUs % 1000000));
+	return buf;
+}
+
+// Writes synthetic audio the way a device would: 512-frame buffers, with buffers occasionally dropped.
+// The tone changes every minute so extracted audio can be checked by ear or by frequency.
+static int generate(int argc, char *argv[]) {
+	const char *path = argv[2];
+	double hours = atof(getOption(argc, argv, "--hours", "1").c_str());
+	uint32_t rate = (uint32_t) atoi(getOption(argc, argv, "--rate", "16000").c_str());
+	uint8_t channels = (uint8_t) atoi(getOption(argc, argv, "--channels", "1").c_str());
+	uint32_t blockMs = (uint32_t) atoi(getOption(argc, argv, "--block-ms", "250").c_str());
+	uint32_t interval = (uint32_t) atoi(getOption(argc, argv, "--index", "240").c_str());
+	uint32_t dropEvery = (uint32_t) atoi(getOption(argc, argv, "--drop-every", "0").c_str());
+	uint32_t start = (uint32_t) strtoul(getOption(argc, argv, "--start", "1700000000").c_str(), NULL, 10);
+
+	MicPosixFile file;
+	if (!file.create(path)) {
+		fprintf(stderr, "could not create %s\n", path);
+		return 1;
+	}
+
+	MicArchiveWriter writer;
+	writer.withFormat(rate, channels)
+		.withPayload(hasFlag(argc, argv, "--pcmu") ? MicArchive::Payload::PCMU : MicArchive::Payload::PCM16)
+		.withBlockDurationMs(blockMs)
+		.withIndexInterval(interval)
+		.withStartTime(start);
+	if (!writer.begin(&file)) {
+		fprintf(stderr, "could not start archive\n");
+		return 1;
+	}
+
+	uint64_t totalFrames = (uint64_t)(hours * 3600 * rate);
+	uint64_t dropFrames = (uint64_t) dropEvery * rate;
+	std::vector<int16_t> samples(PAGE_FRAMES * channels);
+	uint64_t framesDropped = 0;
+	double phase = 0;
+
+	for(uint64_t frame = 0; frame < totalFrames; frame += PAGE_FRAMES) {
+		if (dropFrames && frame > 0 && (frame / dropFrames) != ((frame - PAGE_FRAMES) / dropFrames)) {
+			// Drop a buffer, as if the file system had been too slow
+			framesDropped += PAGE_FRAMES;
+			continue;
+		}
+		double freq = 200.0 + ((frame / rate / 60) % 20) * 50.0;
+		for(size_t ii = 0; ii < PAGE_FRAMES; ii++) {
+			phase += 2.0 * M_PI * freq / rate;
+			for(size_t ch = 0; ch < channels; ch++) {
+				samples[ii * channels + ch] = (int16_t)(8000.0 * sin(phase));
+			}
+		}
+		writer.write(samples.data(), samples.size(), frame * channels);
+	}
+	writer.finalize();
+
+	MicArchiveWriter::Stats stats = writer.getStats();
+	printf("wrote %s: %u data blocks, %u index blocks, %u discontinuities (%llu frames dropped), %u write errors\n",
+		path, (unsigned) stats.dataBlocks, (unsigned) stats.indexBlocks, (unsigned) stats.discontinuities,
+		(unsigned long long) framesDropped, (unsigned) stats.writeErrors);
+	return stats.writeErrors ? 1 : 0;
+}
+
+static int info(const char *path) {
+	MicPosixFile file;
+	MicArchiveReader reader;
+	if (!openArchive(file, reader, path)) {
+		return 1;
+	}
+
+	printf("sample rate:     %u Hz\n", (unsigned) reader.getSampleRate());
+	printf("channels:        %u\n", (unsigned) reader.getNumChannels());
+	printf("payload:         %s\n", (reader.getPayload() == MicArchive::Payload::PCMU) ? "mu-law" : "16-bit PCM");
+	printf("frames/block:    %u (%.1f ms)\n", (unsigned) reader.getFramesPerBlock(), reader.getFramesPerBlock() * 1000.0 / reader.getSampleRate());
+	printf("block size:      %u bytes\n", (unsigned) reader.getBlockSize());
+	printf("index interval:  %u data blocks\n", (unsigned) reader.getIndexInterval());
+	printf("blocks:          %u\n", (unsigned) reader.getNumBlocks());
+	printf("start time:      %s\n", formatTime(reader.getStartTimeUs()).c_str());
+
+	// The last block that can be read gives the end of the recording
+	for(uint32_t blockNum = reader.getNumBlocks(); blockNum-- > 0; ) {
+		MicArchive::BlockInfo info;
+		if (reader.readBlockInfo(blockNum, info)) {
+			uint64_t endFrame = info.frameIndex + info.numFrames;
+			printf("duration:        %.3f s\n", (double) endFrame / reader.getSampleRate());
+			if (reader.getStartTimeUs()) {
+				printf("end time:        %s\n", formatTime(reader.getStartTimeUs() + endFrame * 1000000 / reader.getSampleRate()).c_str());
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+// Reads every data and index block, checking CRCs and frame continuity
+static int verify(const char *path) {
+	MicPosixFile file;
+	MicArchiveReader reader;
+	if (!openArchive(file, reader, path)) {
+		return 1;
+	}
+
+	std::vector<int16_t> samples(reader.getFramesPerBlock() * reader.getNumChannels());
+	uint32_t dataBlocks = 0, damaged = 0, indexBlocks = 0, indexDamaged = 0, gaps = 0, unflaggedGaps = 0;
+	uint64_t nextFrame = 0, framesMissing = 0;
+	bool first = true;
+
+	for(uint32_t blockNum = 0; blockNum < reader.getNumBlocks(); blockNum++) {
+		if (MicArchive::isIndexBlock(blockNum, reader.getIndexInterval())) {
+			// Seeks still work without it, but it's damage all the same
+			int result = reader.checkBlock(blockNum);
+			if (result < 0) {
+				printf("block %u: index block %s\n", (unsigned) blockNum, (result == -1) ? "damaged" : "could not be read");
+				indexDamaged++;
+			}
+			else {
+				indexBlocks++;
+			}
+			continue;
+		}
+		MicArchive::BlockInfo info;
+		int count = reader.readSamples(blockNum, info, samples.data(), samples.size());
+		if (count < 0) {
+			printf("block %u: %s\n", (unsigned) blockNum, (count == -1) ? "damaged" : "could not be read");
+			damaged++;
+			// The next good block shows up as a gap, which is expected here
+			first = true;
+			continue;
+		}
+		dataBlocks++;
+
+		if (!first && info.frameIndex != nextFrame) {
+			gaps++;
+			framesMissing += info.frameIndex - nextFrame;
+			if (!(info.flags & MicArchive::FLAG_DISCONTINUITY)) {
+				unflaggedGaps++;
+				printf("block %u: gap of %lld frames without FLAG_DISCONTINUITY\n", (unsigned) blockNum,
+					(long long)(info.frameIndex - nextFrame));
+			}
+		}
+		first = false;
+		nextFrame = info.frameIndex + info.numFrames;
+	}
+
+	printf("%u data blocks ok, %u damaged, %u index blocks ok, %u damaged, %u gaps (%llu frames missing)\n", (unsigned) dataBlocks,
+		(unsigned) damaged, (unsigned) indexBlocks, (unsigned) indexDamaged, (unsigned) gaps, (unsigned long long) framesMissing);
+	return (damaged || indexDamaged || unflaggedGaps) ? 1 : 0;
+}
+
+// Writes the audio starting at a time to a wav file. Dropped and damaged audio is replaced by silence
+// and marked, so positions in the wav file match the original timing.
+static int extract(int argc, char *argv[]) {
+	if (argc < 4) {
+		usage();
+	}
+	MicPosixFile file;
+	MicArchiveReader reader;
+	if (!openArchive(file, reader, argv[2])) {
+		return 1;
+	}
+	uint32_t rate = reader.getSampleRate();
+	uint8_t channels = reader.getNumChannels();
+
+	uint64_t startFrame;
+	std::string timeStr = getOption(argc, argv, "--time", "");
+	if (!timeStr.empty()) {
+		double t = atof(timeStr.c_str());
+		uint64_t timeUs = (uint64_t)(t * 1000000);
+		if (reader.getStartTimeUs() == 0 || timeUs < reader.getStartTimeUs()) {
+			fprintf(stderr, "time is before the start of the archive, or the start time is unknown\n");
+			return 1;
+		}
+		startFrame = (timeUs - reader.getStartTimeUs()) * rate / 1000000;
+	}
+	else {
+		startFrame = (uint64_t)(atof(getOption(argc, argv, "--offset", "0").c_str()) * rate);
+	}
+	uint64_t endFrame = startFrame + (uint64_t)(atof(getOption(argc, argv, "--seconds", "10").c_str()) * rate);
+
+	MicArchive::BlockInfo info;
+	if (!reader.findFrame(startFrame, info)) {
+		fprintf(stderr, "time is after the end of the archive\n");
+		return 1;
+	}
+
+	MicPosixFile wavFile;
+	if (!wavFile.create(argv[3])) {
+		fprintf(stderr, "could not create %s\n", argv[3]);
+		return 1;
+	}
+	MicWavFileWriter wavWriter;
+	wavWriter.withFormat(channels, rate, 16);
+	if (reader.getStartTimeUs()) {
+		uint64_t timeUs = reader.getStartTimeUs() + startFrame * 1000000 / rate;
+		wavWriter.withBext("Extracted from archive", "archive-tool", NULL)
+			.withCaptureStartTime((uint32_t)(timeUs / 1000000), (uint32_t)(timeUs % 1000000));
+	}
+	if (!wavWriter.begin(&wavFile)) {
+		fprintf(stderr, "could not write %s\n", argv[3]);
+		return 1;
+	}
+
+	std::vector<int16_t> samples(reader.getFramesPerBlock() * channels);
+	std::vector<int16_t> silence(samples.size(), 0);
+	uint64_t frame = startFrame;
+	uint32_t gaps = 0;
+
+	for(uint32_t blockNum = info.blockNum; blockNum < reader.getNumBlocks() && frame < endFrame; blockNum++) {
+		if (MicArchive::isIndexBlock(blockNum, reader.getIndexInterval())) {
+			continue;
+		}
+		int count = reader.readSamples(blockNum, info, samples.data(), samples.size());
+		if (count < 0) {
+			// Damaged; the next good block fills the gap with silence
+			continue;
+		}
+		uint64_t blockEnd = info.frameIndex + count / channels;
+		if (blockEnd <= frame) {
+			continue;
+		}
+
+		if (info.frameIndex > frame) {
+			uint64_t gapEnd = (info.frameIndex < endFrame) ? info.frameIndex : endFrame;
+			wavWriter.addMarker(frame - startFrame, "gap");
+			gaps++;
+			for(; frame < gapEnd; ) {
+				uint64_t n = gapEnd - frame;
+				if (n > reader.getFramesPerBlock()) {
+					n = reader.getFramesPerBlock();
+				}
+				wavWriter.write(silence.data(), (size_t)(n * channels * 2));
+				frame += n;
+			}
+			if (frame >= endFrame) {
+				break;
+			}
+		}
+
+		uint64_t first = frame - info.frameIndex;
+		uint64_t last = (blockEnd < endFrame) ? blockEnd : endFrame;
+		wavWriter.write(&samples[first * channels], (size_t)((last - frame) * channels * 2));
+		frame = last;
+	}
+	wavWriter.finalize();
+
+	printf("wrote %s: %.3f s from %s, %u gaps\n", argv[3], (double)(frame - startFrame) / rate,
+		formatTime(reader.getStartTimeUs() ? reader.getStartTimeUs() + startFrame * 1000000 / rate : 0).c_str(), (unsigned) gaps);
+	return 0;
+}
+
+// Measures the time and the number of file reads to find random frames, and checks each result
+static int bench(int argc, char *argv[]) {
+	uint32_t seeks = (uint32_t) atoi(getOption(argc, argv, "--seeks", "10000").c_str());
+
+	MicPosixFile file;
+	MicArchiveReader reader;
+	auto openStart = std::chrono::steady_clock::now();
+	if (!openArchive(file, reader, argv[2])) {
+		return 1;
+	}
+	double openUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - openStart).count();
+	uint32_t openReads = reader.getReadCount();
+
+	uint64_t endFrame = 0;
+	for(uint32_t blockNum = reader.getNumBlocks(); blockNum-- > 0; ) {
+		MicArchive::BlockInfo info;
+		if (reader.readBlockInfo(blockNum, info)) {
+			endFrame = info.frameIndex + info.numFrames;
+			break;
+		}
+	}
+	if (endFrame == 0) {
+		fprintf(stderr, "no data blocks\n");
+		return 1;
+	}
+
+	std::vector<int16_t> samples(reader.getFramesPerBlock() * reader.getNumChannels());
+	std::mt19937_64 rng(1);
+	std::uniform_int_distribution<uint64_t> dist(0, endFrame - 1);
+	uint32_t maxReads = 0, errors = 0;
+	uint64_t totalReads = 0;
+	double totalUs = 0;
+
+	for(uint32_t ii = 0; ii < seeks; ii++) {
+		uint64_t target = dist(rng);
+		uint32_t readsBefore = reader.getReadCount();
+
+		auto start = std::chrono::steady_clock::now();
+		MicArchive::BlockInfo info;
+		bool found = reader.findFrame(target, info);
+		totalUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		uint32_t reads = reader.getReadCount() - readsBefore;
+		totalReads += reads;
+		if (reads > maxReads) {
+			maxReads = reads;
+		}
+
+		// The result must contain the target, or be the first good block after it if it was dropped or
+		// damaged. readSamples() checks the CRC, so damaged blocks are skipped here too.
+		MicArchive::BlockInfo prev;
+		bool ok = found && target < info.frameIndex + info.numFrames;
+		if (ok && target < info.frameIndex) {
+			for(uint32_t blockNum = info.blockNum; blockNum-- > 0; ) {
+				if (!MicArchive::isIndexBlock(blockNum, reader.getIndexInterval()) &&
+					reader.readSamples(blockNum, prev, samples.data(), samples.size()) >= 0) {
+					ok = (prev.frameIndex + prev.numFrames <= target);
+					break;
+				}
+			}
+		}
+		if (!ok) {
+			errors++;
+		}
+	}
+
+	uint32_t numBlocks = reader.getNumBlocks();
+	printf("%u blocks (%.1f hours), %u seeks\n", (unsigned) numBlocks, (double) endFrame / reader.getSampleRate() / 3600, (unsigned) seeks);
+	printf("open:        %.1f us, %u reads\n", openUs, (unsigned) openReads);
+	printf("seek:        %.2f us average, %.2f reads average, %u reads max (log2 blocks = %.1f)\n",
+		totalUs / seeks, (double) totalReads / seeks, (unsigned) maxReads, log2((double) numBlocks));
+	printf("errors:      %u\n", (unsigned) errors);
+	return errors ? 1 : 0;
+}
+
+// Inverts one byte of a block, to see how damage is handled
+static int corrupt(int argc, char *argv[]) {
+	if (argc < 4) {
+		usage();
+	}
+	MicPosixFile file;
+	MicArchiveReader reader;
+	if (!openArchive(file, reader, argv[2])) {
+		return 1;
+	}
+	uint32_t blockNum = (uint32_t) strtoul(argv[3], NULL, 10);
+	uint32_t offset = (argc >= 5) ? (uint32_t) strtoul(argv[4], NULL, 10) : (uint32_t)(MicArchive::BLOCK_HEADER_SIZE + 8);
+	if (blockNum >= reader.getNumBlocks() || offset >= reader.getBlockSize()) {
+		fprintf(stderr, "block or offset out of range\n");
+		return 1;
+	}
+
+	MicPosixFile rw;
+	uint64_t pos = MicArchive::FILE_HEADER_SIZE + (uint64_t) blockNum * reader.getBlockSize() + offset;
+	uint8_t c;
+	if (!rw.open(argv[2], true) || !rw.seek(pos) || rw.read(&c, 1) != 1) {
+		fprintf(stderr, "could not read %s\n", argv[2]);
+		return 1;
+	}
+	c = ~c;
+	if (!rw.seek(pos) || rw.write(&c, 1) != 1) {
+		fprintf(stderr, "could not write %s\n", argv[2]);
+		return 1;
+	}
+	printf("inverted byte %u of block %u\n", (unsigned) offset, (unsigned) blockNum);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		usage();
+	}
+	std::string cmd = argv[1];
+	if (cmd == "generate") {
+		return generate(argc, argv);
+	}
+	if (cmd == "info") {
+		return info(argv[2]);
+	}
+	if (cmd == "verify") {
+		return verify(argv[2]);
+	}
+	if (cmd == "extract") {
+		return extract(argc, argv);
+	}
+	if (cmd == "bench") {
+		return bench(argc, argv);
+	}
+	if (cmd == "corrupt") {
+		return corrupt(argc, argv);
+	}
+	usage();
+	return 1;
+}
@@ -0,0 +1,278 @@
+// Soak test for buffer sampling from a static arena (Microphone_PDM::withArena)
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src arena-soak.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o arena-soak
+//
+// Run:
+// ./arena-soak --cycles 100000
+//
+// Each cycle allocates a buffer sampling object with new, records from the simulated PDM with
+// bufferSamplingStart() and loop(), and releases it with releaseBufferSampling(). The cycles
+// rotate through plain, trigger, chunked and continuous sampling. Every heap allocation in the
+// program is counted by replacing operator new and delete.
+//
+// The cycles are run twice: first using the heap, to show how many allocations there normally
+// are, then using a Microphone_PDM_StaticArena. With the arena, the test fails unless the heap
+// is completely flat: no allocations and no change in the bytes in use. It also fails if the arena
+// reports an allocation failure, its peak use grows after the first cycles, or a recording in any
+// of the modes has the wrong samples.
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+//
+// Heap accounting
+//
+static size_t heapAllocations = 0;
+static size_t heapBytesInUse = 0;
+
+static void *allocate(size_t size) {
+	// Keep the size in front of the block so delete can subtract it
+	size_t *p = (size_t *)malloc(size + 16);
+	if (!p) {
+		return NULL;
+	}
+	*p = size;
+	heapAllocations++;
+	heapBytesInUse += size;
+	return (uint8_t *)p + 16;
+}
+
+static void deallocate(void *ptr) {
+	if (ptr) {
+		size_t *p = (size_t *)((uint8_t *)ptr - 16);
+		heapBytesInUse -= *p;
+		free(p);
+	}
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, size_t) noexcept { deallocate(p); }
+
+//
+// Test
+//
+static Microphone_PDM &mic = Microphone_PDM::instance();
+
+// 2 segments of 64 ms and the trigger buffer are the largest users, plus the object slots
+static Microphone_PDM_StaticArena<16384> arena;
+
+// Chunked sampling takes its chunks from a pool. Give it its own memory so it doesn't use the heap.
+static uint8_t poolMem[8192] __attribute__((aligned(8)));
+static Microphone_PDM_BlockPool pool(1024, poolMem, sizeof(poolMem));
+
+static const unsigned long RECORD_MS = 64;	// 2 DMA buffers at 16000 Hz
+static uint64_t errors = 0;
+
+// The simulated DMA writes the index of each sample as its value. Returns the next index.
+static bool checkData(const uint8_t *buf, size_t size, uint64_t &index) {
+	const int16_t *samples = (const int16_t *)buf;
+	for(size_t ii = 0; ii < size / 2; ii++, index++) {
+		if (samples[ii] != (int16_t)index) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Next sample index expected by the continuous completion callback, and whether a segment was wrong.
+// They're static so the callback captures nothing and std::function doesn't allocate.
+static uint64_t continuousIndex = 0;
+static bool continuousDataError = false;
+
+static void fail(const char *msg, uint64_t cycle) {
+	if (errors++ < 20) {
+		printf("FAIL: %s (cycle %llu)\n", msg, (unsigned long long)cycle);
+	}
+}
+
+static void runCycle(uint64_t cycle) {
+	mic.start();
+
+	switch(cycle % 4) {
+		case 0: {
+			Microphone_PDM_BufferSampling *sampling = new Microphone_PDM_BufferSampling();
+			if (sampling) {
+				sampling->withDurationMs(RECORD_MS);
+			}
+			if (!mic.bufferSamplingStart(sampling)) {
+				fail("plain start", cycle);
+				break;
+			}
+			while(!sampling->done()) {
+				PdmSim::interrupt();
+				mic.loop();
+			}
+			uint64_t index = 0;
+			if (!checkData(sampling->buffer, sampling->bufferSize, index)) {
+				fail("plain data", cycle);
+			}
+			break;
+		}
+
+		case 1: {
+			Microphone_PDM_BufferSampling_trigger *sampling = new Microphone_PDM_BufferSampling_trigger();
+			if (sampling) {
+				sampling->withPreTriggerMs(RECORD_MS).withDurationMs(RECORD_MS);
+			}
+			if (!mic.bufferSamplingStart(sampling)) {
+				fail("trigger start", cycle);
+				break;
+			}
+			for(int ii = 0; ii < 3; ii++) {
+				PdmSim::interrupt();
+				mic.loop();
+			}
+			sampling->trigger();
+			while(!sampling->done()) {
+				PdmSim::interrupt();
+				mic.loop();
+			}
+
+			// The circular buffer holds the latest samples, so the segments continue the counter from
+			// wherever the first one starts
+			uint8_t *buf1, *buf2;
+			size_t size1, size2;
+			sampling->getSegments(buf1, size1, buf2, size2);
+			uint64_t index = (uint16_t)((const int16_t *)buf1)[0];
+			if (size1 + size2 != sampling->bufferSize || !checkData(buf1, size1, index) || !checkData(buf2, size2, index)) {
+				fail("trigger data", cycle);
+			}
+			break;
+		}
+
+		case 2: {
+			Microphone_PDM_BufferSampling_chunked *sampling = new Microphone_PDM_BufferSampling_chunked();
+			if (sampling) {
+				sampling->withBlockPool(pool).withDurationMs(RECORD_MS);
+			}
+			if (!mic.bufferSamplingStart(sampling)) {
+				fail("chunked start", cycle);
+				break;
+			}
+			while(!sampling->done()) {
+				PdmSim::interrupt();
+				mic.loop();
+			}
+			uint64_t index = 0;
+			if (!sampling->getChunkList().writeTo([&index](const uint8_t *buf, size_t size) { return checkData(buf, size, index); })) {
+				fail("chunked data", cycle);
+			}
+			break;
+		}
+
+		default: {
+			Microphone_PDM_BufferSampling_continuous *sampling = new Microphone_PDM_BufferSampling_continuous();
+			if (sampling) {
+				sampling->withNumSegments(2).withDurationMs(RECORD_MS);
+				sampling->withCompletionCallback([](uint8_t *buf, size_t bufSize) {
+					if (!checkData(buf, bufSize, continuousIndex)) {
+						continuousDataError = true;
+					}
+				});
+			}
+			continuousIndex = 0;
+			continuousDataError = false;
+			if (!mic.bufferSamplingStart(sampling)) {
+				fail("continuous start", cycle);
+				break;
+			}
+			for(int ii = 0; ii < 5; ii++) {
+				PdmSim::interrupt();
+				mic.loop();
+			}
+			if (sampling->getSegmentsCompleted() != 2) {
+				fail("continuous segments", cycle);
+			}
+			if (continuousDataError) {
+				fail("continuous data", cycle);
+			}
+			break;
+		}
+	}
+
+	mic.releaseBufferSampling();
+	mic.stop();
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t cycles = 100000;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--cycles") && ii + 1 < argc) {
+			cycles = strtoull(argv[++ii], NULL, 10);
+		}
+		else {
+			printf("usage: arena-soak [--cycles N]\n");
+			return 1;
+		}
+	}
+
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+	if (mic.init()) {
+		printf("init failed\n");
+		return 1;
+	}
+	PdmSim::setSource([](uint64_t index) { return (int16_t)index; });
+
+	// Warm up, so anything allocated once (the default block pool, for example) is not counted
+	for(uint64_t cycle = 0; cycle < 4; cycle++) {
+		runCycle(cycle);
+	}
+
+	// Heap
+	size_t startAllocations = heapAllocations;
+	size_t startBytes = heapBytesInUse;
+	for(uint64_t cycle = 0; cycle < cycles; cycle++) {
+		runCycle(cycle);
+	}
+	printf("heap:  %llu cycles, %lu heap allocations, heap in use changed by %ld bytes\n", (unsigned long long)cycles,
+		(unsigned long)(heapAllocations - startAllocations), (long)heapBytesInUse - (long)startBytes);
+
+	// Arena
+	mic.withArena(arena);
+	for(uint64_t cycle = 0; cycle < 4; cycle++) {
+		runCycle(cycle);
+	}
+	size_t arenaPeak = arena.getPeakBufferBytes();
+
+	startAllocations = heapAllocations;
+	startBytes = heapBytesInUse;
+
+	printf("%10s %16s %18s %16s %15s\n", "cycle", "heap allocations", "heap bytes in use", "arena peak bytes", "arena failures");
+	for(uint64_t cycle = 0; cycle < cycles; cycle++) {
+		runCycle(cycle);
+
+		if ((cycle + 1) % (cycles / 10 ? cycles / 10 : 1) == 0) {
+			printf("%10llu %16lu %18lu %16lu %15lu\n", (unsigned long long)cycle + 1, (unsigned long)(heapAllocations - startAllocations),
+				(unsigned long)heapBytesInUse, (unsigned long)arena.getPeakBufferBytes(), (unsigned long)arena.getAllocFailures());
+		}
+	}
+
+	if (heapAllocations != startAllocations) {
+		fail("heap was used with the arena", cycles);
+	}
+	if (heapBytesInUse != startBytes) {
+		fail("heap in use changed with the arena", cycles);
+	}
+	if (arena.getAllocFailures()) {
+		fail("arena allocation failed", cycles);
+	}
+	if (arena.getPeakBufferBytes() != arenaPeak) {
+		fail("arena peak use grew", cycles);
+	}
+
+	if (errors) {
+		printf("%llu errors\n", (unsigned long long)errors);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+// Measures the quality and cost of the 8-bit dither (Microphone_PDM::withDither) on the host
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src dither-bench.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o dither-bench
+//
+// Run:
+// ./dither-bench
+//
+// A 1 kHz sine at several levels is captured as UNSIGNED_8 with RANGE_2048, with and without
+// dither. For each capture it reports:
+// - SNR: the sine against everything else, over the whole band
+// - A-weighted SNR: the same, with the A-weighting curve applied to the spectrum, which is closer
+//   to how loud the noise sounds. The noise shaping moves noise to high frequencies where the
+//   ear is less sensitive.
+// - Voice-band SNR: the sine against the noise below 4 kHz, where most speech energy is
+// - Worst spur: the largest single frequency other than the sine. Without dither, quantization
+//   error on quiet signals is harmonics of the signal, which sound like distortion. With dither
+//   it becomes a flat noise floor.
+// - ns/sample: time spent in copySamples()
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+static const int SAMPLE_RATE = 16000;
+static const double SIGNAL_HZ = 1000.0;
+static const size_t FFT_SIZE = 16384;		// 1000 Hz is exactly bin 1024, so no window is needed
+static const double FULL_SCALE = 2048.0;	// RANGE_2048
+static const double VOICE_BAND_HZ = 4000.0;
+static const size_t TIMING_BUFFERS = 20000;
+
+struct Result {
+	double snr;
+	double weightedSnr;
+	double voiceSnr;
+	double worstSpur;
+	double nsPerSample;
+};
+
+static void fft(std::vector<std::complex<double>> &a) {
+	size_t n = a.size();
+	for(size_t ii = 1, jj = 0; ii < n; ii++) {
+		size_t bit = n >> 1;
+		for(; jj & bit; bit >>= 1) {
+			jj ^= bit;
+		}
+		jj ^= bit;
+		if (ii < jj) {
+			std::swap(a[ii], a[jj]);
+		}
+	}
+	for(size_t len = 2; len <= n; len <<= 1) {
+		std::complex<double> wlen = std::polar(1.0, -2 * M_PI / len);
+		for(size_t ii = 0; ii < n; ii += len) {
+			std::complex<double> w(1);
+			for(size_t jj = 0; jj < len / 2; jj++) {
+				std::complex<double> u = a[ii + jj], v = a[ii + jj + len / 2] * w;
+				a[ii + jj] = u + v;
+				a[ii + jj + len / 2] = u - v;
+				w *= wlen;
+			}
+		}
+	}
+}
+
+// IEC 61672 A-weighting, as a power gain
+static double aWeighting(double f) {
+	double f2 = f * f;
+	double ra = (12194.0 * 12194.0 * f2 * f2) / ((f2 + 20.6 * 20.6) * sqrt((f2 + 107.7 * 107.7) * (f2 + 737.9 * 737.9)) * (f2 + 12194.0 * 12194.0));
+	return ra * ra;
+}
+
+static Result measure(double levelDb, bool dither) {
+	Microphone_PDM &mic = Microphone_PDM::instance();
+	Result result;
+
+	double amplitude = FULL_SCALE * pow(10.0, levelDb / 20.0);
+	PdmSim::setSource([amplitude](uint64_t index) {
+		return (int16_t) lround(amplitude * sin(2 * M_PI * SIGNAL_HZ * (double)index / SAMPLE_RATE));
+	});
+
+	mic.withDither(dither);
+	mic.start();
+
+	size_t samplesPerBuffer = mic.getNumberOfSamples();
+	std::vector<uint8_t> buf(mic.getBufferSizeInBytes());
+	std::vector<std::complex<double>> spectrum;
+
+	while(spectrum.size() < FFT_SIZE) {
+		PdmSim::interrupt();
+		mic.copySamples(buf.data());
+		for(size_t ii = 0; ii < samplesPerBuffer && spectrum.size() < FFT_SIZE; ii++) {
+			spectrum.push_back((double)((int)buf[ii] - 128));
+		}
+	}
+
+	fft(spectrum);
+
+	size_t signalBin = (size_t)(SIGNAL_HZ * FFT_SIZE / SAMPLE_RATE);
+	double signalPower = std::norm(spectrum[signalBin]);
+	double signalWeight = aWeighting(SIGNAL_HZ);
+	double noisePower = 0, weightedNoisePower = 0, voiceNoisePower = 0, spurPower = 0;
+
+	// Bin 0 is DC, which is inaudible
+	for(size_t bin = 1; bin <= FFT_SIZE / 2; bin++) {
+		if (bin == signalBin) {
+			continue;
+		}
+		double power = std::norm(spectrum[bin]);
+		double freq = (double)bin * SAMPLE_RATE / FFT_SIZE;
+		noisePower += power;
+		weightedNoisePower += power * aWeighting(freq);
+		if (freq < VOICE_BAND_HZ) {
+			voiceNoisePower += power;
+		}
+		if (power > spurPower) {
+			spurPower = power;
+		}
+	}
+
+	if (signalPower > 0) {
+		result.snr = 10 * log10(signalPower / noisePower);
+		result.weightedSnr = 10 * log10(signalPower * signalWeight / weightedNoisePower);
+		result.voiceSnr = 10 * log10(signalPower / voiceNoisePower);
+		result.worstSpur = 10 * log10(spurPower / signalPower);
+	}
+	else {
+		// The signal was quantized away entirely
+		result.snr = result.weightedSnr = result.voiceSnr = result.worstSpur = -INFINITY;
+	}
+
+	// Time copySamples() only, not the simulated DMA
+	std::chrono::nanoseconds elapsed(0);
+	for(size_t ii = 0; ii < TIMING_BUFFERS; ii++) {
+		PdmSim::interrupt();
+		auto start = std::chrono::steady_clock::now();
+		mic.copySamples(buf.data());
+		elapsed += std::chrono::steady_clock::now() - start;
+	}
+	result.nsPerSample = (double)elapsed.count() / (TIMING_BUFFERS * samplesPerBuffer);
+
+	mic.stop();
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	Microphone_PDM &mic = Microphone_PDM::instance();
+
+	mic.withOutputSize(Microphone_PDM::OutputSize::UNSIGNED_8)
+		.withRange(Microphone_PDM::Range::RANGE_2048)
+		.withSampleRate(SAMPLE_RATE);
+
+	int err = mic.init();
+	if (err) {
+		printf("init failed %d\n", err);
+		return 1;
+	}
+
+	printf("%-10s %-8s %8s %14s %14s %10s %10s\n", "dBFS", "mode", "SNR dB", "A-wtd SNR dB", "<4 kHz SNR dB", "spur dBc", "ns/sample");
+
+	const double levels[] = { -6, -20, -30, -40, -50 };
+	for(double level : levels) {
+		for(int dither = 0; dither < 2; dither++) {
+			Result r = measure(level, dither != 0);
+			printf("%-10.0f %-8s %8.1f %14.1f %14.1f %10.1f %10.2f\n", level, dither ? "dither" : "plain", r.snr, r.weightedSnr, r.voiceSnr, r.worstSpur, r.nsPerSample);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,422 @@
+// Measures recording failures caused by heap fragmentation, with one contiguous buffer
+// (Microphone_PDM_BufferSampling) and with chunks from a block pool (Microphone_PDM_BufferSampling_chunked)
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -fcheck-new -Isim -I../../src pool-frag.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o pool-frag
+//
+// Run:
+// ./pool-frag --heap-kb 256 --record-ms 3000 --cycles 1000
+//
+// The library's heap allocations go to a simulated device heap of a fixed size, a first-fit
+// allocator like the one in newlib. -fcheck-new is needed because a failed new returns NULL
+// on a device instead of throwing. Between and during recordings, simulated application code
+// allocates and frees blocks of random size and lifetime from the same heap. Each cycle records
+// --record-ms of audio from the simulated PDM, checks it, and releases it. The same random
+// sequence is used for each method:
+// - contiguous: Microphone_PDM_BufferSampling, one buffer for the whole recording
+// - chunked: Microphone_PDM_BufferSampling_chunked with 4096-byte blocks. Freed blocks stay in the
+//   pool for the next recording.
+// - chunked, released: the same, but the pool's free blocks are returned to the heap with
+//   releaseFreeBlocks() after each recording
+//
+// For each method it reports the percentage of recordings that could not allocate their memory,
+// the worst fragmentation of the free heap before a recording (1 - largest free block / total
+// free), the number of application allocations that failed, the peak heap use, and the peak
+// number of pool blocks. The test fails if any recording has the wrong samples.
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <random>
+#include <vector>
+
+//
+// Simulated device heap
+//
+class SimHeap {
+public:
+	SimHeap(size_t size) : size(size) {
+		mem = (uint8_t *)malloc(size);
+		freeList = (FreeBlock *)mem;
+		freeList->size = size;
+		freeList->next = NULL;
+	}
+
+	~SimHeap() {
+		::free(mem);
+	}
+
+	void *alloc(size_t n) {
+		size_t need = (n + HEADER_SIZE + 15) & ~(size_t)15;
+
+		FreeBlock **prev = &freeList;
+		for(FreeBlock *block = freeList; block; prev = &block->next, block = block->next) {
+			if (block->size < need) {
+				continue;
+			}
+			if (block->size - need >= MIN_BLOCK_SIZE) {
+				// Split, keeping the rest on the free list
+				FreeBlock *rest = (FreeBlock *)((uint8_t *)block + need);
+				rest->size = block->size - need;
+				rest->next = block->next;
+				*prev = rest;
+			}
+			else {
+				need = block->size;
+				*prev = block->next;
+			}
+			*(size_t *)block = need;
+			used += need;
+			if (used > peakUsed) {
+				peakUsed = used;
+			}
+			return (uint8_t *)block + HEADER_SIZE;
+		}
+		return NULL;
+	}
+
+	void free(void *p) {
+		FreeBlock *block = (FreeBlock *)((uint8_t *)p - HEADER_SIZE);
+		block->size = *(size_t *)block;
+		used -= block->size;
+
+		// The free list is sorted by address so neighbors can be merged
+		FreeBlock *prev = NULL, *next = freeList;
+		while(next && next < block) {
+			prev = next;
+			next = next->next;
+		}
+		block->next = next;
+		if (next && (uint8_t *)block + block->size == (uint8_t *)next) {
+			block->size += next->size;
+			block->next = next->next;
+		}
+		if (prev) {
+			prev->next = block;
+			if ((uint8_t *)prev + prev->size == (uint8_t *)block) {
+				prev->size += block->size;
+				prev->next = block->next;
+			}
+		}
+		else {
+			freeList = block;
+		}
+	}
+
+	bool owns(const void *p) const { return (const uint8_t *)p >= mem && (const uint8_t *)p < mem + size; }
+
+	size_t getLargestFree() const {
+		size_t largest = 0;
+		for(FreeBlock *block = freeList; block; block = block->next) {
+			if (block->size > largest) {
+				largest = block->size;
+			}
+		}
+		return (largest > HEADER_SIZE) ? largest - HEADER_SIZE : 0;
+	}
+
+	size_t getFree() const { return size - used; }
+	size_t getUsed() const { return used; }
+	size_t getPeakUsed() const { return peakUsed; }
+
+private:
+	struct FreeBlock {
+		size_t size;		// Including the header
+		FreeBlock *next;
+	};
+	static const size_t HEADER_SIZE = 16;
+	static const size_t MIN_BLOCK_SIZE = 32;
+
+	uint8_t *mem;
+	size_t size;
+	FreeBlock *freeList;
+	size_t used = 0;
+	size_t peakUsed = 0;
+};
+
+static SimHeap *simHeap = NULL;
+
+// Only the library's allocations go to the simulated heap, while this is set
+static bool useSimHeap = false;
+
+static void *allocate(size_t size) {
+	if (useSimHeap) {
+		return simHeap->alloc(size);
+	}
+	return malloc(size ? size : 1);
+}
+
+static void deallocate(void *p) {
+	if (simHeap && simHeap->owns(p)) {
+		simHeap->free(p);
+	}
+	else {
+		::free(p);
+	}
+}
+
+// Like Device OS, a failed allocation returns NULL instead of throwing
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void operator delete(void *p) noexcept { if (p) deallocate(p); }
+void operator delete[](void *p) noexcept { if (p) deallocate(p); }
+void operator delete(void *p, size_t) noexcept { if (p) deallocate(p); }
+void operator delete[](void *p, size_t) noexcept { if (p) deallocate(p); }
+
+//
+// Simulated application
+//
+struct Options {
+	size_t heapKb = 256;
+	unsigned long recordMs = 3000;
+	int cycles = 1000;
+	double appUse = 0.45;		// Fraction of the heap the application tries to keep in use
+};
+
+class Application {
+public:
+	Application(const Options &options, uint32_t seed) : options(options), rng(seed) {}
+
+	// Allocates or frees one random block
+	void step() {
+		bool alloc = used < options.appUse * options.heapKb * 1024 && (rng() % 100) < 60;
+
+		if (!alloc && !blocks.empty()) {
+			size_t index = rng() % blocks.size();
+			simHeap->free(blocks[index].ptr);
+			used -= blocks[index].size;
+			blocks[index] = blocks.back();
+			blocks.pop_back();
+			return;
+		}
+
+		// Mostly small objects with a few larger buffers, like strings, JSON, and network buffers
+		size_t size;
+		uint32_t r = rng() % 100;
+		if (r < 70) {
+			size = 16 + rng() % 240;
+		}
+		else if (r < 95) {
+			size = 256 + rng() % 1792;
+		}
+		else {
+			size = 2048 + rng() % 6144;
+		}
+
+		void *ptr = simHeap->alloc(size);
+		if (!ptr) {
+			failures++;
+			return;
+		}
+		blocks.push_back(Block{ptr, size});
+		used += size;
+	}
+
+	void run(int steps) {
+		for(int ii = 0; ii < steps; ii++) {
+			step();
+		}
+	}
+
+	void freeAll() {
+		for(const Block &block : blocks) {
+			simHeap->free(block.ptr);
+		}
+		blocks.clear();
+		used = 0;
+	}
+
+	size_t failures = 0;
+
+private:
+	struct Block {
+		void *ptr;
+		size_t size;
+	};
+	const Options &options;
+	std::mt19937 rng;
+	std::vector<Block> blocks;
+	size_t used = 0;
+};
+
+struct Result {
+	int recordings = 0;
+	int failed = 0;
+	double peakFragmentation = 0;
+	size_t appFailures = 0;
+	size_t peakHeapUsed = 0;
+	size_t poolBlocks = 0;
+	int badData = 0;
+};
+
+// The simulated DMA writes the index of each sample as its value
+static bool checkData(const uint8_t *buf, size_t size, uint64_t &index) {
+	const int16_t *samples = (const int16_t *)buf;
+	for(size_t ii = 0; ii < size / 2; ii++, index++) {
+		if (samples[ii] != (int16_t)index) {
+			return false;
+		}
+	}
+	return true;
+}
+
+enum class Method {
+	CONTIGUOUS,			// Microphone_PDM_BufferSampling
+	CHUNKED,			// Microphone_PDM_BufferSampling_chunked, freed blocks kept in the pool
+	CHUNKED_RELEASED	// The same, with releaseFreeBlocks() after each recording
+};
+
+static Result run(const Options &options, Method method) {
+	bool chunked = (method != Method::CONTIGUOUS);
+
+	Microphone_PDM &mic = Microphone_PDM::instance();
+	Result result;
+
+	simHeap = new SimHeap(options.heapKb * 1024);
+
+	// A separate pool, so each run starts with an empty one
+	Microphone_PDM_BlockPool *pool = NULL;
+	if (chunked) {
+		useSimHeap = true;
+		pool = new Microphone_PDM_BlockPool(Microphone_PDM_BlockPool::DEFAULT_BLOCK_SIZE);
+		useSimHeap = false;
+	}
+
+	Application app(options, 1234);
+
+	for(int cycle = 0; cycle < options.cycles; cycle++) {
+		app.run(200);
+
+		double fragmentation = 1.0 - (double)simHeap->getLargestFree() / simHeap->getFree();
+		if (fragmentation > result.peakFragmentation) {
+			result.peakFragmentation = fragmentation;
+		}
+
+		mic.start();
+
+		useSimHeap = true;
+		Microphone_PDM_BufferSampling *sampling;
+		if (chunked) {
+			sampling = new Microphone_PDM_BufferSampling_chunked();
+			if (sampling) {
+				((Microphone_PDM_BufferSampling_chunked *)sampling)->withBlockPool(*pool);
+			}
+		}
+		else {
+			sampling = new Microphone_PDM_BufferSampling();
+		}
+		if (sampling) {
+			sampling->withDurationMs(options.recordMs);
+		}
+		bool ok = mic.bufferSamplingStart(sampling);
+		useSimHeap = false;
+
+		result.recordings++;
+		if (ok) {
+			while(!sampling->done()) {
+				PdmSim::interrupt();
+				useSimHeap = true;
+				mic.loop();
+				useSimHeap = false;
+
+				// The application keeps running during the recording
+				app.run(2);
+			}
+
+			uint64_t index = 0;
+			bool good;
+			if (chunked) {
+				good = ((Microphone_PDM_BufferSampling_chunked *)sampling)->getChunkList().writeTo([&index](const uint8_t *buf, size_t size) {
+					return checkData(buf, size, index);
+				});
+			}
+			else {
+				good = checkData(sampling->buffer, sampling->bufferSize, index);
+			}
+			if (!good) {
+				result.badData++;
+			}
+		}
+		else {
+			result.failed++;
+		}
+
+		useSimHeap = true;
+		mic.releaseBufferSampling();
+		if (method == Method::CHUNKED_RELEASED) {
+			pool->releaseFreeBlocks();
+		}
+		useSimHeap = false;
+		mic.stop();
+	}
+
+	result.appFailures = app.failures;
+	result.peakHeapUsed = simHeap->getPeakUsed();
+	if (pool) {
+		result.poolBlocks = pool->getPeakAllocated();
+	}
+
+	app.freeAll();
+	if (pool) {
+		delete pool;
+	}
+	delete simHeap;
+	simHeap = NULL;
+
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--heap-kb") && ii + 1 < argc) {
+			options.heapKb = (size_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--record-ms") && ii + 1 < argc) {
+			options.recordMs = (unsigned long) atol(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--cycles") && ii + 1 < argc) {
+			options.cycles = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--app-use") && ii + 1 < argc) {
+			options.appUse = atof(argv[++ii]);
+		}
+		else {
+			printf("usage: pool-frag [--heap-kb N] [--record-ms N] [--cycles N] [--app-use FRACTION]\n");
+			return 1;
+		}
+	}
+
+	Microphone_PDM &mic = Microphone_PDM::instance();
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+	if (mic.init()) {
+		printf("init failed\n");
+		return 1;
+	}
+	PdmSim::setSource([](uint64_t index) { return (int16_t)index; });
+
+	size_t recordBytes = 16000 / 1000 * options.recordMs * 2;
+	printf("%u KB heap, application using up to %.0f%%, %lu ms recordings (%u KB), %d cycles\n",
+		(unsigned)options.heapKb, options.appUse * 100, options.recordMs, (unsigned)(recordBytes / 1024), options.cycles);
+	printf("%-17s %10s %8s %11s %13s %16s %12s\n", "method", "recordings", "failed", "peak frag", "app failures", "peak heap used", "pool blocks");
+
+	int errors = 0;
+	const Method methods[] = { Method::CONTIGUOUS, Method::CHUNKED, Method::CHUNKED_RELEASED };
+	const char *methodNames[] = { "contiguous", "chunked", "chunked, released" };
+	for(size_t ii = 0; ii < sizeof(methods) / sizeof(methods[0]); ii++) {
+		Result r = run(options, methods[ii]);
+		printf("%-17s %10d %7.1f%% %10.0f%% %13u %13u KB %12u\n", methodNames[ii], r.recordings,
+			100.0 * r.failed / r.recordings, 100.0 * r.peakFragmentation, (unsigned)r.appFailures,
+			(unsigned)(r.peakHeapUsed / 1024), (unsigned)r.poolBlocks);
+		if (r.badData) {
+			printf("FAIL: %d recordings had wrong data\n", r.badData);
+			errors++;
+		}
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+// Minimal subset of the Device OS API used by the Microphone_PDM library, implemented on top of
+// std::thread so the nRF52 driver can be built and tested on Linux or Mac. See PdmSim.h for the
+// simulated PDM peripheral.
+//
+// Interrupts are simulated by a thread. Code that would run with interrupts disabled on a
+// device (ATOMIC_BLOCK, SINGLE_THREADED_BLOCK) holds the same lock the interrupt thread holds
+// while it runs the PDM interrupt handler, so it can't be interrupted here either.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <functional>
+#include <new>
+
+#define HAL_PLATFORM_NRF52840 1
+#define HAL_PLATFORM_RTL872X 0
+
+#define SYSTEM_VERSION 0x05000000
+#define SYSTEM_VERSION_DEFAULT(major, minor, patch) (((major) << 24) | ((minor) << 16) | ((patch) << 8))
+
+#define SYSTEM_ERROR_NONE 0
+#define SYSTEM_ERROR_NOT_SUPPORTED -120
+#define SYSTEM_ERROR_INVALID_ARGUMENT -160
+#define SYSTEM_ERROR_TIMEOUT -180
+#define SYSTEM_ERROR_INVALID_STATE -210
+#define SYSTEM_ERROR_NO_MEMORY -260
+
+typedef uint16_t pin_t;
+typedef uint32_t system_tick_t;
+
+#define A0 19
+#define A1 18
+
+#define INPUT 0
+#define OUTPUT 1
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(pin_t pin, int mode);
+
+struct Hal_Pin_Info {
+	uint8_t gpio_port;
+	uint8_t gpio_pin;
+};
+Hal_Pin_Info *hal_pin_map();
+
+bool attachInterruptDirect(int irq, void (*handler)(), bool disableSystemInterrupts);
+
+// Logs to stderr
+class Logger {
+public:
+	void trace(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void info(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void warn(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void error(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+};
+extern Logger Log;
+
+// Holds the simulated interrupt lock for its lifetime. Recursive, like nested ATOMIC_BLOCKs.
+class AtomicSection {
+public:
+	AtomicSection();
+	~AtomicSection();
+};
+
+#define ATOMIC_BLOCK() for (bool __todo = true; __todo; __todo = false) for (AtomicSection __as; __todo; __todo = false)
+#define SINGLE_THREADED_BLOCK() ATOMIC_BLOCK()
+
+// Concurrency HAL
+typedef void *os_semaphore_t;
+typedef void *os_thread_t;
+typedef uint8_t os_thread_prio_t;
+typedef void (*os_thread_fn_t)(void *param);
+
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_PRIORITY_CRITICAL 9
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+#define CONCURRENT_WAIT_FOREVER ((system_tick_t)-1)
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned maxCount, unsigned initialCount);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeoutMs, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
+
+typedef void *os_mutex_recursive_t;
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex);
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex);
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex);
+
+// The stack size is ignored. A priority above OS_THREAD_PRIORITY_DEFAULT makes it a SCHED_FIFO thread if
+// the process has permission, otherwise the priority is ignored too. The thread is detached.
+int os_thread_create(os_thread_t *thread, const char *name, os_thread_prio_t priority, os_thread_fn_t fun, void *thread_param, size_t stack_size);
@@ -0,0 +1,357 @@
+#include "Particle.h"
+#include "nrfx_pdm.h"
+#include "PdmSim.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// The lock that stands in for disabling interrupts
+static std::recursive_mutex interruptMutex;
+
+static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+Logger Log;
+
+static PdmSim::SourceFunction source;
+static uint32_t bufferPeriodUs = 0;
+
+// PDM peripheral state, only changed while holding interruptMutex
+static nrfx_pdm_event_handler_t eventHandler = NULL;
+static bool started = false;
+static uint64_t valueIndex = 0;
+
+struct DmaBuffer {
+	int16_t *buffer;
+	uint16_t length;
+};
+
+// The peripheral holds the buffer it's writing and the next one. A fixed array, so the simulation
+// doesn't use the heap while running.
+static DmaBuffer dmaBuffers[2];
+static size_t numDmaBuffers = 0;
+
+static std::atomic<uint64_t> interruptCount{0};
+static std::atomic<uint64_t> missingBufferCount{0};
+static std::atomic<uint64_t> lateInterruptCount{0};
+
+static std::thread interruptThread;
+static std::atomic<bool> interruptThreadRun{false};
+static std::atomic<bool> interruptThreadPaused{false};
+
+unsigned long millis() {
+	return (unsigned long) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros() {
+	return (unsigned long) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void pinMode(pin_t pin, int mode) {
+}
+
+Hal_Pin_Info *hal_pin_map() {
+	static Hal_Pin_Info pinMap[32];
+	return pinMap;
+}
+
+bool attachInterruptDirect(int irq, void (*handler)(), bool disableSystemInterrupts) {
+	return true;
+}
+
+static void logMessage(const char *level, const char *fmt, va_list ap) {
+	fprintf(stderr, "%s: ", level);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+}
+
+void Logger::trace(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("TRACE", fmt, ap);
+	va_end(ap);
+}
+
+void Logger::info(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("INFO", fmt, ap);
+	va_end(ap);
+}
+
+void Logger::warn(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("WARN", fmt, ap);
+	va_end(ap);
+}
+
+void Logger::error(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("ERROR", fmt, ap);
+	va_end(ap);
+}
+
+AtomicSection::AtomicSection() {
+	interruptMutex.lock();
+}
+
+AtomicSection::~AtomicSection() {
+	interruptMutex.unlock();
+}
+
+//
+// Semaphores and threads
+//
+class Semaphore {
+public:
+	Semaphore(unsigned maxCount, unsigned initialCount) : maxCount(maxCount), count(initialCount) {}
+
+	bool take(system_tick_t timeoutMs) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (timeoutMs == CONCURRENT_WAIT_FOREVER) {
+			cond.wait(lock, [this] { return count > 0; });
+		}
+		else if (!cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return count > 0; })) {
+			return false;
+		}
+		count--;
+		return true;
+	}
+
+	bool give() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count >= maxCount) {
+			return false;
+		}
+		count++;
+		cond.notify_one();
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	unsigned maxCount;
+	unsigned count;
+};
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned maxCount, unsigned initialCount) {
+	*semaphore = new Semaphore(maxCount, initialCount);
+	return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+	delete (Semaphore *)semaphore;
+	return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeoutMs, bool reserved) {
+	return ((Semaphore *)semaphore)->take(timeoutMs) ? 0 : 1;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+	return ((Semaphore *)semaphore)->give() ? 0 : 1;
+}
+
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex) {
+	*mutex = new std::recursive_mutex();
+	return 0;
+}
+
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) {
+	delete (std::recursive_mutex *)mutex;
+	return 0;
+}
+
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) {
+	((std::recursive_mutex *)mutex)->lock();
+	return 0;
+}
+
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) {
+	((std::recursive_mutex *)mutex)->unlock();
+	return 0;
+}
+
+int os_thread_create(os_thread_t *thread, const char *name, os_thread_prio_t priority, os_thread_fn_t fun, void *thread_param, size_t stack_size) {
+	std::thread t(fun, thread_param);
+	*thread = (os_thread_t) t.native_handle();
+
+	if (priority > OS_THREAD_PRIORITY_DEFAULT) {
+		// A higher priority thread becomes a real-time thread, which only works if the process is
+		// allowed to (running as root on Linux, for example). Otherwise the priority is ignored.
+		struct sched_param param;
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO) + (priority - OS_THREAD_PRIORITY_DEFAULT);
+		pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param);
+	}
+
+	t.detach();
+	return 0;
+}
+
+//
+// PDM peripheral
+//
+static void callHandler(bool bufferRequested, int16_t *bufferReleased) {
+	nrfx_pdm_evt_t event;
+	event.buffer_requested = bufferRequested;
+	event.buffer_released = bufferReleased;
+	event.error = NRFX_PDM_NO_ERROR;
+
+	eventHandler(&event);
+}
+
+nrfx_err_t nrfx_pdm_init(nrfx_pdm_config_t const *p_config, nrfx_pdm_event_handler_t event_handler) {
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+	if (eventHandler) {
+		return NRFX_ERROR_INVALID_STATE;
+	}
+	eventHandler = event_handler;
+	return NRFX_SUCCESS;
+}
+
+void nrfx_pdm_uninit(void) {
+	nrfx_pdm_stop();
+
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+	eventHandler = NULL;
+}
+
+nrfx_err_t nrfx_pdm_start(void) {
+	{
+		std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+		if (!eventHandler) {
+			return NRFX_ERROR_INVALID_STATE;
+		}
+		if (started) {
+			return NRFX_ERROR_BUSY;
+		}
+		started = true;
+		valueIndex = 0;
+		numDmaBuffers = 0;
+
+		// The driver asks for the first buffer when starting and for the second one when the
+		// peripheral has started using the first
+		callHandler(true, NULL);
+		callHandler(true, NULL);
+	}
+
+	if (bufferPeriodUs) {
+		interruptThreadRun = true;
+		interruptThread = std::thread([]() {
+			auto next = std::chrono::steady_clock::now();
+			while(interruptThreadRun) {
+				next += std::chrono::microseconds(bufferPeriodUs);
+				std::this_thread::sleep_until(next);
+				if (std::chrono::steady_clock::now() - next > std::chrono::microseconds(bufferPeriodUs)) {
+					lateInterruptCount++;
+				}
+				if (!interruptThreadPaused) {
+					PdmSim::interrupt();
+				}
+			}
+		});
+	}
+	return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_pdm_stop(void) {
+	if (interruptThread.joinable()) {
+		interruptThreadRun = false;
+		interruptThread.join();
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+	started = false;
+	numDmaBuffers = 0;
+	return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_pdm_buffer_set(int16_t *buffer, uint16_t buffer_length) {
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+
+	if (numDmaBuffers >= 2) {
+		return NRFX_ERROR_BUSY;
+	}
+	dmaBuffers[numDmaBuffers++] = DmaBuffer{buffer, buffer_length};
+	return NRFX_SUCCESS;
+}
+
+void nrfx_pdm_irq_handler(void) {
+}
+
+// [static]
+void PdmSim::setSource(SourceFunction source) {
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+	::source = source;
+}
+
+// [static]
+void PdmSim::setBufferPeriodUs(uint32_t periodUs) {
+	bufferPeriodUs = periodUs;
+}
+
+// [static]
+void PdmSim::setPaused(bool paused) {
+	interruptThreadPaused = paused;
+}
+
+// [static]
+bool PdmSim::interrupt() {
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+
+	if (!started || numDmaBuffers == 0) {
+		return false;
+	}
+
+	DmaBuffer cur = dmaBuffers[0];
+	dmaBuffers[0] = dmaBuffers[1];
+	numDmaBuffers--;
+
+	for(size_t ii = 0; ii < cur.length; ii++) {
+		cur.buffer[ii] = source ? source(valueIndex) : 0;
+		valueIndex++;
+	}
+
+	if (numDmaBuffers == 0) {
+		// The peripheral moves to the next buffer on its own; if there isn't one, it keeps
+		// writing into the buffer it just released
+		missingBufferCount++;
+	}
+	interruptCount++;
+
+	callHandler(true, cur.buffer);
+	return true;
+}
+
+// [static]
+uint64_t PdmSim::getInterruptCount() {
+	return interruptCount;
+}
+
+// [static]
+uint64_t PdmSim::getValuesGenerated() {
+	std::lock_guard<std::recursive_mutex> lock(interruptMutex);
+	return valueIndex;
+}
+
+// [static]
+uint64_t PdmSim::getMissingBufferCount() {
+	return missingBufferCount;
+}
+
+// [static]
+uint64_t PdmSim::getLateInterruptCount() {
+	return lateInterruptCount;
+}
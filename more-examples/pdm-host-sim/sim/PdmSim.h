@@ -0,0 +1,83 @@
+// Simulated nRF52 PDM peripheral for running the Microphone_PDM library on Linux or Mac
+//
+// The library is built unmodified from ../../src, with sim/ first on the include path so it
+// uses the Particle.h and nrfx_pdm.h here. The simulated EasyDMA fills the buffers the driver
+// passes to nrfx_pdm_buffer_set() from a source function, and calls the driver's event handler
+// the way the PDM interrupt does: the handler runs while holding the simulated interrupt lock,
+// so it can't interleave with ATOMIC_BLOCK or SINGLE_THREADED_BLOCK code.
+//
+// With a buffer period set, nrfx_pdm_start() starts a thread that acts as the interrupt, once
+// per period. With a period of 0, the program calls PdmSim::interrupt() itself, which makes the
+// results repeatable.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <functional>
+
+class PdmSim {
+public:
+	/**
+	 * @brief Function that returns the value of a sample
+	 *
+	 * index counts 16-bit values from when nrfx_pdm_start() was called, including values
+	 * written to buffers that the driver discards. In stereo mode, the left and right samples
+	 * are separate values.
+	 */
+	typedef std::function<int16_t(uint64_t index)> SourceFunction;
+
+	/**
+	 * @brief Sets the function used to fill the DMA buffers. The default is silence.
+	 */
+	static void setSource(SourceFunction source);
+
+	/**
+	 * @brief Sets how often the interrupt thread fills a buffer, in microseconds
+	 *
+	 * 0 (the default) does not start a thread; call interrupt() instead. Set this before
+	 * starting the microphone.
+	 */
+	static void setBufferPeriodUs(uint32_t periodUs);
+
+	/**
+	 * @brief Stops or resumes the interrupt thread without stopping the PDM
+	 *
+	 * Use this to let the consumer catch up before checking totals. Transfers only happen when
+	 * the interrupt runs, so no samples are lost while paused.
+	 */
+	static void setPaused(bool paused);
+
+	/**
+	 * @brief Fills the current DMA buffer and runs the event handler, as the PDM interrupt does
+	 *
+	 * @return false if the PDM is not started
+	 */
+	static bool interrupt();
+
+	/**
+	 * @brief Number of times the event handler has been called for a filled buffer
+	 */
+	static uint64_t getInterruptCount();
+
+	/**
+	 * @brief Number of 16-bit values written by the simulated DMA, including discarded ones
+	 */
+	static uint64_t getValuesGenerated();
+
+	/**
+	 * @brief Number of times a buffer was filled and the driver did not supply a next buffer
+	 *
+	 * The real peripheral would then overwrite the buffer it just filled, so this must stay 0.
+	 */
+	static uint64_t getMissingBufferCount();
+
+	/**
+	 * @brief Number of times the interrupt thread woke up more than one buffer period late
+	 *
+	 * The thread then runs the missed interrupts back to back, which the real peripheral never
+	 * does, so the consumer has no chance to run between them. Buffers dropped at these times
+	 * are caused by the host scheduler, not the consumer.
+	 */
+	static uint64_t getLateInterruptCount();
+};
@@ -0,0 +1,68 @@
+// Subset of the nrfx PDM driver API, implemented by PdmSim.cpp
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef int nrfx_err_t;
+#define NRFX_SUCCESS 0
+#define NRFX_ERROR_INVALID_STATE 8
+#define NRFX_ERROR_BUSY 11
+
+typedef int nrf_pdm_gain_t;
+typedef int nrf_pdm_freq_t;
+typedef int nrf_pdm_edge_t;
+typedef int nrf_pdm_mode_t;
+
+#define NRF_PDM_GAIN_MINIMUM 0x00
+#define NRF_PDM_GAIN_DEFAULT 0x28
+#define NRF_PDM_GAIN_MAXIMUM 0x50
+
+#define NRF_PDM_FREQ_1000K 0x08000000
+#define NRF_PDM_FREQ_1032K 0x08400000
+#define NRF_PDM_FREQ_1067K 0x08800000
+
+#define NRF_PDM_EDGE_LEFTFALLING 0
+#define NRF_PDM_EDGE_LEFTRISING 1
+
+#define NRF_PDM_MODE_STEREO 0
+#define NRF_PDM_MODE_MONO 1
+
+#define NRFX_PDM_MAX_BUFFER_SIZE 32767
+
+typedef enum {
+	NRFX_PDM_NO_ERROR = 0,
+	NRFX_PDM_ERROR_OVERFLOW = 1
+} nrfx_pdm_error_t;
+
+typedef struct {
+	bool buffer_requested;
+	int16_t *buffer_released;
+	nrfx_pdm_error_t error;
+} nrfx_pdm_evt_t;
+
+typedef struct {
+	nrf_pdm_mode_t mode;
+	nrf_pdm_edge_t edge;
+	uint8_t pin_clk;
+	uint8_t pin_din;
+	nrf_pdm_freq_t clock_freq;
+	nrf_pdm_gain_t gain_l;
+	nrf_pdm_gain_t gain_r;
+	uint8_t interrupt_priority;
+} nrfx_pdm_config_t;
+
+#define NRFX_PDM_DEFAULT_CONFIG(_pin_clk, _pin_din) { NRF_PDM_MODE_MONO, NRF_PDM_EDGE_LEFTFALLING, (uint8_t)(_pin_clk), (uint8_t)(_pin_din), NRF_PDM_FREQ_1032K, NRF_PDM_GAIN_DEFAULT, NRF_PDM_GAIN_DEFAULT, 7 }
+
+#define NRF_GPIO_PIN_MAP(port, pin) (((port) << 5) | ((pin) & 0x1F))
+
+#define PDM_IRQn 29
+
+typedef void (*nrfx_pdm_event_handler_t)(nrfx_pdm_evt_t const * const p_evt);
+
+nrfx_err_t nrfx_pdm_init(nrfx_pdm_config_t const *p_config, nrfx_pdm_event_handler_t event_handler);
+void nrfx_pdm_uninit(void);
+nrfx_err_t nrfx_pdm_start(void);
+nrfx_err_t nrfx_pdm_stop(void);
+nrfx_err_t nrfx_pdm_buffer_set(int16_t *buffer, uint16_t buffer_length);
+void nrfx_pdm_irq_handler(void);
@@ -0,0 +1,290 @@
+// Stress test for the nRF52 DMA buffer ring, with the PDM interrupt simulated by a thread
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src spsc-stress.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o spsc-stress
+//
+// Run:
+// ./spsc-stress --seconds 10 --period-us 50
+//
+// The simulated DMA writes the index of each sample as its value, so every sample read can be
+// checked. The consumer reads in random ways (copySamples, noCopySamples, acquireSamples with
+// one or two buffers held, and buffers handed to another thread to release) and randomly
+// stalls so the ring overflows. It checks that:
+// - every sample has the value the DMA wrote, and samples are only skipped, never repeated or
+//   out of order
+// - a lent buffer is never overwritten while it is held
+// - the driver always gives the DMA its next buffer in time
+// - the samples delivered plus the samples reported as dropped equal the samples captured
+// - start() fails while a buffer is still held
+//
+// The test exits with status 1 if any check fails.
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct Options {
+	int seconds = 5;
+	uint32_t periodUs = 50;
+};
+
+static Microphone_PDM &mic = Microphone_PDM::instance();
+static size_t samplesPerBuffer;
+
+static std::mt19937 rng(1234);
+static uint64_t nextIndex = 0;			// Sample index expected next, if nothing was dropped
+static uint64_t samplesDelivered = 0;
+static uint64_t samplesSkipped = 0;		// Sum of the gaps in the sample index seen by the consumer
+static std::atomic<uint64_t> errors{0};
+
+// Buffers handed to the release thread
+static std::mutex releaseMutex;
+static std::condition_variable releaseCond;
+static std::deque<Microphone_PDM_Page> releaseQueue;
+static bool releaseThreadRun = true;
+
+static void fail(const char *msg, uint64_t a, uint64_t b) {
+	if (errors++ < 20) {
+		printf("FAIL: %s (%llu, %llu)\n", msg, (unsigned long long)a, (unsigned long long)b);
+	}
+}
+
+// Checks samples that start at sample index firstIndex
+static bool checkValues(const int16_t *samples, size_t numSamples, uint64_t firstIndex) {
+	for(size_t ii = 0; ii < numSamples; ii++) {
+		if (samples[ii] != (int16_t)(firstIndex + ii)) {
+			fail("sample value", firstIndex + ii, (uint16_t)samples[ii]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Called for every buffer in the order they are read
+static void checkOrder(uint64_t firstIndex, size_t numSamples) {
+	if (firstIndex < nextIndex) {
+		fail("sample index went backwards", firstIndex, nextIndex);
+	}
+	else {
+		samplesSkipped += firstIndex - nextIndex;
+	}
+	nextIndex = firstIndex + numSamples;
+	samplesDelivered += numSamples;
+}
+
+static void checkPage(const Microphone_PDM_Page &page) {
+	if (page.numSamples != samplesPerBuffer) {
+		fail("page size", page.numSamples, samplesPerBuffer);
+	}
+	checkOrder(page.sampleIndex, page.numSamples);
+	checkValues((const int16_t *)page.pSamples, page.numSamples, page.sampleIndex);
+}
+
+static void randomStall(uint32_t periodUs) {
+	uint32_t r = rng() % 1000;
+	if (r < 5) {
+		// Long enough that the ring overflows
+		std::this_thread::sleep_for(std::chrono::microseconds(periodUs * (4 + rng() % 8)));
+	}
+	else if (r < 100) {
+		std::this_thread::sleep_for(std::chrono::microseconds(rng() % periodUs));
+	}
+}
+
+static void releaseThreadFunction() {
+	std::mt19937 releaseRng(5678);
+	std::unique_lock<std::mutex> lock(releaseMutex);
+	while(true) {
+		releaseCond.wait(lock, [] { return !releaseQueue.empty() || !releaseThreadRun; });
+		if (releaseQueue.empty()) {
+			break;
+		}
+		Microphone_PDM_Page page = releaseQueue.front();
+		releaseQueue.pop_front();
+		lock.unlock();
+
+		// The interrupt keeps running while the buffer is held elsewhere
+		std::this_thread::sleep_for(std::chrono::microseconds(releaseRng() % 200));
+		checkValues((const int16_t *)page.pSamples, page.numSamples, page.sampleIndex);
+		mic.releaseSamples(page);
+
+		lock.lock();
+	}
+}
+
+// Reads one or two buffers in a random way. Returns false if nothing was available.
+static bool readRandom(uint32_t periodUs) {
+	switch(rng() % 5) {
+		case 0: {
+			std::vector<int16_t> buf(samplesPerBuffer);
+			if (!mic.copySamples(buf.data())) {
+				return false;
+			}
+			// copySamples has no sample index, so it comes from the data
+			uint64_t firstIndex = nextIndex + (uint16_t)(buf[0] - (int16_t)nextIndex);
+			checkOrder(firstIndex, samplesPerBuffer);
+			checkValues(buf.data(), samplesPerBuffer, firstIndex);
+			return true;
+		}
+
+		case 1:
+			return mic.noCopySamplesWithInfo(checkPage);
+
+		case 2: {
+			// Hold the buffer for up to three buffer periods, then make sure the DMA didn't write to it
+			Microphone_PDM_Page page;
+			if (!mic.acquireSamples(page)) {
+				return false;
+			}
+			checkPage(page);
+			std::this_thread::sleep_for(std::chrono::microseconds(rng() % (periodUs * 3)));
+			checkValues((const int16_t *)page.pSamples, page.numSamples, page.sampleIndex);
+			mic.releaseSamples(page);
+			return true;
+		}
+
+		case 3: {
+			// Hold two buffers and release them in the opposite order
+			Microphone_PDM_Page page1, page2;
+			if (!mic.acquireSamples(page1)) {
+				return false;
+			}
+			checkPage(page1);
+			if (mic.acquireSamples(page2)) {
+				checkPage(page2);
+				std::this_thread::sleep_for(std::chrono::microseconds(rng() % periodUs));
+				mic.releaseSamples(page2);
+				checkValues((const int16_t *)page1.pSamples, page1.numSamples, page1.sampleIndex);
+			}
+			mic.releaseSamples(page1);
+			return true;
+		}
+
+		default: {
+			// Release from another thread
+			Microphone_PDM_Page page;
+			if (!mic.acquireSamples(page)) {
+				return false;
+			}
+			checkPage(page);
+			std::lock_guard<std::mutex> lock(releaseMutex);
+			releaseQueue.push_back(page);
+			releaseCond.notify_one();
+			return true;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--seconds") && ii + 1 < argc) {
+			options.seconds = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--period-us") && ii + 1 < argc) {
+			options.periodUs = (uint32_t) atoi(argv[++ii]);
+		}
+		else {
+			printf("usage: spsc-stress [--seconds N] [--period-us N]\n");
+			return 1;
+		}
+	}
+	if (options.periodUs < 10) {
+		options.periodUs = 10;
+	}
+
+	// The DMA writes the index of each sample as its value
+	PdmSim::setSource([](uint64_t index) { return (int16_t)index; });
+	PdmSim::setBufferPeriodUs(options.periodUs);
+
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+
+	int err = mic.init();
+	if (!err) {
+		err = mic.start();
+	}
+	if (err) {
+		printf("init or start failed %d\n", err);
+		return 1;
+	}
+	samplesPerBuffer = mic.getNumberOfSamples();
+
+	printf("%u buffers of %u samples, interrupt every %u us, for %d seconds\n", (unsigned)Microphone_PDM_MCU::NUM_BUFFERS, (unsigned)samplesPerBuffer, (unsigned)options.periodUs, options.seconds);
+
+	std::thread releaseThread(releaseThreadFunction);
+
+	auto end = std::chrono::steady_clock::now() + std::chrono::seconds(options.seconds);
+	while(std::chrono::steady_clock::now() < end) {
+		if (!readRandom(options.periodUs)) {
+			std::this_thread::yield();
+		}
+		randomStall(options.periodUs);
+	}
+
+	// Stop the interrupt, then read everything that's left so the totals can be compared
+	PdmSim::setPaused(true);
+	{
+		std::unique_lock<std::mutex> lock(releaseMutex);
+		releaseThreadRun = false;
+		releaseCond.notify_one();
+	}
+	releaseThread.join();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	while(mic.noCopySamplesWithInfo(checkPage)) {
+	}
+
+	Microphone_PDM_Stats stats = mic.getStats();
+	uint64_t generated = PdmSim::getValuesGenerated();
+
+	printf("interrupts %llu, samples captured %llu, delivered %llu, dropped %lu (%lu buffers), max queue depth %lu\n",
+		(unsigned long long)PdmSim::getInterruptCount(), (unsigned long long)generated, (unsigned long long)samplesDelivered,
+		(unsigned long)stats.samplesDropped, (unsigned long)stats.buffersDropped, (unsigned long)stats.maxQueueDepth);
+
+	if (PdmSim::getMissingBufferCount()) {
+		fail("DMA had no next buffer", PdmSim::getMissingBufferCount(), 0);
+	}
+	if (samplesDelivered + stats.samplesDropped != generated) {
+		fail("delivered + dropped != captured", samplesDelivered + stats.samplesDropped, generated);
+	}
+	if (samplesSkipped > stats.samplesDropped) {
+		fail("more samples skipped than reported as dropped", samplesSkipped, stats.samplesDropped);
+	}
+	if (stats.buffersProduced != stats.buffersDelivered) {
+		fail("buffers produced != delivered", stats.buffersProduced, stats.buffersDelivered);
+	}
+	if (stats.buffersDropped == 0) {
+		printf("warning: the ring never overflowed, try a smaller --period-us\n");
+	}
+
+	// A buffer that's still held must be released before restarting
+	PdmSim::setPaused(false);
+	Microphone_PDM_Page page;
+	while(!mic.acquireSamples(page)) {
+		std::this_thread::yield();
+	}
+	mic.stop();
+	if (mic.start() != SYSTEM_ERROR_INVALID_STATE) {
+		fail("start() with a buffer held did not fail", 0, 0);
+	}
+	mic.releaseSamples(page);
+	if (mic.start() != 0) {
+		fail("start() after releasing failed", 0, 0);
+	}
+	mic.stop();
+
+	if (errors) {
+		printf("%llu errors\n", (unsigned long long)errors.load());
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
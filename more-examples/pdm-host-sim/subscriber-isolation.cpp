@@ -0,0 +1,173 @@
+// Shows that a stalled subscriber that copies does not cost the other subscribers any audio
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src subscriber-isolation.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o subscriber-isolation
+//
+// Run:
+// ./subscriber-isolation --buffers 1000
+//
+// There are two subscribers. The stalled one never releases its pages, like an SD card writer
+// blocked on a slow card. The fast one checks each page and releases it right away. The
+// interrupt is called directly, followed by loop(), so the fast subscriber is never late.
+//
+// This is run twice. With the stalled subscriber using the DMA buffers (zero copy), the pages it
+// holds keep the ring from advancing, so the DMA runs out of buffers and the fast subscriber
+// loses audio too. With the stalled subscriber copying, the test fails unless the fast subscriber
+// gets every buffer with the right samples and no gaps, the DMA never drops a buffer, and the
+// stalled subscriber's copies still hold the samples they were delivered with.
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <vector>
+
+static Microphone_PDM &mic = Microphone_PDM::instance();
+
+static const size_t STALLED_MAX_PENDING = 4;
+static uint64_t errors = 0;
+
+struct RunResult {
+	uint32_t fastDelivered;
+	uint32_t fastDropped;
+	uint64_t fastGaps;
+	uint64_t fastDataErrors;
+	uint32_t stalledDelivered;
+	uint32_t stalledDropped;
+	uint32_t dmaDropped;
+	uint64_t stalledDataErrors;
+};
+
+static bool checkPage(const Microphone_PDM_Page &page) {
+	// The simulated DMA writes the index of each value as its value
+	const int16_t *pSamples = (const int16_t *)page.pSamples;
+	for(size_t ii = 0; ii < page.numSamples; ii++) {
+		if (pSamples[ii] != (int16_t)(page.sampleIndex + ii)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static RunResult run(uint64_t buffers, bool copy) {
+	RunResult result = {};
+
+	std::vector<Microphone_PDM_Page> stalledPages;
+	int stalledId = mic.subscribe([&stalledPages](const Microphone_PDM_Page &page) {
+		// Never released until the end of the run
+		stalledPages.push_back(page);
+	}, STALLED_MAX_PENDING, copy);
+
+	uint64_t expectedSampleIndex = 0;
+	int fastId = -1;
+	fastId = mic.subscribe([&](const Microphone_PDM_Page &page) {
+		if (page.sampleIndex != expectedSampleIndex) {
+			result.fastGaps++;
+		}
+		expectedSampleIndex = page.sampleIndex + page.numSamples;
+		if (!checkPage(page)) {
+			result.fastDataErrors++;
+		}
+		mic.releaseSubscribedSamples(fastId, page);
+	});
+
+	if (stalledId < 0 || fastId < 0) {
+		printf("FAIL: subscribe failed\n");
+		errors++;
+		return result;
+	}
+
+	mic.resetStats();
+	mic.start();
+	for(uint64_t ii = 0; ii < buffers; ii++) {
+		PdmSim::interrupt();
+		mic.loop();
+	}
+	mic.stop();
+
+	for(const Microphone_PDM_Page &page : stalledPages) {
+		if (!checkPage(page)) {
+			result.stalledDataErrors++;
+		}
+	}
+
+	Microphone_PDM_SubscriberStats fastStats = mic.getSubscriberStats(fastId);
+	Microphone_PDM_SubscriberStats stalledStats = mic.getSubscriberStats(stalledId);
+	result.fastDelivered = fastStats.delivered;
+	result.fastDropped = fastStats.dropped;
+	result.stalledDelivered = stalledStats.delivered;
+	result.stalledDropped = stalledStats.dropped;
+	result.dmaDropped = mic.getStats().buffersDropped;
+
+	mic.unsubscribe(fastId);
+	mic.unsubscribe(stalledId);
+	for(const Microphone_PDM_Page &page : stalledPages) {
+		mic.releaseSubscribedSamples(stalledId, page);
+	}
+
+	printf("%-10s %14lu %12lu %10llu %16lu %14lu %12lu\n", copy ? "copy" : "zero copy",
+		(unsigned long)result.fastDelivered, (unsigned long)result.fastDropped, (unsigned long long)result.fastGaps,
+		(unsigned long)result.stalledDelivered, (unsigned long)result.stalledDropped, (unsigned long)result.dmaDropped);
+
+	return result;
+}
+
+static void fail(const char *msg) {
+	printf("FAIL: %s\n", msg);
+	errors++;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t buffers = 1000;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--buffers") && ii + 1 < argc) {
+			buffers = strtoull(argv[++ii], NULL, 10);
+		}
+		else {
+			printf("usage: subscriber-isolation [--buffers N]\n");
+			return 1;
+		}
+	}
+
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+	if (mic.init()) {
+		printf("init failed\n");
+		return 1;
+	}
+	PdmSim::setSource([](uint64_t index) { return (int16_t)index; });
+
+	printf("%-10s %14s %12s %10s %16s %14s %12s\n", "stalled", "fast delivered", "fast dropped", "fast gaps",
+		"stalled delivered", "stalled dropped", "DMA dropped");
+
+	// Zero copy, for comparison: the stalled subscriber's pages hold up the ring
+	run(buffers, false);
+
+	// Copy: the fast subscriber must not be affected
+	RunResult result = run(buffers, true);
+	if (result.fastDelivered != buffers || result.fastDropped || result.fastGaps) {
+		fail("fast subscriber missed buffers");
+	}
+	if (result.fastDataErrors) {
+		fail("fast subscriber got the wrong samples");
+	}
+	if (result.dmaDropped) {
+		fail("DMA dropped buffers");
+	}
+	if (result.stalledDelivered != STALLED_MAX_PENDING || result.stalledDropped != buffers - STALLED_MAX_PENDING) {
+		fail("stalled subscriber was not limited to its copies");
+	}
+	if (result.stalledDataErrors) {
+		fail("stalled subscriber's copies changed");
+	}
+	if (PdmSim::getMissingBufferCount()) {
+		fail("DMA was left without a next buffer");
+	}
+
+	if (errors) {
+		printf("%llu errors\n", (unsigned long long)errors);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
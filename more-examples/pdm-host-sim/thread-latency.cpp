@@ -0,0 +1,150 @@
+// Measures the time from the DMA interrupt to your code receiving the buffer, with the audio
+// thread (Microphone_PDM::withAudioThread) and with polling from loop()
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src thread-latency.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o thread-latency
+//
+// Run:
+// ./thread-latency --mode thread
+// ./thread-latency --mode loop
+//
+// The simulated PDM interrupt runs in its own thread once every --period-us. The main thread acts
+// as the application loop: each iteration is busy for a random time up to --work-ms, like
+// application code and the system thread, then sleeps 1 ms. In loop mode, it reads all available
+// buffers at the end of each iteration, as an application calling noCopySamples() from loop()
+// does. In thread mode, the audio thread handles the buffers and loop() does not.
+//
+// The latency of each buffer is micros() when the handler gets it minus the page's timestampUs,
+// which is recorded in the interrupt. --load starts threads that spin, to compete for the CPU.
+// The audio thread asks for a higher priority, which is only used if the process can create
+// real-time threads (as root on Linux, for example).
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+	std::string mode = "thread";
+	int seconds = 10;
+	uint32_t periodUs = 2000;
+	int workMs = 20;
+	int load = 0;
+};
+
+static std::mutex latencyMutex;
+static std::vector<uint32_t> latencies;
+static std::atomic<bool> loadRun{true};
+
+static void recordLatency(const Microphone_PDM_Page &page) {
+	uint32_t latency = (uint32_t) micros() - page.timestampUs;
+
+	std::lock_guard<std::mutex> lock(latencyMutex);
+	latencies.push_back(latency);
+}
+
+static void busy(std::chrono::microseconds duration) {
+	auto end = std::chrono::steady_clock::now() + duration;
+	while(std::chrono::steady_clock::now() < end) {
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--mode") && ii + 1 < argc) {
+			options.mode = argv[++ii];
+		}
+		else if (!strcmp(argv[ii], "--seconds") && ii + 1 < argc) {
+			options.seconds = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--period-us") && ii + 1 < argc) {
+			options.periodUs = (uint32_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--work-ms") && ii + 1 < argc) {
+			options.workMs = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--load") && ii + 1 < argc) {
+			options.load = atoi(argv[++ii]);
+		}
+		else {
+			printf("usage: thread-latency [--mode thread|loop] [--seconds N] [--period-us N] [--work-ms N] [--load THREADS]\n");
+			return 1;
+		}
+	}
+	bool threadMode = (options.mode == "thread");
+	if (!threadMode && options.mode != "loop") {
+		printf("--mode must be thread or loop\n");
+		return 1;
+	}
+
+	Microphone_PDM &mic = Microphone_PDM::instance();
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+	if (threadMode) {
+		mic.withAudioThread()
+			.addSamplesHandler(recordLatency);
+	}
+
+	PdmSim::setBufferPeriodUs(options.periodUs);
+
+	std::vector<std::thread> loadThreads;
+	for(int ii = 0; ii < options.load; ii++) {
+		loadThreads.push_back(std::thread([]() {
+			while(loadRun) {
+			}
+		}));
+	}
+
+	if (mic.init() || mic.start()) {
+		printf("init or start failed\n");
+		return 1;
+	}
+
+	std::mt19937 rng(1234);
+	auto end = std::chrono::steady_clock::now() + std::chrono::seconds(options.seconds);
+	while(std::chrono::steady_clock::now() < end) {
+		// Application code and system thread work
+		if (options.workMs > 0) {
+			busy(std::chrono::microseconds(rng() % (options.workMs * 1000)));
+		}
+
+		if (!threadMode) {
+			while(mic.noCopySamplesWithInfo(recordLatency)) {
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	mic.stop();
+	loadRun = false;
+	for(std::thread &t : loadThreads) {
+		t.join();
+	}
+
+	Microphone_PDM_Stats stats = mic.getStats();
+
+	std::lock_guard<std::mutex> lock(latencyMutex);
+	if (latencies.empty()) {
+		printf("no buffers received\n");
+		return 1;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [](double p) { return latencies[(size_t)(p * (latencies.size() - 1))]; };
+
+	printf("%s mode, interrupt every %u us, up to %d ms of work per loop, %d load threads\n", threadMode ? "thread" : "loop",
+		(unsigned)options.periodUs, options.workMs, options.load);
+	printf("buffers %lu, dropped transfers %lu, max queue depth %lu\n", (unsigned long)latencies.size(),
+		(unsigned long)stats.buffersDropped, (unsigned long)stats.maxQueueDepth);
+	printf("latency us: min %u, median %u, 99%% %u, 99.9%% %u, max %u\n", percentile(0), percentile(0.5), percentile(0.99),
+		percentile(0.999), latencies.back());
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+// Compares the CPU used and the wakeup latency of a thread that blocks in waitForSamples() against one
+// that spins on samplesAvailable() and one that polls it with a delay
+//
+// Build (Linux or Mac):
+// g++ -O2 -std=c++17 -pthread -Isim -I../../src wait-idle.cpp sim/PdmSim.cpp ../../src/Microphone_PDM.cpp ../../src/Microphone_PDM_nRF52.cpp ../../src/Microphone_PDM_Pool.cpp -o wait-idle
+//
+// Run:
+// ./wait-idle --mode wait
+// ./wait-idle --mode spin
+// ./wait-idle --mode poll --poll-ms 5
+//
+// The simulated PDM interrupt runs in its own thread once every --period-us. The main thread reads
+// every buffer with noCopySamplesWithInfo(). Its CPU time is measured with CLOCK_THREAD_CPUTIME_ID,
+// which only counts time the thread was running: the time a device could spend in WFI is the rest.
+// The latency of each buffer is micros() when it is read minus the page's timestampUs, which is
+// recorded in the interrupt. The host doesn't always wake the interrupt thread on time, and late
+// interrupts run back to back; the count of those is shown because they cause drops that a device
+// wouldn't have.
+
+#include "Microphone_PDM.h"
+#include "PdmSim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <time.h>
+#include <vector>
+
+struct Options {
+	std::string mode = "wait";
+	int seconds = 10;
+	uint32_t periodUs = 2000;
+	int pollMs = 1;
+};
+
+static double threadCpuSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--mode") && ii + 1 < argc) {
+			options.mode = argv[++ii];
+		}
+		else if (!strcmp(argv[ii], "--seconds") && ii + 1 < argc) {
+			options.seconds = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--period-us") && ii + 1 < argc) {
+			options.periodUs = (uint32_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--poll-ms") && ii + 1 < argc) {
+			options.pollMs = atoi(argv[++ii]);
+		}
+		else {
+			printf("usage: wait-idle [--mode wait|spin|poll] [--seconds N] [--period-us N] [--poll-ms N]\n");
+			return 1;
+		}
+	}
+	if (options.mode != "wait" && options.mode != "spin" && options.mode != "poll") {
+		printf("--mode must be wait, spin, or poll\n");
+		return 1;
+	}
+
+	Microphone_PDM &mic = Microphone_PDM::instance();
+	mic.withOutputSize(Microphone_PDM::OutputSize::RAW_SIGNED_16)
+		.withSampleRate(16000);
+
+	PdmSim::setBufferPeriodUs(options.periodUs);
+
+	if (mic.init() || mic.start()) {
+		printf("init or start failed\n");
+		return 1;
+	}
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(options.seconds * (1000000 / options.periodUs + 1));
+	auto readAll = [&]() {
+		while(mic.noCopySamplesWithInfo([&](const Microphone_PDM_Page &page) {
+			latencies.push_back((uint32_t) micros() - page.timestampUs);
+		})) {
+		}
+	};
+
+	double cpuStart = threadCpuSeconds();
+	auto start = std::chrono::steady_clock::now();
+	auto end = start + std::chrono::seconds(options.seconds);
+	while(std::chrono::steady_clock::now() < end) {
+		if (options.mode == "wait") {
+			if (mic.waitForSamples(100)) {
+				readAll();
+			}
+		}
+		else if (options.mode == "spin") {
+			if (mic.samplesAvailable()) {
+				readAll();
+			}
+		}
+		else {
+			readAll();
+			delay(options.pollMs);
+		}
+	}
+	double cpu = threadCpuSeconds() - cpuStart;
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	mic.stop();
+
+	Microphone_PDM_Stats stats = mic.getStats();
+
+	if (latencies.empty()) {
+		printf("no buffers received\n");
+		return 1;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies[(size_t)(p * (latencies.size() - 1))]; };
+
+	printf("%s: interrupt every %u us", options.mode.c_str(), (unsigned)options.periodUs);
+	if (options.mode == "poll") {
+		printf(", poll every %d ms", options.pollMs);
+	}
+	printf("\n");
+	printf("buffers %lu, dropped transfers %lu, reader CPU %.2f%% (%.1f us per buffer)\n", (unsigned long)latencies.size(),
+		(unsigned long)stats.buffersDropped, 100.0 * cpu / wall, cpu * 1e6 / latencies.size());
+	printf("interrupts more than one period late (host scheduler) %lu\n", (unsigned long)PdmSim::getLateInterruptCount());
+	printf("latency us: min %u, median %u, 99%% %u, max %u\n", percentile(0), percentile(0.5), percentile(0.99), latencies.back());
+
+	return 0;
+}
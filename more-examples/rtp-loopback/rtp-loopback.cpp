@@ -0,0 +1,262 @@
+// Sends audio through MicRtpSink over UDP to 127.0.0.1 and reports loss and jitter at the receiving
+// end using MicRtpReceiverStats. It can also receive from a device instead (--listen).
+//
+// A sender thread acts as the device: it makes a DMA buffer of samples every buffer period and
+// passes it to MicRtpSink::write(). Network loss and delay are simulated with --loss and --jitter-ms,
+// and samples dropped on the device with --drop-every. The receiver compares what it measured against
+// what the sender did, so the loss count can be checked.
+
+#include "MicRtpSink.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	int seconds = 10;
+	uint32_t rate = 16000;
+	uint8_t channels = 1;
+	bool pcmu = false;
+	uint32_t packetMs = 20;
+	size_t bufferSamples = 512;
+	double lossPercent = 0;
+	int jitterMs = 0;
+	int dropEvery = 0;
+	int listenPort = 0;
+};
+
+/**
+ * Transport that discards a percentage of packets, as a lossy network would, and counts them
+ */
+class LossyTransport : public MicDatagramTransport {
+public:
+	LossyTransport(MicDatagramTransport &transport, double lossPercent) : transport(transport), lossPercent(lossPercent), rng(1) {};
+
+	virtual int send(const uint8_t *buf, size_t len) {
+		if (lossPercent > 0 && std::uniform_real_distribution<double>(0, 100)(rng) < lossPercent) {
+			// Lost in the network: the sender thinks it was sent
+			discarded++;
+			return (int) len;
+		}
+		return transport.send(buf, len);
+	}
+
+	MicDatagramTransport &transport;
+	double lossPercent;
+	std::mt19937 rng;
+	std::atomic<uint32_t> discarded{0};
+};
+
+struct SenderResult {
+	uint32_t buffers = 0;
+	uint32_t buffersDropped = 0;
+	MicRtpSink::Stats stats = {};
+};
+
+static void senderThread(const Options &options, LossyTransport &transport, std::atomic<bool> &done, SenderResult &result) {
+	MicRtpSink sink;
+	sink.withTransport(&transport)
+		.withPayload(options.pcmu ? MicRtpSink::Payload::PCMU : MicRtpSink::Payload::L16)
+		.withFormat(options.rate, options.channels)
+		.withPacketDurationMs(options.packetMs);
+	if (sink.begin()) {
+		printf("begin failed\n");
+		done = true;
+		return;
+	}
+
+	std::mt19937 rng(2);
+	size_t numSamples = options.bufferSamples * options.channels;
+	int16_t *samples = new int16_t[numSamples];
+	std::chrono::nanoseconds bufferPeriod((int64_t)options.bufferSamples * 1000000000LL / options.rate);
+
+	uint64_t sampleIndex = 0;
+	auto start = Clock::now();
+	auto end = start + std::chrono::seconds(options.seconds);
+	auto next = start;
+
+	while(Clock::now() < end) {
+		next += bufferPeriod;
+		auto sendTime = next;
+		if (options.jitterMs > 0) {
+			// Delay this buffer, like a busy loop() or a slow network would
+			sendTime += std::chrono::microseconds(rng() % (options.jitterMs * 1000));
+		}
+		std::this_thread::sleep_until(sendTime);
+
+		if (options.dropEvery > 0 && result.buffers > 0 && (result.buffers % options.dropEvery) == 0) {
+			// The DMA dropped this buffer, so the sample index skips ahead
+			result.buffersDropped++;
+			result.buffers++;
+			sampleIndex += numSamples;
+			continue;
+		}
+
+		for(size_t ii = 0; ii < numSamples; ii++) {
+			samples[ii] = (int16_t)(8000 * ((sampleIndex + ii) % 64 < 32 ? 1 : -1));
+		}
+		sink.write(samples, numSamples, sampleIndex);
+		sampleIndex += numSamples;
+		result.buffers++;
+	}
+	sink.flush();
+
+	delete[] samples;
+	result.stats = sink.getStats();
+	done = true;
+}
+
+static void usage() {
+	printf("usage: rtp-loopback [--seconds N] [--rate HZ] [--channels 1|2] [--pcmu] [--packet-ms MS] [--buffer SAMPLES]\n");
+	printf("                    [--loss PERCENT] [--jitter-ms MS] [--drop-every BUFFERS]\n");
+	printf("       rtp-loopback --listen PORT [--rate HZ] [--seconds N]\n");
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--seconds") && ii + 1 < argc) {
+			options.seconds = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--rate") && ii + 1 < argc) {
+			options.rate = (uint32_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--channels") && ii + 1 < argc) {
+			options.channels = (uint8_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--pcmu")) {
+			options.pcmu = true;
+		}
+		else if (!strcmp(argv[ii], "--packet-ms") && ii + 1 < argc) {
+			options.packetMs = (uint32_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--buffer") && ii + 1 < argc) {
+			options.bufferSamples = (size_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--loss") && ii + 1 < argc) {
+			options.lossPercent = atof(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--jitter-ms") && ii + 1 < argc) {
+			options.jitterMs = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--drop-every") && ii + 1 < argc) {
+			options.dropEvery = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--listen") && ii + 1 < argc) {
+			options.listenPort = atoi(argv[++ii]);
+		}
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (options.rate == 0 || (options.channels != 1 && options.channels != 2)) {
+		usage();
+		return 1;
+	}
+
+	int rxFd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(options.listenPort ? INADDR_ANY : INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t) options.listenPort);
+	socklen_t addrLen = sizeof(addr);
+	if (bind(rxFd, (struct sockaddr *)&addr, sizeof(addr)) || getsockname(rxFd, (struct sockaddr *)&addr, &addrLen)) {
+		perror("bind");
+		return 1;
+	}
+
+	// Wake up at least every 100 ms to check whether the sender has finished
+	struct timeval tv = { 0, 100000 };
+	setsockopt(rxFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	std::atomic<bool> senderDone{false};
+	SenderResult sent;
+	int txFd = -1;
+	MicPosixUdpTransport *udpTransport = NULL;
+	LossyTransport *lossyTransport = NULL;
+	std::thread sender;
+
+	if (!options.listenPort) {
+		txFd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (connect(txFd, (struct sockaddr *)&addr, sizeof(addr))) {
+			perror("connect");
+			return 1;
+		}
+		udpTransport = new MicPosixUdpTransport(txFd);
+		lossyTransport = new LossyTransport(*udpTransport, options.lossPercent);
+		sender = std::thread(senderThread, std::cref(options), std::ref(*lossyTransport), std::ref(senderDone), std::ref(sent));
+	}
+	else {
+		printf("listening on UDP port %d for %d seconds\n", options.listenPort, options.seconds);
+	}
+
+	MicRtpReceiverStats stats;
+	uint8_t packet[MicRtpSink::RTP_HEADER_SIZE + MicRtpSink::MAX_PAYLOAD_SIZE];
+	uint32_t markers = 0;
+	auto start = Clock::now();
+	auto nextReport = start + std::chrono::seconds(1);
+	auto end = start + std::chrono::seconds(options.seconds);
+
+	while(true) {
+		ssize_t len = recv(rxFd, packet, sizeof(packet), 0);
+		auto now = Clock::now();
+		if (len > 0) {
+			// Arrival time in sample periods, the same units as the RTP timestamp
+			uint32_t arrival = (uint32_t)(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() * options.rate / 1000000);
+			if (stats.update(packet, (size_t) len, arrival) && (packet[1] & 0x80)) {
+				markers++;
+			}
+		}
+
+		if (now >= nextReport) {
+			printf("received %u, expected %u, lost %d, jitter %.1f ms\n", stats.getReceived(), stats.getExpected(), stats.getLost(),
+				stats.getJitter() * 1000.0 / options.rate);
+			nextReport += std::chrono::seconds(1);
+		}
+
+		if (options.listenPort ? (now >= end) : (senderDone && len <= 0)) {
+			break;
+		}
+	}
+
+	printf("\nreceived %u packets, expected %u, lost %d (%.2f%%), out of order %u, marker bits %u, jitter %.2f ms\n",
+		stats.getReceived(), stats.getExpected(), stats.getLost(),
+		stats.getExpected() ? 100.0 * stats.getLost() / stats.getExpected() : 0.0,
+		stats.getOutOfOrder(), markers, stats.getJitter() * 1000.0 / options.rate);
+
+	int result = 0;
+	if (!options.listenPort) {
+		sender.join();
+
+		printf("sender: %u buffers, %u dropped on the device, %u packets sent, %u discarded by the socket, %u lost in the simulated network, %u discontinuities\n",
+			sent.buffers, sent.buffersDropped, sent.stats.packetsSent, sent.stats.packetsDropped, lossyTransport->discarded.load(),
+			sent.stats.discontinuities);
+
+		// Packets lost in the network or discarded by the socket are missing sequence numbers. Packets
+		// lost at the end of the stream can't be detected, since the receiver never sees a later one.
+		int32_t expectedLost = (int32_t)(lossyTransport->discarded + sent.stats.packetsDropped);
+		bool ok = stats.getLost() <= expectedLost && stats.getLost() >= expectedLost - 1 && markers == sent.stats.discontinuities + 1;
+		printf("%s\n", ok ? "loss and discontinuities match the sender" : "FAILED: the receiver does not agree with the sender");
+		result = ok ? 0 : 1;
+
+		delete lossyTransport;
+		delete udpTransport;
+		close(txFd);
+	}
+	close(rxFd);
+	return result;
+}
@@ -0,0 +1,278 @@
+// Load generator for the receiver: simulates many devices streaming audio to it over TCP
+//
+// Build (Linux):
+// g++ -O2 -std=c++17 -I../../src loadgen.cpp ../../src/MicStreamFraming.cpp -o loadgen
+//
+// Run:
+// ./loadgen --devices 1000 --seconds 30
+//
+// Each simulated device sends 1024-byte buffers (512 16-bit samples) at the rate a real device would
+// (32000 bytes per second at 16000 Hz) or, with --rate 0, as fast as the receiver accepts them. Devices
+// that fall more than a second behind are counted as late. Use --framed to send MicStreamFraming frames
+// instead of raw samples, and --drop-every with --framed to skip a buffer now and then, as a device does
+// when it falls behind.
+
+#include "MicStreamFraming.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+static const size_t PAGE_SAMPLES = 512;
+
+struct Options {
+	std::string host = "127.0.0.1";
+	int port = 7123;
+	int devices = 100;
+	int seconds = 10;
+	uint32_t rate = 16000;
+	bool framed = false;
+	int dropEvery = 0;
+};
+static Options options;
+
+struct Device {
+	int fd = -1;
+	bool connected = false;
+	bool blocked = false;				// Waiting for EPOLLOUT
+	uint64_t pagesSent = 0;				// Complete pages sent
+	uint64_t sampleIndex = 0;			// Sample index of the next page, which skips a page for each one dropped
+	uint64_t pagesDropped = 0;			// Pages skipped with --drop-every
+	size_t partial = 0;					// Bytes of the current page already sent
+	uint8_t page[MicStreamFraming::FRAME_HEADER_SIZE + PAGE_SAMPLES * 2];
+	size_t pageLen = 0;					// Bytes in page, including the frame header if framed
+	MicStreamEncoder encoder;
+	bool late = false;
+};
+
+static void usage() {
+	fprintf(stderr, "usage: loadgen [--host 127.0.0.1] [--port 7123] [--devices 100] [--seconds 10] [--rate 16000] [--framed]\n"
+		"               [--drop-every PAGES]\n");
+	exit(1);
+}
+
+static void parseArgs(int argc, char *argv[]) {
+	for(int ii = 1; ii < argc; ii++) {
+		std::string arg = argv[ii];
+		if (arg == "--framed") {
+			options.framed = true;
+			continue;
+		}
+		if (ii + 1 >= argc) {
+			usage();
+		}
+		const char *value = argv[++ii];
+		if (arg == "--host") {
+			options.host = value;
+		}
+		else if (arg == "--port") {
+			options.port = atoi(value);
+		}
+		else if (arg == "--devices") {
+			options.devices = atoi(value);
+		}
+		else if (arg == "--seconds") {
+			options.seconds = atoi(value);
+		}
+		else if (arg == "--rate") {
+			options.rate = (uint32_t) atoi(value);
+		}
+		else if (arg == "--drop-every") {
+			options.dropEvery = atoi(value);
+		}
+		else {
+			usage();
+		}
+	}
+}
+
+// Fill in the next page of samples: a different tone for each device so the files can be told apart
+static void preparePage(Device &dev, int deviceNum) {
+	int16_t samples[PAGE_SAMPLES];
+	double freq = 200.0 + (deviceNum % 50) * 20.0;
+	double sampleRate = options.rate ? options.rate : 16000;
+
+	if (options.framed && options.dropEvery > 0 && dev.pagesSent > 0 && (dev.pagesSent % options.dropEvery) == 0) {
+		// The device lost this page, so the timestamp of the next one skips ahead
+		dev.sampleIndex += PAGE_SAMPLES;
+		dev.pagesDropped++;
+	}
+
+	for(size_t ii = 0; ii < PAGE_SAMPLES; ii++) {
+		uint64_t n = dev.sampleIndex + ii;
+		samples[ii] = (int16_t)(8000.0 * sin(2.0 * M_PI * freq * n / sampleRate));
+	}
+
+	size_t offset = 0;
+	if (options.framed) {
+		offset = dev.encoder.encodeFrame(dev.page, (uint32_t) dev.sampleIndex, samples, sizeof(samples));
+	}
+	dev.sampleIndex += PAGE_SAMPLES;
+	memcpy(&dev.page[offset], samples, sizeof(samples));
+	dev.pageLen = offset + sizeof(samples);
+	dev.partial = 0;
+}
+
+// Sends pages until the device is caught up or the socket is full. Returns bytes sent, or -1 on error.
+static ssize_t sendDue(Device &dev, int deviceNum, uint64_t pagesDue) {
+	// Limit how much one device can send per pass so the others aren't starved when running unthrottled
+	if (pagesDue > dev.pagesSent + 64) {
+		pagesDue = dev.pagesSent + 64;
+	}
+
+	ssize_t total = 0;
+	while(dev.pagesSent < pagesDue) {
+		if (dev.partial == 0 && dev.pageLen == 0) {
+			preparePage(dev, deviceNum);
+		}
+		ssize_t count = send(dev.fd, &dev.page[dev.partial], dev.pageLen - dev.partial, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				dev.blocked = true;
+				break;
+			}
+			return -1;
+		}
+		total += count;
+		dev.partial += count;
+		if (dev.partial == dev.pageLen) {
+			dev.pagesSent++;
+			dev.pageLen = 0;
+			dev.partial = 0;
+		}
+	}
+	return total;
+}
+
+int main(int argc, char *argv[]) {
+	parseArgs(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t) options.port);
+	if (inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+		fprintf(stderr, "invalid host %s\n", options.host.c_str());
+		return 1;
+	}
+
+	int epollFd = epoll_create1(0);
+	std::vector<Device> devices(options.devices);
+
+	for(int ii = 0; ii < options.devices; ii++) {
+		Device &dev = devices[ii];
+		dev.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (dev.fd < 0) {
+			perror("socket (check ulimit -n)");
+			return 1;
+		}
+		if (connect(dev.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+			perror("connect");
+			return 1;
+		}
+		struct epoll_event ev = {};
+		ev.events = EPOLLOUT | EPOLLONESHOT;
+		ev.data.u32 = (uint32_t) ii;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, dev.fd, &ev);
+		dev.blocked = true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	double pagesPerSecond = (double) options.rate / PAGE_SAMPLES;
+	uint64_t bytesSent = 0;
+	int failed = 0;
+	std::vector<struct epoll_event> events(1024);
+
+	while(true) {
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed >= options.seconds) {
+			break;
+		}
+		uint64_t pagesDue = options.rate ? (uint64_t)(elapsed * pagesPerSecond) + 1 : UINT64_MAX;
+
+		int numEvents = epoll_wait(epollFd, events.data(), (int) events.size(), 5);
+		for(int ii = 0; ii < numEvents; ii++) {
+			Device &dev = devices[events[ii].data.u32];
+			if (events[ii].events & (EPOLLERR | EPOLLHUP)) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, dev.fd, NULL);
+				close(dev.fd);
+				dev.fd = -1;
+				failed++;
+				continue;
+			}
+			if (!dev.connected) {
+				dev.connected = true;
+				if (options.framed) {
+					MicStreamFraming::Format format = { options.rate ? options.rate : 16000, 16, 1 };
+					dev.pageLen = dev.encoder.begin(dev.page, format);
+					// A new socket always has room for the 16-byte stream header
+					if (send(dev.fd, dev.page, dev.pageLen, MSG_NOSIGNAL) != (ssize_t) dev.pageLen) {
+						epoll_ctl(epollFd, EPOLL_CTL_DEL, dev.fd, NULL);
+						close(dev.fd);
+						dev.fd = -1;
+						failed++;
+						continue;
+					}
+					dev.pageLen = 0;
+				}
+			}
+			dev.blocked = false;
+		}
+
+		for(int ii = 0; ii < options.devices; ii++) {
+			Device &dev = devices[ii];
+			if (dev.fd < 0 || !dev.connected || dev.blocked) {
+				continue;
+			}
+			ssize_t count = sendDue(dev, ii, pagesDue);
+			if (count < 0) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, dev.fd, NULL);
+				close(dev.fd);
+				dev.fd = -1;
+				failed++;
+				continue;
+			}
+			bytesSent += count;
+
+			if (options.rate && dev.pagesSent + (uint64_t) pagesPerSecond < pagesDue) {
+				dev.late = true;
+			}
+			if (dev.blocked) {
+				// Only ask for EPOLLOUT when blocked, otherwise every wait would return immediately
+				struct epoll_event ev = {};
+				ev.events = EPOLLOUT | EPOLLONESHOT;
+				ev.data.u32 = (uint32_t) ii;
+				epoll_ctl(epollFd, EPOLL_CTL_MOD, dev.fd, &ev);
+			}
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	int late = 0;
+	uint64_t pagesDropped = 0;
+	for(auto &dev : devices) {
+		pagesDropped += dev.pagesDropped;
+		if (dev.late) {
+			late++;
+		}
+		if (dev.fd >= 0) {
+			close(dev.fd);
+		}
+	}
+
+	printf("devices=%d seconds=%.1f sent=%.1f MB throughput=%.2f MB/s late=%d failed=%d pagesDropped=%llu\n",
+		options.devices, elapsed, bytesSent / 1e6, bytesSent / elapsed / 1e6, late, failed, (unsigned long long) pagesDropped);
+	return 0;
+}
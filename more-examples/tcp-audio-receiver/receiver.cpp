@@ -0,0 +1,677 @@
+// Native receiver for audio streamed over TCP from Particle devices
+//
+// Build (Linux):
+// g++ -O2 -std=c++17 -pthread -I../../src receiver.cpp ../../src/MicStreamFraming.cpp ../../src/MicWavHeader.cpp -o receiver
+//
+// Run:
+// ./receiver --port 7123 --out out --threads 4
+//
+// Each connection is saved as a wav file in the out directory (00001.wav, 00002.wav, ...). Streams that
+// start with a MicStreamFraming stream header are decoded and use the format from the header. Other
+// streams are raw samples in the format set by --rate, --bits, and --channels (default 16000 Hz, 16-bit, mono).
+
+#include "MicStreamFraming.h"
+#include "MicWavHeader.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// The wav header is padded with a JUNK chunk so the samples start at 4096. Combined with a block
+// size that's a multiple of 4096, every data write is aligned to the filesystem block size.
+static const size_t WAV_HEADER_SIZE = 4096;
+
+struct Options {
+	int port = 7123;
+	std::string outDir = "out";
+	int threads = 4;
+	size_t blockSize = 64 * 1024;
+	uint32_t rate = 16000;
+	uint8_t bits = 16;
+	uint8_t channels = 1;
+	int maxGapSeconds = 60;
+	size_t maxPendingBlocks = 8;
+	size_t maxQueueMb = 256;
+	size_t maxQueueBlocks = 0;	// Calculated from maxQueueMb and blockSize
+	int writeDelayMs = 0;
+	bool quiet = false;
+};
+static Options options;
+
+static std::atomic<bool> stopRequested(false);
+
+
+// Runs file writes on worker threads so a slow disk never stalls the network loop
+class ThreadPool {
+public:
+	explicit ThreadPool(int numThreads) {
+		for(int ii = 0; ii < numThreads; ii++) {
+			threads.emplace_back([this]() { run(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		for(auto &t : threads) {
+			t.join();
+		}
+	}
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		cv.notify_one();
+	}
+
+	size_t getQueueDepth() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return jobs.size();
+	}
+
+protected:
+	void run() {
+		while(true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping = false;
+};
+
+
+// Recycles the large write buffers so steady-state operation doesn't allocate
+class BlockPool {
+public:
+	std::unique_ptr<uint8_t[]> alloc() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!freeBlocks.empty()) {
+			std::unique_ptr<uint8_t[]> block = std::move(freeBlocks.back());
+			freeBlocks.pop_back();
+			return block;
+		}
+		return std::unique_ptr<uint8_t[]>(new uint8_t[options.blockSize]);
+	}
+
+	void free(std::unique_ptr<uint8_t[]> block) {
+		std::lock_guard<std::mutex> lock(mutex);
+		freeBlocks.push_back(std::move(block));
+	}
+
+protected:
+	std::vector<std::unique_ptr<uint8_t[]>> freeBlocks;
+	std::mutex mutex;
+};
+static BlockPool blockPool;
+
+
+// An output file. Blocks are written with pwrite at fixed offsets, so they can complete in any order on
+// any worker thread. The header is written when the last reference is released, after all data writes.
+class WavFile {
+public:
+	WavFile(int fd, const std::string &path) : fd(fd), path(path) {
+	}
+
+	~WavFile() {
+		// The JUNK chunk reserved for ds64 lets the header become RF64 if the data passes 4 GB
+		MicWavHeader<WAV_HEADER_SIZE> header;
+		header.withRF64Reserve().withDataAlignment(WAV_HEADER_SIZE);
+		header.writeHeader(format.numChannels, format.sampleRate, format.bitsPerSample);
+		if (!header.setDataSize(dataBytes)) {
+			fprintf(stderr, "%s: could not set the data size in the header\n", path.c_str());
+		}
+
+		if (pwrite(fd, header.getBuffer(), WAV_HEADER_SIZE, 0) != (ssize_t) WAV_HEADER_SIZE || ftruncate(fd, WAV_HEADER_SIZE + dataBytes) != 0) {
+			fprintf(stderr, "%s: write error %d\n", path.c_str(), errno);
+		}
+		close(fd);
+
+		if (!options.quiet) {
+			printf("saved %s (%llu bytes, %u Hz, %u bits, %u channels)\n", path.c_str(), (unsigned long long) dataBytes,
+				(unsigned) format.sampleRate, (unsigned) format.bitsPerSample, (unsigned) format.numChannels);
+		}
+	}
+
+	void writeBlock(const uint8_t *data, size_t len, uint64_t dataOffset) {
+		if (options.writeDelayMs) {
+			// Simulate a slow disk
+			std::this_thread::sleep_for(std::chrono::milliseconds(options.writeDelayMs));
+		}
+		size_t done = 0;
+		while(done < len) {
+			ssize_t count = pwrite(fd, &data[done], len - done, (off_t)(WAV_HEADER_SIZE + dataOffset + done));
+			if (count <= 0) {
+				if (count < 0 && errno == EINTR) {
+					continue;
+				}
+				fprintf(stderr, "%s: write error %d\n", path.c_str(), errno);
+				return;
+			}
+			done += count;
+		}
+	}
+
+	int fd;
+	std::string path;
+	MicStreamFraming::Format format = {};
+	uint64_t dataBytes = 0; //!< Set by the network thread before releasing its reference
+	std::atomic<size_t> pendingBlocks{0}; //!< Blocks submitted to the thread pool and not yet written
+};
+
+
+static ThreadPool *threadPool;
+static std::atomic<uint64_t> totalBytesReceived(0);
+static std::atomic<uint64_t> totalBytesWritten(0);
+static std::atomic<uint32_t> totalCrcErrors(0);
+static std::atomic<uint32_t> totalFramesLost(0);
+static std::atomic<int> lastFileNum(0);
+static std::atomic<uint32_t> totalGaps(0);
+static std::atomic<uint64_t> totalSilenceBytes(0);
+
+// Blocks waiting to be written, for all files. Connections stop reading when this or their own count
+// reaches the high-water mark, so memory use is bounded when the disk can't keep up.
+static std::atomic<size_t> totalPendingBlocks(0);
+
+// Worker threads write to this eventfd when a block is written while connections are paused
+static int resumeFd = -1;
+static std::atomic<size_t> numPaused(0);
+
+
+// State for one device connection, only used on the network thread
+class Connection {
+public:
+	explicit Connection(int fd) : fd(fd) {
+	}
+
+	~Connection() {
+		close(fd);
+	}
+
+	bool open() {
+		char path[512];
+		for(int ii = 0; ii < 100000; ii++) {
+			int num = ++lastFileNum;
+			snprintf(path, sizeof(path), "%s/%05d.wav", options.outDir.c_str(), num);
+
+			int fileFd = ::open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+			if (fileFd >= 0) {
+				file = std::make_shared<WavFile>(fileFd, path);
+				file->format.sampleRate = options.rate;
+				file->format.bitsPerSample = options.bits;
+				file->format.numChannels = options.channels;
+				return true;
+			}
+			if (errno != EEXIST) {
+				break;
+			}
+		}
+		fprintf(stderr, "could not create output file in %s\n", options.outDir.c_str());
+		return false;
+	}
+
+	// Called with each chunk read from the socket
+	void received(const uint8_t *data, size_t len) {
+		totalBytesReceived += len;
+
+		if (detectCount < 4) {
+			// The first 4 bytes tell us if this is a framed stream
+			while(detectCount < 4 && len > 0) {
+				detect[detectCount++] = *data++;
+				len--;
+			}
+			if (detectCount < 4) {
+				return;
+			}
+			framed = (memcmp(detect, "MPDM", 4) == 0);
+			if (framed) {
+				decoder.reset(new MicStreamDecoder(MicStreamFraming::MAX_PAYLOAD_SIZE));
+				decoder->withFormatCallback([this](const MicStreamFraming::Format &format) {
+					file->format = format;
+				});
+				decoder->withFrameCallback([this](const MicStreamFraming::FrameInfo &info, const uint8_t *payload) {
+					frameReceived(info, payload);
+				});
+			}
+			received(detect, 4);
+			totalBytesReceived -= 4;
+		}
+
+		if (framed) {
+			decoder->write(data, len);
+		}
+		else {
+			append(data, len);
+		}
+	}
+
+	// True if this connection has too many blocks waiting to be written, and should stop reading
+	bool isBlocked() const {
+		return file && (file->pendingBlocks >= options.maxPendingBlocks || totalPendingBlocks >= options.maxQueueBlocks);
+	}
+
+	// Called when the connection is closed
+	void finish() {
+		submitBlock();
+		if (decoder) {
+			MicStreamDecoder::Stats stats = decoder->getStats();
+			totalCrcErrors += stats.crcErrors;
+			totalFramesLost += stats.framesLost;
+		}
+		if (file) {
+			file->dataBytes = dataOffset;
+			file.reset();
+		}
+	}
+
+	int fd;
+	bool paused = false;	//!< EPOLLIN is disabled until the pending writes drop
+
+protected:
+	// Called with each frame of a framed stream that passes the CRC check
+	void frameReceived(const MicStreamFraming::FrameInfo &info, const uint8_t *payload) {
+		size_t bytesPerValue = (file->format.bitsPerSample + 7) / 8;
+		if (bytesPerValue == 0) {
+			return;
+		}
+
+		// Frames lost to CRC errors (framesLost) and buffers dropped on the device both show up as a
+		// jump in the timestamp, which counts values. Fill it with silence so the file keeps its timing.
+		if (haveTimestamp && info.timestamp != nextTimestamp) {
+			int32_t gap = (int32_t)(info.timestamp - nextTimestamp);
+			uint64_t maxGap = (uint64_t) options.maxGapSeconds * file->format.sampleRate * file->format.numChannels;
+			if (gap > 0 && (uint64_t) gap <= maxGap) {
+				appendSilence((uint64_t) gap * bytesPerValue, (file->format.bitsPerSample == 8) ? 0x80 : 0);
+				totalGaps++;
+			}
+			else {
+				// A timestamp that goes backwards or jumps far ahead means the device restarted
+				fprintf(stderr, "%s: timestamp jumped by %ld, not filled\n", file->path.c_str(), (long) gap);
+			}
+		}
+		append(payload, info.length);
+
+		nextTimestamp = info.timestamp + (uint32_t)(info.length / bytesPerValue);
+		haveTimestamp = true;
+	}
+
+	void appendSilence(uint64_t len, uint8_t value) {
+		uint8_t silence[4096];
+		memset(silence, value, sizeof(silence));
+
+		totalSilenceBytes += len;
+		while(len > 0) {
+			size_t count = (len < sizeof(silence)) ? (size_t) len : sizeof(silence);
+			append(silence, count);
+			len -= count;
+		}
+	}
+
+	void append(const uint8_t *data, size_t len) {
+		while(len > 0) {
+			if (!block) {
+				block = blockPool.alloc();
+				blockCount = 0;
+			}
+			size_t count = options.blockSize - blockCount;
+			if (count > len) {
+				count = len;
+			}
+			memcpy(&block[blockCount], data, count);
+			blockCount += count;
+			data += count;
+			len -= count;
+
+			if (blockCount == options.blockSize) {
+				submitBlock();
+			}
+		}
+	}
+
+	void submitBlock() {
+		if (!block || blockCount == 0 || !file) {
+			return;
+		}
+
+		// The job holds a reference to the file so the header isn't written until all blocks are
+		std::shared_ptr<WavFile> jobFile = file;
+		uint8_t *data = block.release();
+		size_t len = blockCount;
+		uint64_t offset = dataOffset;
+
+		file->pendingBlocks++;
+		totalPendingBlocks++;
+		threadPool->submit([jobFile, data, len, offset]() {
+			jobFile->writeBlock(data, len, offset);
+			totalBytesWritten += len;
+			blockPool.free(std::unique_ptr<uint8_t[]>(data));
+
+			jobFile->pendingBlocks--;
+			totalPendingBlocks--;
+			if (numPaused > 0) {
+				uint64_t one = 1;
+				ssize_t ignored = write(resumeFd, &one, sizeof(one));
+				(void) ignored;
+			}
+		});
+
+		dataOffset += len;
+		blockCount = 0;
+	}
+
+	std::shared_ptr<WavFile> file;
+	std::unique_ptr<uint8_t[]> block;
+	size_t blockCount = 0;
+	uint64_t dataOffset = 0;
+
+	uint32_t nextTimestamp = 0;		//!< Expected timestamp of the next frame
+	bool haveTimestamp = false;
+
+	uint8_t detect[4];
+	size_t detectCount = 0;
+	bool framed = false;
+	std::unique_ptr<MicStreamDecoder> decoder;
+};
+
+
+static void usage() {
+	fprintf(stderr, "usage: receiver [--port 7123] [--out out] [--threads 4] [--block-kb 64]\n"
+		"                [--rate 16000] [--bits 16] [--channels 1] [--max-gap-seconds 60]\n"
+		"                [--max-pending 8] [--max-queue-mb 256] [--write-delay-ms 0] [--quiet]\n");
+	exit(1);
+}
+
+static void parseArgs(int argc, char *argv[]) {
+	for(int ii = 1; ii < argc; ii++) {
+		std::string arg = argv[ii];
+		if (arg == "--quiet") {
+			options.quiet = true;
+			continue;
+		}
+		if (ii + 1 >= argc) {
+			usage();
+		}
+		const char *value = argv[++ii];
+		if (arg == "--port") {
+			options.port = atoi(value);
+		}
+		else if (arg == "--out") {
+			options.outDir = value;
+		}
+		else if (arg == "--threads") {
+			options.threads = atoi(value);
+		}
+		else if (arg == "--block-kb") {
+			// Keep blocks a multiple of 4096 so writes stay aligned
+			options.blockSize = (size_t) atoi(value) * 1024;
+			options.blockSize -= options.blockSize % 4096;
+		}
+		else if (arg == "--rate") {
+			options.rate = (uint32_t) atoi(value);
+		}
+		else if (arg == "--bits") {
+			options.bits = (uint8_t) atoi(value);
+		}
+		else if (arg == "--channels") {
+			options.channels = (uint8_t) atoi(value);
+		}
+		else if (arg == "--max-gap-seconds") {
+			options.maxGapSeconds = atoi(value);
+		}
+		else if (arg == "--max-pending") {
+			options.maxPendingBlocks = (size_t) atoi(value);
+		}
+		else if (arg == "--max-queue-mb") {
+			options.maxQueueMb = (size_t) atoi(value);
+		}
+		else if (arg == "--write-delay-ms") {
+			options.writeDelayMs = atoi(value);
+		}
+		else {
+			usage();
+		}
+	}
+	if (options.threads < 1 || options.blockSize == 0 || options.maxPendingBlocks == 0) {
+		usage();
+	}
+	options.maxQueueBlocks = options.maxQueueMb * 1024 * 1024 / options.blockSize;
+	if (options.maxQueueBlocks < 1) {
+		options.maxQueueBlocks = 1;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	parseArgs(argc, argv);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, [](int) { stopRequested = true; });
+	signal(SIGTERM, [](int) { stopRequested = true; });
+
+	mkdir(options.outDir.c_str(), 0755);
+
+	int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int one = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t) options.port);
+	if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 4096) != 0) {
+		perror("listen");
+		return 1;
+	}
+	printf("listening on port %d, writing to %s\n", options.port, options.outDir.c_str());
+
+	int epollFd = epoll_create1(0);
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = listenFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+
+	resumeFd = eventfd(0, EFD_NONBLOCK);
+	ev.data.fd = resumeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, resumeFd, &ev);
+
+	threadPool = new ThreadPool(options.threads);
+
+	std::unordered_map<int, std::unique_ptr<Connection>> connections;
+	std::vector<struct epoll_event> events(1024);
+	std::vector<uint8_t> readBuf(256 * 1024);
+	std::vector<int> pausedFds;
+	uint32_t pauseCount = 0;
+
+	auto lastReport = std::chrono::steady_clock::now();
+	uint64_t lastBytes = 0;
+
+	auto closeConnection = [&](int fd) {
+		auto it = connections.find(fd);
+		if (it != connections.end()) {
+			if (it->second->paused) {
+				pausedFds.erase(std::find(pausedFds.begin(), pausedFds.end(), fd));
+				numPaused--;
+			}
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+			it->second->finish();
+			connections.erase(it);
+		}
+	};
+
+	// Stop reading a connection until its writes catch up. The unread data stays in the socket, so TCP
+	// flow control slows the device down instead of the receiver buffering without limit.
+	auto setPaused = [&](Connection &conn, bool paused) {
+		struct epoll_event cev = {};
+		cev.events = paused ? 0 : (EPOLLIN | EPOLLRDHUP);
+		cev.data.fd = conn.fd;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &cev);
+
+		conn.paused = paused;
+		if (paused) {
+			pausedFds.push_back(conn.fd);
+			numPaused++;
+			pauseCount++;
+		}
+		else {
+			pausedFds.erase(std::find(pausedFds.begin(), pausedFds.end(), conn.fd));
+			numPaused--;
+		}
+	};
+
+	// Resume the paused connections that are no longer blocked
+	auto resumeConnections = [&]() {
+		for(size_t ii = 0; ii < pausedFds.size(); ) {
+			Connection &conn = *connections[pausedFds[ii]];
+			if (!conn.isBlocked()) {
+				setPaused(conn, false);
+			}
+			else {
+				ii++;
+			}
+		}
+	};
+
+	while(!stopRequested) {
+		int numEvents = epoll_wait(epollFd, events.data(), (int) events.size(), 1000);
+		if (numEvents < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for(int ii = 0; ii < numEvents; ii++) {
+			int fd = events[ii].data.fd;
+
+			if (fd == listenFd) {
+				while(true) {
+					int clientFd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK);
+					if (clientFd < 0) {
+						break;
+					}
+					std::unique_ptr<Connection> conn(new Connection(clientFd));
+					if (!conn->open()) {
+						continue;
+					}
+					struct epoll_event cev = {};
+					cev.events = EPOLLIN | EPOLLRDHUP;
+					cev.data.fd = clientFd;
+					epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &cev);
+					connections[clientFd] = std::move(conn);
+				}
+				continue;
+			}
+
+			if (fd == resumeFd) {
+				uint64_t value;
+				ssize_t ignored = read(resumeFd, &value, sizeof(value));
+				(void) ignored;
+				resumeConnections();
+				continue;
+			}
+
+			auto it = connections.find(fd);
+			if (it == connections.end()) {
+				continue;
+			}
+
+			// Read until the socket is drained, then wait for the next event
+			bool closed = false;
+			while(!it->second->paused) {
+				ssize_t count = read(fd, readBuf.data(), readBuf.size());
+				if (count > 0) {
+					it->second->received(readBuf.data(), (size_t) count);
+					if (it->second->isBlocked()) {
+						setPaused(*it->second, true);
+
+						// A write may have finished before numPaused was set, without waking us up
+						if (!it->second->isBlocked()) {
+							setPaused(*it->second, false);
+						}
+						break;
+					}
+					if ((size_t) count < readBuf.size()) {
+						break;
+					}
+				}
+				else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					break;
+				}
+				else if (count < 0 && errno == EINTR) {
+					continue;
+				}
+				else {
+					closed = true;
+					break;
+				}
+			}
+			if (closed || (events[ii].events & (EPOLLHUP | EPOLLERR))) {
+				closeConnection(fd);
+			}
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - lastReport).count();
+		if (elapsed >= 5.0 && !options.quiet) {
+			uint64_t bytes = totalBytesReceived;
+			printf("connections=%zu receive=%.2f MB/s written=%llu MB writeQueue=%zu paused=%zu pauses=%u crcErrors=%u framesLost=%u gaps=%u\n",
+				connections.size(), (bytes - lastBytes) / elapsed / 1e6, (unsigned long long)(totalBytesWritten / 1000000),
+				threadPool->getQueueDepth(), pausedFds.size(), (unsigned) pauseCount, (unsigned) totalCrcErrors,
+				(unsigned) totalFramesLost, (unsigned) totalGaps);
+			lastBytes = bytes;
+			lastReport = now;
+		}
+	}
+
+	// Finish all open files, then wait for the writes to complete
+	while(!connections.empty()) {
+		closeConnection(connections.begin()->first);
+	}
+	delete threadPool;
+	close(resumeFd);
+	close(epollFd);
+	close(listenFd);
+
+	printf("received %llu bytes, filled %u gaps with %llu bytes of silence\n", (unsigned long long) totalBytesReceived,
+		(unsigned) totalGaps, (unsigned long long) totalSilenceBytes);
+	return 0;
+}
@@ -0,0 +1,333 @@
+// Loopback benchmark for MicTcpSink
+//
+// A producer thread acts as the capture loop on a device: it generates one page of 16-bit samples
+// every page period and sends it over a TCP connection to 127.0.0.1, either with a blocking write
+// of each page, as calling TCPClient::write() from the noCopySamples callback does, or through
+// MicTcpSink. A receiver thread reads the other end, checks the samples, and can stop reading for a
+// while to simulate a network stall.
+//
+// While the producer is busy, pages keep arriving, as the DMA keeps filling buffers. If it falls
+// more than --ring pages behind, the oldest pages are lost, as they would be when the DMA runs out
+// of buffers. Each sample is a 16-bit counter, so the receiver can tell how many were lost.
+//
+// With --rate 0, pages are produced as fast as they can be sent, to compare throughput and the
+// number of socket writes. The sink is then only given a page when getFreeBytes() has room for it.
+
+#include "MicTcpSink.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	std::string mode = "sink";
+	int seconds = 10;
+	uint32_t rate = 16000;
+	size_t pageSamples = 256;
+	size_t ring = 2;
+	int stallMs = 2000;
+	int stallEveryMs = 5000;
+	int sndbuf = 8192;
+	size_t queueSize = 32768;
+	std::string policy = "oldest";
+};
+
+struct ReceiverResult {
+	uint64_t bytes = 0;
+	uint64_t samplesMissing = 0;
+	uint32_t gaps = 0;
+	bool misaligned = false;
+};
+
+static void receiverThread(int fd, const Options &options, ReceiverResult &result) {
+	std::vector<uint8_t> buf(65536);
+	uint16_t expected = 0;
+	bool haveByte = false;
+	uint8_t firstByte = 0;
+
+	auto start = Clock::now();
+	auto nextStall = start + std::chrono::milliseconds(options.stallEveryMs);
+
+	while(true) {
+		if (options.stallMs > 0 && options.stallEveryMs > 0 && Clock::now() >= nextStall) {
+			// Simulated network stall: stop reading, so the sender's socket buffer fills up
+			std::this_thread::sleep_for(std::chrono::milliseconds(options.stallMs));
+			nextStall += std::chrono::milliseconds(options.stallEveryMs);
+		}
+
+		ssize_t count = read(fd, buf.data(), buf.size());
+		if (count <= 0) {
+			break;
+		}
+		result.bytes += count;
+
+		for(ssize_t ii = 0; ii < count; ii++) {
+			if (!haveByte) {
+				firstByte = buf[ii];
+				haveByte = true;
+				continue;
+			}
+			uint16_t value = (uint16_t)(firstByte | (buf[ii] << 8));
+			haveByte = false;
+
+			if (value != expected) {
+				result.gaps++;
+				result.samplesMissing += (uint16_t)(value - expected);
+			}
+			expected = (uint16_t)(value + 1);
+		}
+	}
+	if (haveByte) {
+		result.misaligned = true;
+	}
+}
+
+static bool connectLoopback(int &clientFd, int &serverFd, int sndbuf) {
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t addrLen = sizeof(addr);
+	if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenFd, 1) ||
+		getsockname(listenFd, (struct sockaddr *)&addr, &addrLen)) {
+		perror("listen");
+		return false;
+	}
+
+	clientFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sndbuf > 0) {
+		// A small send buffer, closer to the few KB a device has, so stalls reach the sender quickly
+		setsockopt(clientFd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	}
+	int one = 1;
+	setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(clientFd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("connect");
+		return false;
+	}
+	serverFd = accept(listenFd, NULL, NULL);
+	close(listenFd);
+	if (serverFd < 0) {
+		perror("accept");
+		return false;
+	}
+	if (sndbuf > 0) {
+		setsockopt(serverFd, SOL_SOCKET, SO_RCVBUF, &sndbuf, sizeof(sndbuf));
+	}
+	return true;
+}
+
+// Blocking write of the whole buffer, like TCPClient::write() with the default timeout
+static uint32_t writeAll(int fd, const uint8_t *buf, size_t len) {
+	uint32_t writes = 0;
+	while(len > 0) {
+		ssize_t count = send(fd, buf, len, MSG_NOSIGNAL);
+		if (count <= 0) {
+			break;
+		}
+		buf += count;
+		len -= count;
+		writes++;
+	}
+	return writes;
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--mode") && ii + 1 < argc) {
+			options.mode = argv[++ii];
+		}
+		else if (!strcmp(argv[ii], "--seconds") && ii + 1 < argc) {
+			options.seconds = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--rate") && ii + 1 < argc) {
+			options.rate = (uint32_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--page") && ii + 1 < argc) {
+			options.pageSamples = (size_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--ring") && ii + 1 < argc) {
+			options.ring = (size_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--stall-ms") && ii + 1 < argc) {
+			options.stallMs = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--stall-every-ms") && ii + 1 < argc) {
+			options.stallEveryMs = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--sndbuf") && ii + 1 < argc) {
+			options.sndbuf = atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--queue") && ii + 1 < argc) {
+			options.queueSize = (size_t) atoi(argv[++ii]);
+		}
+		else if (!strcmp(argv[ii], "--policy") && ii + 1 < argc) {
+			options.policy = argv[++ii];
+		}
+		else {
+			printf("usage: sink-loopback [--mode sink|direct] [--seconds N] [--rate HZ] [--page SAMPLES] [--ring PAGES]\n");
+			printf("       [--stall-ms MS] [--stall-every-ms MS] [--sndbuf BYTES] [--queue BYTES] [--policy oldest|newest]\n");
+			return 1;
+		}
+	}
+	bool useSink = (options.mode == "sink");
+	if ((!useSink && options.mode != "direct") || (options.policy != "oldest" && options.policy != "newest")) {
+		printf("--mode must be sink or direct, --policy oldest or newest\n");
+		return 1;
+	}
+
+	int clientFd, serverFd;
+	if (!connectLoopback(clientFd, serverFd, options.sndbuf)) {
+		return 1;
+	}
+
+	ReceiverResult received;
+	std::thread receiver(receiverThread, serverFd, std::cref(options), std::ref(received));
+
+	MicPosixSocketTransport transport(clientFd);
+	MicTcpSink sink;
+	sink.withTransport(&transport)
+		.withQueueSize(options.queueSize)
+		.withDropPolicy(options.policy == "oldest" ? MicTcpSink::DropPolicy::DROP_OLDEST : MicTcpSink::DropPolicy::DROP_NEWEST);
+	if (!useSink) {
+		// The direct mode uses blocking writes, as TCPClient::write() does
+		int flags = fcntl(clientFd, F_GETFL, 0);
+		fcntl(clientFd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+
+	// With --rate 0, pages are produced as fast as they can be sent, to measure throughput
+	std::chrono::nanoseconds pagePeriod(options.rate ? (int64_t)options.pageSamples * 1000000000LL / options.rate : 0);
+
+	std::vector<uint16_t> page(options.pageSamples);
+	uint16_t nextValue = 0;
+	uint64_t pagesSent = 0, pagesLost = 0, directWrites = 0;
+	std::vector<double> busyUs;
+
+	auto start = Clock::now();
+	auto end = start + std::chrono::seconds(options.seconds);
+	uint64_t pageIndex = 0;
+
+	while(true) {
+		auto now = Clock::now();
+		if (now >= end) {
+			break;
+		}
+
+		if (options.rate) {
+			uint64_t available = (uint64_t)((now - start) / pagePeriod);
+			if (available > pageIndex + options.ring) {
+				// The DMA ran out of buffers while we were busy
+				uint64_t lost = available - pageIndex - options.ring;
+				pagesLost += lost;
+				pageIndex += lost;
+				nextValue = (uint16_t)(nextValue + lost * options.pageSamples);
+			}
+			if (pageIndex >= available) {
+				// No page yet. A device would call sink.loop() from loop() in the meantime.
+				if (useSink) {
+					sink.loop();
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				continue;
+			}
+		}
+
+		if (!options.rate && useSink && sink.getFreeBytes() < page.size() * sizeof(uint16_t)) {
+			// As fast as possible: use the sink's queue depth as backpressure instead of dropping
+			if (sink.loop() < 0) {
+				printf("transport error\n");
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			continue;
+		}
+
+		for(size_t ii = 0; ii < options.pageSamples; ii++) {
+			page[ii] = nextValue++;
+		}
+		pageIndex++;
+
+		auto busyStart = Clock::now();
+		if (useSink) {
+			sink.write(page.data(), page.size() * sizeof(uint16_t));
+			if (sink.loop() < 0) {
+				printf("transport error\n");
+				break;
+			}
+		}
+		else {
+			directWrites += writeAll(clientFd, (const uint8_t *)page.data(), page.size() * sizeof(uint16_t));
+		}
+		busyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - busyStart).count());
+		pagesSent++;
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// Send whatever the sink still has, then close so the receiver sees the end of the stream
+	while(useSink && sink.getQueuedBytes()) {
+		if (sink.flush() < 0) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	shutdown(clientFd, SHUT_WR);
+	receiver.join();
+	close(clientFd);
+	close(serverFd);
+
+	std::sort(busyUs.begin(), busyUs.end());
+	double busyP99 = busyUs.empty() ? 0 : busyUs[(size_t)(0.99 * (busyUs.size() - 1))];
+	double busyMax = busyUs.empty() ? 0 : busyUs.back();
+
+	MicTcpSink::Stats stats = sink.getStats();
+	uint64_t writes = useSink ? stats.writes : directWrites;
+	uint64_t samplesGenerated = (pagesSent + pagesLost) * options.pageSamples;
+	uint64_t samplesReceived = received.bytes / 2;
+	uint64_t samplesDroppedBySink = stats.bytesDropped / 2;
+
+	printf("%s mode", useSink ? "sink" : "direct");
+	if (useSink) {
+		printf(" (%u byte queue, drop %s)", (unsigned)options.queueSize, options.policy.c_str());
+	}
+	if (options.rate) {
+		printf(", %u Hz, %u-sample pages, receiver stalls %d ms every %d ms\n", (unsigned)options.rate, (unsigned)options.pageSamples,
+			options.stallMs, options.stallEveryMs);
+	}
+	else {
+		printf(", as fast as possible\n");
+	}
+	printf("pages sent %lu, lost to DMA overrun %lu, samples dropped by sink %lu\n", (unsigned long)pagesSent,
+		(unsigned long)pagesLost, (unsigned long)samplesDroppedBySink);
+	printf("capture loop time per page: 99%% %.0f us, max %.0f us\n", busyP99, busyMax);
+	printf("socket writes %lu (%.1f bytes each), %.2f MB/s\n", (unsigned long)writes, writes ? (double)received.bytes / writes : 0.0,
+		received.bytes / elapsed / 1e6);
+	printf("received %lu samples, %u gaps, %lu samples missing\n", (unsigned long)samplesReceived, received.gaps,
+		(unsigned long)received.samplesMissing);
+
+	// Every sample is either received, lost to the simulated DMA, or dropped by the sink. The missing
+	// count is taken modulo 65536 per gap, so this only holds while no single gap is that long.
+	bool ok = !received.misaligned && samplesReceived + pagesLost * options.pageSamples + samplesDroppedBySink == samplesGenerated &&
+		received.samplesMissing == pagesLost * options.pageSamples + samplesDroppedBySink;
+	printf("%s\n", ok ? "accounting matches" : "FAILED: samples are not accounted for");
+	return ok ? 0 : 1;
+}
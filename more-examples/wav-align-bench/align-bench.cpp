@@ -0,0 +1,307 @@
+// Compares writing a wav file with the samples at the standard offset against sector-aligned
+// offsets (MicWavFileWriter::withDataAlignment()).
+//
+// Each layout writes the same audio, one DMA buffer per write(), to a file on this computer. The time
+// is measured, and the file offsets of every write are used to count the sectors each layout touches
+// and how many of them are only partly written. On an SD card, a partly written sector has to be read,
+// modified, and written back, which is where the cost of an unaligned layout comes from.
+//
+// The page cache hides that cost on a computer, so with --direct the file is written the way an SD card
+// is: with O_DIRECT, in whole sectors, reading each partly written sector first.
+
+#include "MicWavFileWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+struct Options {
+	const char *path = "align-bench.wav";
+	int seconds = 600;
+	uint32_t rate = 16000;
+	uint8_t channels = 1;
+	size_t bufferBytes = 1024;
+	size_t sectorSize = 512;
+	uint32_t updateIntervalBytes = 65536;
+	int syncEvery = 0;
+	int repeat = 3;
+	bool direct = false;
+};
+static Options options;
+
+/**
+ * File written in whole sectors with O_DIRECT, bypassing the page cache like an SD card without a cache
+ *
+ * A write that covers part of a sector reads the sector, changes part of it, and writes the whole
+ * sector back. The file ends up rounded up to a whole sector, which doesn't matter for the benchmark.
+ */
+class DirectSectorFile : public MicFile {
+public:
+	virtual ~DirectSectorFile() {
+		close();
+	}
+
+	bool create(const char *path) {
+		fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		if (fd < 0) {
+			printf("O_DIRECT is not supported for %s (error %d); use --file on a disk file system\n", path, errno);
+			return false;
+		}
+		if (!buffer && posix_memalign((void **)&buffer, 4096, BUFFER_SIZE) != 0) {
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+		free(buffer);
+		buffer = NULL;
+	}
+
+	virtual int write(const void *buf, size_t len) {
+		const uint8_t *src = (const uint8_t *) buf;
+		size_t sectorSize = options.sectorSize;
+		size_t done = 0;
+
+		while(done < len) {
+			uint64_t sectorStart = pos / sectorSize * sectorSize;
+			size_t offset = (size_t)(pos - sectorStart);
+			size_t count;
+			ssize_t result;
+
+			if (offset == 0 && len - done >= sectorSize) {
+				// Whole sectors are written directly
+				count = (len - done) / sectorSize * sectorSize;
+				if (count > BUFFER_SIZE) {
+					count = BUFFER_SIZE;
+				}
+				memcpy(buffer, &src[done], count);
+				result = pwrite(fd, buffer, count, (off_t) pos);
+			}
+			else {
+				// Read, modify, and write back a partial sector. Past the end of the file it reads nothing.
+				count = sectorSize - offset;
+				if (count > len - done) {
+					count = len - done;
+				}
+				ssize_t readCount = pread(fd, buffer, sectorSize, (off_t) sectorStart);
+				if (readCount < 0) {
+					return -1;
+				}
+				memset(&buffer[readCount], 0, sectorSize - (size_t) readCount);
+				memcpy(&buffer[offset], &src[done], count);
+				result = pwrite(fd, buffer, sectorSize, (off_t) sectorStart);
+			}
+			if (result < 0) {
+				return -1;
+			}
+			pos += count;
+			done += count;
+		}
+		return (int) done;
+	}
+
+	virtual int read(void *, size_t) { return -1; };
+
+	virtual bool seek(uint64_t pos) {
+		this->pos = pos;
+		return true;
+	}
+
+	virtual bool sync() { return fdatasync(fd) == 0; };
+
+	static const size_t BUFFER_SIZE = 65536;
+
+	int fd = -1;
+	uint64_t pos = 0;
+	uint8_t *buffer = NULL;	//!< Aligned bounce buffer, as O_DIRECT requires
+};
+
+/**
+ * File that passes everything to a MicPosixFile and counts the sectors each write touches
+ */
+class SectorCountingFile : public MicFile {
+public:
+	SectorCountingFile(MicFile &file) : file(file) {};
+
+	virtual int write(const void *buf, size_t len) {
+		if (len > 0) {
+			uint64_t first = pos / options.sectorSize;
+			uint64_t last = (pos + len - 1) / options.sectorSize;
+			sectors += last - first + 1;
+			if (pos % options.sectorSize) {
+				partialSectors++;
+			}
+			if ((pos + len) % options.sectorSize && (last != first || pos % options.sectorSize == 0)) {
+				partialSectors++;
+			}
+		}
+		int result = file.write(buf, len);
+		if (result > 0) {
+			pos += result;
+			bytes += result;
+		}
+		writes++;
+		if (options.syncEvery && (writes % options.syncEvery) == 0) {
+			file.sync();
+		}
+		return result;
+	}
+
+	virtual int read(void *buf, size_t len) { return file.read(buf, len); };
+
+	virtual bool seek(uint64_t pos) {
+		this->pos = pos;
+		return file.seek(pos);
+	};
+
+	virtual bool sync() { return file.sync(); };
+
+	MicFile &file;
+	uint64_t pos = 0;
+	uint64_t bytes = 0;
+	uint64_t writes = 0;
+	uint64_t sectors = 0;			//!< Sectors touched by all writes
+	uint64_t partialSectors = 0;	//!< Sectors that a write covered only part of
+};
+
+struct Result {
+	double seconds = 0;
+	uint64_t bytes = 0;
+	uint64_t writes = 0;
+	uint64_t sectors = 0;
+	uint64_t partialSectors = 0;
+	uint32_t dataOffset = 0;
+};
+
+static bool runLayout(size_t dataAlignment, Result &result) {
+	std::vector<uint8_t> buffer(options.bufferBytes);
+	for(size_t ii = 0; ii < buffer.size(); ii++) {
+		buffer[ii] = (uint8_t) ii;
+	}
+	uint64_t totalBytes = (uint64_t) options.seconds * options.rate * options.channels * 2;
+
+	for(int run = 0; run < options.repeat; run++) {
+		MicPosixFile posixFile;
+		DirectSectorFile directFile;
+		if (options.direct ? !directFile.create(options.path) : !posixFile.create(options.path)) {
+			printf("could not create %s\n", options.path);
+			return false;
+		}
+		SectorCountingFile file(options.direct ? (MicFile &) directFile : (MicFile &) posixFile);
+
+		MicWavFileWriter writer;
+		writer.withFormat(options.channels, options.rate, 16)
+			.withDataAlignment(dataAlignment)
+			.withUpdateIntervalBytes(options.updateIntervalBytes);
+
+		auto start = std::chrono::steady_clock::now();
+		if (!writer.begin(&file)) {
+			printf("begin failed\n");
+			return false;
+		}
+		for(uint64_t written = 0; written < totalBytes; written += buffer.size()) {
+			if (!writer.write(buffer.data(), buffer.size())) {
+				printf("write failed\n");
+				return false;
+			}
+		}
+		writer.finalize();
+		posixFile.close();
+		directFile.close();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Keep the fastest run, the one least disturbed by other activity
+		if (run == 0 || seconds < result.seconds) {
+			result.seconds = seconds;
+		}
+		result.bytes = file.bytes;
+		result.writes = file.writes;
+		result.sectors = file.sectors;
+		result.partialSectors = file.partialSectors;
+		result.dataOffset = writer.getDataOffset();
+	}
+	unlink(options.path);
+	return true;
+}
+
+static void usage() {
+	printf("usage: align-bench [--file PATH] [--seconds 600] [--rate 16000] [--channels 1] [--buffer 1024]\n");
+	printf("                   [--sector 512] [--update 65536] [--sync-every 0] [--repeat 3] [--direct]\n");
+}
+
+int main(int argc, char *argv[]) {
+	for(int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "--direct")) {
+			options.direct = true;
+			continue;
+		}
+		if (ii + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		const char *value = argv[++ii];
+		if (!strcmp(argv[ii - 1], "--file")) {
+			options.path = value;
+		}
+		else if (!strcmp(argv[ii - 1], "--seconds")) {
+			options.seconds = atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--rate")) {
+			options.rate = (uint32_t) atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--channels")) {
+			options.channels = (uint8_t) atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--buffer")) {
+			options.bufferBytes = (size_t) atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--sector")) {
+			options.sectorSize = (size_t) atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--update")) {
+			options.updateIntervalBytes = (uint32_t) atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--sync-every")) {
+			options.syncEvery = atoi(value);
+		}
+		else if (!strcmp(argv[ii - 1], "--repeat")) {
+			options.repeat = atoi(value);
+		}
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (options.bufferBytes == 0 || options.sectorSize == 0 || options.repeat < 1 || options.rate == 0) {
+		usage();
+		return 1;
+	}
+
+	printf("%d seconds at %u Hz, %u channels, %zu-byte writes, %zu-byte sectors, sync every %d writes%s\n\n",
+		options.seconds, (unsigned) options.rate, (unsigned) options.channels, options.bufferBytes, options.sectorSize, options.syncEvery,
+		options.direct ? ", O_DIRECT" : "");
+	printf("%-10s %8s %10s %10s %12s %14s %12s\n", "alignment", "offset", "MB/s", "writes", "sectors", "partial", "per write");
+
+	size_t alignments[] = { 0, 512, 4096 };
+	for(size_t alignment : alignments) {
+		Result result;
+		if (!runLayout(alignment, result)) {
+			return 1;
+		}
+		printf("%-10zu %8u %10.1f %10llu %12llu %14llu %12.2f\n", alignment, (unsigned) result.dataOffset,
+			result.bytes / result.seconds / 1e6, (unsigned long long) result.writes, (unsigned long long) result.sectors,
+			(unsigned long long) result.partialSectors, (double) result.sectors / result.writes);
+	}
+	return 0;
+}
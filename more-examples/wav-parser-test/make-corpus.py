@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Write the wav layouts that parser-test checks MicWavParser against.
+
+Usage: python3 make-corpus.py [DIR]   (default: corpus)
+
+Each file is a layout seen in files from real recorders and tools. The py_ files are written by
+Python's wave module; the others are built chunk by chunk to match what the named tools write.
+expected.txt lists what the parser should report for each file, from the layout, not from the parser.
+"""
+
+import os
+import struct
+import sys
+import wave
+
+
+def chunk(ckid, data):
+    """A chunk with its header, and the pad byte after odd-sized data"""
+    result = ckid + struct.pack('<I', len(data)) + data
+    if len(data) & 1:
+        result += b'\0'
+    return result
+
+
+def riff(chunks, form=b'RIFF'):
+    body = b'WAVE' + b''.join(chunks)
+    return form + struct.pack('<I', len(body)) + body
+
+
+def data_offset(chunks):
+    """File offset of the samples: after the RIFF header, the chunks before data, and the data chunk header"""
+    offset = 12
+    for c in chunks:
+        if c[0:4] == b'data':
+            return offset + 8
+        offset += len(c)
+    return 0
+
+
+def chunk_ids(chunks):
+    return ','.join(c[0:4].decode().strip() for c in chunks)
+
+
+def fmt_pcm(channels, rate, bits, tag=1):
+    align = channels * ((bits + 7) // 8)
+    data = struct.pack('<HHIIHH', tag, channels, rate, rate * align, align, bits)
+    if tag != 1:
+        # Formats other than PCM have cbSize
+        data += struct.pack('<H', 0)
+    return chunk(b'fmt ', data)
+
+
+def fmt_extensible(channels, rate, bits, tag, mask):
+    container = (bits + 7) // 8 * 8
+    align = channels * container // 8
+    guid = struct.pack('<H', tag) + bytes([0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71])
+    data = struct.pack('<HHIIHHHHI', 0xfffe, channels, rate, rate * align, align, container, 22, bits, mask) + guid
+    return chunk(b'fmt ', data)
+
+
+def samples(size):
+    return bytes(range(256)) * (size // 256) + bytes(range(size % 256))
+
+
+def info_list():
+    # ffmpeg and many editors write a LIST INFO chunk; ISFT here has an odd size
+    return chunk(b'LIST', b'INFO' + chunk(b'INAM', b'Test name\0') + chunk(b'ISFT', b'Lavf\0'))
+
+
+def bext():
+    return chunk(b'bext', b'Particle test'.ljust(602, b'\0'))
+
+
+class Corpus:
+    def __init__(self, directory):
+        self.directory = directory
+        self.expected = []
+
+    def add(self, name, contents, **fields):
+        """Write a file and its expected results
+
+        fields: error, format, channels, rate, bits, tag, align, extensible, rf64, offset, size, complete, chunks
+        """
+        with open(os.path.join(self.directory, name), 'wb') as f:
+            f.write(contents)
+        self.expect(name, **fields)
+
+    def add_riff(self, name, chunks, **fields):
+        """Write a RIFF file made of chunks, with the data offset and chunk list worked out from them"""
+        self.add(name, riff(chunks), offset=data_offset(chunks), chunks=chunk_ids(chunks), **fields)
+
+    def expect(self, name, error=0, format=1, channels=0, rate=0, bits=0, tag=0, align=0, extensible=0, rf64=0, offset=0, size=0,
+            complete=1, chunks='fmt,data'):
+        self.expected.append('%s error=%d format=%d channels=%d rate=%d bits=%d tag=%d align=%d extensible=%d rf64=%d offset=%d size=%d complete=%d chunks=%s' %
+            (name, error, format, channels, rate, bits, tag, align, extensible, rf64, offset, size, complete, chunks or '-'))
+
+    def write_expected(self):
+        with open(os.path.join(self.directory, 'expected.txt'), 'w') as f:
+            f.write('\n'.join(self.expected) + '\n')
+
+
+def python_wave(corpus, name, channels, rate, width, frames):
+    path = os.path.join(corpus.directory, name)
+    w = wave.open(path, 'wb')
+    w.setnchannels(channels)
+    w.setsampwidth(width)
+    w.setframerate(rate)
+    w.writeframes(samples(frames * channels * width))
+    w.close()
+    size = frames * channels * width
+    corpus.expect(name, channels=channels, rate=rate, bits=width * 8, tag=1, align=channels * width, offset=44, size=size)
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else 'corpus'
+    os.makedirs(directory, exist_ok=True)
+    corpus = Corpus(directory)
+
+    # Python's wave module: the standard 44-byte header
+    python_wave(corpus, 'py_mono.wav', 1, 16000, 2, 1000)
+    python_wave(corpus, 'py_stereo24.wav', 2, 48000, 3, 777)
+    python_wave(corpus, 'py_8bit.wav', 1, 8000, 1, 333)
+
+    fmt = fmt_pcm(1, 22050, 16)
+    data = chunk(b'data', samples(1000))
+    mono = dict(channels=1, rate=22050, bits=16, tag=1, align=2, size=1000)
+
+    # Broadcast recorders: LIST and bext before the data
+    corpus.add_riff('list_before.wav', [fmt, info_list(), bext(), data], **mono)
+
+    # Audacity and editors that save metadata last: LIST and cue after the data
+    corpus.add_riff('list_after.wav', [fmt, data, info_list(), chunk(b'cue ', struct.pack('<I', 0))], **mono)
+
+    # Odd-sized chunks are followed by a pad byte that's not in their size
+    corpus.add_riff('odd_before.wav', [chunk(b'abcd', b'xyz'), fmt, chunk(b'odd1', b'q'), data], **mono)
+
+    # Float samples have an 18-byte fmt chunk and a fact chunk
+    corpus.add_riff('fact_float.wav', [fmt_pcm(2, 44100, 32, tag=3), chunk(b'fact', struct.pack('<I', 125)), chunk(b'data', bytes(1000))],
+        channels=2, rate=44100, bits=32, tag=3, align=8, size=1000)
+
+    # ffmpeg writes WAVE_FORMAT_EXTENSIBLE for 24-bit and multichannel audio, with a LIST before the data
+    corpus.add_riff('ffmpeg_ext24.wav', [fmt_extensible(6, 48000, 24, 1, 0x3f), info_list(), chunk(b'data', samples(1800))],
+        channels=6, rate=48000, bits=24, tag=1, align=18, extensible=1, size=1800)
+
+    # Recorders that stream and never go back to fix the header leave the RIFF size 0, so the end of
+    # the file can't be found from it
+    contents = bytearray(riff([fmt, data]))
+    contents[4:8] = b'\0\0\0\0'
+    corpus.add('zero_riff.wav', bytes(contents), offset=44, complete=0, **mono)
+
+    # Pro Tools and others reserve space with a large JUNK chunk first
+    corpus.add_riff('big_junk.wav', [chunk(b'JUNK', bytes(100000)), fmt, data], **mono)
+
+    # MicWavFileWriter withDataAlignment(512) and (4096): JUNK for the RF64 reserve, then JUNK padding
+    for alignment in (512, 4096):
+        reserve = chunk(b'JUNK', bytes(28))
+        fmt2 = fmt_pcm(2, 16000, 16)
+        pad = alignment - (12 + len(reserve) + len(fmt2) + 8 + 8)
+        chunks = [reserve, fmt2, chunk(b'JUNK', bytes(pad)), chunk(b'data', samples(20480))]
+        assert data_offset(chunks) == alignment
+        corpus.add_riff('al%d.wav' % alignment, chunks, channels=2, rate=16000, bits=16, tag=1, align=4, size=20480)
+
+    # RF64 (EBU Tech 3306) over 4 GB, with only the start of the data: the sizes come from ds64. The
+    # RIFF end is after the data, so skipping the data completes the file.
+    data_size = 4300000012
+    ds64 = chunk(b'ds64', struct.pack('<QQQI', 4 + 36 + 48 + 8 + data_size, data_size, data_size // 12, 0))
+    fmt4 = fmt_extensible(4, 48000, 24, 1, 0x33)
+    contents = b'RF64' + struct.pack('<I', 0xffffffff) + b'WAVE' + ds64 + fmt4 + b'data' + struct.pack('<I', 0xffffffff) + samples(96)
+    corpus.add('rf64_head.wav', contents, channels=4, rate=48000, bits=24, tag=1, align=12, extensible=1, rf64=1, offset=104, size=data_size,
+        chunks='ds64,fmt,data')
+
+    # A file cut off in the middle of the fmt chunk
+    corpus.add('truncated_fmt.wav', riff([fmt, data])[:30], format=0, complete=0, chunks='fmt')
+
+    # Not a wav file
+    corpus.add('not_wav.wav', b'OggS' + bytes(100), error=1, format=0, complete=0, chunks='')
+
+    # A data chunk before fmt: the data is found, but the format isn't known when it is
+    chunks = [data, fmt]
+    corpus.add_riff('data_before_fmt.wav', chunks, format=0, size=1000)
+
+    corpus.write_expected()
+    print('wrote %d files to %s' % (len(corpus.expected), directory))
+
+
+if __name__ == '__main__':
+    main()
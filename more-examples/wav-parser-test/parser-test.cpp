@@ -0,0 +1,285 @@
+// Checks MicWavParser against a corpus of wav layouts, and against files written by MicWavFileWriter
+//
+// Each file is parsed three ways: one byte at a time, walking every chunk to the end of the file; in
+// random slices of up to 700 bytes; and in 64-byte reads at the offsets returned by skipChunk(), as a
+// reader that seeks past chunks does. All three must report what expected.txt says about the file.
+
+#include "MicWavParser.h"
+#include "MicWavFileWriter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * What the parser should report for a file, from expected.txt or the writer settings
+ */
+struct Expected {
+	std::string name;
+	std::map<std::string, std::string> fields;	//!< error, format, channels, ..., chunks
+};
+
+static int numFailed = 0;
+
+static bool loadFile(const std::string &path, std::vector<uint8_t> &contents) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return false;
+	}
+	uint8_t buf[4096];
+	size_t count;
+	while((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		contents.insert(contents.end(), buf, buf + count);
+	}
+	fclose(fp);
+	return true;
+}
+
+// The parser state as fields, in the same form as expected.txt
+static std::map<std::string, std::string> getFields(const MicWavParser &parser) {
+	std::map<std::string, std::string> fields;
+	fields["error"] = std::to_string(parser.hasError());
+	fields["format"] = std::to_string(parser.hasFormat());
+	fields["channels"] = std::to_string(parser.getNumChannels());
+	fields["rate"] = std::to_string(parser.getSampleRate());
+	fields["bits"] = std::to_string(parser.getBitsPerSample());
+	fields["tag"] = std::to_string(parser.getFormatTag());
+	fields["align"] = std::to_string(parser.getBlockAlign());
+	fields["extensible"] = std::to_string(parser.isExtensible());
+	fields["rf64"] = std::to_string(parser.isRF64());
+	fields["offset"] = std::to_string(parser.isDataFound() ? parser.getDataOffset() : 0);
+	fields["size"] = std::to_string(parser.isDataFound() ? parser.getDataSize() : 0);
+	return fields;
+}
+
+static bool compare(const Expected &expected, const char *mode, const std::map<std::string, std::string> &fields) {
+	bool result = true;
+	for(const auto &it : fields) {
+		auto expectedIt = expected.fields.find(it.first);
+		if (expectedIt != expected.fields.end() && expectedIt->second != it.second) {
+			printf("FAIL %s (%s): %s is %s, expected %s\n", expected.name.c_str(), mode, it.first.c_str(), it.second.c_str(), expectedIt->second.c_str());
+			result = false;
+		}
+	}
+	return result;
+}
+
+static std::string chunkName(uint32_t id) {
+	std::string name;
+	for(int shift = 24; shift >= 0; shift -= 8) {
+		char c = (char)(id >> shift);
+		if (c != ' ') {
+			name += c;
+		}
+	}
+	return name;
+}
+
+static void checkFile(const std::string &path, const Expected &expected, unsigned int seed) {
+	std::vector<uint8_t> contents;
+	if (!loadFile(path, contents)) {
+		printf("FAIL %s: could not read %s\n", expected.name.c_str(), path.c_str());
+		numFailed++;
+		return;
+	}
+	bool ok = true;
+
+	// One byte at a time, skipping each chunk after its header and continuing after the data
+	{
+		MicWavParser parser;
+		std::string chunks;
+		parser.withChunkCallback([&chunks](const MicWavParser::ChunkInfo &chunk) {
+			chunks += (chunks.empty() ? "" : ",") + chunkName(chunk.id);
+		});
+
+		std::map<std::string, std::string> fields;
+		uint64_t pos = 0;
+		while(pos < contents.size()) {
+			size_t count = parser.write(&contents[pos], 1);
+			pos += count;
+			if (count == 0) {
+				if (parser.isDataFound() && fields.empty()) {
+					fields = getFields(parser);
+				}
+				if (parser.hasError() || parser.isComplete()) {
+					break;
+				}
+				pos = parser.skipChunk();
+			}
+		}
+		if (fields.empty()) {
+			fields = getFields(parser);
+		}
+		fields["complete"] = std::to_string(parser.isComplete());
+		fields["chunks"] = chunks.empty() ? "-" : chunks;
+		ok = compare(expected, "bytes", fields) && ok;
+	}
+
+	// Random slices until the data is found
+	{
+		MicWavParser parser;
+		srand(seed);
+		size_t pos = 0;
+		while(pos < contents.size() && !parser.isDataFound() && !parser.hasError()) {
+			size_t len = 1 + rand() % 700;
+			if (len > contents.size() - pos) {
+				len = contents.size() - pos;
+			}
+			size_t count = parser.write(&contents[pos], len);
+			pos += count;
+			if (count < len) {
+				break;
+			}
+		}
+		ok = compare(expected, "slices", getFields(parser)) && ok;
+	}
+
+	// 64-byte reads, seeking past each chunk
+	int reads = 0;
+	{
+		MicWavParser parser;
+		uint64_t pos = 0;
+		while(pos < contents.size() && !parser.isDataFound() && !parser.hasError()) {
+			size_t len = contents.size() - (size_t) pos;
+			if (len > 64) {
+				len = 64;
+			}
+			parser.write(&contents[pos], len);
+			reads++;
+			pos = parser.skipChunk();
+		}
+		ok = compare(expected, "seek", getFields(parser)) && ok;
+	}
+
+	if (ok) {
+		printf("ok   %-22s %8zu bytes, %d reads to find the data\n", expected.name.c_str(), contents.size(), reads);
+	}
+	else {
+		numFailed++;
+	}
+}
+
+// Writes a file with MicWavFileWriter and returns what the parser should find in it
+static bool writeFile(const std::string &path, MicWavFileWriter &writer, uint8_t numChannels, uint32_t sampleRate, uint8_t bitsPerSample,
+	size_t dataSize, bool marker, Expected &expected) {
+	MicPosixFile file;
+	if (!file.create(path.c_str())) {
+		return false;
+	}
+	writer.withFormat(numChannels, sampleRate, bitsPerSample);
+	if (!writer.begin(&file)) {
+		return false;
+	}
+	std::vector<uint8_t> samples(dataSize);
+	for(size_t ii = 0; ii < samples.size(); ii++) {
+		samples[ii] = (uint8_t) ii;
+	}
+	writer.write(samples.data(), samples.size() / 2);
+	if (marker) {
+		writer.addMarker("middle");
+	}
+	writer.write(&samples[samples.size() / 2], samples.size() - samples.size() / 2);
+	uint32_t dataOffset = writer.getDataOffset();
+	if (!writer.finalize()) {
+		return false;
+	}
+
+	expected.fields["error"] = "0";
+	expected.fields["format"] = "1";
+	expected.fields["channels"] = std::to_string(numChannels);
+	expected.fields["rate"] = std::to_string(sampleRate);
+	expected.fields["bits"] = std::to_string(bitsPerSample);
+	expected.fields["offset"] = std::to_string(dataOffset);
+	expected.fields["size"] = std::to_string(dataSize);
+	expected.fields["complete"] = "1";
+	return true;
+}
+
+static void checkWriterFiles(const std::string &dir) {
+	struct {
+		const char *name;
+		size_t dataAlignment;
+		bool bext;
+		bool floatExtensible;
+		bool marker;
+		const char *chunks;
+	} layouts[] = {
+		{ "writer_default.wav", 0, false, false, false, "JUNK,fmt,data" },
+		{ "writer_al512.wav", 512, false, false, false, "JUNK,fmt,JUNK,data" },
+		{ "writer_bext_al4096.wav", 4096, true, false, false, "JUNK,bext,fmt,JUNK,data" },
+		{ "writer_float_ext.wav", 0, false, true, false, "JUNK,fmt,data" },
+		{ "writer_markers.wav", 0, false, false, true, "JUNK,fmt,data,cue,LIST" },
+	};
+
+	unsigned int seed = 1000;
+	for(const auto &layout : layouts) {
+		MicWavFileWriter writer;
+		writer.withDataAlignment(layout.dataAlignment);
+		if (layout.bext) {
+			writer.withBext("parser test", "parser-test", "test");
+		}
+		if (layout.floatExtensible) {
+			writer.withEncoding(MicWavHeaderBase::Encoding::FLOAT).withExtensible();
+		}
+
+		Expected expected;
+		expected.name = layout.name;
+		std::string path = dir + "/" + layout.name;
+		uint8_t numChannels = layout.floatExtensible ? 2 : 1;
+		uint8_t bitsPerSample = layout.floatExtensible ? 32 : 16;
+		// An odd size tests the pad byte before the markers
+		size_t dataSize = layout.marker ? 3001 : 4000;
+		if (!writeFile(path, writer, numChannels, 16000, bitsPerSample, dataSize, layout.marker, expected)) {
+			printf("FAIL %s: could not write the file\n", layout.name);
+			numFailed++;
+			continue;
+		}
+		expected.fields["tag"] = layout.floatExtensible ? "3" : "1";
+		expected.fields["align"] = std::to_string(numChannels * bitsPerSample / 8);
+		expected.fields["extensible"] = layout.floatExtensible ? "1" : "0";
+		expected.fields["rf64"] = "0";
+		expected.fields["chunks"] = layout.chunks;
+		checkFile(path, expected, seed++);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::string dir = (argc > 1) ? argv[1] : "corpus";
+
+	FILE *fp = fopen((dir + "/expected.txt").c_str(), "r");
+	if (!fp) {
+		printf("no %s/expected.txt, run make-corpus.py first\n", dir.c_str());
+		return 1;
+	}
+
+	// Each line is a file name followed by name=value fields
+	int numFiles = 0;
+	char line[1024];
+	while(fgets(line, sizeof(line), fp)) {
+		Expected expected;
+		char *save = NULL;
+		for(char *token = strtok_r(line, " \r\n", &save); token; token = strtok_r(NULL, " \r\n", &save)) {
+			char *equals = strchr(token, '=');
+			if (expected.name.empty()) {
+				expected.name = token;
+			}
+			else if (equals) {
+				*equals = 0;
+				expected.fields[token] = &equals[1];
+			}
+		}
+		if (!expected.name.empty()) {
+			checkFile(dir + "/" + expected.name, expected, (unsigned int) ++numFiles);
+		}
+	}
+	fclose(fp);
+
+	checkWriterFiles(dir);
+
+	printf("\n%s: %d failed\n", numFailed ? "FAILED" : "passed", numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+// Checks how MicWavFileWriter handles a file whose seeks fail
+//
+// The file is kept in memory by a MicFile that can be told to fail seeks past the start of the file,
+// so the seek to the header in a periodic update or finalize() works, and the seek back to the end
+// of the samples fails.
+
+#include "MicWavFileWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+/**
+ * MicFile in memory. Seeks to a position other than 0 fail while failSeeks is true.
+ */
+class MemFile : public MicFile {
+public:
+	virtual int write(const void *buf, size_t len) {
+		if (pos + len > data.size()) {
+			data.resize(pos + len);
+		}
+		memcpy(&data[pos], buf, len);
+		pos += len;
+		return (int) len;
+	}
+
+	virtual int read(void *buf, size_t len) {
+		if (pos >= data.size()) {
+			return 0;
+		}
+		if (len > data.size() - pos) {
+			len = data.size() - pos;
+		}
+		memcpy(buf, &data[pos], len);
+		pos += len;
+		return (int) len;
+	}
+
+	virtual bool seek(uint64_t newPos) {
+		if (failSeeks && newPos != 0) {
+			return false;
+		}
+		pos = (size_t) newPos;
+		return true;
+	}
+
+	std::vector<uint8_t> data;
+	size_t pos = 0;
+	bool failSeeks = false;
+};
+
+static const size_t DATA_OFFSET = 80;	// 44-byte header plus the RF64 reserve
+
+static int numFailed = 0;
+
+static void check(const char *test, const char *what, bool ok) {
+	printf("%-28s %-44s %s\n", test, what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		numFailed++;
+	}
+}
+
+// Each byte of the samples is its offset in the data chunk
+static bool samplesMatch(const MemFile &file, size_t size) {
+	if (file.data.size() < DATA_OFFSET + size) {
+		return false;
+	}
+	for(size_t ii = 0; ii < size; ii++) {
+		if (file.data[DATA_OFFSET + ii] != (uint8_t) ii) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool writeSamples(MicWavFileWriter &writer, size_t start, size_t len) {
+	std::vector<uint8_t> buf(len);
+	for(size_t ii = 0; ii < len; ii++) {
+		buf[ii] = (uint8_t)(start + ii);
+	}
+	return writer.write(buf.data(), len);
+}
+
+// The seek back to the end fails in one header update, and the next write() must return there
+static void testUpdateRecovers() {
+	const char *test = "update seek fails once";
+	MemFile file;
+	MicWavFileWriter writer;
+	writer.withFormat(1, 16000, 8).withUpdateIntervalBytes(1024);
+	writer.begin(&file);
+
+	file.failSeeks = true;
+	bool writeOk = writeSamples(writer, 0, 1024);
+	file.failSeeks = false;
+	writeOk = writeSamples(writer, 1024, 1024) && writeOk;
+
+	check(test, "write() succeeds", writeOk);
+	check(test, "header update error counted", writer.getHeaderUpdateErrors() == 1);
+	check(test, "finalize() succeeds", writer.finalize());
+	check(test, "samples are contiguous", samplesMatch(file, 2048) && file.data.size() == DATA_OFFSET + 2048);
+}
+
+// Odd data size with no errors: finalize() adds the pad byte
+static void testPadByte() {
+	const char *test = "odd size";
+	MemFile file;
+	MicWavFileWriter writer;
+	writer.withFormat(1, 16000, 8).withUpdateIntervalBytes(0);
+	writer.begin(&file);
+	writeSamples(writer, 0, 1001);
+
+	check(test, "finalize() succeeds", writer.finalize());
+	check(test, "pad byte written", file.data.size() == DATA_OFFSET + 1002 && file.data[DATA_OFFSET + 1001] == 0);
+	check(test, "samples are intact", samplesMatch(file, 1001));
+}
+
+// A header update fails, and so does the seek in finalize() that returns to the end of the file.
+// Writing the pad byte and the header still succeed, but finalize() must report the failure.
+static void testFinalizeSeekFails() {
+	const char *test = "seek fails after update";
+	MemFile file;
+	MicWavFileWriter writer;
+	writer.withFormat(1, 16000, 8).withUpdateIntervalBytes(1024);
+	writer.begin(&file);
+
+	file.failSeeks = true;
+	writeSamples(writer, 0, 1025);
+
+	check(test, "header update error counted", writer.getHeaderUpdateErrors() == 1);
+	check(test, "finalize() fails", !writer.finalize());
+}
+
+int main() {
+	testUpdateRecovers();
+	testPadByte();
+	testFinalizeSeekFails();
+
+	if (numFailed) {
+		printf("%d checks failed\n", numFailed);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
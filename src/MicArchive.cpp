@@ -0,0 +1,619 @@
+#include "MicArchive.h"
+#include "MicRtpSink.h"
+#include "MicStreamFraming.h"
+
+#include <new>
+#include <string.h>
+
+// [static]
+void MicArchive::setUint32LE(uint8_t *p, uint32_t value) {
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+// [static]
+uint32_t MicArchive::getUint32LE(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// [static]
+void MicArchive::setUint64LE(uint8_t *p, uint64_t value) {
+	setUint32LE(p, (uint32_t) value);
+	setUint32LE(&p[4], (uint32_t)(value >> 32));
+}
+
+// [static]
+uint64_t MicArchive::getUint64LE(const uint8_t *p) {
+	return (uint64_t) getUint32LE(p) | ((uint64_t) getUint32LE(&p[4]) << 32);
+}
+
+
+MicArchiveWriter::MicArchiveWriter() {
+}
+
+MicArchiveWriter::~MicArchiveWriter() {
+	delete[] block;
+	delete[] index;
+}
+
+MicArchiveWriter &MicArchiveWriter::withStartTime(uint32_t unixTime, uint32_t microseconds) {
+	startTimeUs = (uint64_t) unixTime * 1000000 + microseconds;
+	startTimeSet = true;
+	if (file) {
+		fileHeaderDirty = true;
+	}
+	else {
+		startTimeForNextFile = true;
+	}
+	return *this;
+}
+
+bool MicArchiveWriter::begin(MicFile *file) {
+	if (!file || !sampleRate || !numChannels) {
+		return false;
+	}
+
+	framesPerBlock = (uint32_t)((uint64_t) sampleRate * blockDurationMs / 1000);
+	if (framesPerBlock == 0) {
+		framesPerBlock = 1;
+	}
+	uint32_t payloadMax = framesPerBlock * numChannels * (uint32_t) MicArchive::bytesPerSample(payload);
+
+	if (indexInterval > payloadMax / MicArchive::INDEX_ENTRY_SIZE) {
+		indexInterval = payloadMax / MicArchive::INDEX_ENTRY_SIZE;
+	}
+	if (indexInterval == 0) {
+		// Very short blocks; make room for one entry
+		indexInterval = 1;
+	}
+	if (payloadMax < indexInterval * MicArchive::INDEX_ENTRY_SIZE) {
+		payloadMax = indexInterval * MicArchive::INDEX_ENTRY_SIZE;
+	}
+	blockSize = (uint32_t) MicArchive::BLOCK_HEADER_SIZE + payloadMax;
+
+	delete[] block;
+	delete[] index;
+	block = new (std::nothrow) uint8_t[blockSize];
+	index = new (std::nothrow) uint8_t[indexInterval * MicArchive::INDEX_ENTRY_SIZE];
+	if (!block || !index) {
+		return false;
+	}
+
+	this->file = file;
+	blockNum = 0;
+	blockFrames = 0;
+	blockFrameIndex = 0;
+	blockFlags = 0;
+	indexCount = 0;
+	nextSampleIndex = 0;
+	started = false;
+	firstPageSet = false;
+	// Each file gets a new start time, unless withStartTime() was called for this file before begin()
+	if (!startTimeForNextFile) {
+		startTimeUs = 0;
+		startTimeSet = false;
+	}
+	startTimeForNextFile = false;
+	fileHeaderDirty = false;
+	stats = {};
+
+	if (!writeFileHeader()) {
+		this->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool MicArchiveWriter::write(const int16_t *pSamples, size_t numSamples, uint64_t sampleIndex) {
+	if (!file) {
+		return false;
+	}
+	bool result = true;
+
+	if (started && sampleIndex != nextSampleIndex) {
+		// Samples were dropped (or repeated). A block never spans the gap.
+		stats.discontinuities++;
+		if (blockFrames) {
+			result = writeDataBlock();
+		}
+		blockFlags |= MicArchive::FLAG_DISCONTINUITY;
+	}
+	started = true;
+	nextSampleIndex = sampleIndex + numSamples;
+
+	size_t bytesPerSample = MicArchive::bytesPerSample(payload);
+
+	while(numSamples >= numChannels) {
+		if (blockFrames == 0) {
+			blockFrameIndex = sampleIndex / numChannels;
+		}
+
+		size_t frames = framesPerBlock - blockFrames;
+		if (frames > numSamples / numChannels) {
+			frames = numSamples / numChannels;
+		}
+		size_t count = frames * numChannels;
+
+		uint8_t *dst = &block[MicArchive::BLOCK_HEADER_SIZE + blockFrames * numChannels * bytesPerSample];
+		if (payload == MicArchive::Payload::PCMU) {
+			for(size_t ii = 0; ii < count; ii++) {
+				dst[ii] = MicRtpSink::linearToUlaw(pSamples[ii]);
+			}
+		}
+		else {
+			for(size_t ii = 0; ii < count; ii++) {
+				dst[2 * ii] = (uint8_t) pSamples[ii];
+				dst[2 * ii + 1] = (uint8_t)((uint16_t) pSamples[ii] >> 8);
+			}
+		}
+
+		blockFrames += (uint32_t) frames;
+		pSamples += count;
+		numSamples -= count;
+		sampleIndex += count;
+
+		if (blockFrames == framesPerBlock) {
+			if (!writeDataBlock()) {
+				result = false;
+			}
+		}
+	}
+
+	return result;
+}
+
+#ifdef PARTICLE
+bool MicArchiveWriter::write(const Microphone_PDM_Page &page) {
+	if (!startTimeSet && !started) {
+		// timestampUs is when the DMA finished, which is the time of the last sample in the buffer
+		uint32_t frames = page.numSamples / numChannels;
+		firstPageMicros = page.timestampUs - (uint32_t)((uint64_t) frames * 1000000 / sampleRate);
+		firstPageFrameIndex = page.sampleIndex / numChannels;
+		firstPageSet = true;
+	}
+
+	// The clock reference may take a second or so to find, so keep trying with each buffer. The
+	// file header is rewritten with the start time when it's found.
+	uint64_t pageStartUs;
+	if (!startTimeSet && firstPageSet && MicClock::toUnixTimeUs(firstPageMicros, pageStartUs)) {
+		uint64_t startUs = pageStartUs - firstPageFrameIndex * 1000000 / sampleRate;
+
+		withStartTime((uint32_t)(startUs / 1000000), (uint32_t)(startUs % 1000000));
+	}
+
+	return write((const int16_t *) page.pSamples, page.numSamples, page.sampleIndex);
+}
+#endif
+
+bool MicArchiveWriter::flush() {
+	if (!file) {
+		return false;
+	}
+	if (blockFrames == 0) {
+		return true;
+	}
+	return writeDataBlock();
+}
+
+bool MicArchiveWriter::finalize() {
+	if (!file) {
+		return false;
+	}
+
+	bool result = flush();
+	if (fileHeaderDirty && !writeFileHeader()) {
+		result = false;
+	}
+	if (!file->sync()) {
+		result = false;
+	}
+	file = NULL;
+
+	return result;
+}
+
+bool MicArchiveWriter::writeDataBlock() {
+	uint32_t payloadSize = blockFrames * numChannels * (uint32_t) MicArchive::bytesPerSample(payload);
+
+	bool result = writeBlock(MicArchive::DATA_MAGIC, blockFrameIndex, blockFrames, payloadSize, blockFlags);
+	stats.dataBlocks++;
+
+	// The block number is used even if the write failed, so the index stays in step with the file
+	uint8_t *entry = &index[indexCount++ * MicArchive::INDEX_ENTRY_SIZE];
+	MicArchive::setUint64LE(entry, blockFrameIndex);
+	MicArchive::setUint32LE(&entry[8], blockFrames);
+
+	blockFrames = 0;
+	blockFlags = 0;
+
+	if (indexCount == indexInterval) {
+		if (!writeIndexBlock()) {
+			result = false;
+		}
+	}
+	return result;
+}
+
+bool MicArchiveWriter::writeIndexBlock() {
+	uint32_t payloadSize = indexCount * (uint32_t) MicArchive::INDEX_ENTRY_SIZE;
+
+	// Only called when the data block has just been written, so its buffer is free
+	memcpy(&block[MicArchive::BLOCK_HEADER_SIZE], index, payloadSize);
+
+	bool result = writeBlock(MicArchive::INDEX_MAGIC, MicArchive::getUint64LE(index), indexCount, payloadSize, 0);
+	stats.indexBlocks++;
+	indexCount = 0;
+
+	if (fileHeaderDirty && !writeFileHeader()) {
+		result = false;
+	}
+	if (!file->sync()) {
+		result = false;
+	}
+	return result;
+}
+
+bool MicArchiveWriter::writeBlock(uint32_t magic, uint64_t frameIndex, uint32_t count, uint32_t payloadSize, uint32_t flags) {
+	MicArchive::setUint32LE(block, magic);
+	MicArchive::setUint32LE(&block[4], blockNum);
+	MicArchive::setUint64LE(&block[8], frameIndex);
+	MicArchive::setUint32LE(&block[16], count);
+	MicArchive::setUint32LE(&block[20], payloadSize);
+	MicArchive::setUint32LE(&block[24], flags);
+
+	memset(&block[MicArchive::BLOCK_HEADER_SIZE + payloadSize], 0, blockSize - MicArchive::BLOCK_HEADER_SIZE - payloadSize);
+
+	uint32_t crc = MicStreamFraming::crc32(block, 28);
+	crc = MicStreamFraming::crc32(&block[MicArchive::BLOCK_HEADER_SIZE], payloadSize, crc);
+	MicArchive::setUint32LE(&block[28], crc);
+
+	blockNum++;
+
+	if (file->write(block, blockSize) != (int) blockSize) {
+		// Keep the following blocks at their own locations even if part of this one was written
+		stats.writeErrors++;
+		file->seek(MicArchive::FILE_HEADER_SIZE + (uint64_t) blockNum * blockSize);
+		return false;
+	}
+	return true;
+}
+
+bool MicArchiveWriter::writeFileHeader() {
+	uint8_t buf[MicArchive::FILE_HEADER_SIZE];
+	memset(buf, 0, sizeof(buf));
+
+	MicArchive::setUint32LE(buf, MicArchive::FILE_MAGIC);
+	buf[4] = MicArchive::VERSION;
+	buf[6] = (uint8_t) MicArchive::FILE_HEADER_SIZE;
+	MicArchive::setUint32LE(&buf[8], sampleRate);
+	buf[12] = numChannels;
+	buf[13] = (uint8_t) payload;
+	buf[14] = (uint8_t) MicArchive::BLOCK_HEADER_SIZE;
+	MicArchive::setUint32LE(&buf[16], framesPerBlock);
+	MicArchive::setUint32LE(&buf[20], blockSize);
+	MicArchive::setUint32LE(&buf[24], indexInterval);
+	MicArchive::setUint64LE(&buf[32], startTimeUs);
+	MicArchive::setUint32LE(&buf[60], MicStreamFraming::crc32(buf, 60));
+
+	if (!file->seek(0) || file->write(buf, sizeof(buf)) != (int) sizeof(buf)) {
+		return false;
+	}
+	fileHeaderDirty = false;
+
+	return file->seek(MicArchive::FILE_HEADER_SIZE + (uint64_t) blockNum * blockSize);
+}
+
+
+MicArchiveReader::MicArchiveReader() {
+}
+
+MicArchiveReader::~MicArchiveReader() {
+	delete[] block;
+}
+
+bool MicArchiveReader::open(MicFile *file) {
+	uint8_t buf[MicArchive::FILE_HEADER_SIZE];
+
+	this->file = file;
+	numBlocks = 0;
+	readCount = 0;
+
+	if (!file || !file->seek(0)) {
+		return false;
+	}
+	readCount++;
+	if (file->read(buf, sizeof(buf)) != (int) sizeof(buf)) {
+		return false;
+	}
+	if (MicArchive::getUint32LE(buf) != MicArchive::FILE_MAGIC || buf[4] != MicArchive::VERSION ||
+		MicArchive::getUint32LE(&buf[60]) != MicStreamFraming::crc32(buf, 60)) {
+		return false;
+	}
+
+	sampleRate = MicArchive::getUint32LE(&buf[8]);
+	numChannels = buf[12];
+	payload = (MicArchive::Payload) buf[13];
+	framesPerBlock = MicArchive::getUint32LE(&buf[16]);
+	blockSize = MicArchive::getUint32LE(&buf[20]);
+	indexInterval = MicArchive::getUint32LE(&buf[24]);
+	startTimeUs = MicArchive::getUint64LE(&buf[32]);
+
+	if (!sampleRate || !numChannels || !framesPerBlock || !indexInterval || buf[14] != MicArchive::BLOCK_HEADER_SIZE ||
+		(payload != MicArchive::Payload::PCM16 && payload != MicArchive::Payload::PCMU) ||
+		blockSize < MicArchive::BLOCK_HEADER_SIZE + (uint64_t) framesPerBlock * numChannels * MicArchive::bytesPerSample(payload)) {
+		return false;
+	}
+
+	delete[] block;
+	block = new (std::nothrow) uint8_t[blockSize];
+	if (!block) {
+		return false;
+	}
+
+	// MicFile doesn't have a size, so find the number of complete blocks by exponential then binary search
+	uint32_t low = 0, high = 1;
+	while(blockExists(high - 1)) {
+		low = high;
+		if (high >= 0x80000000) {
+			break;
+		}
+		high *= 2;
+	}
+	// low blocks exist, high do not
+	while(high - low > 1) {
+		uint32_t mid = low + (high - low) / 2;
+		if (blockExists(mid - 1)) {
+			low = mid;
+		}
+		else {
+			high = mid;
+		}
+	}
+	numBlocks = low;
+
+	return true;
+}
+
+bool MicArchiveReader::findFrame(uint64_t frameIndex, MicArchive::BlockInfo &info) {
+	if (!file || numBlocks == 0) {
+		return false;
+	}
+
+	uint32_t intervalBlocks = indexInterval + 1;
+	uint32_t numIntervals = (numBlocks + indexInterval) / intervalBlocks;
+
+	// Find the last interval that starts at or before frameIndex
+	uint32_t low = 0, high = numIntervals;
+	bool found = false;
+	uint32_t interval = 0;
+	while(low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		uint64_t start;
+		if (getIntervalStart(mid, start) && start <= frameIndex) {
+			found = true;
+			interval = mid;
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	if (!found) {
+		// Before the first block
+		return findNextBlock(0, info);
+	}
+	return findNextBlock(findInInterval(interval, frameIndex), info);
+}
+
+bool MicArchiveReader::findTime(uint32_t unixTime, uint32_t microseconds, MicArchive::BlockInfo &info) {
+	if (startTimeUs == 0) {
+		return false;
+	}
+
+	uint64_t timeUs = (uint64_t) unixTime * 1000000 + microseconds;
+	uint64_t frameIndex = 0;
+	if (timeUs > startTimeUs) {
+		frameIndex = (timeUs - startTimeUs) * sampleRate / 1000000;
+	}
+	return findFrame(frameIndex, info);
+}
+
+bool MicArchiveReader::readBlockInfo(uint32_t blockNum, MicArchive::BlockInfo &info) {
+	if (MicArchive::isIndexBlock(blockNum, indexInterval) || readBlock(blockNum, MicArchive::DATA_MAGIC, false) != 0) {
+		return false;
+	}
+
+	info.blockNum = blockNum;
+	info.frameIndex = MicArchive::getUint64LE(&block[8]);
+	info.numFrames = MicArchive::getUint32LE(&block[16]);
+	info.flags = MicArchive::getUint32LE(&block[24]);
+
+	// The header CRC can't be checked without the payload, so at least check that the values are possible
+	return info.numFrames != 0 && info.numFrames <= framesPerBlock;
+}
+
+int MicArchiveReader::readSamples(uint32_t blockNum, MicArchive::BlockInfo &info, int16_t *pSamples, size_t maxSamples) {
+	if (MicArchive::isIndexBlock(blockNum, indexInterval)) {
+		return -1;
+	}
+	int result = readBlock(blockNum, MicArchive::DATA_MAGIC, true);
+	if (result < 0) {
+		return result;
+	}
+
+	info.blockNum = blockNum;
+	info.frameIndex = MicArchive::getUint64LE(&block[8]);
+	info.numFrames = MicArchive::getUint32LE(&block[16]);
+	info.flags = MicArchive::getUint32LE(&block[24]);
+
+	size_t count = (size_t) info.numFrames * numChannels;
+	if (count * MicArchive::bytesPerSample(payload) > MicArchive::getUint32LE(&block[20])) {
+		return -1;
+	}
+	if (count > maxSamples) {
+		count = maxSamples - (maxSamples % numChannels);
+	}
+
+	const uint8_t *src = &block[MicArchive::BLOCK_HEADER_SIZE];
+	if (payload == MicArchive::Payload::PCMU) {
+		for(size_t ii = 0; ii < count; ii++) {
+			pSamples[ii] = MicRtpSink::ulawToLinear(src[ii]);
+		}
+	}
+	else {
+		for(size_t ii = 0; ii < count; ii++) {
+			pSamples[ii] = (int16_t)(src[2 * ii] | (src[2 * ii + 1] << 8));
+		}
+	}
+	return (int) count;
+}
+
+int MicArchiveReader::checkBlock(uint32_t blockNum) {
+	uint32_t magic = MicArchive::isIndexBlock(blockNum, indexInterval) ? MicArchive::INDEX_MAGIC : MicArchive::DATA_MAGIC;
+	return readBlock(blockNum, magic, true);
+}
+
+int MicArchiveReader::readBlock(uint32_t blockNum, uint32_t magic, bool withPayload) {
+	if (blockNum >= numBlocks) {
+		return -2;
+	}
+
+	size_t len = withPayload ? blockSize : MicArchive::BLOCK_HEADER_SIZE;
+	if (!file->seek(MicArchive::FILE_HEADER_SIZE + (uint64_t) blockNum * blockSize)) {
+		return -2;
+	}
+	readCount++;
+	if (file->read(block, len) != (int) len) {
+		return -2;
+	}
+
+	if (MicArchive::getUint32LE(block) != magic || MicArchive::getUint32LE(&block[4]) != blockNum) {
+		return -1;
+	}
+
+	if (withPayload) {
+		uint32_t payloadSize = MicArchive::getUint32LE(&block[20]);
+		if (payloadSize > blockSize - MicArchive::BLOCK_HEADER_SIZE) {
+			return -1;
+		}
+		uint32_t crc = MicStreamFraming::crc32(block, 28);
+		crc = MicStreamFraming::crc32(&block[MicArchive::BLOCK_HEADER_SIZE], payloadSize, crc);
+		if (crc != MicArchive::getUint32LE(&block[28])) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+bool MicArchiveReader::blockExists(uint32_t blockNum) {
+	uint8_t c;
+
+	if (!file->seek(MicArchive::FILE_HEADER_SIZE + ((uint64_t) blockNum + 1) * blockSize - 1)) {
+		return false;
+	}
+	readCount++;
+	return file->read(&c, 1) == 1;
+}
+
+bool MicArchiveReader::getIntervalStart(uint32_t interval, uint64_t &frameIndex) {
+	uint32_t indexBlockNum = interval * (indexInterval + 1) + indexInterval;
+
+	// The whole index block is read so the CRC can be checked, but it's still only one read
+	if (readBlock(indexBlockNum, MicArchive::INDEX_MAGIC, true) == 0) {
+		frameIndex = MicArchive::getUint64LE(&block[8]);
+		return true;
+	}
+
+	// No index block, or it's damaged
+	MicArchive::BlockInfo info;
+	if (!findNextBlock(interval * (indexInterval + 1), info)) {
+		return false;
+	}
+	frameIndex = info.frameIndex;
+	return true;
+}
+
+uint32_t MicArchiveReader::findInInterval(uint32_t interval, uint64_t frameIndex) {
+	uint32_t firstBlockNum = interval * (indexInterval + 1);
+
+	if (readBlock(firstBlockNum + indexInterval, MicArchive::INDEX_MAGIC, true) == 0) {
+		uint32_t count = MicArchive::getUint32LE(&block[16]);
+		if (count > indexInterval) {
+			count = indexInterval;
+		}
+		const uint8_t *entries = &block[MicArchive::BLOCK_HEADER_SIZE];
+
+		// Find the last entry that starts at or before frameIndex
+		uint32_t low = 0, high = count;
+		while(low < high) {
+			uint32_t mid = low + (high - low) / 2;
+			if (MicArchive::getUint64LE(&entries[mid * MicArchive::INDEX_ENTRY_SIZE]) <= frameIndex) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+		if (low == 0) {
+			return firstBlockNum;
+		}
+		const uint8_t *entry = &entries[(low - 1) * MicArchive::INDEX_ENTRY_SIZE];
+		if (frameIndex < MicArchive::getUint64LE(entry) + MicArchive::getUint32LE(&entry[8])) {
+			return firstBlockNum + low - 1;
+		}
+		return firstBlockNum + low;
+	}
+
+	// No index block, or it's damaged, so search the data block headers instead. Damaged blocks are
+	// skipped over by using the next valid block.
+	uint32_t endBlockNum = firstBlockNum + indexInterval;
+	if (endBlockNum > numBlocks) {
+		endBlockNum = numBlocks;
+	}
+
+	MicArchive::BlockInfo info, best;
+	bool found = false;
+	uint32_t low = firstBlockNum, high = endBlockNum;
+	while(low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (!findNextBlock(mid, info) || info.blockNum >= high) {
+			// No valid blocks from mid to high
+			high = mid;
+		}
+		else if (info.frameIndex <= frameIndex) {
+			best = info;
+			found = true;
+			low = info.blockNum + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	if (!found) {
+		return firstBlockNum;
+	}
+	if (frameIndex < best.frameIndex + best.numFrames) {
+		return best.blockNum;
+	}
+	return best.blockNum + 1;
+}
+
+bool MicArchiveReader::findNextBlock(uint32_t blockNum, MicArchive::BlockInfo &info) {
+	// Read the whole block to check the CRC, so a damaged header is never used for searching
+	for(; blockNum < numBlocks; blockNum++) {
+		if (MicArchive::isIndexBlock(blockNum, indexInterval) || readBlock(blockNum, MicArchive::DATA_MAGIC, true) != 0) {
+			continue;
+		}
+		info.blockNum = blockNum;
+		info.frameIndex = MicArchive::getUint64LE(&block[8]);
+		info.numFrames = MicArchive::getUint32LE(&block[16]);
+		info.flags = MicArchive::getUint32LE(&block[24]);
+		if (info.numFrames != 0 && info.numFrames <= framesPerBlock) {
+			return true;
+		}
+	}
+	return false;
+}
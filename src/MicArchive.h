@@ -0,0 +1,430 @@
+#ifndef __MicArchive_H
+#define __MicArchive_H
+
+#include "MicFile.h"
+
+#ifdef PARTICLE
+#include "MicClock.h"
+#include "Microphone_PDM.h"
+#endif
+
+/**
+ * @brief Block-based audio archive file format, for finding the audio at a given time quickly
+ *
+ * A wav file has no timing information other than the sample rate, so finding the audio at a given
+ * time in a long recording means assuming that no samples were ever dropped. An archive instead stores
+ * audio in fixed-duration blocks, each with the index of its first sample, a sequence number, and a CRC.
+ * After every indexInterval data blocks there is an index block listing them, so a time can be found by
+ * binary search reading only a few blocks, even in a file of many hours. Every block occupies the same
+ * number of bytes (blockSize), so the position of block N is known without reading the file, and a
+ * damaged block does not affect any other block.
+ *
+ * All values are little endian. The file starts with a 64-byte file header:
+ *
+ * | Offset | Size | File header                                           |
+ * | -----: | ---: | :---------------------------------------------------- |
+ * |      0 |    4 | Magic "MPDA"                                          |
+ * |      4 |    1 | Version (1)                                           |
+ * |      5 |    1 | Reserved (0)                                          |
+ * |      6 |    2 | File header size (64)                                 |
+ * |      8 |    4 | Sample rate in Hz                                     |
+ * |     12 |    1 | Number of channels                                    |
+ * |     13 |    1 | Payload encoding: 0 = 16-bit PCM, 1 = G.711 mu-law    |
+ * |     14 |    1 | Block header size (32)                                |
+ * |     15 |    1 | Reserved (0)                                          |
+ * |     16 |    4 | Sample frames per full data block                     |
+ * |     20 |    4 | blockSize: bytes per block, including the header      |
+ * |     24 |    4 | indexInterval: data blocks per index block            |
+ * |     28 |    4 | Reserved (0)                                          |
+ * |     32 |    8 | Time of sample frame 0, microseconds since 1970 UTC, or 0 if unknown |
+ * |     40 |   20 | Reserved (0)                                          |
+ * |     60 |    4 | CRC-32 of bytes 0 - 59                                |
+ *
+ * It's followed by blocks of blockSize bytes. Block N (counting from 0) is at offset 64 + N * blockSize.
+ * Blocks indexInterval, 2 * indexInterval + 1, ... (every indexInterval + 1 blocks) are index blocks
+ * and the rest are data blocks. Each block starts with a 32-byte block header:
+ *
+ * | Offset | Size | Block header                                          |
+ * | -----: | ---: | :---------------------------------------------------- |
+ * |      0 |    4 | Magic "MBLK" for a data block, "MIDX" for an index block |
+ * |      4 |    4 | Block number N                                        |
+ * |      8 |    8 | Data: index of the first sample frame. Index: the same for its first data block. |
+ * |     16 |    4 | Data: number of sample frames. Index: number of entries. |
+ * |     20 |    4 | Payload size in bytes                                 |
+ * |     24 |    4 | Flags. Bit 0: samples were dropped before this block  |
+ * |     28 |    4 | CRC-32 of bytes 0 - 27 and the payload                |
+ *
+ * Sample frame indexes count from the start of capture, including samples that were dropped, so the
+ * time of a frame is the start time plus frameIndex / sampleRate. A data block never spans dropped
+ * samples; the writer ends the block early instead. Each entry in an index block is 12 bytes: the
+ * first sample frame index (8 bytes) and the number of frames (4 bytes) of one of the preceding data
+ * blocks. The unused part of each block is filled with zeros.
+ */
+class MicArchive {
+public:
+	/**
+	 * @brief Payload encoding
+	 */
+	enum class Payload : uint8_t {
+		PCM16 = 0,		//!< 16-bit signed little endian (default)
+		PCMU = 1,		//!< G.711 mu-law, half the size of PCM16
+	};
+
+	/**
+	 * @brief Fields of a data block header
+	 */
+	struct BlockInfo {
+		uint32_t blockNum;		//!< Block number, which determines its location in the file
+		uint64_t frameIndex;	//!< Index of the first sample frame
+		uint32_t numFrames;		//!< Number of sample frames
+		uint32_t flags;			//!< FLAG_DISCONTINUITY
+	};
+
+	static constexpr uint32_t FILE_MAGIC = 0x4144504d;		//!< "MPDA" as a little endian uint32_t
+	static constexpr uint32_t DATA_MAGIC = 0x4b4c424d;		//!< "MBLK" as a little endian uint32_t
+	static constexpr uint32_t INDEX_MAGIC = 0x5844494d;		//!< "MIDX" as a little endian uint32_t
+	static constexpr uint8_t VERSION = 1;					//!< Version in the file header
+	static constexpr size_t FILE_HEADER_SIZE = 64;			//!< Size of the file header in bytes
+	static constexpr size_t BLOCK_HEADER_SIZE = 32;			//!< Size of each block header in bytes
+	static constexpr size_t INDEX_ENTRY_SIZE = 12;			//!< Size of each index entry in bytes
+	static constexpr uint32_t FLAG_DISCONTINUITY = 0x01;	//!< Samples were dropped before this block
+
+	/**
+	 * @brief Bytes per sample (per channel) in the payload
+	 */
+	static size_t bytesPerSample(Payload payload) { return (payload == Payload::PCMU) ? 1 : 2; };
+
+	/**
+	 * @brief Returns true if block blockNum is an index block
+	 */
+	static bool isIndexBlock(uint32_t blockNum, uint32_t indexInterval) { return (blockNum % (indexInterval + 1)) == indexInterval; };
+
+	static void setUint32LE(uint8_t *p, uint32_t value);
+	static uint32_t getUint32LE(const uint8_t *p);
+	static void setUint64LE(uint8_t *p, uint64_t value);
+	static uint64_t getUint64LE(const uint8_t *p);
+};
+
+
+/**
+ * @brief Writes an archive file from Microphone_PDM buffers
+ *
+ * Samples must be 16-bit (OutputSize::SIGNED_16 or RAW_SIGNED_16). One block is buffered in RAM (blockSize
+ * bytes, 8032 bytes with the defaults at 16000 Hz mono) and written to the file when full, so the file
+ * system sees one large sequential write per block. The file is synced after each index block.
+ */
+class MicArchiveWriter {
+public:
+	/**
+	 * @brief Counters returned by getStats()
+	 */
+	struct Stats {
+		uint32_t dataBlocks;		//!< Data blocks written
+		uint32_t indexBlocks;		//!< Index blocks written
+		uint32_t discontinuities;	//!< Number of times samples were missing from the input
+		uint32_t writeErrors;		//!< Blocks that could not be written
+	};
+
+	MicArchiveWriter();
+	virtual ~MicArchiveWriter();
+
+	/**
+	 * @brief Set the sample format (default: 16000 Hz mono). Use the values from Microphone_PDM.
+	 */
+	MicArchiveWriter &withFormat(uint32_t sampleRate, uint8_t numChannels) { this->sampleRate = sampleRate; this->numChannels = numChannels; return *this; };
+
+	/**
+	 * @brief Set the payload encoding (default: PCM16)
+	 */
+	MicArchiveWriter &withPayload(MicArchive::Payload payload) { this->payload = payload; return *this; };
+
+	/**
+	 * @brief Audio per data block in milliseconds (default: 250)
+	 *
+	 * Longer blocks have less overhead but need more RAM, and more audio is lost if one is damaged.
+	 */
+	MicArchiveWriter &withBlockDurationMs(uint32_t blockDurationMs) { this->blockDurationMs = blockDurationMs; return *this; };
+
+	/**
+	 * @brief Data blocks per index block (default: 240, one minute with 250 ms blocks)
+	 *
+	 * Reduced if needed so the index fits in one block.
+	 */
+	MicArchiveWriter &withIndexInterval(uint32_t indexInterval) { this->indexInterval = indexInterval; return *this; };
+
+	/**
+	 * @brief Set the time of sample index 0, when Microphone_PDM::start() was called
+	 *
+	 * @param unixTime Seconds since 1970 (UTC)
+	 *
+	 * @param microseconds Fraction of a second, 0 - 999999
+	 *
+	 * On Particle devices, write(const Microphone_PDM_Page &page) sets this automatically from the first
+	 * buffer if the time is valid. It can be set after begin(); the file header is updated with the next
+	 * index block. Each begin() clears the start time of the previous file, so set it for every file.
+	 */
+	MicArchiveWriter &withStartTime(uint32_t unixTime, uint32_t microseconds = 0);
+
+	/**
+	 * @brief Start a new archive file
+	 *
+	 * @param file An open, empty, writable file. It must remain valid until finalize() is called.
+	 *
+	 * @return true if the block buffer was allocated and the file header was written
+	 */
+	bool begin(MicFile *file);
+
+	/**
+	 * @brief Add samples to the archive, writing blocks as they fill
+	 *
+	 * @param pSamples 16-bit samples, interleaved if stereo
+	 *
+	 * @param numSamples Number of int16_t values, as in Microphone_PDM_Page::numSamples
+	 *
+	 * @param sampleIndex Index of the first sample, as in Microphone_PDM_Page::sampleIndex. If it's not
+	 * the index following the previous call, the block in progress is written early and the next block
+	 * is marked with FLAG_DISCONTINUITY.
+	 *
+	 * @return false if a block could not be written to the file
+	 */
+	bool write(const int16_t *pSamples, size_t numSamples, uint64_t sampleIndex);
+
+#ifdef PARTICLE
+	/**
+	 * @brief Add a buffer from Microphone_PDM::acquireSamples(), noCopySamplesWithInfo(), or a subscriber
+	 *
+	 * If the start time was not set, the time of sample 0 is calculated from the first buffer's timestamp,
+	 * using MicClock. Until MicClock has found its reference, about a second after Time.isValid(), each
+	 * later buffer tries again. The time is accurate to about half a buffer period.
+	 */
+	bool write(const Microphone_PDM_Page &page);
+
+	/**
+	 * @brief Lets this object be used as the sink of a Microphone_PDM_Pipeline
+	 */
+	void operator()(const Microphone_PDM_Page &page) {
+		write(page);
+	}
+#endif
+
+	/**
+	 * @brief Write the data block in progress even if it's not full
+	 */
+	bool flush();
+
+	/**
+	 * @brief Write the block in progress and the final file header. The MicFile can be closed after this.
+	 *
+	 * The last index interval does not get an index block, as its location is reserved for a full index.
+	 * Readers find those blocks by reading their headers.
+	 */
+	bool finalize();
+
+	/**
+	 * @brief Bytes per block in the file, available after begin()
+	 */
+	uint32_t getBlockSize() const { return blockSize; };
+
+	/**
+	 * @brief Get the counters
+	 */
+	Stats getStats() const { return stats; };
+
+protected:
+	/**
+	 * @brief Write the data block in block and add it to the index
+	 */
+	bool writeDataBlock();
+
+	/**
+	 * @brief Write the index block for the last indexInterval data blocks
+	 */
+	bool writeIndexBlock();
+
+	/**
+	 * @brief Fill in the block header and CRC, zero the unused part, and write blockSize bytes
+	 */
+	bool writeBlock(uint32_t magic, uint64_t frameIndex, uint32_t count, uint32_t payloadSize, uint32_t flags);
+
+	/**
+	 * @brief Write the file header at the start of the file and seek back to the end
+	 */
+	bool writeFileHeader();
+
+	MicFile *file = NULL;							//!< File being written, or NULL if not open
+	uint32_t sampleRate = 16000;					//!< Samples per second per channel
+	uint8_t numChannels = 1;						//!< 1 or 2
+	MicArchive::Payload payload = MicArchive::Payload::PCM16; //!< Payload encoding
+	uint32_t blockDurationMs = 250;					//!< Audio per data block
+	uint32_t indexInterval = 240;					//!< Data blocks per index block
+	uint64_t startTimeUs = 0;						//!< Time of sample frame 0, or 0 if unknown
+	bool startTimeSet = false;						//!< startTimeUs has been set
+	bool fileHeaderDirty = false;					//!< startTimeUs changed after the file header was written
+	bool startTimeForNextFile = false;				//!< withStartTime() was called with no file open, so begin() keeps it
+
+	uint32_t framesPerBlock = 0;					//!< Sample frames in a full data block
+	uint32_t blockSize = 0;							//!< Bytes per block in the file
+	uint8_t *block = NULL;							//!< Block being built
+	uint8_t *index = NULL;							//!< Entries for the next index block
+	uint32_t blockNum = 0;							//!< Number of the next block to write
+	uint32_t blockFrames = 0;						//!< Sample frames in block
+	uint64_t blockFrameIndex = 0;					//!< Frame index of the first frame in block
+	uint32_t blockFlags = 0;						//!< Flags for the block in progress
+	uint32_t indexCount = 0;						//!< Entries in index
+	uint64_t nextSampleIndex = 0;					//!< Sample index expected in the next call to write()
+	bool started = false;							//!< True after the first write()
+	uint32_t firstPageMicros = 0;					//!< micros() at the first sample of the first page, for the start time
+	uint64_t firstPageFrameIndex = 0;				//!< Sample frame index of the first page
+	bool firstPageSet = false;						//!< firstPageMicros has been set since begin()
+	Stats stats = {};								//!< Counters
+};
+
+
+/**
+ * @brief Reads an archive file and finds the audio at a given time
+ *
+ * Finding a time reads O(log n) block headers: a binary search over the index blocks, then one
+ * index block. For the last index interval, which has no index block, or if an index block is damaged,
+ * it searches the data block headers in that interval instead. Runs on Particle devices or computers.
+ */
+class MicArchiveReader {
+public:
+	MicArchiveReader();
+	virtual ~MicArchiveReader();
+
+	/**
+	 * @brief Read the file header and find the number of blocks
+	 *
+	 * @param file An open file. It must remain valid while this object is used.
+	 *
+	 * @return false if the file is not an archive, or the file header is damaged
+	 */
+	bool open(MicFile *file);
+
+	/**
+	 * @brief Find the data block containing a sample frame
+	 *
+	 * @param frameIndex Sample frame index (samples per channel since capture started)
+	 *
+	 * @param info Filled in with the block. If frameIndex was dropped or is in a damaged block, this
+	 * is the next block after it. If frameIndex is before the first block, this is the first block.
+	 *
+	 * @return false if frameIndex is after the last block
+	 */
+	bool findFrame(uint64_t frameIndex, MicArchive::BlockInfo &info);
+
+	/**
+	 * @brief Find the data block containing the audio at a given time
+	 *
+	 * @param unixTime Seconds since 1970 (UTC)
+	 *
+	 * @param microseconds Fraction of a second, 0 - 999999
+	 *
+	 * @param info Filled in with the block, as for findFrame()
+	 *
+	 * @return false if the start time is unknown or the time is after the last block
+	 */
+	bool findTime(uint32_t unixTime, uint32_t microseconds, MicArchive::BlockInfo &info);
+
+	/**
+	 * @brief Read the header of a data block
+	 *
+	 * Only the header is read, so the CRC is not checked; readSamples() checks it.
+	 *
+	 * @return false if it's an index block, is past the end of the file, or the header is damaged
+	 */
+	bool readBlockInfo(uint32_t blockNum, MicArchive::BlockInfo &info);
+
+	/**
+	 * @brief Read and decode the samples in a data block
+	 *
+	 * @param blockNum Block number, from findFrame() or BlockInfo::blockNum
+	 *
+	 * @param info Filled in with the block header
+	 *
+	 * @param pSamples Buffer for the samples, interleaved if stereo
+	 *
+	 * @param maxSamples Size of pSamples in int16_t values. getFramesPerBlock() * getNumChannels() is enough.
+	 *
+	 * @return Number of int16_t values, or -1 if the block is damaged (CRC error) and -2 if it could not be read
+	 */
+	int readSamples(uint32_t blockNum, MicArchive::BlockInfo &info, int16_t *pSamples, size_t maxSamples);
+
+	/**
+	 * @brief Read a whole block, data or index, and check its CRC
+	 *
+	 * @param blockNum Block number, 0 to getNumBlocks() - 1
+	 *
+	 * @return 0 if the block is valid, -1 if it's damaged (CRC error) and -2 if it could not be read
+	 */
+	int checkBlock(uint32_t blockNum);
+
+	uint32_t getSampleRate() const { return sampleRate; };
+	uint8_t getNumChannels() const { return numChannels; };
+	MicArchive::Payload getPayload() const { return payload; };
+	uint32_t getFramesPerBlock() const { return framesPerBlock; };
+	uint32_t getBlockSize() const { return blockSize; };
+	uint32_t getIndexInterval() const { return indexInterval; };
+
+	/**
+	 * @brief Time of sample frame 0 in microseconds since 1970 (UTC), or 0 if unknown
+	 */
+	uint64_t getStartTimeUs() const { return startTimeUs; };
+
+	/**
+	 * @brief Number of blocks in the file, including index blocks
+	 */
+	uint32_t getNumBlocks() const { return numBlocks; };
+
+	/**
+	 * @brief Number of read() calls made on the file since open(), to measure seek cost
+	 */
+	uint32_t getReadCount() const { return readCount; };
+
+protected:
+	/**
+	 * @brief Read the block header (and payload, if withPayload) into block and check it
+	 *
+	 * @return 0 on success, -1 if the magic, block number, or CRC don't match, or -2 if it could not be read
+	 */
+	int readBlock(uint32_t blockNum, uint32_t magic, bool withPayload);
+
+	/**
+	 * @brief Returns true if the last byte of a block can be read
+	 */
+	bool blockExists(uint32_t blockNum);
+
+	/**
+	 * @brief Frame index of the first valid data block at or after the start of an index interval
+	 *
+	 * Using the next valid block when an interval is entirely damaged keeps the values in order for
+	 * the binary search.
+	 */
+	bool getIntervalStart(uint32_t interval, uint64_t &frameIndex);
+
+	/**
+	 * @brief Find the block number to start looking for frameIndex in one index interval
+	 *
+	 * @return The block containing frameIndex, or the block after the last block that starts before it
+	 */
+	uint32_t findInInterval(uint32_t interval, uint64_t frameIndex);
+
+	/**
+	 * @brief Find the first data block at or after blockNum with a valid CRC
+	 */
+	bool findNextBlock(uint32_t blockNum, MicArchive::BlockInfo &info);
+
+	MicFile *file = NULL;				//!< Archive file
+	uint32_t sampleRate = 0;			//!< From the file header
+	uint8_t numChannels = 0;			//!< From the file header
+	MicArchive::Payload payload = MicArchive::Payload::PCM16; //!< From the file header
+	uint32_t framesPerBlock = 0;		//!< From the file header
+	uint32_t blockSize = 0;				//!< From the file header
+	uint32_t indexInterval = 0;			//!< From the file header
+	uint64_t startTimeUs = 0;			//!< From the file header
+	uint32_t numBlocks = 0;				//!< Complete blocks in the file
+	uint8_t *block = NULL;				//!< Buffer of blockSize bytes
+	uint32_t readCount = 0;				//!< Number of reads
+};
+
+#endif /* __MicArchive_H */
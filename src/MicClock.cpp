@@ -0,0 +1,61 @@
+#include "MicClock.h"
+
+#ifdef PARTICLE
+
+uint32_t MicClock::lastSecond = 0;
+uint32_t MicClock::lastMicros = 0;
+uint32_t MicClock::refSecond = 0;
+uint32_t MicClock::refMicros = 0;
+
+// [static]
+bool MicClock::update() {
+	if (!Time.isValid()) {
+		lastSecond = refSecond = 0;
+		return false;
+	}
+
+	uint32_t now = (uint32_t) Time.now();
+	uint32_t microsNow = micros();
+
+	if (refSecond) {
+		// Move the reference forward so micros() - refMicros never wraps
+		uint32_t elapsedSec = (microsNow - refMicros) / 1000000;
+		if (elapsedSec >= 1000) {
+			refSecond += elapsedSec;
+			refMicros += elapsedSec * 1000000;
+			elapsedSec = 0;
+		}
+
+		// Allow for Time.now() changing just before or after the rollover calculated from the reference
+		uint32_t expected = refSecond + elapsedSec;
+		if (now + 1 < expected || now > expected + 1) {
+			// The time was set or synchronized
+			refSecond = 0;
+		}
+	}
+
+	if (!refSecond && lastSecond && now == lastSecond + 1 && microsNow - lastMicros <= MAX_INTERVAL_US) {
+		// The second started between the previous call and this one
+		refSecond = now;
+		refMicros = lastMicros + (microsNow - lastMicros) / 2;
+	}
+
+	lastSecond = now;
+	lastMicros = microsNow;
+
+	return refSecond != 0;
+}
+
+// [static]
+bool MicClock::toUnixTimeUs(uint32_t microsValue, uint64_t &unixTimeUs) {
+	if (!update()) {
+		return false;
+	}
+
+	// microsValue can be before or after the reference
+	int32_t offsetUs = (int32_t)(microsValue - refMicros);
+	unixTimeUs = (uint64_t) refSecond * 1000000 + offsetUs;
+	return true;
+}
+
+#endif // PARTICLE
@@ -0,0 +1,57 @@
+#ifndef __MicClock_H
+#define __MicClock_H
+
+#ifdef PARTICLE
+#include "Particle.h"
+
+/**
+ * @brief Converts micros() values, such as Microphone_PDM_Page::timestampUs, to Unix time in microseconds
+ *
+ * Time.now() only has a resolution of 1 second, so a time calculated from it can be off by up to a
+ * second. Each update() compares Time.now() with micros(). When it sees Time.now() change to the next
+ * second, it saves micros() at that moment as a reference, and later conversions are calculated from
+ * the reference. The rollover is placed halfway between the two calls that saw it, so the accuracy is
+ * half the interval between calls, typically a buffer period when called for each buffer.
+ *
+ * If Time.now() stops agreeing with the reference, for example when the time is synchronized with the
+ * cloud, the reference is discarded and found again at the next rollover.
+ */
+class MicClock {
+public:
+	/**
+	 * @brief Convert a micros() value to Unix time
+	 *
+	 * @param microsValue A value of micros() within about 30 minutes of now
+	 *
+	 * @param unixTimeUs Filled in with the Unix time in microseconds
+	 *
+	 * @return false if the time is not valid or the reference has not been found yet. Call it again
+	 * later, typically with the next buffer. This calls update().
+	 */
+	static bool toUnixTimeUs(uint32_t microsValue, uint64_t &unixTimeUs);
+
+	/**
+	 * @brief Check Time.now() for the start of a new second
+	 *
+	 * @return true if the reference has been found
+	 *
+	 * toUnixTimeUs() calls this. Calling it more often, such as from loop(), finds the reference
+	 * sooner and more accurately.
+	 */
+	static bool update();
+
+	/**
+	 * @brief A rollover seen over a longer interval than this is not used as the reference
+	 */
+	static const uint32_t MAX_INTERVAL_US = 250000;
+
+protected:
+	static uint32_t lastSecond;		//!< Time.now() at the previous update(), or 0
+	static uint32_t lastMicros;		//!< micros() at the previous update()
+	static uint32_t refSecond;		//!< Unix time of the reference, or 0 if it has not been found
+	static uint32_t refMicros;		//!< Value of micros() when refSecond started
+};
+
+#endif // PARTICLE
+
+#endif /* __MicClock_H */
@@ -0,0 +1,69 @@
+#include "MicFile.h"
+
+#ifndef PARTICLE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MicPosixFile::MicPosixFile() {
+}
+
+MicPosixFile::~MicPosixFile() {
+	close();
+}
+
+bool MicPosixFile::create(const char *path) {
+	close();
+	fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	return fd >= 0;
+}
+
+bool MicPosixFile::open(const char *path, bool writable) {
+	close();
+	fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+	return fd >= 0;
+}
+
+void MicPosixFile::close() {
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+int MicPosixFile::write(const void *buf, size_t len) {
+	const uint8_t *p = (const uint8_t *) buf;
+	size_t done = 0;
+
+	while(done < len) {
+		ssize_t count = ::write(fd, &p[done], len - done);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return done ? (int) done : -errno;
+		}
+		done += count;
+	}
+	return (int) done;
+}
+
+int MicPosixFile::read(void *buf, size_t len) {
+	ssize_t count;
+	do {
+		count = ::read(fd, buf, len);
+	} while(count < 0 && errno == EINTR);
+
+	return (count < 0) ? -errno : (int) count;
+}
+
+bool MicPosixFile::seek(uint64_t pos) {
+	return lseek(fd, (off_t) pos, SEEK_SET) == (off_t) pos;
+}
+
+bool MicPosixFile::sync() {
+	return fsync(fd) == 0;
+}
+
+#endif // PARTICLE
@@ -0,0 +1,91 @@
+#ifndef __MicFile_H
+#define __MicFile_H
+
+#ifdef PARTICLE
+#include "Particle.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Minimal interface to a file, used by the streaming wav writer
+ *
+ * Implement this to write to a file system such as SdFat or LittleFS. Only sequential writes,
+ * seeking, and reading are required. On a computer, use MicPosixFile.
+ */
+class MicFile {
+public:
+	virtual ~MicFile() {};
+
+	/**
+	 * @brief Write bytes at the current position
+	 *
+	 * @return int Number of bytes written. Anything other than len is treated as an error.
+	 */
+	virtual int write(const void *buf, size_t len) = 0;
+
+	/**
+	 * @brief Read bytes from the current position
+	 *
+	 * @return int Number of bytes read, 0 at end of file, or negative on error
+	 */
+	virtual int read(void *buf, size_t len) = 0;
+
+	/**
+	 * @brief Set the current position
+	 *
+	 * @param pos Offset from the start of the file in bytes
+	 *
+	 * @return true on success
+	 */
+	virtual bool seek(uint64_t pos) = 0;
+
+	/**
+	 * @brief Flush buffered data to the storage medium. Optional.
+	 */
+	virtual bool sync() { return true; };
+};
+
+#ifndef PARTICLE
+/**
+ * @brief MicFile using a POSIX file descriptor, for running the file writers on a computer
+ */
+class MicPosixFile : public MicFile {
+public:
+	MicPosixFile();
+	virtual ~MicPosixFile();
+
+	/**
+	 * @brief Create a file, replacing it if it exists, and open it for reading and writing
+	 */
+	bool create(const char *path);
+
+	/**
+	 * @brief Open an existing file
+	 *
+	 * @param writable true to open for reading and writing, false for reading only
+	 */
+	bool open(const char *path, bool writable = false);
+
+	/**
+	 * @brief Close the file. It's also closed by the destructor.
+	 */
+	void close();
+
+	/**
+	 * @brief Returns true if a file is open
+	 */
+	bool isOpen() const { return fd >= 0; };
+
+	virtual int write(const void *buf, size_t len);
+	virtual int read(void *buf, size_t len);
+	virtual bool seek(uint64_t pos);
+	virtual bool sync();
+
+protected:
+	int fd = -1; //!< File descriptor, or -1 if not open
+};
+#endif
+
+#endif /* __MicFile_H */
@@ -0,0 +1,267 @@
+#include "MicRtpSink.h"
+
+#include <new>
+#include <stdlib.h>
+
+#ifndef PARTICLE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef PARTICLE
+int MicUdpTransport::send(const uint8_t *buf, size_t len) {
+	int result = udp.sendPacket(buf, len, remoteAddr, remotePort);
+	if (result < 0 && result != SYSTEM_ERROR_NO_MEMORY) {
+		return result;
+	}
+	// Out of buffers is the same as would block for UDP; the packet is just not sent
+	return (result < 0) ? 0 : (int) len;
+}
+#else
+MicPosixUdpTransport::MicPosixUdpTransport(int fd) : fd(fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags >= 0) {
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	}
+}
+
+int MicPosixUdpTransport::send(const uint8_t *buf, size_t len) {
+	ssize_t count = ::send(fd, buf, len, 0);
+	if (count >= 0) {
+		return (int) count;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR) {
+		return 0;
+	}
+	return -errno;
+}
+#endif
+
+
+MicRtpSink::MicRtpSink() {
+}
+
+MicRtpSink::~MicRtpSink() {
+	delete[] packet;
+}
+
+int MicRtpSink::begin() {
+	if (numChannels < 1 || numChannels > 2 || sampleRate == 0) {
+		return -1;
+	}
+
+	size_t bytesPerSample = (payload == Payload::PCMU) ? 1 : 2;
+
+	packetSamples = (size_t)((uint64_t)sampleRate * packetDurationMs / 1000) * numChannels;
+	if (packetSamples * bytesPerSample > MAX_PAYLOAD_SIZE) {
+		packetSamples = MAX_PAYLOAD_SIZE / bytesPerSample;
+	}
+	// Keep stereo pairs in the same packet
+	packetSamples -= packetSamples % numChannels;
+	if (packetSamples == 0) {
+		packetSamples = numChannels;
+	}
+
+	if (!packet) {
+		packet = new (std::nothrow) uint8_t[RTP_HEADER_SIZE + MAX_PAYLOAD_SIZE];
+		if (!packet) {
+			return -1;
+		}
+	}
+
+	// RFC 3550 recommends random initial values so streams can't be confused with each other
+	if (ssrc == 0) {
+		ssrc = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	}
+	sequence = (uint16_t) rand();
+	timestampBase = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+	packetCount = 0;
+	started = false;
+	marker = true;
+	stats = {};
+
+	return 0;
+}
+
+int MicRtpSink::write(const int16_t *pSamples, size_t numSamples, uint64_t sampleIndex) {
+	if (!packet) {
+		return -1;
+	}
+
+	int result = 0;
+
+	if (started && sampleIndex != nextSampleIndex) {
+		// Samples were dropped on the device. Send what we have and start over at the new timestamp.
+		stats.discontinuities++;
+		result = flush();
+		marker = true;
+	}
+
+	while(numSamples > 0) {
+		if (packetCount == 0) {
+			packetSampleIndex = sampleIndex;
+		}
+
+		size_t count = packetSamples - packetCount;
+		if (count > numSamples) {
+			count = numSamples;
+		}
+
+		uint8_t *dst = &packet[RTP_HEADER_SIZE];
+		if (payload == Payload::PCMU) {
+			dst += packetCount;
+			for(size_t ii = 0; ii < count; ii++) {
+				dst[ii] = linearToUlaw(pSamples[ii]);
+			}
+		}
+		else {
+			// L16 is network byte order (big endian)
+			dst += packetCount * 2;
+			for(size_t ii = 0; ii < count; ii++) {
+				uint16_t sample = (uint16_t) pSamples[ii];
+				dst[ii * 2] = (uint8_t)(sample >> 8);
+				dst[ii * 2 + 1] = (uint8_t) sample;
+			}
+		}
+
+		packetCount += count;
+		pSamples += count;
+		numSamples -= count;
+		sampleIndex += count;
+
+		if (packetCount == packetSamples) {
+			int res = flush();
+			if (res < 0) {
+				result = res;
+			}
+		}
+	}
+	started = true;
+	nextSampleIndex = sampleIndex;
+
+	return result;
+}
+
+int MicRtpSink::flush() {
+	if (packetCount == 0) {
+		return 0;
+	}
+	if (!transport) {
+		packetCount = 0;
+		return -1;
+	}
+
+	// The RTP timestamp counts sample frames, so with stereo it's half the sample index
+	uint32_t timestamp = timestampBase + (uint32_t)(packetSampleIndex / numChannels);
+
+	packet[0] = 0x80; // Version 2, no padding, no extension, no CSRCs
+	packet[1] = (uint8_t)((marker ? 0x80 : 0) | payloadType);
+	packet[2] = (uint8_t)(sequence >> 8);
+	packet[3] = (uint8_t) sequence;
+	packet[4] = (uint8_t)(timestamp >> 24);
+	packet[5] = (uint8_t)(timestamp >> 16);
+	packet[6] = (uint8_t)(timestamp >> 8);
+	packet[7] = (uint8_t) timestamp;
+	packet[8] = (uint8_t)(ssrc >> 24);
+	packet[9] = (uint8_t)(ssrc >> 16);
+	packet[10] = (uint8_t)(ssrc >> 8);
+	packet[11] = (uint8_t) ssrc;
+
+	size_t len = RTP_HEADER_SIZE + packetCount * ((payload == Payload::PCMU) ? 1 : 2);
+	packetCount = 0;
+
+	// The sequence number advances even if the packet could not be sent, so the receiver counts it as lost
+	sequence++;
+	marker = false;
+
+	int result = transport->send(packet, len);
+	if (result > 0) {
+		stats.packetsSent++;
+		stats.bytesSent += len;
+		return 0;
+	}
+	else if (result == 0) {
+		stats.packetsDropped++;
+		return 0;
+	}
+	else {
+		stats.sendErrors++;
+		return result;
+	}
+}
+
+// [static]
+uint8_t MicRtpSink::linearToUlaw(int16_t sample) {
+	const int32_t BIAS = 0x84;
+	const int32_t CLIP = 32635;
+
+	int32_t value = sample;
+	uint8_t sign = 0;
+	if (value < 0) {
+		value = -value;
+		sign = 0x80;
+	}
+	if (value > CLIP) {
+		value = CLIP;
+	}
+	value += BIAS;
+
+	int exponent = 7;
+	for(int32_t mask = 0x4000; (value & mask) == 0 && exponent > 0; mask >>= 1) {
+		exponent--;
+	}
+	int mantissa = (value >> (exponent + 3)) & 0x0f;
+
+	return (uint8_t) ~(sign | (exponent << 4) | mantissa);
+}
+
+// [static]
+int16_t MicRtpSink::ulawToLinear(uint8_t ulaw) {
+	ulaw = ~ulaw;
+
+	int exponent = (ulaw >> 4) & 0x07;
+	int mantissa = ulaw & 0x0f;
+	int32_t value = (((mantissa << 3) + 0x84) << exponent) - 0x84;
+
+	return (int16_t)((ulaw & 0x80) ? -value : value);
+}
+
+
+bool MicRtpReceiverStats::update(const uint8_t *packet, size_t len, uint32_t arrival) {
+	if (len < MicRtpSink::RTP_HEADER_SIZE || (packet[0] & 0xc0) != 0x80) {
+		return false;
+	}
+
+	uint16_t seq = (uint16_t)((packet[2] << 8) | packet[3]);
+	uint32_t timestamp = ((uint32_t)packet[4] << 24) | ((uint32_t)packet[5] << 16) | ((uint32_t)packet[6] << 8) | packet[7];
+
+	int32_t transit = (int32_t)(arrival - timestamp);
+
+	if (received == 0) {
+		baseSeq = maxSeq = seq;
+		lastTransit = transit;
+	}
+	else {
+		// Extend the 16-bit sequence number using the highest one seen so far
+		int16_t delta = (int16_t)(seq - (uint16_t)maxSeq);
+		if (delta > 0) {
+			maxSeq += delta;
+		}
+		else {
+			outOfOrder++;
+		}
+
+		// J(i) = J(i-1) + (|D(i-1,i)| - J(i-1))/16, kept multiplied by 16 to avoid losing the fraction
+		int32_t d = transit - lastTransit;
+		lastTransit = transit;
+		if (d < 0) {
+			d = -d;
+		}
+		jitterQ4 += d - ((jitterQ4 + 8) >> 4);
+	}
+	received++;
+
+	return true;
+}
@@ -0,0 +1,284 @@
+#ifndef __MicRtpSink_H
+#define __MicRtpSink_H
+
+#ifdef PARTICLE
+#include "Particle.h"
+#include "Microphone_PDM.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Abstract interface to a datagram socket, such as UDP
+ *
+ * MicRtpSink only uses this class, so it does not depend on Particle networking and can be run
+ * on a computer using MicPosixUdpTransport.
+ */
+class MicDatagramTransport {
+public:
+	virtual ~MicDatagramTransport() {};
+
+	/**
+	 * @brief Send one datagram without blocking
+	 *
+	 * @param buf The datagram
+	 *
+	 * @param len Length in bytes
+	 *
+	 * @return int len if sent, 0 if the socket cannot accept it right now, or a negative error code
+	 */
+	virtual int send(const uint8_t *buf, size_t len) = 0;
+};
+
+#ifdef PARTICLE
+/**
+ * @brief Transport using a Particle UDP object
+ *
+ * Call udp.begin() with a local port before sending.
+ */
+class MicUdpTransport : public MicDatagramTransport {
+public:
+	MicUdpTransport(UDP &udp, IPAddress remoteAddr, uint16_t remotePort) : udp(udp), remoteAddr(remoteAddr), remotePort(remotePort) {};
+
+	virtual int send(const uint8_t *buf, size_t len);
+
+protected:
+	UDP &udp;				//!< UDP object, not owned by this object
+	IPAddress remoteAddr;	//!< Where to send
+	uint16_t remotePort;	//!< Port to send to
+};
+#else
+/**
+ * @brief Transport using a connected POSIX UDP socket, for running MicRtpSink on a computer
+ *
+ * Call connect() on the socket to set the destination first. The socket is switched to non-blocking
+ * mode. It's not closed by this object.
+ */
+class MicPosixUdpTransport : public MicDatagramTransport {
+public:
+	explicit MicPosixUdpTransport(int fd);
+
+	virtual int send(const uint8_t *buf, size_t len);
+
+protected:
+	int fd; //!< Connected socket file descriptor
+};
+#endif
+
+
+/**
+ * @brief Sends audio as RTP (RFC 3550) packets over UDP for low-latency live monitoring
+ *
+ * Samples must be 16-bit (OutputSize::SIGNED_16 or RAW_SIGNED_16). They are packed as L16
+ * (big-endian 16-bit PCM, RFC 3551) or PCMU (G.711 mu-law, 8 bits per sample) and sent in
+ * packets of packetDurationMs.
+ *
+ * The RTP timestamp is derived from the sample index of each buffer, not a clock, so it advances
+ * by exactly one per sample frame. If samples were dropped on the device, the packet in progress is
+ * sent early and the next packet starts at the new timestamp with the marker bit set, so the receiver
+ * can see the gap.
+ *
+ * Sending never blocks. If the socket can't accept a packet it's discarded and counted, as late audio
+ * is not useful for live monitoring.
+ */
+class MicRtpSink {
+public:
+	/**
+	 * @brief Payload encoding
+	 */
+	enum class Payload {
+		L16,	//!< 16-bit big-endian PCM (default)
+		PCMU,	//!< G.711 mu-law, half the bandwidth of L16. Standard receivers expect 8000 Hz mono.
+	};
+
+	/**
+	 * @brief Counters returned by getStats()
+	 */
+	struct Stats {
+		uint32_t packetsSent;		//!< Packets accepted by the transport
+		uint32_t bytesSent;			//!< Bytes in those packets, including the RTP header
+		uint32_t packetsDropped;	//!< Packets discarded because the socket could not accept them
+		uint32_t sendErrors;		//!< Packets the transport returned an error for
+		uint32_t discontinuities;	//!< Number of times samples were missing from the input
+	};
+
+	static constexpr size_t RTP_HEADER_SIZE = 12;		//!< RTP header without CSRCs or extensions
+	static constexpr size_t MAX_PAYLOAD_SIZE = 1460;	//!< Keeps packets within a 1500-byte MTU
+
+	MicRtpSink();
+	virtual ~MicRtpSink();
+
+	/**
+	 * @brief Set where to send packets. Must be set before write().
+	 */
+	MicRtpSink &withTransport(MicDatagramTransport *transport) { this->transport = transport; return *this; };
+
+	/**
+	 * @brief Set the payload encoding (default: L16)
+	 *
+	 * This also sets the payload type to 96 (dynamic) for L16 or 0 for PCMU.
+	 */
+	MicRtpSink &withPayload(Payload payload) { this->payload = payload; this->payloadType = (payload == Payload::PCMU) ? 0 : 96; return *this; };
+
+	/**
+	 * @brief Override the RTP payload type number. Call after withPayload().
+	 */
+	MicRtpSink &withPayloadType(uint8_t payloadType) { this->payloadType = payloadType & 0x7f; return *this; };
+
+	/**
+	 * @brief Set the sample format (default: 16000 Hz mono). Use the values from Microphone_PDM.
+	 */
+	MicRtpSink &withFormat(uint32_t sampleRate, uint8_t numChannels) { this->sampleRate = sampleRate; this->numChannels = numChannels; return *this; };
+
+	/**
+	 * @brief Audio per packet in milliseconds (default: 20)
+	 *
+	 * Shorter packets lower the latency but have more overhead. The packet is made shorter if needed
+	 * to fit in MAX_PAYLOAD_SIZE bytes.
+	 */
+	MicRtpSink &withPacketDurationMs(uint32_t packetDurationMs) { this->packetDurationMs = packetDurationMs; return *this; };
+
+	/**
+	 * @brief Set the synchronization source identifier. By default, it's random.
+	 */
+	MicRtpSink &withSsrc(uint32_t ssrc) { this->ssrc = ssrc; return *this; };
+
+	/**
+	 * @brief Allocate the packet buffer and start a new stream. Call after the with methods.
+	 *
+	 * @return int 0 on success or a negative error code
+	 */
+	int begin();
+
+	/**
+	 * @brief Add samples to the stream, sending packets as they fill
+	 *
+	 * @param pSamples 16-bit samples, interleaved if stereo
+	 *
+	 * @param numSamples Number of int16_t values, as in Microphone_PDM_Page::numSamples
+	 *
+	 * @param sampleIndex Index of the first sample, as in Microphone_PDM_Page::sampleIndex
+	 *
+	 * @return int 0 on success or a negative error code from the transport
+	 */
+	int write(const int16_t *pSamples, size_t numSamples, uint64_t sampleIndex);
+
+#ifdef PARTICLE
+	/**
+	 * @brief Add a buffer from Microphone_PDM::acquireSamples(), a subscriber, or a pipeline
+	 */
+	int write(const Microphone_PDM_Page &page) {
+		return write((const int16_t *)page.pSamples, page.numSamples, page.sampleIndex);
+	}
+
+	/**
+	 * @brief Lets this object be used as the sink of a Microphone_PDM_Pipeline
+	 */
+	void operator()(const Microphone_PDM_Page &page) {
+		write(page);
+	}
+#endif
+
+	/**
+	 * @brief Send the packet in progress even if it's not full
+	 */
+	int flush();
+
+	/**
+	 * @brief Number of sample frames (per channel) in each full packet
+	 */
+	size_t getSamplesPerPacket() const { return packetSamples / numChannels; };
+
+	/**
+	 * @brief Get the counters
+	 */
+	Stats getStats() const { return stats; };
+
+	/**
+	 * @brief Encode a 16-bit sample as G.711 mu-law
+	 */
+	static uint8_t linearToUlaw(int16_t sample);
+
+	/**
+	 * @brief Decode a G.711 mu-law sample to 16 bits
+	 */
+	static int16_t ulawToLinear(uint8_t ulaw);
+
+protected:
+	MicDatagramTransport *transport = NULL;		//!< Where to send packets. Not owned by this object.
+	Payload payload = Payload::L16;				//!< Payload encoding
+	uint8_t payloadType = 96;					//!< RTP payload type
+	uint32_t sampleRate = 16000;				//!< Samples per second per channel
+	uint8_t numChannels = 1;					//!< 1 or 2
+	uint32_t packetDurationMs = 20;				//!< Audio per packet
+	uint32_t ssrc = 0;							//!< RTP SSRC. 0 means choose a random value in begin().
+
+	uint8_t *packet = NULL;			//!< Header and payload of the packet in progress
+	size_t packetSamples = 0;		//!< int16_t values in a full packet
+	size_t packetCount = 0;			//!< int16_t values in the packet in progress
+	uint16_t sequence = 0;			//!< RTP sequence number of the next packet
+	uint32_t timestampBase = 0;		//!< Random offset added to the sample frame index
+	uint64_t packetSampleIndex = 0;	//!< Sample index of the first sample in the packet in progress
+	uint64_t nextSampleIndex = 0;	//!< Sample index expected in the next call to write()
+	bool started = false;			//!< True after the first write()
+	bool marker = true;				//!< Set the marker bit on the next packet
+	Stats stats = {};				//!< Counters
+};
+
+
+/**
+ * @brief Receiver-side statistics for an RTP stream, calculated as in RFC 3550 appendix A
+ *
+ * Call update() for each packet received. Used to check a stream for loss and jitter.
+ */
+class MicRtpReceiverStats {
+public:
+	/**
+	 * @brief Process a received packet
+	 *
+	 * @param packet The RTP packet
+	 *
+	 * @param len Length of the packet in bytes
+	 *
+	 * @param arrival Arrival time of the packet in sample periods (seconds multiplied by the sample rate)
+	 *
+	 * @return false The packet is not a valid RTP packet and was ignored
+	 */
+	bool update(const uint8_t *packet, size_t len, uint32_t arrival);
+
+	/**
+	 * @brief Number of packets expected, from the first and highest sequence numbers
+	 */
+	uint32_t getExpected() const { return received ? (maxSeq - baseSeq + 1) : 0; };
+
+	/**
+	 * @brief Number of packets received
+	 */
+	uint32_t getReceived() const { return received; };
+
+	/**
+	 * @brief Number of packets lost. Can be negative if packets were duplicated.
+	 */
+	int32_t getLost() const { return (int32_t)(getExpected() - received); };
+
+	/**
+	 * @brief Interarrival jitter in sample periods. Divide by the sample rate to get seconds.
+	 */
+	uint32_t getJitter() const { return jitterQ4 >> 4; };
+
+	/**
+	 * @brief Number of packets that arrived with a lower sequence number than one already received
+	 */
+	uint32_t getOutOfOrder() const { return outOfOrder; };
+
+protected:
+	uint32_t received = 0;		//!< Packets received
+	uint32_t baseSeq = 0;		//!< First sequence number
+	uint32_t maxSeq = 0;		//!< Highest sequence number, extended to 32 bits
+	uint32_t outOfOrder = 0;	//!< Packets older than maxSeq
+	int32_t lastTransit = 0;	//!< Arrival minus RTP timestamp of the previous packet
+	uint32_t jitterQ4 = 0;		//!< Jitter multiplied by 16
+};
+
+#endif /* __MicRtpSink_H */
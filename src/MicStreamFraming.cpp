@@ -0,0 +1,348 @@
+#include "MicStreamFraming.h"
+
+#include <new>
+#include <string.h>
+
+static_assert(MicStreamFraming::STREAM_HEADER_SIZE == MicStreamFraming::FRAME_HEADER_SIZE, "the decoder receives both headers into the same buffer");
+
+static void putU16(uint8_t *p, uint16_t value) {
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t) (value >> 8);
+}
+
+static void putU32(uint8_t *p, uint32_t value) {
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t) (value >> 8);
+	p[2] = (uint8_t) (value >> 16);
+	p[3] = (uint8_t) (value >> 24);
+}
+
+static uint16_t getU16(const uint8_t *p) {
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Reflected polynomial 0xEDB88320. 1 KB in flash is much faster than calculating bit-by-bit.
+static const uint32_t crcTable[256] = {
+	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+	0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+	0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+	0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+	0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
+};
+
+// [static]
+uint32_t MicStreamFraming::crc32(const void *data, size_t len, uint32_t crc) {
+	const uint8_t *p = (const uint8_t *) data;
+
+	crc = ~crc;
+	for(size_t ii = 0; ii < len; ii++) {
+		crc = crcTable[(crc ^ p[ii]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// [static]
+size_t MicStreamFraming::writeStreamHeader(uint8_t *buf, const Format &format) {
+	putU32(&buf[0], STREAM_MAGIC);
+	buf[4] = VERSION;
+	buf[5] = (uint8_t) STREAM_HEADER_SIZE;
+	buf[6] = (uint8_t) FRAME_HEADER_SIZE;
+	buf[7] = format.numChannels;
+	putU32(&buf[8], format.sampleRate);
+	buf[12] = format.bitsPerSample;
+	buf[13] = buf[14] = buf[15] = 0;
+
+	return STREAM_HEADER_SIZE;
+}
+
+// [static]
+bool MicStreamFraming::readStreamHeader(const uint8_t *buf, Format &format) {
+	if (getU32(&buf[0]) != STREAM_MAGIC || buf[4] != VERSION || buf[5] != STREAM_HEADER_SIZE || buf[6] != FRAME_HEADER_SIZE) {
+		return false;
+	}
+	format.numChannels = buf[7];
+	format.sampleRate = getU32(&buf[8]);
+	format.bitsPerSample = buf[12];
+	return true;
+}
+
+// [static]
+size_t MicStreamFraming::writeFrameHeader(uint8_t *buf, uint32_t sequence, uint32_t timestamp, const Segment *segments, size_t numSegments) {
+	size_t len = 0;
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		len += segments[ii].len;
+	}
+	if (len > MAX_PAYLOAD_SIZE) {
+		return 0;
+	}
+
+	putU16(&buf[0], FRAME_SYNC);
+	putU16(&buf[2], (uint16_t) len);
+	putU32(&buf[4], sequence);
+	putU32(&buf[8], timestamp);
+
+	uint32_t crc = crc32(buf, 12);
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		crc = crc32(segments[ii].data, segments[ii].len, crc);
+	}
+	putU32(&buf[12], crc);
+
+	return FRAME_HEADER_SIZE;
+}
+
+
+size_t MicStreamEncoder::begin(uint8_t *buf, const MicStreamFraming::Format &format) {
+	sequence = 0;
+	return MicStreamFraming::writeStreamHeader(buf, format);
+}
+
+size_t MicStreamEncoder::encodeFrame(uint8_t *buf, uint32_t timestamp, const void *payload, size_t len) {
+	MicStreamFraming::Segment segment = { payload, len };
+	return encodeFrame(buf, timestamp, &segment, 1);
+}
+
+size_t MicStreamEncoder::encodeFrame(uint8_t *buf, uint32_t timestamp, const MicStreamFraming::Segment *segments, size_t numSegments) {
+	size_t result = MicStreamFraming::writeFrameHeader(buf, sequence, timestamp, segments, numSegments);
+	if (result) {
+		sequence++;
+	}
+	return result;
+}
+
+
+MicStreamDecoder::MicStreamDecoder(size_t maxPayloadSize) : maxPayloadSize(maxPayloadSize) {
+	if (this->maxPayloadSize > MicStreamFraming::MAX_PAYLOAD_SIZE) {
+		this->maxPayloadSize = MicStreamFraming::MAX_PAYLOAD_SIZE;
+	}
+}
+
+MicStreamDecoder::~MicStreamDecoder() {
+	delete[] payload;
+	delete[] rescan;
+}
+
+void MicStreamDecoder::reset() {
+	state = State::STREAM_HEADER;
+	headerCount = 0;
+	payloadCount = 0;
+	rescanOffset = rescanCount = 0;
+	resyncPending = false;
+	haveSequence = false;
+	stats = {};
+}
+
+bool MicStreamDecoder::write(const uint8_t *data, size_t len) {
+	while(state != State::BAD_STREAM) {
+		if (rescanOffset < rescanCount) {
+			// Bytes from a bad frame come before the new data
+			rescanOffset += writeSome(&rescan[rescanOffset], rescanCount - rescanOffset);
+		}
+		else if (len > 0) {
+			size_t count = writeSome(data, len);
+			data += count;
+			len -= count;
+		}
+		else {
+			break;
+		}
+
+		if (resyncPending) {
+			// Done here, after the offsets are updated, because it changes rescan
+			resync();
+		}
+	}
+	return state != State::BAD_STREAM;
+}
+
+size_t MicStreamDecoder::writeSome(const uint8_t *data, size_t len) {
+	size_t count = 0;
+
+	switch(state) {
+	case State::STREAM_HEADER:
+		count = MicStreamFraming::STREAM_HEADER_SIZE - headerCount;
+		if (count > len) {
+			count = len;
+		}
+		memcpy(&header[headerCount], data, count);
+		headerCount += count;
+
+		if (headerCount == MicStreamFraming::STREAM_HEADER_SIZE) {
+			headerCount = 0;
+			if (!payload) {
+				payload = new (std::nothrow) uint8_t[maxPayloadSize ? maxPayloadSize : 1];
+			}
+			if (!rescan) {
+				rescan = new (std::nothrow) uint8_t[MicStreamFraming::FRAME_HEADER_SIZE - 1 + maxPayloadSize];
+			}
+			if (!payload || !rescan || !MicStreamFraming::readStreamHeader(header, format)) {
+				state = State::BAD_STREAM;
+				return 0;
+			}
+			state = State::FRAME_HEADER;
+			if (formatCallback) {
+				formatCallback(format);
+			}
+		}
+		break;
+
+	case State::FRAME_HEADER:
+		if (headerCount < 2) {
+			// Look for the sync word one byte at a time
+			count = 1;
+			header[headerCount++] = data[0];
+			if (headerCount == 2 && getU16(header) != MicStreamFraming::FRAME_SYNC) {
+				// The second byte could be the start of the sync word
+				stats.bytesSkipped++;
+				header[0] = header[1];
+				headerCount = 1;
+			}
+			if (headerCount == 1 && header[0] != (uint8_t) MicStreamFraming::FRAME_SYNC) {
+				stats.bytesSkipped++;
+				headerCount = 0;
+			}
+			break;
+		}
+
+		count = MicStreamFraming::FRAME_HEADER_SIZE - headerCount;
+		if (count > len) {
+			count = len;
+		}
+		memcpy(&header[headerCount], data, count);
+		headerCount += count;
+
+		if (headerCount == MicStreamFraming::FRAME_HEADER_SIZE) {
+			headerCount = 0;
+			if (!frameHeaderReceived()) {
+				payloadCount = 0;
+				resyncPending = true;
+			}
+		}
+		break;
+
+	case State::PAYLOAD:
+		count = frameInfo.length - payloadCount;
+		if (count > len) {
+			count = len;
+		}
+		memcpy(&payload[payloadCount], data, count);
+		payloadCount += count;
+
+		if (payloadCount == frameInfo.length) {
+			payloadReceived();
+		}
+		break;
+
+	case State::BAD_STREAM:
+	default:
+		return 0;
+	}
+	return count;
+}
+
+bool MicStreamDecoder::frameHeaderReceived() {
+	frameInfo.length = getU16(&header[2]);
+	frameInfo.sequence = getU32(&header[4]);
+	frameInfo.timestamp = getU32(&header[8]);
+	expectedCrc = getU32(&header[12]);
+
+	if (frameInfo.length > maxPayloadSize) {
+		stats.lengthErrors++;
+		return false;
+	}
+
+	payloadCount = 0;
+	state = State::PAYLOAD;
+	if (frameInfo.length == 0) {
+		payloadReceived();
+	}
+	return true;
+}
+
+void MicStreamDecoder::payloadReceived() {
+	state = State::FRAME_HEADER;
+
+	uint32_t crc = MicStreamFraming::crc32(header, 12);
+	crc = MicStreamFraming::crc32(payload, frameInfo.length, crc);
+	if (crc != expectedCrc) {
+		// The length may be what was corrupted, in which case the payload contains good frames
+		stats.crcErrors++;
+		resyncPending = true;
+		return;
+	}
+
+	if (haveSequence && frameInfo.sequence != nextSequence) {
+		stats.sequenceGaps++;
+		stats.framesLost += frameInfo.sequence - nextSequence;
+	}
+	haveSequence = true;
+	nextSequence = frameInfo.sequence + 1;
+
+	stats.frames++;
+	stats.payloadBytes += frameInfo.length;
+
+	if (frameCallback) {
+		frameCallback(frameInfo, payload);
+	}
+}
+
+void MicStreamDecoder::resync() {
+	// The sync word at the start of header was not a real frame. Scan again from the byte after it:
+	// the rest of the header, the payload received for it, then any bytes still waiting to be rescanned.
+	// The bad frame came from the bytes already used from rescan, if any, so this always fits.
+	const size_t headerRest = MicStreamFraming::FRAME_HEADER_SIZE - 1;
+	size_t remaining = rescanCount - rescanOffset;
+
+	memmove(&rescan[headerRest + payloadCount], &rescan[rescanOffset], remaining);
+	memcpy(rescan, &header[1], headerRest);
+	memcpy(&rescan[headerRest], payload, payloadCount);
+	rescanOffset = 0;
+	rescanCount = headerRest + payloadCount + remaining;
+
+	resyncPending = false;
+	payloadCount = 0;
+	stats.bytesSkipped++;
+	state = State::FRAME_HEADER;
+	headerCount = 0;
+}
@@ -0,0 +1,313 @@
+#ifndef __MicStreamFraming_H
+#define __MicStreamFraming_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+/**
+ * @brief Self-describing framing for streaming audio, with sequence numbers and CRC
+ *
+ * This file does not depend on Particle, so the same code can be used to decode the stream on
+ * a computer.
+ *
+ * A stream starts with a 16-byte stream header that describes the format, so the receiver doesn't
+ * need to be told the sample rate, bits per sample, and number of channels separately. All values
+ * are little endian.
+ *
+ * | Offset | Size | Stream header                                 |
+ * | -----: | ---: | :-------------------------------------------- |
+ * |      0 |    4 | Magic "MPDM"                                  |
+ * |      4 |    1 | Version (1)                                   |
+ * |      5 |    1 | Stream header size (16)                       |
+ * |      6 |    1 | Frame header size (16)                        |
+ * |      7 |    1 | Number of channels                            |
+ * |      8 |    4 | Sample rate in Hz                             |
+ * |     12 |    1 | Bits per sample                               |
+ * |     13 |    3 | Reserved (0)                                  |
+ *
+ * It's followed by any number of frames, each a 16-byte frame header and a payload of samples:
+ *
+ * | Offset | Size | Frame header                                  |
+ * | -----: | ---: | :-------------------------------------------- |
+ * |      0 |    2 | Sync word 0x4D46 (bytes "FM")                 |
+ * |      2 |    2 | Payload length in bytes                       |
+ * |      4 |    4 | Sequence number, increments by 1 per frame    |
+ * |      8 |    4 | Timestamp: sample index of the payload        |
+ * |     12 |    4 | CRC-32 of bytes 0 - 11 and the payload        |
+ *
+ * The timestamp is Microphone_PDM_Page::sampleIndex of the first sample in the payload, truncated to 32
+ * bits. Like numSamples, it counts values, so in stereo the left and right samples are counted separately;
+ * divide by the number of channels to get the sample frame. The next frame's timestamp is this frame's
+ * timestamp plus the payload length in bytes divided by the bytes per sample, so a gap in the timestamps
+ * means samples were dropped on the device and a gap in the sequence numbers means frames were lost in transit.
+ *
+ * The payload is not copied: encode the header into a small buffer and send it followed by the payload
+ * from the DMA buffer. The overhead is 16 bytes per frame, so payloads of 1600 bytes or more (for example
+ * two 512-sample 16-bit buffers, which can be passed as two segments) keep it under 1%.
+ */
+class MicStreamFraming {
+public:
+	static constexpr uint32_t STREAM_MAGIC = 0x4d44504d;	//!< "MPDM" as a little endian uint32_t
+	static constexpr uint8_t VERSION = 1;					//!< Version in the stream header
+	static constexpr size_t STREAM_HEADER_SIZE = 16;		//!< Size of the stream header in bytes
+	static constexpr size_t FRAME_HEADER_SIZE = 16;			//!< Size of each frame header in bytes
+	static constexpr uint16_t FRAME_SYNC = 0x4d46;			//!< First two bytes of each frame header
+	static constexpr size_t MAX_PAYLOAD_SIZE = 65535;		//!< Largest payload that fits in the length field
+
+	/**
+	 * @brief Format of the samples, sent in the stream header
+	 */
+	struct Format {
+		uint32_t sampleRate;	//!< Sample rate in Hz, from Microphone_PDM::getSampleRate()
+		uint8_t bitsPerSample;	//!< 8 or 16, from Microphone_PDM::getBitsPerSample()
+		uint8_t numChannels;	//!< 1 or 2, from Microphone_PDM::getNumChannels()
+	};
+
+	/**
+	 * @brief Fields of a frame header
+	 */
+	struct FrameInfo {
+		uint16_t length;		//!< Payload length in bytes
+		uint32_t sequence;		//!< Sequence number
+		uint32_t timestamp;		//!< Sample index of the first value in the payload, with stereo samples counted separately
+	};
+
+	/**
+	 * @brief One piece of a payload that is in more than one buffer
+	 */
+	struct Segment {
+		const void *data;		//!< Bytes in this segment
+		size_t len;				//!< Number of bytes
+	};
+
+	/**
+	 * @brief Writes a stream header
+	 *
+	 * @param buf Buffer of at least STREAM_HEADER_SIZE bytes
+	 *
+	 * @param format The sample format
+	 *
+	 * @return size_t STREAM_HEADER_SIZE
+	 */
+	static size_t writeStreamHeader(uint8_t *buf, const Format &format);
+
+	/**
+	 * @brief Parses a stream header
+	 *
+	 * @return true The magic and version are valid and format was filled in
+	 */
+	static bool readStreamHeader(const uint8_t *buf, Format &format);
+
+	/**
+	 * @brief Writes a frame header for a payload in one or more segments
+	 *
+	 * @param buf Buffer of at least FRAME_HEADER_SIZE bytes
+	 *
+	 * @param sequence Sequence number
+	 *
+	 * @param timestamp Index of the first sample in the payload
+	 *
+	 * @param segments The payload, which is used to calculate the CRC but not copied
+	 *
+	 * @param numSegments Number of segments
+	 *
+	 * @return size_t FRAME_HEADER_SIZE, or 0 if the payload is larger than MAX_PAYLOAD_SIZE
+	 */
+	static size_t writeFrameHeader(uint8_t *buf, uint32_t sequence, uint32_t timestamp, const Segment *segments, size_t numSegments);
+
+	/**
+	 * @brief Writes a frame header for a payload in one buffer
+	 */
+	static size_t writeFrameHeader(uint8_t *buf, uint32_t sequence, uint32_t timestamp, const void *payload, size_t len) {
+		Segment segment = { payload, len };
+		return writeFrameHeader(buf, sequence, timestamp, &segment, 1);
+	}
+
+	/**
+	 * @brief Calculates a CRC-32 (IEEE 802.3, the same as zlib)
+	 *
+	 * @param data Bytes to include
+	 *
+	 * @param len Number of bytes
+	 *
+	 * @param crc Pass the result of the previous call to continue a CRC over more than one buffer, or 0 to start
+	 */
+	static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+};
+
+
+/**
+ * @brief Creates the stream header and frame headers for a stream, keeping track of the sequence number
+ */
+class MicStreamEncoder {
+public:
+	/**
+	 * @brief Start a new stream
+	 *
+	 * @param buf Buffer of at least MicStreamFraming::STREAM_HEADER_SIZE bytes to write the stream header to
+	 *
+	 * @param format Format of the samples
+	 *
+	 * @return size_t Number of bytes written to buf. Send these before any frames.
+	 */
+	size_t begin(uint8_t *buf, const MicStreamFraming::Format &format);
+
+	/**
+	 * @brief Create the header for the next frame
+	 *
+	 * @param buf Buffer of at least MicStreamFraming::FRAME_HEADER_SIZE bytes to write the header to
+	 *
+	 * @param timestamp Index of the first sample in the payload, normally Microphone_PDM_Page::sampleIndex.
+	 * In stereo, left and right samples are counted separately.
+	 *
+	 * @param payload Samples. Send these after the header.
+	 *
+	 * @param len Payload length in bytes
+	 *
+	 * @return size_t Number of bytes written to buf, or 0 if the payload is too large
+	 */
+	size_t encodeFrame(uint8_t *buf, uint32_t timestamp, const void *payload, size_t len);
+
+	/**
+	 * @brief Create the header for the next frame when the payload is in more than one buffer
+	 */
+	size_t encodeFrame(uint8_t *buf, uint32_t timestamp, const MicStreamFraming::Segment *segments, size_t numSegments);
+
+	/**
+	 * @brief Sequence number that will be used for the next frame
+	 */
+	uint32_t getSequence() const { return sequence; };
+
+protected:
+	uint32_t sequence = 0;	//!< Sequence number of the next frame
+};
+
+
+/**
+ * @brief Reference decoder for the receiving side
+ *
+ * Pass bytes as they arrive to write(), in pieces of any size. The stream header callback is called
+ * once the stream header is received, and the frame callback for each frame with a valid CRC.
+ *
+ * If a frame header or CRC is not valid, the frame is discarded and the decoder scans for the next sync
+ * word, starting from the byte after the bad frame's sync word. The bytes of the bad frame are scanned
+ * again, so a frame header with a corrupted length loses only that frame and not the frames it appeared
+ * to contain. Sequence gaps and CRC errors are counted.
+ */
+class MicStreamDecoder {
+public:
+	/**
+	 * @brief Counters returned by getStats()
+	 */
+	struct Stats {
+		uint32_t frames;			//!< Frames with a valid CRC
+		uint32_t payloadBytes;		//!< Bytes of payload in those frames
+		uint32_t crcErrors;			//!< Frames discarded because the CRC did not match
+		uint32_t lengthErrors;		//!< Frame headers discarded because the length was too large
+		uint32_t sequenceGaps;		//!< Number of times the sequence number skipped
+		uint32_t framesLost;		//!< Total number of sequence numbers skipped
+		uint32_t bytesSkipped;		//!< Bytes discarded while looking for a sync word
+	};
+
+	/**
+	 * @brief Construct a decoder
+	 *
+	 * @param maxPayloadSize Largest payload to accept. Two buffers of about this size, one for the payload
+	 * and one for rescanning after an error, are allocated on the heap when the stream header is received.
+	 */
+	explicit MicStreamDecoder(size_t maxPayloadSize = 8192);
+	virtual ~MicStreamDecoder();
+
+	/**
+	 * @brief Function to call when the stream header has been received
+	 */
+	MicStreamDecoder &withFormatCallback(std::function<void(const MicStreamFraming::Format &format)> formatCallback) { this->formatCallback = formatCallback; return *this; };
+
+	/**
+	 * @brief Function to call for each valid frame. The payload is only valid during the callback.
+	 */
+	MicStreamDecoder &withFrameCallback(std::function<void(const MicStreamFraming::FrameInfo &info, const uint8_t *payload)> frameCallback) { this->frameCallback = frameCallback; return *this; };
+
+	/**
+	 * @brief Process received bytes
+	 *
+	 * @return false The stream header was not valid. The remainder of the stream is ignored.
+	 */
+	bool write(const uint8_t *data, size_t len);
+
+	/**
+	 * @brief Prepare to receive a new stream
+	 */
+	void reset();
+
+	/**
+	 * @brief Returns true once the stream header has been received
+	 */
+	bool hasFormat() const { return state != State::STREAM_HEADER && state != State::BAD_STREAM; };
+
+	/**
+	 * @brief Returns the format from the stream header. Only valid if hasFormat() is true.
+	 */
+	const MicStreamFraming::Format &getFormat() const { return format; };
+
+	/**
+	 * @brief Get the counters
+	 */
+	Stats getStats() const { return stats; };
+
+protected:
+	/**
+	 * @brief Decoder state
+	 */
+	enum class State {
+		STREAM_HEADER,	//!< Receiving the stream header
+		FRAME_HEADER,	//!< Receiving a frame header
+		PAYLOAD,		//!< Receiving a payload
+		BAD_STREAM		//!< The stream header was not valid
+	};
+
+	/**
+	 * @brief Processes bytes in the current state. Returns the number of bytes used, which is at least
+	 * 1 unless the stream is bad.
+	 */
+	size_t writeSome(const uint8_t *data, size_t len);
+
+	/**
+	 * @brief Called when a complete frame header is in header. Returns false if not valid.
+	 */
+	bool frameHeaderReceived();
+
+	/**
+	 * @brief Called when the complete payload for the current frame has been received
+	 */
+	void payloadReceived();
+
+	/**
+	 * @brief Discards the first byte of the bad frame and arranges for the rest of its header and payload
+	 * to be scanned again for a sync word
+	 */
+	void resync();
+
+	size_t maxPayloadSize;						//!< Largest payload accepted
+	uint8_t *payload = NULL;					//!< Buffer for the payload
+	uint8_t *rescan = NULL;						//!< Bytes to process before any more from write(), after a bad frame
+	size_t rescanOffset = 0;					//!< Offset of the next byte to process in rescan
+	size_t rescanCount = 0;						//!< Number of bytes in rescan
+	bool resyncPending = false;					//!< The current frame was bad, call resync()
+	uint8_t header[MicStreamFraming::FRAME_HEADER_SIZE];	//!< Stream header or frame header being received
+	size_t headerCount = 0;						//!< Number of bytes in header
+	size_t payloadCount = 0;					//!< Number of bytes in payload
+	State state = State::STREAM_HEADER;			//!< What's being received
+	MicStreamFraming::Format format = {};		//!< From the stream header
+	MicStreamFraming::FrameInfo frameInfo = {};	//!< Current frame header
+	uint32_t expectedCrc = 0;					//!< CRC from the current frame header
+	bool haveSequence = false;					//!< True after the first valid frame
+	uint32_t nextSequence = 0;					//!< Expected sequence number of the next frame
+	Stats stats = {};							//!< Counters
+	std::function<void(const MicStreamFraming::Format &format)> formatCallback = 0;
+	std::function<void(const MicStreamFraming::FrameInfo &info, const uint8_t *payload)> frameCallback = 0;
+};
+
+#endif /* __MicStreamFraming_H */
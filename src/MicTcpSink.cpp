@@ -0,0 +1,200 @@
+#include "MicTcpSink.h"
+
+#include <new>
+#include <string.h>
+
+#ifndef PARTICLE
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef PARTICLE
+int MicTcpClientTransport::write(const uint8_t *buf, size_t len) {
+	if (!client.connected()) {
+		return SYSTEM_ERROR_INVALID_STATE;
+	}
+
+	client.clearWriteError();
+	int count = (int) client.write(buf, len, 0);
+	if (count > 0) {
+		return count;
+	}
+
+	// A timeout of 0 returns an error when the socket buffer is full, which is not fatal
+	// as long as the connection is still up
+	int err = client.getWriteError();
+	if (err != 0 && !client.connected()) {
+		return err;
+	}
+	return 0;
+}
+#else
+MicPosixSocketTransport::MicPosixSocketTransport(int fd) : fd(fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags >= 0) {
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	}
+}
+
+int MicPosixSocketTransport::write(const uint8_t *buf, size_t len) {
+#ifdef MSG_NOSIGNAL
+	ssize_t count = ::send(fd, buf, len, MSG_NOSIGNAL);
+#else
+	ssize_t count = ::send(fd, buf, len, 0);
+#endif
+	if (count >= 0) {
+		return (int) count;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+		return 0;
+	}
+	return -errno;
+}
+#endif
+
+
+MicTcpSink::MicTcpSink() {
+}
+
+MicTcpSink::~MicTcpSink() {
+	delete[] queue;
+}
+
+bool MicTcpSink::write(const void *data, size_t len) {
+	if (!queue) {
+		queue = new (std::nothrow) uint8_t[queueSize];
+		head = 0;
+		queued = 0;
+		if (!queue) {
+			stats.bytesDropped += len;
+			stats.drops++;
+			return false;
+		}
+	}
+
+	if (len > queueSize - queued) {
+		// The transport may have taken only part of the frame at head. The rest of that frame has to be
+		// sent, or the receiver would combine its first bytes with the end of a later frame.
+		size_t unsentInFrame = (frameSize > 1) ? (frameSize - frameBytesSent) % frameSize : 0;
+
+		if (dropPolicy == DropPolicy::DROP_NEWEST || len > queueSize - unsentInFrame) {
+			stats.bytesDropped += len;
+			stats.drops++;
+			return false;
+		}
+
+		// DROP_OLDEST: discard whole frames after the partly sent one, if any
+		size_t discard = len - (queueSize - queued);
+		if (frameSize > 1) {
+			discard = ((discard + frameSize - 1) / frameSize) * frameSize;
+		}
+		if (discard > queued - unsentInFrame) {
+			discard = queued - unsentInFrame;
+		}
+
+		// Move the rest of the partly sent frame up to where the discarded data ends, then discard
+		for(size_t ii = unsentInFrame; ii-- > 0; ) {
+			queue[(head + discard + ii) % queueSize] = queue[(head + ii) % queueSize];
+		}
+		consume(discard);
+		stats.bytesDropped += discard;
+		stats.drops++;
+	}
+
+	if (queued == 0) {
+		oldestMs = nowMs();
+	}
+
+	const uint8_t *src = (const uint8_t *) data;
+	size_t tail = (head + queued) % queueSize;
+	size_t first = queueSize - tail;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(&queue[tail], src, first);
+	memcpy(queue, &src[first], len - first);
+
+	queued += len;
+	stats.bytesQueued += len;
+	if (queued > stats.maxQueued) {
+		stats.maxQueued = queued;
+	}
+	return true;
+}
+
+int MicTcpSink::loop() {
+	if (queued == 0) {
+		return 0;
+	}
+
+	if (maxLatencyMs == 0 || (nowMs() - oldestMs) >= maxLatencyMs) {
+		// Data has waited long enough, send even a partial write
+		return send(1);
+	}
+	else {
+		// Only send full-size writes
+		return send(maxWriteSize);
+	}
+}
+
+int MicTcpSink::flush() {
+	return send(1);
+}
+
+void MicTcpSink::clear() {
+	head = 0;
+	queued = 0;
+	frameBytesSent = 0;
+}
+
+int MicTcpSink::send(size_t minBytes) {
+	if (!transport) {
+		return 0;
+	}
+
+	while(queued >= minBytes && queued > 0) {
+		// Only the bytes up to the end of the ring are contiguous
+		size_t len = queueSize - head;
+		if (len > queued) {
+			len = queued;
+		}
+		if (len > maxWriteSize) {
+			len = maxWriteSize;
+		}
+
+		int result = transport->write(&queue[head], len);
+		if (result < 0) {
+			return result;
+		}
+		if (result == 0) {
+			stats.wouldBlock++;
+			break;
+		}
+		consume((size_t) result);
+		if (frameSize > 1) {
+			frameBytesSent = (frameBytesSent + (size_t) result) % frameSize;
+		}
+		stats.bytesSent += result;
+		stats.writes++;
+	}
+	return 0;
+}
+
+void MicTcpSink::consume(size_t len) {
+	head = (head + len) % queueSize;
+	queued -= len;
+	if (queued == 0) {
+		head = 0;
+	}
+}
+
+// [static]
+uint32_t MicTcpSink::nowMs() {
+#ifdef PARTICLE
+	return (uint32_t) millis();
+#else
+	return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
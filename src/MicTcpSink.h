@@ -0,0 +1,240 @@
+#ifndef __MicTcpSink_H
+#define __MicTcpSink_H
+
+#ifdef PARTICLE
+#include "Particle.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Abstract interface to a connected byte stream, such as a TCP socket
+ *
+ * MicTcpSink only uses this class, so it does not depend on Particle networking and can be run
+ * on a computer using MicPosixSocketTransport.
+ */
+class MicTransport {
+public:
+	virtual ~MicTransport() {};
+
+	/**
+	 * @brief Write bytes to the stream without blocking
+	 *
+	 * @param buf Bytes to write
+	 *
+	 * @param len Number of bytes to write. This will be at most the maximum write size of the sink.
+	 *
+	 * @return int Number of bytes written, which can be less than len. 0 if the stream cannot accept
+	 * any more data right now. A negative value is an error and the connection should be closed.
+	 */
+	virtual int write(const uint8_t *buf, size_t len) = 0;
+};
+
+#ifdef PARTICLE
+/**
+ * @brief Transport using a Particle TCPClient
+ *
+ * The TCPClient must already be connected. Writes use a timeout of 0 so they never block.
+ */
+class MicTcpClientTransport : public MicTransport {
+public:
+	explicit MicTcpClientTransport(TCPClient &client) : client(client) {};
+
+	virtual int write(const uint8_t *buf, size_t len);
+
+protected:
+	TCPClient &client; //!< Connected TCPClient, not owned by this object
+};
+#else
+/**
+ * @brief Transport using a connected POSIX socket, for running MicTcpSink on a computer
+ *
+ * The socket is switched to non-blocking mode. It's not closed by this object.
+ */
+class MicPosixSocketTransport : public MicTransport {
+public:
+	explicit MicPosixSocketTransport(int fd);
+
+	virtual int write(const uint8_t *buf, size_t len);
+
+protected:
+	int fd; //!< Connected socket file descriptor
+};
+#endif
+
+
+/**
+ * @brief Queues audio and sends it over a stream transport without blocking
+ *
+ * Calling TCPClient::write() with each DMA buffer stalls the capture loop whenever the socket buffer
+ * fills, and the DMA buffers overflow. This class instead copies each buffer into an outbound queue
+ * with write(), which never blocks. loop() sends the queue in writes of up to maxWriteSize bytes (the
+ * TCP MSS by default), waiting until that much is queued or the oldest data is maxLatencyMs old, so
+ * there are fewer, larger segments.
+ *
+ * When the network can't keep up, the queue fills. Check isCongested() or getQueuedBytes() to slow
+ * down or pause capture. If the queue does fill, the drop policy chooses whether the new data or the
+ * oldest queued data is discarded; either way the stream stays aligned to whole sample frames.
+ *
+ * This class is not thread-safe. Call write() and loop() from the same thread.
+ */
+class MicTcpSink {
+public:
+	/**
+	 * @brief What to discard when write() is called and the queue does not have room
+	 */
+	enum class DropPolicy {
+		DROP_NEWEST,	//!< Discard the data passed to write() (default)
+		DROP_OLDEST,	//!< Discard the oldest queued data that has not been sent yet to make room
+	};
+
+	/**
+	 * @brief Counters returned by getStats()
+	 */
+	struct Stats {
+		uint32_t bytesQueued;	//!< Bytes accepted by write()
+		uint32_t bytesSent;		//!< Bytes accepted by the transport
+		uint32_t bytesDropped;	//!< Bytes discarded by the drop policy
+		uint32_t drops;			//!< Number of times data was discarded
+		uint32_t writes;		//!< Number of transport writes that sent data
+		uint32_t wouldBlock;	//!< Number of transport writes that could not send anything
+		uint32_t maxQueued;		//!< Largest number of bytes in the queue at once
+	};
+
+	MicTcpSink();
+	virtual ~MicTcpSink();
+
+	/**
+	 * @brief Set the transport to send to. Must be called before loop().
+	 */
+	MicTcpSink &withTransport(MicTransport *transport) { this->transport = transport; return *this; };
+
+	/**
+	 * @brief Size of the outbound queue in bytes (default: 8192)
+	 *
+	 * At 16000 Hz with 16-bit samples, 8192 bytes is 256 milliseconds of audio. The queue is allocated
+	 * on the heap the first time write() is called, so set this before then.
+	 */
+	MicTcpSink &withQueueSize(size_t queueSize) { this->queueSize = queueSize; return *this; };
+
+	/**
+	 * @brief Largest single transport write in bytes (default: 1460, the TCP MSS for Ethernet-sized packets)
+	 */
+	MicTcpSink &withMaxWriteSize(size_t maxWriteSize) { this->maxWriteSize = maxWriteSize; return *this; };
+
+	/**
+	 * @brief Send a partial write once the oldest queued data is this old (default: 50 milliseconds)
+	 *
+	 * Set to 0 to send whatever is queued on every loop().
+	 */
+	MicTcpSink &withMaxLatencyMs(uint32_t maxLatencyMs) { this->maxLatencyMs = maxLatencyMs; return *this; };
+
+	/**
+	 * @brief What to discard when the queue is full (default: DROP_NEWEST)
+	 */
+	MicTcpSink &withDropPolicy(DropPolicy dropPolicy) { this->dropPolicy = dropPolicy; return *this; };
+
+	/**
+	 * @brief Bytes per sample frame (default: 2). Data is only discarded in multiples of this.
+	 *
+	 * Use 1 for 8-bit mono, 2 for 16-bit mono, and 4 for 16-bit stereo.
+	 */
+	MicTcpSink &withFrameSize(size_t frameSize) { this->frameSize = frameSize; return *this; };
+
+	/**
+	 * @brief Queue depth in percent at which isCongested() returns true (default: 75)
+	 */
+	MicTcpSink &withHighWaterPercent(uint8_t highWaterPercent) { this->highWaterPercent = highWaterPercent; return *this; };
+
+	/**
+	 * @brief Add data to the outbound queue. Never blocks.
+	 *
+	 * @param data Bytes to send, typically a DMA buffer of samples
+	 *
+	 * @param len Number of bytes. Should be a multiple of the frame size.
+	 *
+	 * @return true All of the data was queued
+	 * @return false The data was discarded because the queue was full (DROP_NEWEST), or the queue could
+	 * not be allocated. With DROP_OLDEST, this returns true and older data is discarded instead.
+	 */
+	bool write(const void *data, size_t len);
+
+	/**
+	 * @brief Send queued data. Call this often, typically from loop().
+	 *
+	 * @return int 0 on success or a negative error code from the transport. After an error, close the
+	 * connection and call clear() before using a new one.
+	 */
+	int loop();
+
+	/**
+	 * @brief Send everything in the queue that the transport will accept now, without waiting for a full write
+	 *
+	 * @return int 0 on success or a negative error code from the transport
+	 */
+	int flush();
+
+	/**
+	 * @brief Discard everything in the queue
+	 */
+	void clear();
+
+	/**
+	 * @brief Number of bytes waiting to be sent
+	 */
+	size_t getQueuedBytes() const { return queued; };
+
+	/**
+	 * @brief Number of bytes that can be passed to write() without discarding data
+	 */
+	size_t getFreeBytes() const { return queueSize - queued; };
+
+	/**
+	 * @brief Returns true if the queue is above the high water mark and capture should slow down
+	 */
+	bool isCongested() const { return queued * 100 >= queueSize * highWaterPercent; };
+
+	/**
+	 * @brief Get the counters
+	 */
+	Stats getStats() const { return stats; };
+
+	/**
+	 * @brief Clear the counters
+	 */
+	void resetStats() { stats = {}; };
+
+protected:
+	/**
+	 * @brief Does transport writes until the queue has less than minBytes or the transport is full
+	 */
+	int send(size_t minBytes);
+
+	/**
+	 * @brief Removes len bytes from the front of the queue
+	 */
+	void consume(size_t len);
+
+	/**
+	 * @brief Milliseconds clock used for maxLatencyMs
+	 */
+	static uint32_t nowMs();
+
+	MicTransport *transport = NULL;				//!< Where to send data. Not owned by this object.
+	size_t queueSize = 8192;					//!< Size of queue in bytes
+	size_t maxWriteSize = 1460;					//!< Largest single transport write
+	uint32_t maxLatencyMs = 50;					//!< Longest time to hold a partial write
+	DropPolicy dropPolicy = DropPolicy::DROP_NEWEST; //!< What to discard when the queue is full
+	size_t frameSize = 2;						//!< Bytes per sample frame
+	uint8_t highWaterPercent = 75;				//!< isCongested() threshold
+
+	uint8_t *queue = NULL;		//!< Ring buffer of queueSize bytes, allocated by write()
+	size_t head = 0;			//!< Offset in queue of the oldest byte
+	size_t queued = 0;			//!< Number of bytes in queue
+	uint32_t oldestMs = 0;		//!< nowMs() when the oldest byte in queue was written
+	size_t frameBytesSent = 0;	//!< Bytes of the frame at head that the transport has already taken
+	Stats stats = {};			//!< Counters
+};
+
+#endif /* __MicTcpSink_H */
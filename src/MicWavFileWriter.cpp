@@ -0,0 +1,275 @@
+#include "MicWavFileWriter.h"
+
+#include <new>
+#include <string.h>
+
+MicWavFileWriter::MicWavFileWriter() {
+}
+
+MicWavFileWriter::~MicWavFileWriter() {
+	delete[] headerBuffer;
+}
+
+bool MicWavFileWriter::begin(MicFile *file) {
+	this->file = file;
+	dataSize = lastUpdateSize = 0;
+	dataOffset = 0;
+	numMarkers = 0;
+	headerUpdateErrors = 0;
+	seekToEnd = false;
+	firstSampleMicrosSet = false;
+
+	// With data alignment the header can be up to dataAlignment bytes, so it's allocated instead
+	// of being on the stack
+	MicWavHeaderBase sizer(NULL, 0);
+	configureHeader(sizer);
+	size_t headerSize = sizer.getHeaderSize();
+	if (headerSize > headerBufferSize) {
+		delete[] headerBuffer;
+		headerBuffer = new (std::nothrow) uint8_t[headerSize];
+		headerBufferSize = headerBuffer ? headerSize : 0;
+	}
+
+	if (!file || !headerBuffer || !file->seek(0) || !writeHeader()) {
+		this->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool MicWavFileWriter::write(const void *data, size_t len) {
+	if (!file) {
+		return false;
+	}
+
+	// RIFF sizes are 32 bits, so the whole file, including a possible pad byte, must be less than 4 GB
+	// unless it can become RF64
+	if (!rf64 && dataOffset - 8 + dataSize + len + 1 > 0xffffffffULL) {
+		return false;
+	}
+
+	if (seekToEnd) {
+		if (!file->seek(dataOffset + dataSize)) {
+			return false;
+		}
+		seekToEnd = false;
+	}
+
+	if (file->write(data, len) != (int) len) {
+		return false;
+	}
+	dataSize += len;
+
+	// The samples are written even if the header update fails, so it's counted instead of returned
+	if (updateIntervalBytes && dataSize - lastUpdateSize >= updateIntervalBytes && !updateHeader()) {
+		headerUpdateErrors++;
+	}
+	return true;
+}
+
+#ifdef PARTICLE
+bool MicWavFileWriter::write(const Microphone_PDM_Page &page) {
+	size_t bytesPerSample = Microphone_PDM::instance().getSampleSizeInBytes();
+
+	if (!captureStartSet && dataSize == 0) {
+		// timestampUs is when the DMA finished, which is the time of the last sample in the buffer
+		uint32_t frames = page.numSamples / (numChannels ? numChannels : 1);
+		firstSampleMicros = page.timestampUs - (uint32_t)((uint64_t) frames * 1000000 / sampleRate);
+		firstSampleMicrosSet = true;
+	}
+
+	// The clock reference may take a second or so to find, so keep trying with each buffer
+	uint64_t startUs;
+	if (!captureStartSet && firstSampleMicrosSet && MicClock::toUnixTimeUs(firstSampleMicros, startUs)) {
+		withCaptureStartTime((uint32_t)(startUs / 1000000), (uint32_t)(startUs % 1000000));
+	}
+
+	return write(page.pSamples, page.numSamples * bytesPerSample);
+}
+#endif
+
+MicWavFileWriter &MicWavFileWriter::withCaptureStartTime(uint32_t unixTime, uint32_t microseconds) {
+	bextInfo.originationTime = unixTime;
+	captureStartMicroseconds = microseconds;
+	captureStartSet = true;
+	return *this;
+}
+
+bool MicWavFileWriter::updateHeader() {
+	if (!file) {
+		return false;
+	}
+
+	if (!file->seek(0) || !writeHeader() || !file->seek(dataOffset + dataSize)) {
+		seekToEnd = true;
+		return false;
+	}
+	lastUpdateSize = dataSize;
+
+	return file->sync();
+}
+
+bool MicWavFileWriter::finalize() {
+	if (!file) {
+		return false;
+	}
+
+	// The pad byte and markers go after the samples, wherever a failed header update left the position
+	bool result = !seekToEnd || file->seek(dataOffset + dataSize);
+	seekToEnd = false;
+
+	// RIFF chunks must be an even number of bytes, so add a pad byte after odd-sized data.
+	// It's not included in the data chunk size.
+	if (dataSize & 1) {
+		uint8_t pad = 0;
+		result = result && file->write(&pad, 1) == 1;
+	}
+
+	if (numMarkers) {
+		result = result && writeMarkers();
+	}
+
+	result = result && file->seek(0) && writeHeader(getMarkersSize()) && file->sync();
+	file = NULL;
+
+	// The next file gets a new capture start time
+	captureStartSet = false;
+	firstSampleMicrosSet = false;
+	bextInfo.originationTime = 0;
+
+	return result;
+}
+
+bool MicWavFileWriter::addMarker(const char *label) {
+	// Bytes per sample frame, as in the fmt chunk block align
+	uint32_t blockAlign = numChannels * ((bitsPerSample + 7) / 8);
+
+	return addMarker(blockAlign ? (dataSize / blockAlign) : 0, label);
+}
+
+bool MicWavFileWriter::addMarker(uint64_t sampleFrame, const char *label) {
+	if (numMarkers >= MAX_MARKERS || sampleFrame > 0xffffffffULL) {
+		return false;
+	}
+
+	Marker &marker = markers[numMarkers++];
+	marker.sampleFrame = (uint32_t) sampleFrame;
+	marker.label[0] = 0;
+	if (label) {
+		strncpy(marker.label, label, MAX_LABEL_LENGTH);
+		marker.label[MAX_LABEL_LENGTH] = 0;
+	}
+	return true;
+}
+
+uint32_t MicWavFileWriter::getMarkersSize() const {
+	if (numMarkers == 0) {
+		return 0;
+	}
+
+	// cue chunk: header, count, and 24 bytes per cue point
+	uint32_t size = 8 + 4 + 24 * numMarkers;
+
+	// LIST chunk: header, "adtl", and a labl chunk for each marker with a label
+	uint32_t listSize = 0;
+	for(size_t ii = 0; ii < numMarkers; ii++) {
+		size_t len = strlen(markers[ii].label);
+		if (len) {
+			// Chunk header, cue point ID, and the label including the null, padded to even
+			listSize += 8 + 4 + ((len + 2) & ~1);
+		}
+	}
+	if (listSize) {
+		size += 8 + 4 + listSize;
+	}
+	return size;
+}
+
+bool MicWavFileWriter::writeMarkers() {
+	// Scratch buffer for one chunk header or cue point at a time
+	uint8_t buf[24];
+	MicWavHeaderBase scratch(buf, sizeof(buf));
+
+	scratch.setUint32BE(0, MicWavHeaderBase::fourCharStringToValue("cue "));
+	scratch.setUint32LE(4, (uint32_t)(4 + 24 * numMarkers));
+	scratch.setUint32LE(8, (uint32_t) numMarkers);
+	if (file->write(buf, 12) != 12) {
+		return false;
+	}
+
+	for(size_t ii = 0; ii < numMarkers; ii++) {
+		// Cue point IDs start at 1, and the position is in sample frames from the start of the data chunk
+		scratch.setUint32LE(0, (uint32_t)(ii + 1));
+		scratch.setUint32LE(4, markers[ii].sampleFrame);
+		scratch.setUint32BE(8, MicWavHeaderBase::fourCharStringToValue("data"));
+		scratch.setUint32LE(12, 0);
+		scratch.setUint32LE(16, 0);
+		scratch.setUint32LE(20, markers[ii].sampleFrame);
+		if (file->write(buf, 24) != 24) {
+			return false;
+		}
+	}
+
+	uint32_t cueSize = 8 + 4 + 24 * numMarkers;
+	uint32_t totalSize = getMarkersSize();
+	if (totalSize == cueSize) {
+		// No labels
+		return true;
+	}
+
+	scratch.setUint32BE(0, MicWavHeaderBase::fourCharStringToValue("LIST"));
+	scratch.setUint32LE(4, totalSize - cueSize - 8);
+	scratch.setUint32BE(8, MicWavHeaderBase::fourCharStringToValue("adtl"));
+	if (file->write(buf, 12) != 12) {
+		return false;
+	}
+
+	for(size_t ii = 0; ii < numMarkers; ii++) {
+		size_t len = strlen(markers[ii].label);
+		if (!len) {
+			continue;
+		}
+		scratch.setUint32BE(0, MicWavHeaderBase::fourCharStringToValue("labl"));
+		scratch.setUint32LE(4, (uint32_t)(4 + len + 1));
+		scratch.setUint32LE(8, (uint32_t)(ii + 1));
+		if (file->write(buf, 12) != 12) {
+			return false;
+		}
+
+		// The label, null terminator, and a pad byte if needed to make the chunk an even size
+		size_t labelSize = (len + 2) & ~1;
+		if (file->write(markers[ii].label, len + 1) != (int)(len + 1)) {
+			return false;
+		}
+		if (labelSize > len + 1) {
+			uint8_t pad = 0;
+			if (file->write(&pad, 1) != 1) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool MicWavFileWriter::writeHeader(uint32_t trailingChunksSize) {
+	MicWavHeaderBase header(headerBuffer, headerBufferSize);
+
+	// The header is rebuilt each time. Once the data exceeds 4 GB, setDataSize() turns the reserved
+	// JUNK chunk into ds64, so the data offset never changes.
+	bextInfo.timeReference = captureStartSet ? MicWavHeaderBase::calculateTimeReference(bextInfo.originationTime, captureStartMicroseconds, sampleRate) : 0;
+	configureHeader(header);
+	if (!header.writeHeader(numChannels, sampleRate, bitsPerSample) || !header.setDataSize(dataSize, trailingChunksSize)) {
+		return false;
+	}
+	dataOffset = (uint32_t) header.getBufferOffset();
+
+	return file->write(header.getBuffer(), header.getBufferOffset()) == (int) header.getBufferOffset();
+}
+
+void MicWavFileWriter::configureHeader(MicWavHeaderBase &header) const {
+	header.withEncoding(encoding)
+		.withExtensible(extensible, channelMask)
+		.withRF64Reserve(rf64)
+		.withDataAlignment(dataAlignment)
+		.withBext(bext ? &bextInfo : NULL);
+}
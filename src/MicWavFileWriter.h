@@ -0,0 +1,276 @@
+#ifndef __MicWavFileWriter_H
+#define __MicWavFileWriter_H
+
+#include "MicFile.h"
+#include "MicWavHeader.h"
+
+#ifdef PARTICLE
+#include "MicClock.h"
+#include "Microphone_PDM.h"
+#endif
+
+/**
+ * @brief Writes a wav file incrementally, for recordings that don't fit in RAM
+ *
+ * begin() writes a header with a data size of 0, then each write() appends samples to the file.
+ * Every updateIntervalBytes, the RIFF and data sizes in the header are updated and the file is
+ * synced, so if the device resets or loses power, the file is valid up to the last update.
+ * finalize() writes the final sizes.
+ *
+ * By default, space is reserved in the header so a recording that grows beyond 4 GB is converted
+ * to RF64 in place, without rewriting the samples.
+ *
+ * Markers added with addMarker() are kept in a small fixed array and written as cue and LIST/adtl
+ * chunks after the data by finalize(). Most audio editors show them as markers or regions.
+ *
+ * The file is accessed through MicFile, so it works with any file system. MicPosixFile is provided
+ * for testing on a computer.
+ */
+class MicWavFileWriter {
+public:
+	MicWavFileWriter();
+	virtual ~MicWavFileWriter();
+
+	/**
+	 * @brief Set the format of the samples (default: mono, 16000 Hz, 16 bits)
+	 *
+	 * Use Microphone_PDM::instance().getNumChannels(), getSampleRate(), and getBitsPerSample().
+	 */
+	MicWavFileWriter &withFormat(uint8_t numChannels, uint32_t sampleRate, uint8_t bitsPerSample) {
+		this->numChannels = numChannels; this->sampleRate = sampleRate; this->bitsPerSample = bitsPerSample; return *this;
+	};
+
+	/**
+	 * @brief Set the sample encoding (default: PCM). Use FLOAT for 32-bit float samples.
+	 */
+	MicWavFileWriter &withEncoding(MicWavHeaderBase::Encoding encoding) { this->encoding = encoding; return *this; };
+
+	/**
+	 * @brief Write a WAVE_FORMAT_EXTENSIBLE fmt chunk (default: false)
+	 *
+	 * See MicWavHeaderBase::withExtensible(). It's required for more than 2 channels or more than
+	 * 16 bits per sample.
+	 */
+	MicWavFileWriter &withExtensible(bool extensible = true, uint32_t channelMask = 0) { this->extensible = extensible; this->channelMask = channelMask; return *this; };
+
+	/**
+	 * @brief Allow the file to exceed 4 GB by converting it to RF64 (default: true)
+	 *
+	 * This adds a 36-byte JUNK chunk to the header, which all common wav readers ignore. If false,
+	 * the header is the standard 44 bytes and write() fails when the file would exceed 4 GB.
+	 */
+	MicWavFileWriter &withRF64(bool rf64) { this->rf64 = rf64; return *this; };
+
+	/**
+	 * @brief Start the samples at a multiple of dataAlignment bytes in the file (default: 0, no alignment)
+	 *
+	 * Use 512 for SD cards, or the file system block size, so each DMA buffer written is aligned to
+	 * sectors instead of straddling two of them. The header is padded with a JUNK chunk, so the samples
+	 * start at offset 512 (or dataAlignment) instead of 80. The header buffer is allocated in begin().
+	 */
+	MicWavFileWriter &withDataAlignment(size_t dataAlignment) { this->dataAlignment = dataAlignment; return *this; };
+
+	/**
+	 * @brief Add a Broadcast Wave Format bext chunk identifying the recording (default: no bext chunk)
+	 *
+	 * @param description Free text, up to 256 characters, or NULL
+	 *
+	 * @param originator Name of the recorder, up to 32 characters, or NULL
+	 *
+	 * @param originatorReference Unique identifier such as the device ID, up to 32 characters, or NULL
+	 *
+	 * The strings are not copied and must remain valid until finalize(). The origination date, time,
+	 * and time reference (samples since midnight) come from the capture start time, see
+	 * withCaptureStartTime(). They're written with the next header update after it's set.
+	 */
+	MicWavFileWriter &withBext(const char *description, const char *originator, const char *originatorReference) {
+		bext = true; bextInfo.description = description; bextInfo.originator = originator; bextInfo.originatorReference = originatorReference; return *this;
+	};
+
+	/**
+	 * @brief Set the time of the first sample in the file, for the bext chunk
+	 *
+	 * @param unixTime Seconds since 1970 (UTC)
+	 *
+	 * @param microseconds Fraction of a second, 0 - 999999
+	 *
+	 * On Particle devices, write(const Microphone_PDM_Page &page) sets this automatically from the first
+	 * buffer once the time is valid and MicClock can convert the buffer's timestamp. It's cleared by finalize(), so set it again for the next file.
+	 */
+	MicWavFileWriter &withCaptureStartTime(uint32_t unixTime, uint32_t microseconds = 0);
+
+	/**
+	 * @brief How often to update the header while recording, in bytes of samples (default: 65536)
+	 *
+	 * At 16000 Hz with 16-bit samples, 65536 bytes is about 2 seconds of audio. Updating requires
+	 * two seeks and a sync, so very small values reduce the write throughput. 0 disables periodic updates.
+	 */
+	MicWavFileWriter &withUpdateIntervalBytes(uint32_t updateIntervalBytes) { this->updateIntervalBytes = updateIntervalBytes; return *this; };
+
+	/**
+	 * @brief Start a new wav file
+	 *
+	 * @param file An open, empty, writable file. It must remain valid until finalize() is called.
+	 *
+	 * @return true if the header was written
+	 */
+	bool begin(MicFile *file);
+
+	/**
+	 * @brief Append samples to the file
+	 *
+	 * @param data Samples in the format set with withFormat(), typically a DMA buffer
+	 *
+	 * @param len Length in bytes
+	 *
+	 * @return true if the samples were written. False if the file could not be written, or the file
+	 * would exceed 4 GB, the limit of a wav file, and withRF64(false) was used.
+	 *
+	 * The periodic header update does not affect the result, as the samples were still written. If it
+	 * fails, getHeaderUpdateErrors() is incremented and the next write() returns to the end of the file.
+	 */
+	bool write(const void *data, size_t len);
+
+#ifdef PARTICLE
+	/**
+	 * @brief Append a buffer from Microphone_PDM::acquireSamples(), noCopySamplesWithInfo(), or a subscriber
+	 *
+	 * If the capture start time was not set, the time of the first sample is calculated from the first
+	 * buffer's timestamp for the bext chunk, using MicClock. Until MicClock has found its reference,
+	 * about a second after Time.isValid(), each later buffer tries again. The time is accurate to about
+	 * half a buffer period.
+	 */
+	bool write(const Microphone_PDM_Page &page);
+#endif
+
+	/**
+	 * @brief Write the current sizes to the header and sync the file
+	 *
+	 * This is done automatically every updateIntervalBytes, but you can also call it yourself.
+	 */
+	bool updateHeader();
+
+	/**
+	 * @brief Gets the number of periodic header updates from write() that failed since begin()
+	 *
+	 * If this is not 0, the header on the card may be out of date until finalize() or a later update
+	 * succeeds.
+	 */
+	uint32_t getHeaderUpdateErrors() const { return headerUpdateErrors; };
+
+	/**
+	 * @brief Add a marker at the current end of the recording
+	 *
+	 * @param label Optional text for the marker. It's truncated to MAX_LABEL_LENGTH characters.
+	 *
+	 * @return false if MAX_MARKERS markers have already been added
+	 *
+	 * Markers are saved in RAM and written by finalize(), so there's no cost while recording. Call
+	 * this from the same thread as write().
+	 */
+	bool addMarker(const char *label = NULL);
+
+	/**
+	 * @brief Add a marker at a specific position
+	 *
+	 * @param sampleFrame Position in sample frames (samples per channel) from the start of the recording
+	 *
+	 * @param label Optional text for the marker. It's truncated to MAX_LABEL_LENGTH characters.
+	 *
+	 * @return false if MAX_MARKERS markers have already been added, or the position is beyond what
+	 * a cue chunk can hold (32 bits)
+	 */
+	bool addMarker(uint64_t sampleFrame, const char *label);
+
+	/**
+	 * @brief Number of markers added since begin()
+	 */
+	size_t getNumMarkers() const { return numMarkers; };
+
+	/**
+	 * @brief Finish the file, writing any markers. The MicFile can be closed after this.
+	 */
+	bool finalize();
+
+	/**
+	 * @brief Returns true after begin() succeeds and before finalize()
+	 */
+	bool isOpen() const { return file != NULL; };
+
+	/**
+	 * @brief Number of bytes of samples written so far
+	 */
+	uint64_t getDataSize() const { return dataSize; };
+
+	/**
+	 * @brief Offset in the file where the samples start
+	 */
+	uint32_t getDataOffset() const { return dataOffset; };
+
+	/**
+	 * @brief Returns true if the file has been converted to RF64 because it exceeded 4 GB
+	 */
+	bool isRF64() const { return dataOffset - 8 + dataSize + (dataSize & 1) > 0xffffffffULL; };
+
+	static constexpr size_t MAX_MARKERS = 16;		//!< Maximum number of markers per file
+	static constexpr size_t MAX_LABEL_LENGTH = 23;	//!< Maximum length of a marker label, not including the null
+
+protected:
+	/**
+	 * @brief A marker saved by addMarker()
+	 */
+	struct Marker {
+		uint32_t sampleFrame;					//!< Position in sample frames
+		char label[MAX_LABEL_LENGTH + 1];		//!< Label, or an empty string
+	};
+
+	/**
+	 * @brief Writes the header for the current data size at the start of the file
+	 *
+	 * @param trailingChunksSize Size of the chunks after the data, from getMarkersSize() when finalizing
+	 */
+	bool writeHeader(uint32_t trailingChunksSize = 0);
+
+	/**
+	 * @brief Size of the cue and LIST chunks for the markers, including chunk headers
+	 */
+	uint32_t getMarkersSize() const;
+
+	/**
+	 * @brief Write the cue and LIST chunks at the current file position
+	 */
+	bool writeMarkers();
+
+	/**
+	 * @brief Apply the format and options to a header object
+	 */
+	void configureHeader(MicWavHeaderBase &header) const;
+
+	MicFile *file = NULL;				//!< File being written, or NULL if not open
+	uint8_t numChannels = 1;			//!< Number of channels
+	uint32_t sampleRate = 16000;		//!< Samples per second
+	uint8_t bitsPerSample = 16;			//!< Bits per sample, per channel
+	MicWavHeaderBase::Encoding encoding = MicWavHeaderBase::Encoding::PCM; //!< Sample encoding
+	bool extensible = false;			//!< Use WAVE_FORMAT_EXTENSIBLE
+	uint32_t channelMask = 0;			//!< Channel mask for extensible files
+	bool rf64 = true;					//!< Reserve space to convert to RF64
+	size_t dataAlignment = 0;			//!< Alignment of the samples in the file
+	uint8_t *headerBuffer = NULL;		//!< Buffer for building the header
+	size_t headerBufferSize = 0;		//!< Size of headerBuffer in bytes
+	Marker markers[MAX_MARKERS];		//!< Markers to write at finalize
+	bool bext = false;					//!< Write a bext chunk
+	bool captureStartSet = false;		//!< bextInfo has the capture start time
+	uint32_t captureStartMicroseconds = 0; //!< Fraction of a second of the capture start time
+	uint32_t firstSampleMicros = 0;		//!< micros() at the first sample, for the capture start time
+	bool firstSampleMicrosSet = false;	//!< firstSampleMicros has been set since begin()
+	MicWavBextInfo bextInfo;			//!< Values for the bext chunk
+	size_t numMarkers = 0;				//!< Number of entries in markers
+	uint32_t updateIntervalBytes = 65536; //!< How often to update the header
+	uint32_t dataOffset = 0;			//!< Size of the header
+	uint64_t dataSize = 0;				//!< Bytes of samples written
+	uint64_t lastUpdateSize = 0;		//!< dataSize when the header was last written
+	uint32_t headerUpdateErrors = 0;	//!< Periodic header updates that failed
+	bool seekToEnd = false;				//!< A failed header update may have left the file position before the end
+};
+
+#endif /* __MicWavFileWriter_H */
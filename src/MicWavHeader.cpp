@@ -0,0 +1,509 @@
+#include "MicWavHeader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+// Define the debug logging level here
+// 0 = Off
+// 1 = Normal
+// 2 = High
+#define WAV_LOGHANDLER_DEBUG_LEVEL 1
+
+// Don't change these, just change the debugging level above
+// Note: must use Serial.printlnf here, not Log.info, as these are called from the log handler itself!
+#if WAV_LOGHANDLER_DEBUG_LEVEL >= 1 && defined(PARTICLE)
+#define DEBUG_NORMAL(x) Log.info x
+#else
+#define DEBUG_NORMAL(x)
+#endif
+
+#if WAV_LOGHANDLER_DEBUG_LEVEL >= 2 && defined(PARTICLE)
+#define DEBUG_HIGH(x) Log.info x
+#else
+#define DEBUG_HIGH(x)
+#endif
+
+MicWavHeaderBase::MicWavHeaderBase(uint8_t *buffer, size_t bufferSize) : buffer(buffer), bufferSize(bufferSize) {
+
+}
+MicWavHeaderBase::~MicWavHeaderBase() {
+
+}
+
+size_t MicWavHeaderBase::getHeaderSize() const {
+	// fmt chunk data is 16 bytes for PCM, 18 for other formats (adds cbSize), 40 for extensible
+	size_t fmtSize = extensible ? 40 : ((encoding == Encoding::PCM) ? 16 : 18);
+	size_t headerSize = 12 + (rf64Reserve ? (8 + DS64_SIZE) : 0) + (bextInfo ? (8 + BEXT_SIZE) : 0) + 8 + fmtSize + 8;
+
+	if (dataAlignment && (headerSize % dataAlignment) != 0) {
+		// The padding is a chunk, so it's at least 8 bytes
+		headerSize = (headerSize + 8 + dataAlignment - 1) / dataAlignment * dataAlignment;
+	}
+	return headerSize;
+}
+
+bool MicWavHeaderBase::writeHeader(uint8_t numChannels, uint32_t sampleRate, uint8_t bitsPerSample, uint32_t dataSizeInBytes) {
+	size_t fmtSize = extensible ? 40 : ((encoding == Encoding::PCM) ? 16 : 18);
+	size_t headerSize = getHeaderSize();
+
+	if (bufferSize < headerSize) {
+		DEBUG_NORMAL(("buffer too small, was %d need %d", bufferSize, headerSize));
+		return false;
+	}
+
+	// Extensible files store samples in whole bytes, and bitsPerSample is the number of valid bits
+	uint16_t containerBits = extensible ? (uint16_t)((bitsPerSample + 7) / 8 * 8) : bitsPerSample;
+	uint16_t blockAlign = (uint16_t)(numChannels * containerBits / 8);
+
+	// Chunk ID (4 bytes)
+	// Technically using 'riff' would work, but it generates a compiler warning
+	setUint32BE(0, fourCharStringToValue("RIFF"));
+
+	// ChunkSize is set by setDataSize below (4 bytes)
+
+	// Format (4 bytes)
+	setUint32BE(8, fourCharStringToValue("WAVE"));
+
+	size_t offset = 12;
+	if (rf64Reserve) {
+		// Placeholder that setDataSize turns into a ds64 chunk if the file exceeds 4 GB
+		setUint32BE(offset, fourCharStringToValue("JUNK"));
+		setUint32LE(offset + 4, DS64_SIZE);
+		memset(&buffer[offset + 8], 0, DS64_SIZE);
+		offset += 8 + DS64_SIZE;
+	}
+
+	if (bextInfo) {
+		setUint32BE(offset, fourCharStringToValue("bext"));
+		setUint32LE(offset + 4, BEXT_SIZE);
+		writeBext(offset + 8);
+		offset += 8 + BEXT_SIZE;
+	}
+
+	// Subchunk 1 ID and size (8 bytes)
+	setUint32BE(offset, fourCharStringToValue("fmt "));
+	setUint32LE(offset + 4, (uint32_t) fmtSize);
+	offset += 8;
+
+	// Audio format PCM = 1, float = 3, extensible = 0xfffe (2 bytes)
+	setUint16LE(offset, extensible ? 0xfffe : (uint16_t) encoding);
+
+	// Num channels (2 bytes)
+	setUint16LE(offset + 2, numChannels);
+
+	// Sample rate (4 bytes)
+	setUint32LE(offset + 4, sampleRate);
+
+	// Byte rate (4 bytes)
+	setUint32LE(offset + 8, sampleRate * blockAlign);
+
+	// Block align (2 bytes)
+	setUint16LE(offset + 12, blockAlign);
+
+	// Bits per sample, per channel (2 bytes)
+	setUint16LE(offset + 14, containerBits);
+
+	if (fmtSize >= 18) {
+		// cbSize, the size of the extension (2 bytes)
+		setUint16LE(offset + 16, extensible ? 22 : 0);
+	}
+	if (extensible) {
+		// Valid bits per sample (2 bytes)
+		setUint16LE(offset + 18, bitsPerSample);
+
+		// Channel mask (4 bytes)
+		uint32_t mask = channelMask;
+		if (mask == 0) {
+			mask = (numChannels == 1) ? 0x4 : ((numChannels == 2) ? 0x3 : 0);
+		}
+		setUint32LE(offset + 20, mask);
+
+		// SubFormat GUID: the format tag followed by the standard suffix (16 bytes)
+		static const uint8_t guidSuffix[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+		setUint16LE(offset + 24, (uint16_t) encoding);
+		memcpy(&buffer[offset + 26], guidSuffix, sizeof(guidSuffix));
+	}
+	offset += fmtSize;
+
+	if (offset + 8 < headerSize) {
+		// JUNK chunk so the data starts at a multiple of dataAlignment
+		size_t padSize = headerSize - offset - 16;
+		setUint32BE(offset, fourCharStringToValue("JUNK"));
+		setUint32LE(offset + 4, (uint32_t) padSize);
+		memset(&buffer[offset + 8], 0, padSize);
+		offset += 8 + padSize;
+	}
+
+	// Subchunk 2 ID (4 bytes)
+	setUint32BE(offset, fourCharStringToValue("data"));
+
+	// data size (numSamples * numChannels * bitsPerSample / 8) is set by setDataSize below (4 bytes)
+	offset += 8;
+
+	// End of header is offset 44 for the standard header
+	bufferOffset = offset;
+
+	return setDataSize(dataSizeInBytes);
+}
+
+
+bool MicWavHeaderBase::setDataSize(uint64_t dataSizeInBytes, uint32_t trailingChunksSize) {
+	// DEBUG_HIGH(("setDataSize %lu", dataSizeInBytes));
+
+	size_t dataOffset;
+	uint32_t dataChunkSize;
+	if (!findChunk(fourCharStringToValue("data"), dataOffset, dataChunkSize)) {
+		return false;
+	}
+
+	// The RIFF size is everything after the first 8 bytes, including the pad byte after odd-sized data
+	uint64_t riffSize = (dataOffset - 8) + dataSizeInBytes + (dataSizeInBytes & 1) + trailingChunksSize;
+
+	if (riffSize > 0xffffffffULL && !isRF64()) {
+		// Convert to RF64 in place using the reserved JUNK chunk
+		size_t junkOffset;
+		uint32_t junkSize;
+		// ds64 must be the first chunk, so this can't use the JUNK chunk used for data alignment
+		if (!findChunk(fourCharStringToValue("JUNK"), junkOffset, junkSize) || junkOffset != 20 || junkSize < DS64_SIZE) {
+			DEBUG_NORMAL(("data too large for RIFF and no ds64 reserve"));
+			return false;
+		}
+		setUint32BE(0, fourCharStringToValue("RF64"));
+		setUint32BE(junkOffset - 8, fourCharStringToValue("ds64"));
+	}
+
+	if (isRF64()) {
+		size_t ds64Offset;
+		uint32_t ds64Size;
+		if (!findChunk(fourCharStringToValue("ds64"), ds64Offset, ds64Size) || ds64Size < DS64_SIZE) {
+			return false;
+		}
+		uint16_t blockAlign = getBlockAlign();
+
+		setUint64LE(ds64Offset, riffSize);
+		setUint64LE(ds64Offset + 8, dataSizeInBytes);
+		setUint64LE(ds64Offset + 16, blockAlign ? (dataSizeInBytes / blockAlign) : 0);
+		setUint32LE(ds64Offset + 24, 0); // No table of other chunk sizes
+
+		// The 32-bit sizes are -1 to indicate that the ds64 values are used
+		setUint32LE(4, 0xffffffff);
+		setUint32LE(dataOffset - 4, 0xffffffff);
+	}
+	else {
+		setUint32LE(4, (uint32_t) riffSize);
+		setUint32LE(dataOffset - 4, (uint32_t) dataSizeInBytes);
+	}
+	return true;
+}
+
+void MicWavHeaderBase::writeBext(size_t offset) {
+	memset(&buffer[offset], 0, BEXT_SIZE);
+
+	// Description (256), Originator (32), OriginatorReference (32)
+	setString(offset, 256, bextInfo->description);
+	setString(offset + 256, 32, bextInfo->originator);
+	setString(offset + 288, 32, bextInfo->originatorReference);
+
+	// OriginationDate "yyyy-mm-dd" (10) and OriginationTime "hh:mm:ss" (8), left empty if unknown
+	if (bextInfo->originationTime) {
+		uint32_t days = bextInfo->originationTime / 86400;
+		uint32_t secs = bextInfo->originationTime % 86400;
+
+		// Convert days since 1970-01-01 to a date (proleptic Gregorian calendar)
+		uint32_t z = days + 719468;
+		uint32_t era = z / 146097;
+		uint32_t doe = z - era * 146097;
+		uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		uint32_t mp = (5 * doy + 2) / 153;
+		uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+		uint32_t month = (mp < 10) ? (mp + 3) : (mp - 9);
+		uint32_t year = yoe + era * 400 + ((month <= 2) ? 1 : 0);
+
+		char buf[40];
+		snprintf(buf, sizeof(buf), "%04u-%02u-%02u%02u:%02u:%02u", (unsigned) year, (unsigned) month, (unsigned) day,
+			(unsigned)(secs / 3600), (unsigned)((secs / 60) % 60), (unsigned)(secs % 60));
+		memcpy(&buffer[offset + 320], buf, 18);
+	}
+
+	// TimeReference, samples since midnight (8)
+	setUint64LE(offset + 338, bextInfo->timeReference);
+
+	// Version (2). Version 1 has a UMID (64 at 348), which is left as zeros. The loudness fields
+	// of version 2 (10 at 412) and the reserved bytes (180 at 422) are zero.
+	setUint16LE(offset + 346, 1);
+}
+
+void MicWavHeaderBase::setString(size_t offset, size_t fieldSize, const char *str) {
+	// The field is not null terminated if the string fills it
+	if (str) {
+		size_t len = strlen(str);
+		memcpy(&buffer[offset], str, (len < fieldSize) ? len : fieldSize);
+	}
+}
+
+// [static]
+uint64_t MicWavHeaderBase::calculateTimeReference(uint32_t unixTime, uint32_t microseconds, uint32_t sampleRate) {
+	return (uint64_t)(unixTime % 86400) * sampleRate + (uint64_t) microseconds * sampleRate / 1000000;
+}
+
+uint64_t MicWavHeaderBase::getDataSize() const {
+	size_t chunkDataOffset;
+	uint32_t chunkDataSize;
+
+	if (isRF64() && findChunk(fourCharStringToValue("ds64"), chunkDataOffset, chunkDataSize) && chunkDataSize >= DS64_SIZE) {
+		return getUint64LE(chunkDataOffset + 8);
+	}
+	if (findChunk(fourCharStringToValue("data"), chunkDataOffset, chunkDataSize)) {
+		return chunkDataSize;
+	}
+	return 0;
+}
+
+bool MicWavHeaderBase::isExtensible() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	return fmtOffset && fmtSize >= 40 && getUint16LE(fmtOffset) == 0xfffe;
+}
+
+uint16_t MicWavHeaderBase::getFormatTag() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	if (!fmtOffset) {
+		return 0;
+	}
+	if (isExtensible()) {
+		// The first two bytes of the SubFormat GUID
+		return getUint16LE(fmtOffset + 24);
+	}
+	return getUint16LE(fmtOffset);
+}
+
+uint16_t MicWavHeaderBase::getNumChannels() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	return fmtOffset ? getUint16LE(fmtOffset + 2) : 0;
+}
+
+uint32_t MicWavHeaderBase::getSampleRate() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	return fmtOffset ? getUint32LE(fmtOffset + 4) : 0;
+}
+
+uint16_t MicWavHeaderBase::getBitsPerSample() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	if (!fmtOffset) {
+		return 0;
+	}
+	if (isExtensible() && getUint16LE(fmtOffset + 18) != 0) {
+		// Valid bits per sample
+		return getUint16LE(fmtOffset + 18);
+	}
+	return getUint16LE(fmtOffset + 14);
+}
+
+uint16_t MicWavHeaderBase::getBlockAlign() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	return fmtOffset ? getUint16LE(fmtOffset + 12) : 0;
+}
+
+uint32_t MicWavHeaderBase::getChannelMask() const {
+	uint32_t fmtSize;
+	size_t fmtOffset = findFmtChunk(fmtSize);
+
+	return isExtensible() ? getUint32LE(fmtOffset + 20) : 0;
+}
+
+size_t MicWavHeaderBase::findFmtChunk(uint32_t &fmtSize) const {
+	size_t fmtOffset;
+
+	// The fmt chunk must be at least 16 bytes and entirely within the buffer
+	if (!findChunk(fourCharStringToValue("fmt "), fmtOffset, fmtSize) || fmtSize < 16 || fmtOffset + fmtSize > bufferOffset) {
+		return 0;
+	}
+	return fmtOffset;
+}
+
+uint32_t MicWavHeaderBase::getDataOffset() const {
+	size_t chunkDataOffset;
+	uint32_t chunkDataSize;
+
+	if (findChunk(fourCharStringToValue("data"), chunkDataOffset, chunkDataSize)) {
+		return chunkDataOffset;
+	}
+	else {
+		// Not found
+		return 0;
+	}
+}
+
+bool MicWavHeaderBase::findChunk(uint32_t id, size_t &chunkDataOffset, uint32_t &chunkDataSize) const {
+	// 12 is start of subchunk 1 for all RIFF WAVE files
+	size_t offset = 12;
+
+	while(offset + 8 <= bufferOffset) {
+		uint32_t subChunkSize = getUint32LE(offset + 4);
+
+		uint32_t foundId = getUint32BE(offset);
+		if (foundId == id) {
+			// Found it! Return the offset of the actual data in the chunk
+			chunkDataOffset = offset + 8;
+			chunkDataSize = subChunkSize;
+			return true;
+		}
+
+		// Chunks with an odd size are followed by a pad byte that's not included in the size
+		uint64_t nextOffset = (uint64_t) offset + 8 + subChunkSize + (subChunkSize & 1);
+
+		// Stop at a chunk that extends past the buffer, such as data, which may have a size of
+		// 0xffffffff in RF64 files
+		if (nextOffset >= bufferOffset) {
+			break;
+		}
+		offset = (size_t) nextOffset;
+	}
+	return false;
+}
+
+// The LE and BE functions assume current Particle ARM Cortex processors that are little
+// endian. This could probably be made more portable.
+
+void MicWavHeaderBase::setUint16LE(size_t offset, uint16_t value) {
+	// Currently all of the fields in a wav file appear to be aligned, but using
+	// memcpy is safer and makes sure we won't get an unaligned exception in these functions
+	memcpy(&buffer[offset], &value, 2);
+}
+
+uint16_t MicWavHeaderBase::getUint16LE(size_t offset) const {
+	uint16_t result;
+	memcpy(&result, &buffer[offset], 2);
+	return result;
+}
+
+void MicWavHeaderBase::setUint32LE(size_t offset, uint32_t value) {
+	memcpy(&buffer[offset], &value, 4);
+}
+
+uint32_t MicWavHeaderBase::getUint32LE(size_t offset) const {
+	uint32_t result;
+	memcpy(&result, &buffer[offset], 4);
+	return result;
+}
+
+void MicWavHeaderBase::setUint64LE(size_t offset, uint64_t value) {
+	memcpy(&buffer[offset], &value, 8);
+}
+
+uint64_t MicWavHeaderBase::getUint64LE(size_t offset) const {
+	uint64_t result;
+	memcpy(&result, &buffer[offset], 8);
+	return result;
+}
+
+// [static]
+uint32_t MicWavHeaderBase::fourCharStringToValue(const char *str)  {
+	uint32_t value = 0;
+
+	value |= ((uint32_t)str[0]) << 24;
+	value |= ((uint32_t)str[1]) << 16;
+	value |= ((uint32_t)str[2]) << 8;
+	value |= ((uint32_t)str[3]);
+
+	return value;
+}
+
+void MicWavHeaderBase::setUint32BE(size_t offset, uint32_t value) {
+	buffer[offset]     = (uint8_t) (value >> 24);
+	buffer[offset + 1] = (uint8_t) (value >> 16);
+	buffer[offset + 2] = (uint8_t) (value >> 8);
+	buffer[offset + 3] = (uint8_t) value;
+}
+
+uint32_t MicWavHeaderBase::getUint32BE(size_t offset) const {
+	uint32_t value = 0;
+
+	value |= ((uint32_t)buffer[offset]) << 24;
+	value |= ((uint32_t)buffer[offset + 1]) << 16;
+	value |= ((uint32_t)buffer[offset + 2]) << 8;
+	value |= ((uint32_t)buffer[offset + 3]);
+
+	return value;
+}
+
+/*
+From: http://soundfile.sapp.org/doc/WaveFormat/
+
+0         4   ChunkID          Contains the letters "RIFF" in ASCII form
+                               (0x52494646 big-endian form).
+4         4   ChunkSize        36 + SubChunk2Size, or more precisely:
+                               4 + (8 + SubChunk1Size) + (8 + SubChunk2Size)
+                               This is the size of the rest of the chunk
+                               following this number.  This is the size of the
+                               entire file in bytes minus 8 bytes for the
+                               two fields not included in this count:
+                               ChunkID and ChunkSize.
+8         4   Format           Contains the letters "WAVE"
+                               (0x57415645 big-endian form).
+
+                               The "WAVE" format consists of two subchunks: "fmt " and "data":
+The "fmt " subchunk describes the sound data's format:
+
+12        4   Subchunk1ID      Contains the letters "fmt "
+                               (0x666d7420 big-endian form).
+16        4   Subchunk1Size    16 for PCM.  This is the size of the
+                               rest of the Subchunk which follows this number.
+20        2   AudioFormat      PCM = 1 (i.e. Linear quantization)
+                               Values other than 1 indicate some
+                               form of compression.
+22        2   NumChannels      Mono = 1, Stereo = 2, etc.
+24        4   SampleRate       8000, 44100, etc.
+28        4   ByteRate         == SampleRate * NumChannels * BitsPerSample/8
+32        2   BlockAlign       == NumChannels * BitsPerSample/8
+                               The number of bytes for one sample including
+                               all channels. I wonder what happens when
+                               this number isn't an integer?
+34        2   BitsPerSample    8 bits = 8, 16 bits = 16, etc.
+          2   ExtraParamSize   if PCM, then doesn't exist
+          X   ExtraParams      space for extra parameters
+
+The "data" subchunk contains the size of the data and the actual sound:
+
+36        4   Subchunk2ID      Contains the letters "data"
+                               (0x64617461 big-endian form).
+40        4   Subchunk2Size    == NumSamples * NumChannels * BitsPerSample/8
+                               This is the number of bytes in the data.
+                               You can also think of this as the size
+                               of the read of the subchunk following this
+                               number.
+44        *   Data             The actual sound data.
+
+RF64 (EBU Tech 3306) files are the same, except that the ChunkID is "RF64", and the ChunkSize and
+Subchunk2Size are 0xffffffff. The real sizes are in a "ds64" chunk, which must be the first chunk after
+"WAVE". To allow converting a file in place, writeHeader reserves space with a "JUNK" chunk of the
+same size, which readers ignore:
+
+12        4   "JUNK" or "ds64"
+16        4   28
+20        8   RIFF size (64-bit)
+28        8   data size (64-bit)
+36        8   Sample count (64-bit)
+44        4   Table length, number of following 64-bit sizes for other chunks (always 0 here)
+
+WAVE_FORMAT_EXTENSIBLE fmt chunks have an AudioFormat of 0xfffe, Subchunk1Size 40, and after BitsPerSample:
+
+          2   cbSize           22
+          2   ValidBitsPerSample
+          4   ChannelMask      Speaker positions, 0x4 = front center, 0x3 = front left and right
+          16  SubFormat        GUID, the first 2 bytes are the format (1 = PCM, 3 = float) followed by
+                               00 00 00 00 10 00 80 00 00 aa 00 38 9b 71
+*/
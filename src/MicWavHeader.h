@@ -0,0 +1,308 @@
+#ifndef __MicWavHeader_H
+#define __MicWavHeader_H
+
+#ifdef PARTICLE
+#include "Particle.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Information for a Broadcast Wave Format (EBU Tech 3285) bext chunk
+ *
+ * The strings are not copied and must remain valid while the header is being written. Longer
+ * strings are truncated to the size of the field.
+ */
+struct MicWavBextInfo {
+	const char *description = NULL;			//!< Free text, up to 256 characters
+	const char *originator = NULL;			//!< Name of the recorder, up to 32 characters
+	const char *originatorReference = NULL;	//!< Unique identifier such as the device ID, up to 32 characters
+	uint32_t originationTime = 0;			//!< Time of the first sample, Unix time (seconds since 1970, UTC). 0 if unknown.
+	uint64_t timeReference = 0;				//!< Time of the first sample, in samples since midnight UTC
+};
+
+/**
+ * @brief Class for manipulating wav file headers
+ *
+ * By default, writeHeader() writes the standard 44-byte PCM header. It can optionally write a
+ * WAVE_FORMAT_EXTENSIBLE fmt chunk (for more than 2 channels, more than 16 bits, or float samples)
+ * and reserve space for an RF64 ds64 chunk, so the file can be converted to RF64 in place if it
+ * grows beyond 4 GB.
+ */
+class MicWavHeaderBase {
+public:
+	/**
+	 * @brief Sample encoding, the wav format tag
+	 */
+	enum class Encoding : uint16_t {
+		PCM = 1,		//!< Integer samples (default)
+		FLOAT = 3,		//!< IEEE float samples (bitsPerSample 32 or 64)
+	};
+
+	MicWavHeaderBase(uint8_t *buffer, size_t bufferSize);
+	virtual ~MicWavHeaderBase();
+
+	/**
+	 * @brief Set the sample encoding for writeHeader() (default: PCM)
+	 */
+	MicWavHeaderBase &withEncoding(Encoding encoding) { this->encoding = encoding; return *this; };
+
+	/**
+	 * @brief Write a WAVE_FORMAT_EXTENSIBLE fmt chunk (default: false)
+	 *
+	 * @param extensible true to use the extensible format. It's required for more than 2 channels or
+	 * more than 16 bits per sample.
+	 *
+	 * @param channelMask Speaker positions (dwChannelMask). 0 uses front center for mono, front left
+	 * and right for stereo, and no assignment for more channels.
+	 */
+	MicWavHeaderBase &withExtensible(bool extensible = true, uint32_t channelMask = 0) { this->extensible = extensible; this->channelMask = channelMask; return *this; };
+
+	/**
+	 * @brief Reserve space for an RF64 ds64 chunk (default: false)
+	 *
+	 * This adds a 36-byte JUNK chunk after the RIFF header. If setDataSize() is later called with a
+	 * size that does not fit in a RIFF file, the JUNK chunk is replaced by a ds64 chunk and the file
+	 * becomes RF64 (EBU Tech 3306), without moving the data.
+	 */
+	MicWavHeaderBase &withRF64Reserve(bool rf64Reserve = true) { this->rf64Reserve = rf64Reserve; return *this; };
+
+	/**
+	 * @brief Align the start of the samples to a multiple of dataAlignment bytes (default: 0, no alignment)
+	 *
+	 * With the standard 44-byte header, every 512-byte buffer of samples written to an SD card or
+	 * flash file system straddles two sectors. Setting this to the sector size (512) or the file system
+	 * block size (4096) adds a JUNK chunk before the data chunk so getDataOffset() is a multiple of
+	 * dataAlignment. The buffer must be at least getHeaderSize() bytes. Must be even.
+	 */
+	MicWavHeaderBase &withDataAlignment(size_t dataAlignment) { this->dataAlignment = dataAlignment & ~(size_t)1; return *this; };
+
+	/**
+	 * @brief Add a bext chunk, as in Broadcast Wave Format files (default: NULL, no bext chunk)
+	 *
+	 * @param bextInfo The values for the chunk. Not copied, so it must remain valid while writeHeader()
+	 * is called. This adds 610 bytes to the header.
+	 */
+	MicWavHeaderBase &withBext(const MicWavBextInfo *bextInfo) { this->bextInfo = bextInfo; return *this; };
+
+	/**
+	 * @brief Calculate the bext time reference, the number of samples since midnight
+	 *
+	 * @param unixTime Time of the first sample, seconds since 1970 (UTC)
+	 *
+	 * @param microseconds Fraction of a second to add to unixTime, 0 - 999999
+	 *
+	 * @param sampleRate Samples per second
+	 */
+	static uint64_t calculateTimeReference(uint32_t unixTime, uint32_t microseconds, uint32_t sampleRate);
+
+	/**
+	 * @brief Gets the size of the header writeHeader() will write with the current options
+	 */
+	size_t getHeaderSize() const;
+
+	/**
+	 * @brief Writes the wav file header to the start of buffer and updates bufferOffset
+	 *
+	 * @param numChannels number of channels, typically 1 or 2
+	 *
+	 * @param sampleRate sampling rate per channel in samples per second. For example: 16000 is 16 kHz sampling rate.
+	 *
+	 * @param bitsPerSample the number of bits per sample per channel. Typically 8 or 16.
+	 *
+	 * @param dataSizeInBytes the size of the data (optional). If you don't pass this parameter or pass 0 you
+	 * must call setDataSize later, as wav files must include the chunk length and the file length in the header.
+	 * There is no facility for files bounded by the length of the file or stream.
+	 */
+	bool writeHeader(uint8_t numChannels, uint32_t sampleRate, uint8_t bitsPerSample, uint32_t dataSizeInBytes = 0);
+
+	/**
+	 * @brief Update the size of the data chunk (in bytes).
+	 *
+	 * @param dataSizeInBytes This is the size of the data (part of the file after getDataOffset()), which is
+	 * typically 44 bytes less than the file size for files we create. If it's odd, the RIFF size includes
+	 * the pad byte that must follow the data.
+	 *
+	 * @param trailingChunksSize Total size of any chunks written after the data chunk, such as cue and
+	 * LIST, including their chunk headers. This is added to the RIFF size.
+	 *
+	 * This modifies the file chunk header and the data subchunk size. If the file is too large for
+	 * RIFF and space was reserved with withRF64Reserve(), the header is converted to RF64.
+	 *
+	 * @return false if the header has no data chunk, or the size is too large and there is no space
+	 * reserved for a ds64 chunk
+	 */
+	bool setDataSize(uint64_t dataSizeInBytes, uint32_t trailingChunksSize = 0);
+
+	/**
+	 * @brief Gets the size of the data chunk in bytes, from the ds64 chunk for RF64 files
+	 */
+	uint64_t getDataSize() const;
+
+	/**
+	 * @brief Returns true if the header is RF64 instead of RIFF
+	 */
+	bool isRF64() const { return getUint32BE(0) == fourCharStringToValue("RF64"); };
+
+	/**
+	 * @brief Returns true if the fmt chunk is WAVE_FORMAT_EXTENSIBLE
+	 */
+	bool isExtensible() const;
+
+	/**
+	 * @brief Gets the format tag. For extensible files, this is the tag from the SubFormat GUID,
+	 * so it's 1 for PCM and 3 for float either way. Returns 0 if there is no fmt chunk.
+	 */
+	uint16_t getFormatTag() const;
+
+	/**
+	 * @brief Gets the number of channels from the fmt chunk, or 0 if there is no fmt chunk
+	 */
+	uint16_t getNumChannels() const;
+
+	/**
+	 * @brief Gets the sample rate from the fmt chunk, or 0 if there is no fmt chunk
+	 */
+	uint32_t getSampleRate() const;
+
+	/**
+	 * @brief Gets the bits per sample from the fmt chunk, or 0 if there is no fmt chunk
+	 *
+	 * For extensible files, this is the number of valid bits, which can be less than the container size.
+	 */
+	uint16_t getBitsPerSample() const;
+
+	/**
+	 * @brief Gets the size of one sample frame (all channels) in bytes, or 0 if there is no fmt chunk
+	 */
+	uint16_t getBlockAlign() const;
+
+	/**
+	 * @brief Gets the speaker position mask of an extensible file, or 0
+	 */
+	uint32_t getChannelMask() const;
+
+	/**
+	 * @brief Set the number of valid bytes in buffer, for parsing a header read from a file
+	 *
+	 * writeHeader() sets this automatically.
+	 */
+	void setBufferOffset(size_t bufferOffset) { this->bufferOffset = (bufferOffset < bufferSize) ? bufferOffset : bufferSize; };
+
+	/**
+	 * @brief Gets the offset of the data chunk
+	 *
+	 * When we create the file with writeHeader, this will be 44 unless other options are used, and a
+	 * multiple of dataAlignment if set. When we read files, it's typically 44 but could be larger if
+	 * there are other chunks before the data chunk.
+	 */
+	uint32_t getDataOffset() const;
+
+	/**
+	 * @brief Find a subchunk within the header
+	 *
+	 * @param id The subchunk id to find (typically 'fmt ' or 'data')
+	 *
+	 * @param chunkDataOffset Filled in with the file offset of this subchunk data (not including the header)
+	 *
+	 * @param chunkDataSize Filled in with the size of this subchunk data (not including the header)
+	 *
+	 * The entire header must be in buffer. This is usually 44 bytes, but files we didn't write could
+	 * be larger with more subchunks.
+	 */
+	bool findChunk(uint32_t id, size_t &chunkDataOffset, uint32_t &chunkDataSize) const;
+
+	void setUint16LE(size_t offset, uint16_t value);
+	uint16_t getUint16LE(size_t offset) const;
+
+	void setUint32LE(size_t offset, uint32_t value);
+	uint32_t getUint32LE(size_t offset) const;
+
+	void setUint64LE(size_t offset, uint64_t value);
+	uint64_t getUint64LE(size_t offset) const;
+
+	static uint32_t fourCharStringToValue(const char *str);
+
+	void setUint32BE(size_t offset, uint32_t value);
+	uint32_t getUint32BE(size_t offset) const;
+
+	size_t getBufferOffset() const { return bufferOffset; };
+
+	uint8_t *getBuffer() { return buffer; };
+
+	const uint8_t *getBuffer() const { return buffer; };
+
+	size_t getBufferSize() const { return bufferSize; };
+
+	/**
+	 * @brief This is the size of the header we write using writeHeader.
+	 *
+	 * The buffer must be at least this large. For reading headers it will also often be 44
+	 * bytes but it could be larger. Though some larger files (non-PCM files, for example)
+	 * cannot be read. However, it could have extra subchunks, which the library will
+	 * safely ignore.
+	 */
+	static const size_t STANDARD_SIZE = 44;
+
+	/**
+	 * @brief The largest header writeHeader writes without data alignment: RF64 reserve and extensible fmt chunk
+	 */
+	static const size_t MAX_HEADER_SIZE = 104;
+
+	/**
+	 * @brief Size of the data in the ds64 chunk, and the JUNK chunk reserved for it
+	 */
+	static const size_t DS64_SIZE = 28;
+
+	/**
+	 * @brief Size of the data in the bext chunk, with no coding history
+	 */
+	static const size_t BEXT_SIZE = 602;
+
+protected:
+	/**
+	 * @brief Find the fmt chunk and make sure it's complete
+	 *
+	 * @param fmtSize Filled in with the size of the fmt chunk data
+	 *
+	 * @return The offset of the fmt chunk data, or 0 if not found or not entirely in the buffer
+	 */
+	size_t findFmtChunk(uint32_t &fmtSize) const;
+
+	/**
+	 * @brief Write the bext chunk data (BEXT_SIZE bytes) at offset
+	 */
+	void writeBext(size_t offset);
+
+	/**
+	 * @brief Copy a string to a fixed-size field that has been cleared to zeros, truncating it if needed
+	 */
+	void setString(size_t offset, size_t fieldSize, const char *str);
+
+	uint8_t *buffer;
+	size_t bufferSize;
+	size_t bufferOffset = 0;
+	Encoding encoding = Encoding::PCM;	//!< Format tag for writeHeader
+	bool extensible = false;			//!< Write WAVE_FORMAT_EXTENSIBLE
+	uint32_t channelMask = 0;			//!< dwChannelMask for extensible, 0 for the default
+	bool rf64Reserve = false;			//!< Reserve a JUNK chunk for ds64
+	size_t dataAlignment = 0;			//!< Align the data chunk to this many bytes, 0 for none
+	const MicWavBextInfo *bextInfo = NULL;	//!< bext chunk values, or NULL for no bext chunk
+};
+
+/**
+ * @brief Templated class that allows the size of the buffer to be configured
+ *
+ * For writing wav headers, it must be at least 44 bytes.
+ */
+template <size_t BUFFER_SIZE>
+class MicWavHeader : public MicWavHeaderBase {
+public:
+	explicit MicWavHeader() : MicWavHeaderBase(staticBuffer, BUFFER_SIZE) {};
+
+private:
+	uint8_t staticBuffer[BUFFER_SIZE]; //!< static buffer to write to
+};
+
+#endif /* __MicWavHeader_H */
@@ -0,0 +1,195 @@
+#include "MicWavParser.h"
+
+#include <string.h>
+
+// Chunk IDs as big-endian values, as in MicWavHeaderBase::fourCharStringToValue()
+static const uint32_t ID_RIFF = 0x52494646;
+static const uint32_t ID_RF64 = 0x52463634;
+static const uint32_t ID_WAVE = 0x57415645;
+static const uint32_t ID_FMT  = 0x666d7420;
+static const uint32_t ID_DS64 = 0x64733634;
+static const uint32_t ID_DATA = 0x64617461;
+
+static uint32_t getUint32BE(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+MicWavParser::MicWavParser() {
+}
+
+MicWavParser::~MicWavParser() {
+}
+
+void MicWavParser::reset() {
+	state = State::RIFF_HEADER;
+	bufCount = 0;
+	bufNeeded = 12;
+	offset = riffEnd = skipEnd = 0;
+	chunk = {};
+	rf64 = extensible = fmtFound = dataFound = false;
+	ds64RiffSize = ds64DataSize = 0;
+	formatTag = numChannels = blockAlign = bitsPerSample = 0;
+	sampleRate = channelMask = 0;
+	dataOffset = dataSize = 0;
+}
+
+size_t MicWavParser::write(const uint8_t *data, size_t len) {
+	size_t used = 0;
+
+	while(used < len) {
+		switch(state) {
+		case State::RIFF_HEADER:
+		case State::CHUNK_HEADER:
+		case State::CHUNK_DATA: {
+			size_t count = bufNeeded - bufCount;
+			if (count > len - used) {
+				count = len - used;
+			}
+			memcpy(&buf[bufCount], &data[used], count);
+			bufCount += count;
+			used += count;
+			offset += count;
+
+			if (bufCount < bufNeeded) {
+				break;
+			}
+			if (state == State::RIFF_HEADER) {
+				uint32_t id = getUint32BE(buf);
+				if ((id != ID_RIFF && id != ID_RF64) || getUint32BE(&buf[8]) != ID_WAVE) {
+					state = State::ERROR;
+					break;
+				}
+				rf64 = (id == ID_RF64);
+
+				// RF64 files get the size from ds64. Some writers leave the size 0 until the file is
+				// closed, so treat that as unknown too.
+				uint32_t riffSize = getUint32LE(4);
+				riffEnd = (rf64 || riffSize < 4) ? UINT64_MAX : (8 + (uint64_t) riffSize);
+
+				bufCount = 0;
+				bufNeeded = 8;
+				state = State::CHUNK_HEADER;
+			}
+			else if (state == State::CHUNK_HEADER) {
+				chunkHeaderReceived();
+			}
+			else {
+				chunkDataReceived();
+			}
+			break;
+		}
+
+		case State::SKIP: {
+			uint64_t count = skipEnd - offset;
+			if (count > len - used) {
+				count = len - used;
+			}
+			used += (size_t) count;
+			offset += count;
+
+			if (offset >= skipEnd) {
+				skipRest();
+			}
+			break;
+		}
+
+		case State::DATA:
+		case State::COMPLETE:
+		case State::ERROR:
+			return used;
+		}
+	}
+	return used;
+}
+
+uint64_t MicWavParser::skipChunk() {
+	if (state == State::SKIP || state == State::DATA) {
+		offset = skipEnd;
+		skipRest();
+	}
+	return offset;
+}
+
+void MicWavParser::chunkHeaderReceived() {
+	chunk.id = getUint32BE(buf);
+	chunk.offset = offset;
+	chunk.size = getUint32LE(4);
+
+	if (chunk.id == ID_DATA && rf64 && chunk.size == 0xffffffff) {
+		chunk.size = ds64DataSize;
+	}
+
+	if (chunkCallback) {
+		chunkCallback(chunk);
+	}
+
+	// Skipping starts after the chunk data and the pad byte after odd-sized chunks
+	skipEnd = chunk.offset + chunk.size + (chunk.size & 1);
+	bufCount = 0;
+
+	if (chunk.id == ID_FMT || chunk.id == ID_DS64) {
+		// Keep the start of the chunk, which has all of the fields used
+		if (chunk.size < ((chunk.id == ID_FMT) ? 16 : 24)) {
+			state = State::ERROR;
+			return;
+		}
+		bufNeeded = (chunk.size < MAX_CHUNK_DATA) ? (size_t) chunk.size : MAX_CHUNK_DATA;
+		state = State::CHUNK_DATA;
+	}
+	else if (chunk.id == ID_DATA && !dataFound) {
+		dataFound = true;
+		dataOffset = chunk.offset;
+		dataSize = chunk.size;
+		state = State::DATA;
+	}
+	else {
+		skipRest();
+	}
+}
+
+void MicWavParser::chunkDataReceived() {
+	if (chunk.id == ID_FMT) {
+		formatTag = getUint16LE(0);
+		numChannels = getUint16LE(2);
+		sampleRate = getUint32LE(4);
+		blockAlign = getUint16LE(12);
+		bitsPerSample = getUint16LE(14);
+
+		if (formatTag == 0xfffe && bufCount >= 40) {
+			extensible = true;
+			if (getUint16LE(18) != 0) {
+				// Valid bits per sample
+				bitsPerSample = getUint16LE(18);
+			}
+			channelMask = getUint32LE(20);
+			// The first two bytes of the SubFormat GUID
+			formatTag = getUint16LE(24);
+		}
+		fmtFound = true;
+	}
+	else {
+		ds64RiffSize = getUint64LE(0);
+		ds64DataSize = getUint64LE(8);
+		if (rf64) {
+			riffEnd = 8 + ds64RiffSize;
+		}
+	}
+
+	skipRest();
+}
+
+void MicWavParser::skipRest() {
+	if (offset < skipEnd) {
+		state = State::SKIP;
+	}
+	else if (offset + 8 > riffEnd) {
+		// No room for another chunk before the end of the RIFF chunk
+		state = State::COMPLETE;
+	}
+	else {
+		// The next chunk starts here
+		bufCount = 0;
+		bufNeeded = 8;
+		state = State::CHUNK_HEADER;
+	}
+}
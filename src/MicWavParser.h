@@ -0,0 +1,226 @@
+#ifndef __MicWavParser_H
+#define __MicWavParser_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+/**
+ * @brief Incremental parser for wav file headers
+ *
+ * MicWavHeaderBase needs the whole header in one buffer, which doesn't work well for files with
+ * large chunks such as LIST, bext, or alignment padding before the data chunk. This parser instead
+ * accepts the file in slices of any size, down to one byte at a time, and uses a fixed amount of
+ * memory regardless of the size of the header.
+ *
+ * It finds the fmt chunk, the ds64 chunk of RF64 files, and the data chunk. Other chunks are
+ * reported to the chunk callback and skipped. If you can seek in the file, call skipChunk() to skip
+ * chunks without reading them at all:
+ *
+ * ```
+ * MicWavParser parser;
+ * uint64_t offset = 0;
+ * while(!parser.isDataFound() && !parser.hasError()) {
+ *     file.seek(offset);
+ *     int count = file.read(buf, sizeof(buf));
+ *     if (count <= 0) break;
+ *     parser.write(buf, count);
+ *     offset = parser.skipChunk();
+ * }
+ * ```
+ *
+ * This file does not depend on Particle, so it can also be used on a computer.
+ */
+class MicWavParser {
+public:
+	/**
+	 * @brief Information about a chunk, passed to the chunk callback
+	 */
+	struct ChunkInfo {
+		uint32_t id;		//!< Chunk ID as a big-endian value, compare to MicWavHeaderBase::fourCharStringToValue()
+		uint64_t offset;	//!< File offset of the chunk data, after the 8-byte chunk header
+		uint64_t size;		//!< Size of the chunk data, from ds64 for the data chunk of RF64 files
+	};
+
+	MicWavParser();
+	virtual ~MicWavParser();
+
+	/**
+	 * @brief Function to call for each chunk header, including fmt and data
+	 *
+	 * The chunk data has not been received yet when this is called. To read a chunk, such as LIST
+	 * or cue, save its offset and size and read it from the file later.
+	 */
+	MicWavParser &withChunkCallback(std::function<void(const ChunkInfo &chunk)> chunkCallback) { this->chunkCallback = chunkCallback; return *this; };
+
+	/**
+	 * @brief Process the next bytes of the file
+	 *
+	 * @param data Bytes starting at file offset getOffset()
+	 *
+	 * @param len Number of bytes
+	 *
+	 * @return Number of bytes used. Stops at the start of the samples in the data chunk, so if the
+	 * result is less than len, the rest of data is samples. Returns 0 while at the data chunk (call
+	 * skipChunk() to continue with the chunks after it), after the end of the file, or after an error.
+	 */
+	size_t write(const uint8_t *data, size_t len);
+
+	/**
+	 * @brief Skip the rest of the current chunk without passing it to write()
+	 *
+	 * If the parser is skipping an unknown chunk, or is at the data chunk, this moves past it
+	 * (including the pad byte after odd-sized chunks). Otherwise it does nothing.
+	 *
+	 * @return The file offset of the next byte to pass to write(), the same as getOffset()
+	 */
+	uint64_t skipChunk();
+
+	/**
+	 * @brief Prepare to parse a new file
+	 */
+	void reset();
+
+	/**
+	 * @brief The file offset of the next byte to pass to write()
+	 */
+	uint64_t getOffset() const { return offset; };
+
+	/**
+	 * @brief Returns true once the data chunk header has been parsed
+	 */
+	bool isDataFound() const { return dataFound; };
+
+	/**
+	 * @brief Returns true if the file is not a wav file or the header is not valid
+	 */
+	bool hasError() const { return state == State::ERROR; };
+
+	/**
+	 * @brief Returns true after the end of the RIFF chunk has been reached
+	 */
+	bool isComplete() const { return state == State::COMPLETE; };
+
+	/**
+	 * @brief Returns true once a complete fmt chunk has been parsed
+	 */
+	bool hasFormat() const { return fmtFound; };
+
+	/**
+	 * @brief Returns true if the file is RF64
+	 */
+	bool isRF64() const { return rf64; };
+
+	/**
+	 * @brief Returns true if the fmt chunk is WAVE_FORMAT_EXTENSIBLE
+	 */
+	bool isExtensible() const { return extensible; };
+
+	/**
+	 * @brief Format tag, from the SubFormat GUID for extensible files (1 = PCM, 3 = float)
+	 */
+	uint16_t getFormatTag() const { return formatTag; };
+
+	/**
+	 * @brief Number of channels
+	 */
+	uint16_t getNumChannels() const { return numChannels; };
+
+	/**
+	 * @brief Samples per second per channel
+	 */
+	uint32_t getSampleRate() const { return sampleRate; };
+
+	/**
+	 * @brief Bits per sample, the valid bits for extensible files
+	 */
+	uint16_t getBitsPerSample() const { return bitsPerSample; };
+
+	/**
+	 * @brief Bytes per sample frame (all channels)
+	 */
+	uint16_t getBlockAlign() const { return blockAlign; };
+
+	/**
+	 * @brief Speaker positions for extensible files, otherwise 0
+	 */
+	uint32_t getChannelMask() const { return channelMask; };
+
+	/**
+	 * @brief File offset of the first sample. Valid once isDataFound() is true.
+	 */
+	uint64_t getDataOffset() const { return dataOffset; };
+
+	/**
+	 * @brief Size of the data chunk in bytes. Valid once isDataFound() is true.
+	 */
+	uint64_t getDataSize() const { return dataSize; };
+
+	/**
+	 * @brief Largest part of a chunk that's kept: the size of an extensible fmt chunk
+	 */
+	static constexpr size_t MAX_CHUNK_DATA = 40;
+
+protected:
+	/**
+	 * @brief Parser state
+	 */
+	enum class State {
+		RIFF_HEADER,	//!< Receiving the 12-byte RIFF or RF64 header
+		CHUNK_HEADER,	//!< Receiving an 8-byte chunk header
+		CHUNK_DATA,		//!< Receiving the start of a fmt or ds64 chunk
+		SKIP,			//!< Skipping chunk data
+		DATA,			//!< At the start of the samples
+		COMPLETE,		//!< Reached the end of the RIFF chunk
+		ERROR			//!< Not a valid wav file
+	};
+
+	/**
+	 * @brief Called when the chunk header in buf is complete
+	 */
+	void chunkHeaderReceived();
+
+	/**
+	 * @brief Called when the part of the fmt or ds64 chunk that's kept is complete
+	 */
+	void chunkDataReceived();
+
+	/**
+	 * @brief Skip to skipEnd, then expect the next chunk header or the end of the RIFF chunk
+	 */
+	void skipRest();
+
+	/**
+	 * @brief Read a little endian value from buf
+	 */
+	uint16_t getUint16LE(size_t index) const { return (uint16_t)(buf[index] | (buf[index + 1] << 8)); };
+	uint32_t getUint32LE(size_t index) const { return (uint32_t) getUint16LE(index) | ((uint32_t) getUint16LE(index + 2) << 16); };
+	uint64_t getUint64LE(size_t index) const { return (uint64_t) getUint32LE(index) | ((uint64_t) getUint32LE(index + 4) << 32); };
+
+	State state = State::RIFF_HEADER;	//!< What's being received
+	uint8_t buf[MAX_CHUNK_DATA];		//!< RIFF header, chunk header, or fmt or ds64 data
+	size_t bufCount = 0;				//!< Bytes in buf
+	size_t bufNeeded = 12;				//!< Bytes needed in buf for the current state
+	uint64_t offset = 0;				//!< File offset of the next byte
+	uint64_t riffEnd = 0;				//!< File offset of the end of the RIFF chunk
+	uint64_t skipEnd = 0;				//!< File offset where skipping ends
+	ChunkInfo chunk = {};				//!< Current chunk
+	bool rf64 = false;					//!< File is RF64
+	bool extensible = false;			//!< fmt chunk is extensible
+	bool fmtFound = false;				//!< fmt chunk was parsed
+	bool dataFound = false;				//!< data chunk was found
+	uint64_t ds64RiffSize = 0;			//!< RIFF size from ds64
+	uint64_t ds64DataSize = 0;			//!< data size from ds64
+	uint16_t formatTag = 0;				//!< From fmt
+	uint16_t numChannels = 0;			//!< From fmt
+	uint32_t sampleRate = 0;			//!< From fmt
+	uint16_t blockAlign = 0;			//!< From fmt
+	uint16_t bitsPerSample = 0;			//!< From fmt
+	uint32_t channelMask = 0;			//!< From fmt
+	uint64_t dataOffset = 0;			//!< File offset of the samples
+	uint64_t dataSize = 0;				//!< Size of the samples
+	std::function<void(const ChunkInfo &chunk)> chunkCallback = 0;
+};
+
+#endif /* __MicWavParser_H */
@@ -1,12 +1,19 @@
 
 #include "Microphone_PDM.h"
 
+#include <new>
+
 // #include "pinmap_hal.h"
 
 // 
 
 Microphone_PDM *Microphone_PDM::_instance = NULL;
 
+// All of the buffer sampling classes must fit in an arena object slot
+static_assert(sizeof(Microphone_PDM_BufferSampling_trigger) <= Microphone_PDM_Arena::OBJECT_SLOT_SIZE, "OBJECT_SLOT_SIZE too small");
+static_assert(sizeof(Microphone_PDM_BufferSampling_chunked) <= Microphone_PDM_Arena::OBJECT_SLOT_SIZE, "OBJECT_SLOT_SIZE too small");
+static_assert(sizeof(Microphone_PDM_BufferSampling_continuous) <= Microphone_PDM_Arena::OBJECT_SLOT_SIZE, "OBJECT_SLOT_SIZE too small");
+
 Microphone_PDM::Microphone_PDM() {
 }
 
@@ -17,11 +24,239 @@ Microphone_PDM::~Microphone_PDM() {
 // [static] 
 Microphone_PDM &Microphone_PDM::instance() {
 	if (!_instance) {
-		_instance = new Microphone_PDM();
+		// Constructed in static storage so the singleton is never on the heap
+		alignas(Microphone_PDM) static uint8_t instanceStorage[sizeof(Microphone_PDM)];
+
+		_instance = new(instanceStorage) Microphone_PDM();
 	}
 	return *_instance;
 }
 
+int Microphone_PDM::init() {
+	if (!samplesSemaphore) {
+		// Counts filled buffers, so it never needs to go higher than the number of buffers
+		if (os_semaphore_create(&samplesSemaphore, Microphone_PDM_MCU::NUM_BUFFERS, 0)) {
+			samplesSemaphore = NULL;
+			return SYSTEM_ERROR_NO_MEMORY;
+		}
+	}
+
+	int err = Microphone_PDM_MCU::init();
+	if (err) {
+		return err;
+	}
+
+	if (audioThreadEnabled && !audioThread) {
+		if (os_thread_create(&audioThread, "audio", audioThreadPriority, audioThreadFunctionStatic, this, audioThreadStackSize)) {
+			audioThread = NULL;
+			return SYSTEM_ERROR_NO_MEMORY;
+		}
+	}
+	return 0;
+}
+
+void Microphone_PDM::audioThreadFunction() {
+	while(true) {
+		os_semaphore_take(samplesSemaphore, CONCURRENT_WAIT_FOREVER, false);
+
+		// The semaphore counts buffers, but process everything available in case some were
+		// filled while the handlers were running
+		Microphone_PDM_Page page;
+		while(acquireSamples(page)) {
+			dispatchPage(page);
+		}
+	}
+}
+
+void Microphone_PDM::dispatchPage(Microphone_PDM_Page &page) {
+	for(auto &handler : samplesHandlers) {
+		handler(page);
+	}
+
+	// Hold a reference while dispatching so a subscriber that releases immediately does not
+	// return the buffer to the DMA before the other subscribers have seen it
+	int index = page.index;
+	subscribedPages[index] = page;
+	pageRefCount[index].store(1);
+
+	if (numSubscribers.load()) {
+		// The sinks are called with the mutex held, so unsubscribe() from another thread waits until
+		// they return. It's recursive so a sink can unsubscribe itself.
+		os_mutex_recursive_lock(subscribersMutex);
+
+		for(size_t ii = 0; ii < MAX_SUBSCRIBERS; ii++) {
+			Subscriber &sub = subscribers[ii];
+			if (!sub.sink) {
+				continue;
+			}
+
+			uint32_t pending = sub.pending.load();
+			if (pending >= sub.maxPending) {
+				// This subscriber already holds as much as it's allowed to
+				sub.dropped++;
+				continue;
+			}
+
+			if (sub.copyBuffers) {
+				// Copying subscriber: it holds its own buffer, never the DMA buffer, so it
+				// can't keep the ring from advancing for the other subscribers. Fewer than
+				// maxPending copies are pending, so a free one is always found.
+				size_t bytes = page.numSamples * getSampleSizeInBytes();
+				uint32_t inUse = sub.copyInUse.load();
+				size_t slot = 0;
+				while(slot < sub.maxPending && (inUse & (1UL << slot)) != 0) {
+					slot++;
+				}
+				if (slot >= sub.maxPending || bytes > sub.copyBufferSize) {
+					sub.dropped++;
+					continue;
+				}
+
+				Microphone_PDM_Page copyPage = page;
+				copyPage.pSamples = &sub.copyBuffers[slot * sub.copyBufferSize];
+				copyPage.index = -1;
+				memcpy(copyPage.pSamples, page.pSamples, bytes);
+
+				sub.copyInUse.fetch_or(1UL << slot);
+				sub.pending.fetch_add(1);
+				if (++pending > sub.maxPendingSeen) {
+					sub.maxPendingSeen = pending;
+				}
+				sub.delivered++;
+
+				sub.sink(copyPage);
+				continue;
+			}
+
+			pageRefCount[index].fetch_add(1);
+			sub.pending.fetch_add(1);
+			if (++pending > sub.maxPendingSeen) {
+				sub.maxPendingSeen = pending;
+			}
+			sub.delivered++;
+
+			sub.sink(page);
+		}
+
+		os_mutex_recursive_unlock(subscribersMutex);
+	}
+
+	releasePageReference(index);
+}
+
+void Microphone_PDM::releasePageReference(int index) {
+	if (pageRefCount[index].fetch_sub(1) == 1) {
+		// Last reference
+		releaseSamples(subscribedPages[index]);
+	}
+}
+
+int Microphone_PDM::subscribe(std::function<void(const Microphone_PDM_Page &page)> sink, size_t maxPending, bool copy) {
+	if (!subscribersMutex) {
+		// Nothing is dispatched to subscribers until numSubscribers is non-zero, which happens after this
+		if (os_mutex_recursive_create(&subscribersMutex)) {
+			subscribersMutex = NULL;
+			return -1;
+		}
+	}
+
+	if (maxPending < 1) {
+		maxPending = 1;
+	}
+	if (maxPending > (copy ? MAX_COPY_PENDING : MAX_PENDING)) {
+		maxPending = copy ? MAX_COPY_PENDING : MAX_PENDING;
+	}
+
+	int result = -1;
+
+	os_mutex_recursive_lock(subscribersMutex);
+	for(size_t ii = 0; ii < MAX_SUBSCRIBERS; ii++) {
+		Subscriber &sub = subscribers[ii];
+		// A slot whose previous subscriber still holds buffers is not reused, so its late
+		// releaseSubscribedSamples() calls can't be counted against the new subscriber
+		if (!sub.sink && sub.pending.load() == 0) {
+			// Nothing is pending, so the previous subscriber's copies are no longer in use
+			delete[] sub.copyBuffers;
+			sub.copyBuffers = NULL;
+			sub.copyBufferSize = 0;
+			sub.copyInUse.store(0);
+			if (copy) {
+				size_t bufferSize = getBufferSizeInBytes();
+				sub.copyBuffers = new (std::nothrow) uint8_t[bufferSize * maxPending];
+				if (!sub.copyBuffers) {
+					break;
+				}
+				sub.copyBufferSize = bufferSize;
+			}
+
+			sub.maxPending = maxPending;
+			sub.delivered = sub.dropped = sub.maxPendingSeen = 0;
+			sub.sink = sink;
+			numSubscribers++;
+			result = (int)ii;
+			break;
+		}
+	}
+	os_mutex_recursive_unlock(subscribersMutex);
+
+	return result;
+}
+
+void Microphone_PDM::unsubscribe(int subscriberId) {
+	if (subscriberId < 0 || subscriberId >= (int)MAX_SUBSCRIBERS || !subscribersMutex) {
+		return;
+	}
+
+	os_mutex_recursive_lock(subscribersMutex);
+	if (subscribers[subscriberId].sink) {
+		subscribers[subscriberId].sink = NULL;
+		numSubscribers--;
+	}
+	os_mutex_recursive_unlock(subscribersMutex);
+}
+
+void Microphone_PDM::releaseSubscribedSamples(int subscriberId, const Microphone_PDM_Page &page) {
+	if (subscriberId < 0 || subscriberId >= (int)MAX_SUBSCRIBERS) {
+		return;
+	}
+
+	Subscriber &sub = subscribers[subscriberId];
+	uint8_t *pSamples = (uint8_t *)page.pSamples;
+	if (sub.copyBuffers && pSamples >= sub.copyBuffers && pSamples < &sub.copyBuffers[sub.maxPending * sub.copyBufferSize]) {
+		// One of the subscriber's own copies. Free it before decrementing pending so dispatchPage()
+		// always finds a free copy when pending is below maxPending.
+		size_t slot = (pSamples - sub.copyBuffers) / sub.copyBufferSize;
+		sub.copyInUse.fetch_and(~(1UL << slot));
+		sub.pending.fetch_sub(1);
+	}
+	else if (page.index >= 0) {
+		sub.pending.fetch_sub(1);
+		releasePageReference(page.index);
+	}
+}
+
+Microphone_PDM_SubscriberStats Microphone_PDM::getSubscriberStats(int subscriberId) const {
+	Microphone_PDM_SubscriberStats stats = {};
+
+	if (subscriberId >= 0 && subscriberId < (int)MAX_SUBSCRIBERS && subscribersMutex) {
+		os_mutex_recursive_lock(subscribersMutex);
+
+		const Subscriber &sub = subscribers[subscriberId];
+		stats.delivered = sub.delivered;
+		stats.dropped = sub.dropped;
+		stats.pending = sub.pending.load();
+		stats.maxPending = sub.maxPendingSeen;
+
+		os_mutex_recursive_unlock(subscribersMutex);
+	}
+	return stats;
+}
+
+// [static]
+void Microphone_PDM::audioThreadFunctionStatic(void *param) {
+	((Microphone_PDM *)param)->audioThreadFunction();
+}
+
 #if 0
 Microphone_PDM &Microphone_PDM::withGainDb(float gain) {
 	if (gain < -20.0) {
@@ -48,12 +283,23 @@ void Microphone_PDM::loop() {
 		sampling->loop();
 	}
 
+	if (numSubscribers && !audioThread) {
+		Microphone_PDM_Page page;
+		while(acquireSamples(page)) {
+			dispatchPage(page);
+		}
+	}
 }
 
 
 bool Microphone_PDM::bufferSamplingStart(Microphone_PDM_BufferSampling *sampling) {
 	releaseBufferSampling();
 
+	if (!sampling) {
+		// Could not be allocated
+		return false;
+	}
+
 	this->sampling = sampling;
 
 	return sampling->start();
@@ -80,13 +326,157 @@ size_t Microphone_PDM::getSampleSizeInBytes() const {
 	}
 }
 
+bool Microphone_PDM::waitForSamples(system_tick_t timeoutMs) {
+	if (samplesAvailable()) {
+		return true;
+	}
+	if (!samplesSemaphore) {
+		return false;
+	}
+
+	system_tick_t startMs = millis();
+
+	while(true) {
+		system_tick_t waitMs = CONCURRENT_WAIT_FOREVER;
+
+		if (timeoutMs != CONCURRENT_WAIT_FOREVER) {
+			system_tick_t elapsedMs = millis() - startMs;
+			if (elapsedMs >= timeoutMs) {
+				return samplesAvailable();
+			}
+			waitMs = timeoutMs - elapsedMs;
+		}
+
+		// The semaphore may have been given for buffers that were already read by polling, so
+		// a successful take does not guarantee samples are available. Check and wait again if not.
+		os_semaphore_take(samplesSemaphore, waitMs, false);
+
+		if (samplesAvailable()) {
+			return true;
+		}
+	}
+}
+
+bool Microphone_PDM::noCopySamplesWithInfo(std::function<void(const Microphone_PDM_Page &page)> callback) {
+	Microphone_PDM_Page page;
+
+	if (acquireSamples(page)) {
+		callback(page);
+		releaseSamples(page);
+		return true;
+	}
+	else {
+		return false;
+	}
+}
+
+Microphone_PDM_Stats Microphone_PDM::getStats() const {
+	Microphone_PDM_Stats stats;
+
+	stats.buffersProduced = statBuffersProduced.load(std::memory_order_relaxed);
+	stats.buffersDelivered = statBuffersDelivered.load(std::memory_order_relaxed);
+	stats.buffersDropped = statBuffersDropped.load(std::memory_order_relaxed);
+	stats.samplesDropped = statSamplesDropped.load(std::memory_order_relaxed);
+	stats.maxQueueDepth = statMaxQueueDepth.load(std::memory_order_relaxed);
+	stats.lastDropMs = statLastDropMs.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+void Microphone_PDM::resetStats() {
+	statBuffersProduced.store(0);
+	statBuffersDelivered.store(0);
+	statBuffersDropped.store(0);
+	statSamplesDropped.store(0);
+	statMaxQueueDepth.store(0);
+	statLastDropMs.store(0);
+}
+
+void Microphone_PDM_Base::statsBufferProduced(uint32_t queueDepth) {
+	statBuffersProduced.fetch_add(1, std::memory_order_relaxed);
+
+	// Only the interrupt updates this, so it doesn't need to be a compare-exchange
+	if (queueDepth > statMaxQueueDepth.load(std::memory_order_relaxed)) {
+		statMaxQueueDepth.store(queueDepth, std::memory_order_relaxed);
+	}
+}
+
+void Microphone_PDM_Base::statsBufferDropped(uint32_t numSamples) {
+	statBuffersDropped.fetch_add(1, std::memory_order_relaxed);
+	statSamplesDropped.fetch_add(numSamples, std::memory_order_relaxed);
+	statLastDropMs.store((uint32_t) millis(), std::memory_order_relaxed);
+}
+
+void Microphone_PDM_Base::notifySamplesAvailable() {
+	if (samplesSemaphore) {
+		// This is safe to call from an ISR
+		os_semaphore_give(samplesSemaphore, false);
+	}
+}
+
+void Microphone_PDM_Base::tagBuffer(BufferInfo *info, size_t numSamples) {
+	if (info) {
+		info->sampleIndex = nextSampleIndex;
+		info->sequence = nextSequence;
+		info->timestampUs = (uint32_t) micros();
+	}
+	nextSampleIndex += numSamples;
+	nextSequence++;
+}
 
-void Microphone_PDM_Base::copySamplesInternal(const int16_t *src, uint8_t *dst) const {
+
+void Microphone_PDM_Base::copySamplesInternal(const int16_t *src, uint8_t *dst) {
 	const int16_t *srcEnd = &src[numSamples];
 
 	size_t increment = copySrcIncrement();
 
-	if (outputSize == OutputSize::UNSIGNED_8) {
+	if (outputSize == OutputSize::UNSIGNED_8 && dither) {
+		// All of the arithmetic is done in units of the 16-bit input. One step of the
+		// 8-bit output is div input units.
+		int32_t div = (int32_t)(1 << (size_t) range);
+		int32_t mask = div - 1;
+		int32_t half = div / 2;
+
+		// Work on local copies of the state so the compiler can keep them in registers
+		uint32_t seed = ditherSeed;
+		int32_t error = ditherError;
+
+		while(src < srcEnd) {
+			// Subtract the error from the previous sample (first-order noise shaping)
+			int32_t val = (int32_t)*src - error;
+			src += increment;
+
+			// xorshift32 (a LFSR-type generator). The low and high 16 bits are used as two
+			// independent uniform values. Their difference has a triangular (TPDF) distribution
+			// of +/- 1 output step.
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			int32_t noise = (int32_t)(seed & mask) - (int32_t)((seed >> 16) & mask);
+
+			// Round to the nearest output step
+			int32_t quantized = (val + noise + half) >> (size_t) range;
+
+			// Error is calculated before clipping so a clipped sample doesn't feed a large error forward
+			error = quantized * div - val;
+
+			// Clip to signed 8-bit
+			if (quantized < -128) {
+				quantized = -128;
+			}
+			if (quantized > 127) {
+				quantized = 127;
+			}
+
+			// Add 128 to make unsigned 8-bit (offset)
+			*((uint8_t *)dst) = (uint8_t) (quantized + 128);
+			dst += sizeof(uint8_t);
+		}
+
+		ditherSeed = seed;
+		ditherError = error;
+	}
+	else if (outputSize == OutputSize::UNSIGNED_8) {
 
 		// Scale the 16-bit signed values to an appropriate range for unsigned 8-bit values
 		int16_t div = (int16_t)(1 << (size_t) range);
@@ -147,8 +537,52 @@ Microphone_PDM_BufferSampling::Microphone_PDM_BufferSampling() {
 }
 
 Microphone_PDM_BufferSampling::~Microphone_PDM_BufferSampling() {
-	if (buffer) {
-		delete[] buffer;		
+	freeBuffer(buffer);
+}
+
+// [static]
+void *Microphone_PDM_BufferSampling::operator new(size_t size) noexcept {
+	Microphone_PDM_Arena *arena = Microphone_PDM::instance().getArena();
+	if (arena) {
+		return arena->allocObject(size);
+	}
+	else {
+		return ::operator new(size, std::nothrow);
+	}
+}
+
+// [static]
+void Microphone_PDM_BufferSampling::operator delete(void *ptr) noexcept {
+	Microphone_PDM_Arena *arena = Microphone_PDM::instance().getArena();
+	if (arena && arena->ownsObject(ptr)) {
+		arena->freeObject(ptr);
+	}
+	else {
+		::operator delete(ptr);
+	}
+}
+
+// [static]
+uint8_t *Microphone_PDM_BufferSampling::allocBuffer(size_t size) {
+	Microphone_PDM_Arena *arena = Microphone_PDM::instance().getArena();
+	if (arena) {
+		return arena->allocBuffer(size);
+	}
+	else {
+		return new uint8_t[size];
+	}
+}
+
+// [static]
+void Microphone_PDM_BufferSampling::freeBuffer(uint8_t *buf) {
+	if (buf) {
+		Microphone_PDM_Arena *arena = Microphone_PDM::instance().getArena();
+		if (arena && arena->ownsBuffer(buf)) {
+			arena->freeBuffer(buf);
+		}
+		else {
+			delete[] buf;
+		}
 	}
 }
 
@@ -158,7 +592,7 @@ bool Microphone_PDM_BufferSampling::start() {
 	offset = reserveHeaderSize;
 	bufferSize = reserveHeaderSize + (Microphone_PDM::instance().getSampleRate() / 1000 * durationMs) * sampleSizeInBytes;
 
-	buffer = new uint8_t[bufferSize];
+	buffer = allocBuffer(bufferSize);
 
 	return buffer != NULL;
 }
@@ -187,3 +621,329 @@ void Microphone_PDM_BufferSampling::loop() {
 bool Microphone_PDM_BufferSampling::done() const {
 	return buffer && offset >= bufferSize;
 }
+
+
+Microphone_PDM_BufferSampling_trigger::Microphone_PDM_BufferSampling_trigger() {
+}
+
+bool Microphone_PDM_BufferSampling_trigger::start() {
+	sampleSizeInBytes = Microphone_PDM::instance().getSampleSizeInBytes();
+	uint32_t sampleRate = Microphone_PDM::instance().getSampleRate();
+
+	// Whole samples in a number of milliseconds, without rounding the rate down to samples per ms
+	auto bytesForMs = [sampleRate, this](uint64_t ms) {
+		return (size_t)(sampleRate * ms / 1000) * sampleSizeInBytes;
+	};
+
+	// The circular buffer holds the pre-trigger audio plus the post-trigger audio, so the pre-trigger
+	// audio is never overwritten while recording after the trigger
+	offset = 0;
+	bufferSize = bytesForMs((uint64_t) preTriggerMs + durationMs);
+	wrapped = false;
+	triggered = false;
+	postTriggerRemaining = bytesForMs(durationMs);
+
+	// loop() could never fill an empty buffer
+	if (bufferSize == 0) {
+		buffer = NULL;
+		return false;
+	}
+
+	buffer = allocBuffer(bufferSize);
+
+	return buffer != NULL;
+}
+
+void Microphone_PDM_BufferSampling_trigger::loop() {
+	if (!buffer || done() || !Microphone_PDM::instance().samplesAvailable()) {
+		return;
+	}
+
+	Microphone_PDM::instance().noCopySamples([this](void *pSamples, size_t numSamples) {
+		uint8_t *src = (uint8_t *)pSamples;
+		size_t bytesToCopy = sampleSizeInBytes * numSamples;
+
+		if (triggered && bytesToCopy > postTriggerRemaining) {
+			bytesToCopy = postTriggerRemaining;
+		}
+
+		while(bytesToCopy > 0) {
+			size_t count = bufferSize - offset;
+			if (count > bytesToCopy) {
+				count = bytesToCopy;
+			}
+			memcpy(&buffer[offset], src, count);
+			src += count;
+			bytesToCopy -= count;
+
+			if (triggered) {
+				postTriggerRemaining -= count;
+			}
+
+			offset += count;
+			if (offset >= bufferSize) {
+				offset = 0;
+				wrapped = true;
+			}
+		}
+
+		if (done()) {
+			if (triggerCallback) {
+				uint8_t *buf1, *buf2;
+				size_t size1, size2;
+				getSegments(buf1, size1, buf2, size2);
+
+				triggerCallback(buf1, size1, buf2, size2);
+			}
+		}
+	});
+}
+
+bool Microphone_PDM_BufferSampling_trigger::done() const {
+	return buffer && triggered && postTriggerRemaining == 0;
+}
+
+void Microphone_PDM_BufferSampling_trigger::trigger() {
+	triggered = true;
+}
+
+void Microphone_PDM_BufferSampling_trigger::getSegments(uint8_t *&buf1, size_t &size1, uint8_t *&buf2, size_t &size2) const {
+	if (wrapped && offset != 0) {
+		// Oldest data is at offset
+		buf1 = &buffer[offset];
+		size1 = bufferSize - offset;
+		buf2 = buffer;
+		size2 = offset;
+	}
+	else {
+		buf1 = buffer;
+		size1 = wrapped ? bufferSize : offset;
+		buf2 = NULL;
+		size2 = 0;
+	}
+}
+
+
+uint8_t *Microphone_PDM_ChunkList::getChunk(size_t index, size_t &size) const {
+	size_t chunkOffset = index * chunkSize;
+
+	size = totalSize - chunkOffset;
+	if (size > chunkSize) {
+		size = chunkSize;
+	}
+	return chunks[index];
+}
+
+bool Microphone_PDM_ChunkList::writeTo(std::function<bool(const uint8_t *buf, size_t size)> sink) const {
+	for(size_t ii = 0; ii < numChunks; ii++) {
+		size_t size;
+		uint8_t *chunk = getChunk(ii, size);
+
+		if (!sink(chunk, size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Microphone_PDM_BufferSampling_chunked::Microphone_PDM_BufferSampling_chunked() : pool(&Microphone_PDM_BlockPool::defaultPool()) {
+}
+
+Microphone_PDM_BufferSampling_chunked::~Microphone_PDM_BufferSampling_chunked() {
+	freeChunks();
+}
+
+bool Microphone_PDM_BufferSampling_chunked::start() {
+	freeChunks();
+
+	sampleSizeInBytes = Microphone_PDM::instance().getSampleSizeInBytes();
+
+	size_t chunkSize = pool->getBlockSize();
+	if (reserveHeaderSize > chunkSize) {
+		// The header must fit in the first chunk
+		return false;
+	}
+
+	offset = reserveHeaderSize;
+	bufferSize = reserveHeaderSize + (Microphone_PDM::instance().getSampleRate() / 1000 * durationMs) * sampleSizeInBytes;
+
+	size_t count = (bufferSize + chunkSize - 1) / chunkSize;
+
+	chunks = (uint8_t **) allocBuffer(count * sizeof(uint8_t *));
+	if (!chunks) {
+		return false;
+	}
+
+	for(numChunks = 0; numChunks < count; numChunks++) {
+		chunks[numChunks] = pool->alloc();
+		if (!chunks[numChunks]) {
+			freeChunks();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Microphone_PDM_BufferSampling_chunked::loop() {
+	if (!chunks || done() || !Microphone_PDM::instance().samplesAvailable()) {
+		return;
+	}
+
+	Microphone_PDM::instance().noCopySamples([this](void *pSamples, size_t numSamples) {
+		const uint8_t *src = (const uint8_t *)pSamples;
+		size_t bytesToCopy = sampleSizeInBytes * numSamples;
+		size_t chunkSize = pool->getBlockSize();
+
+		if ((offset + bytesToCopy) > bufferSize) {
+			bytesToCopy = bufferSize - offset;
+		}
+
+		while(bytesToCopy > 0) {
+			size_t chunkOffset = offset % chunkSize;
+			size_t count = chunkSize - chunkOffset;
+			if (count > bytesToCopy) {
+				count = bytesToCopy;
+			}
+			memcpy(&chunks[offset / chunkSize][chunkOffset], src, count);
+			src += count;
+			offset += count;
+			bytesToCopy -= count;
+		}
+
+		if (done()) {
+			preCompletion();
+
+			if (chunksCallback) {
+				chunksCallback(getChunkList());
+			}
+		}
+	});
+}
+
+bool Microphone_PDM_BufferSampling_chunked::done() const {
+	return chunks && offset >= bufferSize;
+}
+
+Microphone_PDM_ChunkList Microphone_PDM_BufferSampling_chunked::getChunkList() const {
+	Microphone_PDM_ChunkList chunkList;
+
+	chunkList.chunks = chunks;
+	chunkList.numChunks = numChunks;
+	chunkList.chunkSize = pool->getBlockSize();
+	chunkList.totalSize = bufferSize;
+
+	return chunkList;
+}
+
+void Microphone_PDM_BufferSampling_chunked::freeChunks() {
+	if (chunks) {
+		for(size_t ii = 0; ii < numChunks; ii++) {
+			pool->free(chunks[ii]);
+		}
+		freeBuffer((uint8_t *)chunks);
+		chunks = NULL;
+	}
+	numChunks = 0;
+}
+
+
+Microphone_PDM_BufferSampling_continuous::Microphone_PDM_BufferSampling_continuous() {
+}
+
+Microphone_PDM_BufferSampling_continuous::~Microphone_PDM_BufferSampling_continuous() {
+	freeSegments();
+}
+
+bool Microphone_PDM_BufferSampling_continuous::start() {
+	freeSegments();
+
+	sampleSizeInBytes = Microphone_PDM::instance().getSampleSizeInBytes();
+
+	offset = reserveHeaderSize;
+	bufferSize = reserveHeaderSize + (Microphone_PDM::instance().getSampleRate() / 1000 * durationMs) * sampleSizeInBytes;
+	currentSegment = 0;
+	samplesCaptured = 0;
+	segmentsCompleted = 0;
+	samplesDropped = 0;
+	haveSampleIndex = false;
+
+	segments = (uint8_t **) allocBuffer(numSegments * sizeof(uint8_t *));
+	if (!segments) {
+		return false;
+	}
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		segments[ii] = NULL;
+	}
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		segments[ii] = allocBuffer(bufferSize);
+		if (!segments[ii]) {
+			freeSegments();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Microphone_PDM_BufferSampling_continuous::loop() {
+	if (!segments) {
+		return;
+	}
+
+	// Process everything that is available so we don't fall behind
+	while(Microphone_PDM::instance().samplesAvailable()) {
+		Microphone_PDM::instance().noCopySamplesWithInfo([this](const Microphone_PDM_Page &page) {
+			const uint8_t *src = (const uint8_t *)page.pSamples;
+			size_t bytesToCopy = sampleSizeInBytes * page.numSamples;
+
+			// A sample index past the expected one means buffers were dropped in between. A smaller
+			// one means the microphone was restarted, which is not a drop.
+			if (haveSampleIndex && page.sampleIndex > nextSampleIndex) {
+				samplesDropped += (uint32_t)(page.sampleIndex - nextSampleIndex);
+			}
+			nextSampleIndex = page.sampleIndex + page.numSamples;
+			haveSampleIndex = true;
+
+			samplesCaptured += page.numSamples;
+
+			while(bytesToCopy > 0) {
+				size_t count = bufferSize - offset;
+				if (count > bytesToCopy) {
+					count = bytesToCopy;
+				}
+				memcpy(&segments[currentSegment][offset], src, count);
+				src += count;
+				offset += count;
+				bytesToCopy -= count;
+
+				if (offset >= bufferSize) {
+					// This segment is full. The rest of this DMA buffer goes into the next segment.
+					buffer = segments[currentSegment];
+					preCompletion();
+
+					if (completionCallback) {
+						completionCallback(buffer, bufferSize);
+					}
+					buffer = NULL;
+					segmentsCompleted++;
+
+					if (++currentSegment >= numSegments) {
+						currentSegment = 0;
+					}
+					offset = reserveHeaderSize;
+				}
+			}
+		});
+	}
+}
+
+void Microphone_PDM_BufferSampling_continuous::freeSegments() {
+	if (segments) {
+		for(size_t ii = 0; ii < numSegments; ii++) {
+			freeBuffer(segments[ii]);
+		}
+		freeBuffer((uint8_t *)segments);
+		segments = NULL;
+	}
+}
@@ -3,6 +3,10 @@
 
 #include "Particle.h"
 
+#include <atomic>
+
+#include "Microphone_PDM_Pool.h"
+
 /**
  * @brief Class to configure buffer sampling mode
  * 
@@ -75,7 +79,31 @@ public:
 	virtual void preCompletion() {};
 
 	/**
-	 * Buffer allocated dynamically if bufferSamplingStart() is used. Released by bufferSamplingRelease().
+	 * @brief Allocates objects from the arena set with Microphone_PDM::withArena(), if any, otherwise the heap
+	 * 
+	 * @return Pointer to the memory, or NULL if it could not be allocated
+	 */
+	static void *operator new(size_t size) noexcept;
+
+	/**
+	 * @brief Frees objects allocated by operator new
+	 */
+	static void operator delete(void *ptr) noexcept;
+
+	/**
+	 * @brief Allocates a data buffer from the arena set with Microphone_PDM::withArena(), if any, otherwise the heap
+	 * 
+	 * @return Pointer to the buffer, or NULL if it could not be allocated
+	 */
+	static uint8_t *allocBuffer(size_t size);
+
+	/**
+	 * @brief Frees a data buffer allocated by allocBuffer(). Does nothing if buf is NULL.
+	 */
+	static void freeBuffer(uint8_t *buf);
+
+	/**
+	 * Buffer allocated by allocBuffer() if bufferSamplingStart() is used. Released by bufferSamplingRelease().
 	 */
 	uint8_t *buffer = 0;
 
@@ -112,6 +140,395 @@ public:
 	size_t sampleSizeInBytes;
 };
 
+/**
+ * @brief Class to configure buffer sampling with audio from before a trigger event
+ *
+ * Samples are recorded continuously into a fixed circular buffer that holds the most recent
+ * preTriggerMs of audio. When you call trigger(), recording continues for durationMs more,
+ * then the trigger callback is called with the audio from before and after the trigger.
+ *
+ * The buffer is allocated once in start(). Nothing is reallocated or moved at trigger time, so the
+ * audio is passed to the callback as up to two segments, in order: buf1 followed by buf2. If the
+ * circular buffer did not wrap, buf2 is NULL and size2 is 0.
+ *
+ * Allocate with new and pass to Microphone_PDM::bufferSamplingStart(), the same as Microphone_PDM_BufferSampling.
+ */
+class Microphone_PDM_BufferSampling_trigger : public Microphone_PDM_BufferSampling {
+public:
+	/**
+	 * @brief Constructor - do not allocate on the stack!
+	 */
+	Microphone_PDM_BufferSampling_trigger();
+
+	/**
+	 * @brief Set how much audio to keep from before trigger() is called, in milliseconds
+	 * 
+	 * Use withDurationMs() to set how much audio to record after trigger() is called.
+	 */
+	Microphone_PDM_BufferSampling_trigger &withPreTriggerMs(unsigned long ms) { this->preTriggerMs = ms; return *this;};
+
+	/**
+	 * @brief Sets a callback function to call when the post-trigger audio has been recorded
+	 * 
+	 * @param triggerCallback Function or lambda to call. The audio is buf1 (size1 bytes) followed by buf2 (size2 bytes).
+	 */
+	Microphone_PDM_BufferSampling_trigger &withTriggerCallback(std::function<void(uint8_t *buf1, size_t size1, uint8_t *buf2, size_t size2)> triggerCallback) { this->triggerCallback = triggerCallback; return *this;};
+
+	/**
+	 * @brief Allocates the circular buffer and starts recording
+	 *
+	 * @return false if the buffer could not be allocated, or if preTriggerMs and durationMs add up to
+	 * less than one sample
+	 */
+	virtual bool start();
+
+	/**
+	 * @brief Must be called from the application loop. This is done by Microphone_PDM::loop().
+	 */
+	virtual void loop();
+
+	/**
+	 * @brief Returns true after trigger() has been called and the post-trigger audio has been recorded
+	 */
+	virtual bool done() const;
+
+	/**
+	 * @brief Mark the current time as the trigger. Calling it again after the first time has no effect.
+	 */
+	void trigger();
+
+	/**
+	 * @brief Gets the recorded audio as up to two segments, in order. Use after done() returns true.
+	 * 
+	 * This can also be used before the trigger to get the audio that is currently in the circular buffer.
+	 */
+	void getSegments(uint8_t *&buf1, size_t &size1, uint8_t *&buf2, size_t &size2) const;
+
+	/**
+	 * How long to keep from before the trigger in milliseconds
+	 */
+	unsigned long preTriggerMs = 0;
+
+	/**
+	 * Callback to call when the post-trigger audio has been recorded
+	 */
+	std::function<void(uint8_t *buf1, size_t size1, uint8_t *buf2, size_t size2)> triggerCallback = 0;
+
+	/**
+	 * true if the circular buffer has been filled at least once, so the oldest data is at offset
+	 */
+	bool wrapped = false;
+
+	/**
+	 * true if trigger() has been called
+	 */
+	bool triggered = false;
+
+	/**
+	 * Number of bytes left to record after the trigger
+	 */
+	size_t postTriggerRemaining = 0;
+};
+
+/**
+ * @brief Scatter-gather view of audio stored in fixed-size chunks
+ * 
+ * Passed to the completion callback of Microphone_PDM_BufferSampling_chunked. Chunk i holds
+ * bytes starting at i * chunkSize. All chunks are full except possibly the last.
+ */
+struct Microphone_PDM_ChunkList {
+	uint8_t **chunks;	//!< Array of numChunks pointers to chunks
+	size_t numChunks;	//!< Number of chunks
+	size_t chunkSize;	//!< Size of each chunk in bytes
+	size_t totalSize;	//!< Total size of the data in bytes
+
+	/**
+	 * @brief Get a chunk and the number of valid bytes in it
+	 * 
+	 * @param index Chunk index, 0 <= index < numChunks
+	 * 
+	 * @param size Filled in with the number of bytes of data in this chunk
+	 */
+	uint8_t *getChunk(size_t index, size_t &size) const;
+
+	/**
+	 * @brief Pass all of the data to a sink function, one chunk at a time, in order
+	 * 
+	 * @param sink Function or lambda that returns false to stop early (on error, for example)
+	 * 
+	 * @return true if every chunk was written
+	 */
+	bool writeTo(std::function<bool(const uint8_t *buf, size_t size)> sink) const;
+};
+
+/**
+ * @brief Class to configure buffer sampling into a list of fixed-size chunks
+ * 
+ * Microphone_PDM_BufferSampling allocates one buffer for the whole recording. A 10 second recording
+ * at 16000 Hz, 16-bit is 320 Kbytes, which can fail on a fragmented heap even when there is plenty 
+ * of free RAM. This class stores the data in fixed-size chunks from a Microphone_PDM_BlockPool
+ * instead, and the completion callback gets a Microphone_PDM_ChunkList.
+ * 
+ * Allocate with new and pass to Microphone_PDM::bufferSamplingStart(), the same as Microphone_PDM_BufferSampling.
+ */
+class Microphone_PDM_BufferSampling_chunked : public Microphone_PDM_BufferSampling {
+public:
+	/**
+	 * @brief Constructor - do not allocate on the stack!
+	 */
+	Microphone_PDM_BufferSampling_chunked();
+
+	/**
+	 * @brief Destructor. Returns the chunks to the pool.
+	 */
+	virtual ~Microphone_PDM_BufferSampling_chunked();
+
+	/**
+	 * @brief Set the pool to allocate chunks from (optional)
+	 * 
+	 * @param pool The pool. Must remain valid until this object is deleted. The default is
+	 * Microphone_PDM_BlockPool::defaultPool(), 4096 byte chunks from the heap.
+	 */
+	Microphone_PDM_BufferSampling_chunked &withBlockPool(Microphone_PDM_BlockPool &pool) { this->pool = &pool; return *this;};
+
+	/**
+	 * @brief Sets a callback function to call when the samples have been recorded
+	 */
+	Microphone_PDM_BufferSampling_chunked &withChunksCallback(std::function<void(const Microphone_PDM_ChunkList &chunkList)> chunksCallback) { this->chunksCallback = chunksCallback; return *this;};
+
+	/**
+	 * @brief Allocates the chunks and starts recording
+	 * 
+	 * @return false if the chunks could not be allocated. Any chunks that were allocated are returned to the pool.
+	 */
+	virtual bool start();
+
+	/**
+	 * @brief Must be called from the application loop. This is done by Microphone_PDM::loop().
+	 */
+	virtual void loop();
+
+	/**
+	 * @brief Returns true when the recording is complete
+	 */
+	virtual bool done() const;
+
+	/**
+	 * @brief Get the scatter-gather view of the data. Use after done() returns true.
+	 */
+	Microphone_PDM_ChunkList getChunkList() const;
+
+	/**
+	 * Pool that chunks are allocated from
+	 */
+	Microphone_PDM_BlockPool *pool;
+
+	/**
+	 * Array of numChunks pointers to chunks
+	 */
+	uint8_t **chunks = NULL;
+
+	/**
+	 * Number of entries in chunks
+	 */
+	size_t numChunks = 0;
+
+	/**
+	 * Callback to call when the recording is complete
+	 */
+	std::function<void(const Microphone_PDM_ChunkList &chunkList)> chunksCallback = 0;
+
+protected:
+	/**
+	 * @brief Returns all chunks to the pool
+	 */
+	void freeChunks();
+};
+
+/**
+ * @brief Class to configure continuous buffer sampling into back-to-back segments with no gaps
+ * 
+ * Recording with Microphone_PDM_BufferSampling, then starting a new one, loses the samples that arrive
+ * in between. This class owns two or more segment buffers of durationMs each. When a segment is full,
+ * recording continues into the next segment starting with the very next sample, and the full segment
+ * is passed to the completion callback (set with withCompletionCallback()).
+ * 
+ * Recording continues until you call Microphone_PDM::releaseBufferSampling(). The buffer passed to the
+ * callback is not overwritten until all of the other segments have been filled, so with the default of
+ * 2 segments you have durationMs to write it out.
+ * 
+ * The callback is called synchronously from loop(), and no DMA buffers are read until it returns. If it
+ * takes longer than the DMA buffers can hold (about 64 milliseconds with the defaults on nRF52, see
+ * MICROPHONE_PDM_NUM_BUFFERS), audio is dropped. For a slow write, such as to an SD card, pass the
+ * buffer to another thread to write and return from the callback right away.
+ * 
+ * getSamplesCaptured() and getSamplesDropped() can be used to verify that no samples were lost. Segment
+ * boundaries never lose samples; any loss is because the DMA buffers overflowed.
+ * 
+ * Allocate with new and pass to Microphone_PDM::bufferSamplingStart(), the same as Microphone_PDM_BufferSampling.
+ */
+class Microphone_PDM_BufferSampling_continuous : public Microphone_PDM_BufferSampling {
+public:
+	/**
+	 * @brief Constructor - do not allocate on the stack!
+	 */
+	Microphone_PDM_BufferSampling_continuous();
+
+	/**
+	 * @brief Destructor. Frees all segments.
+	 */
+	virtual ~Microphone_PDM_BufferSampling_continuous();
+
+	/**
+	 * @brief Set the number of segment buffers (optional, default is 2, minimum is 2)
+	 */
+	Microphone_PDM_BufferSampling_continuous &withNumSegments(size_t numSegments) { this->numSegments = (numSegments < 2) ? 2 : numSegments; return *this;};
+
+	/**
+	 * @brief Allocates the segments and starts recording
+	 */
+	virtual bool start();
+
+	/**
+	 * @brief Must be called from the application loop. This is done by Microphone_PDM::loop().
+	 * 
+	 * All available DMA buffers are processed on each call.
+	 */
+	virtual void loop();
+
+	/**
+	 * @brief Always returns false, as recording is continuous
+	 */
+	virtual bool done() const { return false; };
+
+	/**
+	 * @brief Number of samples written to segments since start()
+	 */
+	uint64_t getSamplesCaptured() const { return samplesCaptured; };
+
+	/**
+	 * @brief Number of segments passed to the completion callback since start()
+	 */
+	uint32_t getSegmentsCompleted() const { return segmentsCompleted; };
+
+	/**
+	 * @brief Number of samples dropped by the DMA since the first buffer recorded. 0 means the recording is gapless.
+	 *
+	 * This is counted from gaps in Microphone_PDM_Page::sampleIndex between the buffers this object
+	 * records, so it's not affected by other recordings or Microphone_PDM::resetStats().
+	 */
+	uint32_t getSamplesDropped() const { return samplesDropped; };
+
+	/**
+	 * Number of segment buffers
+	 */
+	size_t numSegments = 2;
+
+	/**
+	 * Array of numSegments segment buffers, each bufferSize bytes
+	 */
+	uint8_t **segments = NULL;
+
+	/**
+	 * Index into segments that is currently being recorded to
+	 */
+	size_t currentSegment = 0;
+
+	/**
+	 * Number of samples written to segments since start()
+	 */
+	uint64_t samplesCaptured = 0;
+
+	/**
+	 * Number of segments passed to the completion callback since start()
+	 */
+	uint32_t segmentsCompleted = 0;
+
+	/**
+	 * Number of samples dropped between buffers since the first buffer recorded
+	 */
+	uint32_t samplesDropped = 0;
+
+	/**
+	 * Microphone_PDM_Page::sampleIndex expected for the next buffer if none are dropped
+	 */
+	uint64_t nextSampleIndex = 0;
+
+	/**
+	 * true after the first buffer has been recorded, so nextSampleIndex is valid
+	 */
+	bool haveSampleIndex = false;
+
+protected:
+	/**
+	 * @brief Frees all segments
+	 */
+	void freeSegments();
+};
+
+/**
+ * @brief Capture integrity statistics, returned by Microphone_PDM::getStats()
+ *
+ * All counters are since init() or the last resetStats().
+ */
+struct Microphone_PDM_Stats {
+	uint32_t buffersProduced;	//!< Number of DMA buffers filled and made available to your code
+	uint32_t buffersDelivered;	//!< Number of DMA buffers consumed by copySamples(), noCopySamples(), etc.
+	uint32_t buffersDropped;	//!< Number of DMA transfers discarded because all of the DMA buffers were full
+	uint32_t samplesDropped;	//!< Number of samples lost in those discarded transfers
+	uint32_t maxQueueDepth;		//!< Largest number of buffers that were waiting to be consumed at once
+	unsigned long lastDropMs;	//!< Value of millis() when data was last dropped, or 0 if there were no drops
+};
+
+
+/**
+ * @brief Handle to a DMA buffer lent to your code by Microphone_PDM::acquireSamples()
+ *
+ * The samples have already been converted to the output size in place. The DMA will not reuse
+ * the buffer until you pass this handle to Microphone_PDM::releaseSamples().
+ */
+struct Microphone_PDM_Page {
+	void *pSamples = NULL;	//!< Pointer to the samples, in the DMA buffer
+	size_t numSamples = 0;	//!< Number of samples (not bytes!)
+	int index = -1;			//!< Which DMA buffer this is. Used internally. -1 if the handle is not valid.
+
+	/**
+	 * Number of 16-bit values captured before the first one in this buffer, counting from 0 at start().
+	 * This is the same unit as numSamples, so in stereo mode the left and right samples are counted
+	 * separately; divide by 2 to get the sample frame. Values that were dropped are counted, so if
+	 * sampleIndex is not the previous sampleIndex + numSamples there is a gap.
+	 */
+	uint64_t sampleIndex = 0;
+
+	/**
+	 * Increments by 1 for each DMA transfer since start(), including transfers that were discarded
+	 * because all buffers were full.
+	 */
+	uint32_t sequence = 0;
+
+	/**
+	 * Value of micros() when the DMA finished filling this buffer, which is the time of the last
+	 * sample. Wraps around about every 71 minutes.
+	 */
+	uint32_t timestampUs = 0;
+
+	/**
+	 * @brief Returns true if this handle refers to a DMA buffer that has not been released
+	 */
+	bool isValid() const { return index >= 0; };
+};
+
+
+/**
+ * @brief Per-subscriber statistics, returned by Microphone_PDM::getSubscriberStats()
+ */
+struct Microphone_PDM_SubscriberStats {
+	uint32_t delivered;		//!< Number of buffers passed to this subscriber
+	uint32_t dropped;		//!< Number of buffers skipped because this subscriber already held maxPending buffers
+	uint32_t pending;		//!< Number of buffers this subscriber currently holds (its lag)
+	uint32_t maxPending;	//!< Largest number of buffers this subscriber has held at once
+};
+
 
 /**
  * @brief Class used for settings. You will not instantiate one of these; it's a base class of Microphone_PDM_MCU.
@@ -177,8 +594,11 @@ protected:
 	 * is RAW_SIGNED_16, which does not do any transformation.
 	 * 
 	 * src and dst can be the same buffer to transform the data range in place.
+	 *
+	 * When dither is enabled and the output size is UNSIGNED_8, this updates the dither state
+	 * (ditherSeed and ditherError), which is why this method is not const.
 	 */
-	void copySamplesInternal(const int16_t *src, uint8_t *dst) const;
+	void copySamplesInternal(const int16_t *src, uint8_t *dst);
 
 	/**
 	 * @brief How much to increment src in copySamplesInternal. Used internally.
@@ -190,6 +610,60 @@ protected:
 	 */
 	virtual size_t copySrcIncrement() const { return 1; };
 
+	/**
+	 * @brief Called from the DMA interrupt when a buffer has been filled. Used internally.
+	 *
+	 * @param queueDepth Number of buffers waiting to be consumed, including this one
+	 */
+	void statsBufferProduced(uint32_t queueDepth);
+
+	/**
+	 * @brief Called from the DMA interrupt when data was discarded because all buffers were full. Used internally.
+	 *
+	 * @param numSamples Number of samples that were lost
+	 */
+	void statsBufferDropped(uint32_t numSamples);
+
+	/**
+	 * @brief Called when a buffer has been consumed. Used internally.
+	 */
+	void statsBufferDelivered() { statBuffersDelivered.fetch_add(1, std::memory_order_relaxed); };
+
+	/**
+	 * @brief Called from the DMA interrupt when a buffer has been filled to wake any thread waiting for samples. Used internally.
+	 */
+	void notifySamplesAvailable();
+
+	/**
+	 * @brief Sequence number, sample index, and timestamp of a DMA buffer, recorded in the DMA interrupt
+	 */
+	struct BufferInfo {
+		uint64_t sampleIndex;	//!< See Microphone_PDM_Page
+		uint32_t sequence;		//!< See Microphone_PDM_Page
+		uint32_t timestampUs;	//!< See Microphone_PDM_Page
+	};
+
+	/**
+	 * @brief Called from the DMA interrupt for each transfer. Used internally.
+	 * 
+	 * @param info Filled in with the sequence number, sample index, and current time (if not NULL)
+	 * 
+	 * @param numSamples Number of samples in the transfer, as returned by getNumberOfSamples()
+	 * 
+	 * Pass NULL for info for a transfer that was discarded so it's still counted.
+	 */
+	void tagBuffer(BufferInfo *info, size_t numSamples);
+
+	/**
+	 * @brief Copies the info for a DMA buffer into a page. Used internally.
+	 */
+	static void setPageInfo(Microphone_PDM_Page &page, const BufferInfo &info) { page.sampleIndex = info.sampleIndex; page.sequence = info.sequence; page.timestampUs = info.timestampUs; };
+
+	/**
+	 * @brief Resets the sequence number and sample index to 0. Used internally when starting.
+	 */
+	void resetTags() { nextSampleIndex = 0; nextSequence = 0; };
+
 	pin_t clkPin = A0;		//!< The pin used for the PDM clock (output)
 	pin_t datPin = A1;		//!< The pin used for the PDM data (input)
 	bool stereoMode = false;	//!< Use stereo mode (default: false, mono mode)
@@ -197,6 +671,22 @@ protected:
 	OutputSize outputSize = OutputSize::SIGNED_16;	//!< Output size (8 or 16 bits)
 	Range range = Range::RANGE_2048;				//!< Range adjustment factor
 	size_t numSamples; //!< Number of samples in the DMA buffer
+	bool dither = false;			//!< Use TPDF dither and noise shaping when converting to UNSIGNED_8
+	uint32_t ditherSeed = 0x2545f491;	//!< Random number generator state for dither, must be non-zero
+	int32_t ditherError = 0;		//!< Quantization error carried to the next sample (and next buffer) for noise shaping
+
+	os_semaphore_t samplesSemaphore = NULL;	//!< Given by the DMA interrupt when a buffer has been filled. Created by init().
+
+	uint64_t nextSampleIndex = 0;	//!< Sample index of the next DMA transfer. Only used from the DMA interrupt.
+	uint32_t nextSequence = 0;		//!< Sequence number of the next DMA transfer. Only used from the DMA interrupt.
+
+	// Statistics. These are updated from the DMA interrupt so they're atomic.
+	std::atomic<uint32_t> statBuffersProduced{0};	//!< See Microphone_PDM_Stats
+	std::atomic<uint32_t> statBuffersDelivered{0};	//!< See Microphone_PDM_Stats
+	std::atomic<uint32_t> statBuffersDropped{0};	//!< See Microphone_PDM_Stats
+	std::atomic<uint32_t> statSamplesDropped{0};	//!< See Microphone_PDM_Stats
+	std::atomic<uint32_t> statMaxQueueDepth{0};		//!< See Microphone_PDM_Stats
+	std::atomic<uint32_t> statLastDropMs{0};		//!< See Microphone_PDM_Stats
 };
 
 // This is here because the platform-specific classes derive from Microphone_PDM_Base
@@ -293,6 +783,22 @@ public:
 	 */
 	Microphone_PDM &withRange(Range range) { this->range = range; return *this; };
 
+	/**
+	 * @brief Enables dithering when converting to 8-bit samples (UNSIGNED_8)
+	 *
+	 * @param dither true to enable, false to use plain truncation (default)
+	 *
+	 * Without dither, reducing the 16-bit DMA samples to 8 bits truncates the value, which produces
+	 * audible distortion that is correlated with the signal, especially on quiet audio. With dither
+	 * enabled, a small amount of triangular (TPDF) noise is added before quantization and the
+	 * quantization error is fed back into the next sample (first-order noise shaping), which moves
+	 * the error toward high frequencies where it's less audible. The state is carried across
+	 * buffers so there are no discontinuities at buffer boundaries.
+	 *
+	 * This only affects OutputSize::UNSIGNED_8. It costs a few additional instructions per sample.
+	 */
+	Microphone_PDM &withDither(bool dither = true) { this->dither = dither; ditherError = 0; return *this; };
+
 	/**
 	 * @brief Sets the sampling rate. Default is 16000. Cannot be changed on nRF52!
 	 *
@@ -309,15 +815,44 @@ public:
 	 * This is often done from setup(). You can defer it until you're ready to sample if desired,
 	 * calling right before start().
 	 */
-	int init() {
-		return Microphone_PDM_MCU::init();
-	}
+	int init();
+
+	/**
+	 * @brief Process samples from a dedicated thread instead of loop() (optional)
+	 *
+	 * @param priority Thread priority. The default is one higher than the application thread.
+	 * 
+	 * @param stackSize Thread stack size in bytes. Your handlers run on this stack.
+	 * 
+	 * When enabled, init() creates a thread that sleeps until the DMA interrupt signals that a buffer
+	 * has been filled, then passes every available buffer to each handler added with addSamplesHandler(),
+	 * in order. Because it does not depend on loop() timing, this is much less likely to drop audio
+	 * when your application code or the system thread is busy.
+	 * 
+	 * Must be called before init(). When using the audio thread, do not also read samples from loop()
+	 * using samplesAvailable(), copySamples(), noCopySamples() or buffer sampling.
+	 */
+	Microphone_PDM &withAudioThread(os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT + 1, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT) { 
+		this->audioThreadEnabled = true; this->audioThreadPriority = priority; this->audioThreadStackSize = stackSize; return *this; 
+	};
+
+	/**
+	 * @brief Adds a function to call from the audio thread for each buffer of samples
+	 * 
+	 * @param handler Function or lambda with this prototype:
+	 * 
+	 *   void handler(const Microphone_PDM_Page &page)
+	 * 
+	 * The handler is called from the audio thread (see withAudioThread()), and the buffer is returned to the
+	 * DMA after all handlers return, so handlers should not block. Add all handlers before init().
+	 */
+	Microphone_PDM &addSamplesHandler(std::function<void(const Microphone_PDM_Page &page)> handler) { samplesHandlers.push_back(handler); return *this; };
 
 	/**
 	 * @brief Uninitialize the PDM module. Not supported on RTL872x (P2, Photon 2)!
 	 *
-	 * Releases the resources used by the PDM module, though the 2K RAM buffer is statically 
-	 * allocated on the heap and is not freed.
+	 * Releases the resources used by the PDM module, though the DMA buffers are statically 
+	 * allocated on the heap and are not freed.
 	 */
 	int uninit() {
 		return Microphone_PDM_MCU::uninit();
@@ -325,6 +860,9 @@ public:
 
 	/**
 	 * @brief Start sampling
+	 *
+	 * @return 0 on success, SYSTEM_ERROR_INVALID_STATE if a buffer from acquireSamples() has not
+	 * been released, or another error code
 	 */
 	int start() {
 		return Microphone_PDM_MCU::start();
@@ -356,7 +894,7 @@ public:
 	 * @param sampling Microphone_PDM_BufferSampling class. Must be allocated with new. Ownerships transfers to this class.
 	 * 
 	 * @return true 
-	 * @return false 
+	 * @return false The buffer could not be allocated, or sampling is NULL because the object could not be allocated
 	 * 
 	 * Added in version 0.0.2
 	 */
@@ -369,6 +907,104 @@ public:
 	void releaseBufferSampling();
 	
 
+	/**
+	 * @brief Subscribe to receive every buffer of samples, along with other subscribers
+	 * 
+	 * @param sink Function or lambda with this prototype:
+	 * 
+	 *   void sink(const Microphone_PDM_Page &page)
+	 * 
+	 * @param maxPending Maximum number of buffers this subscriber can hold at once, from 1 to MAX_PENDING 
+	 * (MAX_COPY_PENDING if copy is true). Larger values are reduced to the maximum. If it's holding this many 
+	 * when a new buffer arrives, it's skipped for that buffer and dropped is incremented in its statistics.
+	 * 
+	 * @param copy true to give this subscriber its own copy of each buffer instead of the DMA buffer. 
+	 * maxPending buffers of getBufferSizeInBytes() are allocated from the heap, so call this after init().
+	 * 
+	 * @return int Subscriber ID (0 or greater), or -1 if there are already MAX_SUBSCRIBERS subscribers 
+	 * or the copy buffers could not be allocated
+	 * 
+	 * Every subscriber receives the same buffer, converted to the output size once, without copying. 
+	 * The sink must call releaseSubscribedSamples() with its subscriber ID and the page when it's done, 
+	 * which can be later and from another thread. The buffer is returned to the DMA after every 
+	 * subscriber has released it.
+	 * 
+	 * The DMA reuses the buffers in order, so a buffer that one subscriber holds keeps every later 
+	 * buffer from going back to the DMA, even after the other subscribers release them. If a zero-copy 
+	 * subscriber holds a buffer for longer than about MAX_PENDING buffer periods, the DMA runs out of 
+	 * buffers and audio is dropped for all subscribers (see getStats()). A subscriber that may take 
+	 * longer, such as an SD card write, should pass true for copy. Its page points to its own buffer 
+	 * and the DMA buffer is not held, so if it falls behind only it misses buffers (counted in its 
+	 * dropped statistic) and the other subscribers still have the whole ring.
+	 * 
+	 * Buffers are dispatched from the audio thread if withAudioThread() is used, otherwise from loop().
+	 * Do not also read samples using copySamples(), noCopySamples(), or buffer sampling.
+	 */
+	int subscribe(std::function<void(const Microphone_PDM_Page &page)> sink, size_t maxPending = 1, bool copy = false);
+
+	/**
+	 * @brief Stop delivering buffers to a subscriber
+	 * 
+	 * @param subscriberId Value returned from subscribe()
+	 * 
+	 * Buffers it holds must still be released with releaseSubscribedSamples(). The subscriber ID is not 
+	 * reused until they have been. This can be called from any thread, including from the sink.
+	 */
+	void unsubscribe(int subscriberId);
+
+	/**
+	 * @brief Release a buffer passed to a subscriber
+	 * 
+	 * @param subscriberId Value returned from subscribe()
+	 * 
+	 * @param page The page passed to the subscriber's sink function
+	 * 
+	 * This can be called from any thread.
+	 */
+	void releaseSubscribedSamples(int subscriberId, const Microphone_PDM_Page &page);
+
+	/**
+	 * @brief Get statistics for a subscriber, including its lag
+	 * 
+	 * @param subscriberId Value returned from subscribe()
+	 * 
+	 * This can be called from any thread.
+	 */
+	Microphone_PDM_SubscriberStats getSubscriberStats(int subscriberId) const;
+
+	/**
+	 * @brief Maximum number of subscribers
+	 */
+	static const size_t MAX_SUBSCRIBERS = 4;
+
+	/**
+	 * @brief Largest maxPending value for subscribe()
+	 * 
+	 * Two of the ring buffers belong to the DMA, so this is how many filled buffers can be held 
+	 * without the DMA running out.
+	 */
+	static const size_t MAX_PENDING = (Microphone_PDM_MCU::NUM_BUFFERS > 2) ? (Microphone_PDM_MCU::NUM_BUFFERS - 2) : 1;
+
+	/**
+	 * @brief Largest maxPending value for subscribe() with copy set
+	 */
+	static const size_t MAX_COPY_PENDING = 32;
+
+	/**
+	 * @brief Use an arena for buffer sampling objects and buffers instead of the heap (optional)
+	 * 
+	 * @param arena The arena, typically a global Microphone_PDM_StaticArena. Must remain valid.
+	 * 
+	 * This must be set before you allocate any Microphone_PDM_BufferSampling objects and not changed
+	 * afterwards. If an object or buffer does not fit in the arena, allocation fails; the heap is not used.
+	 */
+	Microphone_PDM &withArena(Microphone_PDM_Arena &arena) { this->arena = &arena; return *this; };
+
+	/**
+	 * @brief Get the arena set by withArena(), or NULL if the heap is used
+	 */
+	Microphone_PDM_Arena *getArena() const { return arena; };
+
 	/**
 	 * @brief Get the Microphone_PDM_BufferSampling object if it has been set by bufferSamplingStart
 	 * 
@@ -399,8 +1035,10 @@ public:
 	 * 8000 Hz, it will be 256 samples because the hardware only samples at 16000 Hz but the code
 	 * will automatically discard every other sample so there will only be 256 samples.
 	 * 
-	 * On the RTL872x, it's 256 samples (512 bytes). It's smaller because the are 4 buffers instead of the
-	 * 2 buffers used on the nRF52, and the optimal DMA size on the RTL872x is 512 bytes.
+	 * On the RTL872x, it's 256 samples (512 bytes), as the optimal DMA size on the RTL872x is 512 bytes.
+	 * 
+	 * The buffer size can be changed at compile time by defining MICROPHONE_PDM_BUFFER_SIZE_SAMPLES, and
+	 * the number of buffers by defining MICROPHONE_PDM_NUM_BUFFERS.
 	 */
 	size_t getNumberOfSamples() const {
 		return Microphone_PDM_MCU::getNumberOfSamples();
@@ -422,6 +1060,39 @@ public:
 		return Microphone_PDM_MCU::copySamples(pSamples);
 	}
 
+	/**
+	 * @brief Wait for samples to become available, blocking the calling thread
+	 * 
+	 * @param timeoutMs Maximum time to wait in milliseconds. Pass CONCURRENT_WAIT_FOREVER to wait forever.
+	 * 
+	 * @return true Samples are available
+	 * @return false The timeout expired, or init() has not been called
+	 * 
+	 * Instead of spinning on samplesAvailable(), this blocks on a semaphore that is signaled by the DMA
+	 * interrupt, so the thread does not use any CPU while waiting and the MCU can sleep between DMA
+	 * transfers. This is intended to be called from a worker thread. Calling it from loop() with a long
+	 * timeout will delay loop() processing.
+	 * 
+	 * Only one thread should wait at a time, and this should not be used with withAudioThread().
+	 */
+	bool waitForSamples(system_tick_t timeoutMs);
+
+	/**
+	 * @brief Wait for samples to become available, then copy them to your buffer
+	 * 
+	 * @param pSamples Pointer to buffer to copy samples to. It must be at least getNumberOfSamples() samples in length.
+	 * 
+	 * @param timeoutMs Maximum time to wait in milliseconds. Pass CONCURRENT_WAIT_FOREVER to wait forever.
+	 * 
+	 * @return true Samples were copied
+	 * @return false The timeout expired. Your buffer is unmodified.
+	 * 
+	 * This is the same as waitForSamples() followed by copySamples().
+	 */
+	bool copySamples(void *pSamples, system_tick_t timeoutMs) {
+		return waitForSamples(timeoutMs) && copySamples(pSamples);
+	}
+
 	/**
 	 * @brief Alternative API to get samples
 	 *
@@ -447,6 +1118,54 @@ public:
 		return Microphone_PDM_MCU::noCopySamples(callback);
 	}
 
+	/**
+	 * @brief Alternative API to get samples, with the sequence number, sample index, and timestamp
+	 *
+	 * @param callback Callback function or lambda
+	 *  
+	 * @return true 
+	 * @return false 
+	 * 
+	 * This is the same as noCopySamples(), except the callback has this prototype:
+	 * 
+	 *   void callback(const Microphone_PDM_Page &page)
+	 * 
+	 * page.pSamples and page.numSamples are the samples. page.sampleIndex, page.sequence, and page.timestampUs
+	 * are recorded in the DMA interrupt when the buffer is filled, so they can be used to align the audio with
+	 * other sensors and to detect discontinuities.
+	 */
+	bool noCopySamplesWithInfo(std::function<void(const Microphone_PDM_Page &page)> callback);
+
+	/**
+	 * @brief Borrow the oldest DMA buffer without copying it
+	 *
+	 * @param page Filled in with the handle to the buffer
+	 *
+	 * @return true A buffer was available and page was filled in
+	 * @return false There were no samples available
+	 *
+	 * Unlike noCopySamples(), you don't have to finish with the samples before returning. You can hold
+	 * the buffer, for example while an asynchronous network write completes, and call releaseSamples()
+	 * later. You can hold more than one buffer and release them in any order, however the DMA reuses
+	 * buffers in the order they were captured, so any buffer you hold reduces the number available
+	 * for new samples. If you hold them all, new samples will be dropped.
+	 *
+	 * Release all buffers before calling start() again. start() fails with SYSTEM_ERROR_INVALID_STATE
+	 * while any buffer is still held.
+	 */
+	bool acquireSamples(Microphone_PDM_Page &page) {
+		return Microphone_PDM_MCU::acquireSamples(page);
+	}
+
+	/**
+	 * @brief Return a buffer borrowed using acquireSamples()
+	 *
+	 * @param page The handle filled in by acquireSamples(). It's invalidated by this call.
+	 */
+	void releaseSamples(Microphone_PDM_Page &page) {
+		Microphone_PDM_MCU::releaseSamples(page);
+	}
+
 	/**
 	 * @brief Get the sample size in bytes
 	 * 
@@ -487,6 +1206,24 @@ public:
 	 */
 	uint8_t getBitsPerSample() const { return (uint8_t) getSampleSizeInBytes() * 8; };
 
+	/**
+	 * @brief Get capture integrity statistics
+	 *
+	 * @return Microphone_PDM_Stats Snapshot of the counters
+	 *
+	 * When your code does not consume buffers quickly enough, the DMA has nowhere to put new samples
+	 * and they're discarded. This is reflected in buffersDropped, samplesDropped, and lastDropMs.
+	 * The maxQueueDepth shows how close you've come to dropping data. 
+	 *
+	 * This is safe to call at any time. The counters are updated from the DMA interrupt.
+	 */
+	Microphone_PDM_Stats getStats() const;
+
+	/**
+	 * @brief Resets all of the counters returned by getStats() to 0
+	 */
+	void resetStats();
+
 protected:
 	/**
 	 * @brief Allocate a Microphone_PDM object for using the hardware PDM decoder
@@ -514,11 +1251,70 @@ protected:
 	 */
 	Microphone_PDM_BufferSampling *sampling = 0;
 
+	/**
+	 * Arena for buffer sampling objects and buffers, or NULL to use the heap
+	 */
+	Microphone_PDM_Arena *arena = NULL;
+
+	/**
+	 * @brief Runs the audio thread. Used internally.
+	 */
+	void audioThreadFunction();
+
+	/**
+	 * @brief Audio thread entry point (static function). Used internally.
+	 */
+	static void audioThreadFunctionStatic(void *param);
+
+	bool audioThreadEnabled = false;		//!< Set by withAudioThread()
+	os_thread_prio_t audioThreadPriority;	//!< Set by withAudioThread()
+	size_t audioThreadStackSize;			//!< Set by withAudioThread()
+	os_thread_t audioThread = NULL;			//!< The audio thread, created by init()
+
+	/**
+	 * Functions called from the audio thread for each buffer, added by addSamplesHandler()
+	 */
+	std::vector<std::function<void(const Microphone_PDM_Page &page)>> samplesHandlers;
+
+	/**
+	 * @brief Passes a buffer to the samples handlers and subscribers, then releases our reference to it. Used internally.
+	 */
+	void dispatchPage(Microphone_PDM_Page &page);
+
+	/**
+	 * @brief Releases one reference to a subscribed buffer. Used internally.
+	 */
+	void releasePageReference(int index);
+
+	/**
+	 * @brief State for each subscriber
+	 * 
+	 * Everything except pending and copyInUse is protected by subscribersMutex.
+	 */
+	struct Subscriber {
+		std::function<void(const Microphone_PDM_Page &page)> sink;	//!< Function to call, or empty if this slot is not in use
+		uint32_t maxPending = 1;					//!< Slow-subscriber limit
+		std::atomic<uint32_t> pending{0};			//!< Buffers currently held, decremented from any thread
+		uint32_t delivered = 0;						//!< See Microphone_PDM_SubscriberStats
+		uint32_t dropped = 0;						//!< See Microphone_PDM_SubscriberStats
+		uint32_t maxPendingSeen = 0;				//!< See Microphone_PDM_SubscriberStats
+		uint8_t *copyBuffers = NULL;				//!< maxPending buffers of copyBufferSize bytes, or NULL if this subscriber does not copy
+		size_t copyBufferSize = 0;					//!< Size of each copy buffer in bytes
+		std::atomic<uint32_t> copyInUse{0};			//!< Bit for each copy buffer that is pending, cleared from any thread
+	};
+
+	Subscriber subscribers[MAX_SUBSCRIBERS];	//!< Subscribers, indexed by subscriber ID
+	std::atomic<size_t> numSubscribers{0};		//!< Number of active subscribers
+	os_mutex_recursive_t subscribersMutex = NULL;	//!< Held while dispatching and changing subscribers. Created by the first subscribe().
+
+	Microphone_PDM_Page subscribedPages[Microphone_PDM_MCU::NUM_BUFFERS];		//!< Page for each DMA buffer being held by subscribers
+	std::atomic<uint32_t> pageRefCount[Microphone_PDM_MCU::NUM_BUFFERS] = {};		//!< Number of references to each DMA buffer
+
 	/**
 	 * @brief Singleton instance of this class
 	 *
 	 * Since there is only one PDM decoder on the nRF52 you must create only one instance of this class
-	 * (typically as a global variable).
+	 * (typically as a global variable). It's constructed in static storage, not on the heap.
 	 */
 	static Microphone_PDM *_instance;
 };
@@ -0,0 +1,335 @@
+#ifndef __Microphone_PDM_Pipeline_H
+#define __Microphone_PDM_Pipeline_H
+
+#include "Microphone_PDM.h"
+
+#include <math.h>
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief Base class for stages that process a whole buffer at a time
+ *
+ * Most stages work on one sample at a time: any object or lambda with the prototype
+ *
+ *   int32_t operator()(int32_t sample)
+ *
+ * is a per-sample stage. Derive from this class instead when the stage needs the whole buffer,
+ * for example an FFT or an encoder. Block stages have the prototype:
+ *
+ *   void operator()(int16_t *pSamples, size_t numSamples)
+ *
+ * Per-sample stages on either side of a block stage are fused separately, so each block stage
+ * costs one additional pass over the buffer.
+ */
+class Microphone_PDM_BlockStage {
+};
+
+/**
+ * @brief Per-sample stage that multiplies each sample by a constant
+ *
+ * The gain is stored as 20.12 fixed-point so it costs one multiply and one shift per sample. The
+ * multiply is 64-bit, because samples between fused stages can be larger than 16 bits, and the
+ * result is saturated to 32 bits.
+ */
+class Microphone_PDM_Stage_gain {
+public:
+	/**
+	 * @brief Construct a gain stage
+	 *
+	 * @param gain Multiplier, for example 2.0 for +6 dB. Can be negative to invert. The magnitude must
+	 * be less than 524288 (2^19) so the fixed-point value fits in 32 bits; larger values are limited to that.
+	 */
+	explicit Microphone_PDM_Stage_gain(float gain) : gainQ12(toQ12(gain)) {};
+
+	int32_t operator()(int32_t sample) const {
+		int64_t result = ((int64_t)sample * gainQ12) >> 12;
+
+		if (result > INT32_MAX) {
+			return INT32_MAX;
+		}
+		if (result < INT32_MIN) {
+			return INT32_MIN;
+		}
+		return (int32_t) result;
+	}
+
+protected:
+	/**
+	 * @brief Converts a gain to 20.12 fixed-point, rounded to the nearest value and limited to 32 bits
+	 */
+	static int32_t toQ12(float gain) {
+		float scaled = gain * 4096.0f;
+
+		if (scaled >= 2147483647.0f) {
+			return INT32_MAX;
+		}
+		if (scaled <= -2147483648.0f) {
+			return INT32_MIN;
+		}
+		return (int32_t) lroundf(scaled);
+	}
+
+	int32_t gainQ12; //!< Gain multiplied by 4096
+};
+
+/**
+ * @brief Per-sample stage that removes the DC offset
+ *
+ * This is a one-pole high-pass filter y[n] = x[n] - x[n-1] + R * y[n-1]. With the default
+ * R of 0.995, the cutoff is about 13 Hz at 16000 Hz.
+ *
+ * The filter has state, so for stereo pass numChannels = 2. It then keeps separate state for the
+ * left and right channels, alternating between them on each sample. This relies on every buffer
+ * starting with a left sample and having an even number of samples, which is always true of the
+ * buffers from Microphone_PDM.
+ */
+class Microphone_PDM_Stage_dcBlock {
+public:
+	static const size_t MAX_CHANNELS = 2; //!< Stereo
+
+	/**
+	 * @brief Construct a DC blocking stage
+	 *
+	 * @param pole R, between 0 and 1. Closer to 1 lowers the cutoff frequency but settles more slowly.
+	 *
+	 * @param numChannels 1 for mono (the default) or 2 for interleaved stereo
+	 */
+	explicit Microphone_PDM_Stage_dcBlock(float pole = 0.995f, size_t numChannels = 1) :
+		poleQ15((int32_t)lroundf(pole * 32768.0f)), numChannels((numChannels == MAX_CHANNELS) ? MAX_CHANNELS : 1) {};
+
+	int32_t operator()(int32_t sample) {
+		State &state = channelState[channel];
+		if (++channel >= numChannels) {
+			channel = 0;
+		}
+
+		int32_t out = sample - state.lastIn + (int32_t)(((int64_t)state.lastOut * poleQ15) >> 15);
+		state.lastIn = sample;
+		state.lastOut = out;
+		return out;
+	}
+
+protected:
+	/**
+	 * @brief Filter state for one channel
+	 */
+	struct State {
+		int32_t lastIn = 0;		//!< x[n-1]
+		int32_t lastOut = 0;	//!< y[n-1]
+	};
+
+	int32_t poleQ15;					//!< R multiplied by 32768
+	size_t numChannels;					//!< 1 or 2
+	size_t channel = 0;					//!< Channel of the next sample
+	State channelState[MAX_CHANNELS];	//!< State for each channel
+};
+
+/**
+ * @brief Per-sample stage that limits samples to +/- limit
+ */
+class Microphone_PDM_Stage_clip {
+public:
+	explicit Microphone_PDM_Stage_clip(int32_t limit) : limit(limit) {};
+
+	int32_t operator()(int32_t sample) const {
+		return (sample > limit) ? limit : ((sample < -limit) ? -limit : sample);
+	}
+
+protected:
+	int32_t limit; //!< Largest magnitude allowed
+};
+
+/**
+ * @brief Source that takes buffers from the Microphone_PDM singleton
+ *
+ * This is the default source for Microphone_PDM_Pipeline. A custom source needs the same three methods.
+ */
+class Microphone_PDM_PipelineSource {
+public:
+	bool acquire(Microphone_PDM_Page &page) {
+		return Microphone_PDM::instance().acquireSamples(page);
+	}
+	void release(Microphone_PDM_Page &page) {
+		Microphone_PDM::instance().releaseSamples(page);
+	}
+	size_t getSampleSizeInBytes() const {
+		return Microphone_PDM::instance().getSampleSizeInBytes();
+	}
+};
+
+/**
+ * @brief A chain of processing stages between a source of buffers and a sink, composed at compile time
+ *
+ * @tparam Source Where the buffers come from, normally Microphone_PDM_PipelineSource
+ * @tparam Sink Callable with the prototype void sink(const Microphone_PDM_Page &page)
+ * @tparam Stages Per-sample stages and block stages (Microphone_PDM_BlockStage), run in order
+ *
+ * Each run of adjacent per-sample stages is fused into a single loop over the DMA buffer. The
+ * stages are inlined into that loop, so a chain of gain, DC block, and clip reads and writes each
+ * sample once instead of three times. Samples are 32-bit between fused stages and are only
+ * saturated to 16 bits when stored, so an intermediate stage can exceed 16 bits without clipping.
+ *
+ * Stages run in place on the DMA buffer, after it has been converted by the Microphone_PDM settings,
+ * and only work on 16-bit samples, so use OutputSize::SIGNED_16 or RAW_SIGNED_16. With 8-bit output,
+ * loop() does not take any buffers and returns 0. Stages with state, such as
+ * Microphone_PDM_Stage_dcBlock, need to be told the number of channels for stereo.
+ *
+ * You will normally create one using Microphone_PDM_makePipeline() and call its loop() method from
+ * loop(), or from an audio thread. Don't also read samples using copySamples() or an audio thread
+ * handler, as each buffer only goes to one of them.
+ *
+ * ```
+ * auto pipeline = Microphone_PDM_makePipeline(
+ *     [](const Microphone_PDM_Page &page) { client.write((const uint8_t *)page.pSamples, page.numSamples * 2); },
+ *     Microphone_PDM_Stage_dcBlock(),
+ *     Microphone_PDM_Stage_gain(4.0),
+ *     Microphone_PDM_Stage_clip(30000));
+ * ```
+ */
+template<class Source, class Sink, class... Stages>
+class Microphone_PDM_Pipeline {
+public:
+	static constexpr size_t NUM_STAGES = sizeof...(Stages); //!< Number of stages, not including the source and sink
+
+	/**
+	 * @brief Construct a pipeline. Normally you use Microphone_PDM_makePipeline() instead.
+	 */
+	Microphone_PDM_Pipeline(Source source, Sink sink, Stages... stages) :
+		source(std::move(source)), sink(std::move(sink)), stages(std::move(stages)...) {};
+
+	/**
+	 * @brief Process all buffers that are available from the source
+	 *
+	 * @return size_t Number of buffers passed to the sink. Always 0 if the source's samples are
+	 * not 16-bit.
+	 */
+	size_t loop() {
+		size_t count = 0;
+		Microphone_PDM_Page page;
+
+		if (source.getSampleSizeInBytes() != 2) {
+			// Refuse 8-bit samples instead of passing them to the sink without running the stages
+			return 0;
+		}
+
+		while(source.acquire(page)) {
+			process((int16_t *)page.pSamples, page.numSamples);
+			sink(page);
+			source.release(page);
+			count++;
+		}
+		return count;
+	}
+
+	/**
+	 * @brief Run the stages in place on a buffer of samples, without the source or sink
+	 *
+	 * @param pSamples Samples to process
+	 *
+	 * @param numSamples Number of samples (not bytes!)
+	 *
+	 * This is useful for running the same chain on samples from somewhere else, such as a file.
+	 */
+	void process(int16_t *pSamples, size_t numSamples) {
+		runFrom(pSamples, numSamples, std::integral_constant<size_t, 0>());
+	}
+
+	/**
+	 * @brief Get a stage so you can change its settings
+	 *
+	 * @tparam I Index of the stage, 0 is the first stage after the source
+	 */
+	template<size_t I>
+	typename std::tuple_element<I, std::tuple<Stages...>>::type &getStage() {
+		return std::get<I>(stages);
+	}
+
+	/**
+	 * @brief Get the sink
+	 */
+	Sink &getSink() { return sink; };
+
+protected:
+	template<size_t I>
+	using IsBlock = std::is_base_of<Microphone_PDM_BlockStage, typename std::tuple_element<I, std::tuple<Stages...>>::type>;
+
+	/**
+	 * @brief Index of the first block stage at or after I, or NUM_STAGES if there is none
+	 */
+	template<size_t I, bool AtEnd = (I >= NUM_STAGES)>
+	struct RunEnd {
+		static constexpr size_t value = IsBlock<I>::value ? I : RunEnd<I + 1>::value;
+	};
+	template<size_t I>
+	struct RunEnd<I, true> {
+		static constexpr size_t value = NUM_STAGES;
+	};
+
+	// All stages have been run
+	void runFrom(int16_t *, size_t, std::integral_constant<size_t, NUM_STAGES>) {
+	}
+
+	// Run stage I, if it's a block stage, or the run of per-sample stages that starts at I, then the rest
+	template<size_t I>
+	void runFrom(int16_t *pSamples, size_t numSamples, std::integral_constant<size_t, I>) {
+		runStage<I>(pSamples, numSamples, std::integral_constant<bool, IsBlock<I>::value>());
+	}
+
+	template<size_t I>
+	void runStage(int16_t *pSamples, size_t numSamples, std::true_type) {
+		std::get<I>(stages)(pSamples, numSamples);
+		runFrom(pSamples, numSamples, std::integral_constant<size_t, I + 1>());
+	}
+
+	template<size_t I>
+	void runStage(int16_t *pSamples, size_t numSamples, std::false_type) {
+		constexpr size_t END = RunEnd<I>::value;
+
+		// The fused pass: one load and one store per sample for all of the stages from I to END
+		for(size_t ii = 0; ii < numSamples; ii++) {
+			int32_t sample = applyRun(pSamples[ii], std::integral_constant<size_t, I>(), std::integral_constant<size_t, END>());
+
+			if (sample > 32767) {
+				sample = 32767;
+			}
+			else if (sample < -32768) {
+				sample = -32768;
+			}
+			pSamples[ii] = (int16_t) sample;
+		}
+		runFrom(pSamples, numSamples, std::integral_constant<size_t, END>());
+	}
+
+	template<size_t END>
+	int32_t applyRun(int32_t sample, std::integral_constant<size_t, END>, std::integral_constant<size_t, END>) {
+		return sample;
+	}
+
+	template<size_t I, size_t END>
+	int32_t applyRun(int32_t sample, std::integral_constant<size_t, I>, std::integral_constant<size_t, END>) {
+		return applyRun(std::get<I>(stages)(sample), std::integral_constant<size_t, I + 1>(), std::integral_constant<size_t, END>());
+	}
+
+	Source source;					//!< Where buffers come from
+	Sink sink;						//!< Where processed buffers go
+	std::tuple<Stages...> stages;	//!< The stages, in order
+};
+
+/**
+ * @brief Create a pipeline that takes buffers from the Microphone_PDM singleton
+ *
+ * @param sink Callable with the prototype void sink(const Microphone_PDM_Page &page)
+ *
+ * @param stages Zero or more per-sample or block stages, run in order
+ *
+ * @return The pipeline. Use auto for the type, as it depends on the stages.
+ */
+template<class Sink, class... Stages>
+Microphone_PDM_Pipeline<Microphone_PDM_PipelineSource, Sink, Stages...> Microphone_PDM_makePipeline(Sink sink, Stages... stages) {
+	return Microphone_PDM_Pipeline<Microphone_PDM_PipelineSource, Sink, Stages...>(Microphone_PDM_PipelineSource(), std::move(sink), std::move(stages)...);
+}
+
+#endif /* __Microphone_PDM_Pipeline_H */
@@ -0,0 +1,127 @@
+#include "Microphone_PDM_Pool.h"
+
+Microphone_PDM_BlockPool::Microphone_PDM_BlockPool(size_t blockSize) : blockSize((blockSize + 3) & ~(size_t)3) {
+}
+
+Microphone_PDM_BlockPool::Microphone_PDM_BlockPool(size_t blockSize, uint8_t *mem, size_t memSize) : 
+	blockSize((blockSize + 3) & ~(size_t)3), mem(mem), memSize(memSize) {
+
+	// Blocks are carved from mem, so make sure the first one is aligned
+	size_t misalignment = (uintptr_t)mem & 3;
+	if (misalignment) {
+		memOffset = 4 - misalignment;
+	}
+}
+
+Microphone_PDM_BlockPool::~Microphone_PDM_BlockPool() {
+	releaseFreeBlocks();
+}
+
+uint8_t *Microphone_PDM_BlockPool::alloc() {
+	uint8_t *block = NULL;
+
+	if (freeList) {
+		block = (uint8_t *)freeList;
+		freeList = freeList->next;
+	}
+	else if (mem) {
+		if (memOffset + blockSize <= memSize) {
+			block = &mem[memOffset];
+			memOffset += blockSize;
+		}
+	}
+	else {
+		block = new uint8_t[blockSize];
+	}
+
+	if (block) {
+		if (++numAllocated > peakAllocated) {
+			peakAllocated = numAllocated;
+		}
+	}
+	else {
+		allocFailures++;
+	}
+	return block;
+}
+
+void Microphone_PDM_BlockPool::free(uint8_t *block) {
+	if (block) {
+		FreeBlock *freeBlock = (FreeBlock *)block;
+		freeBlock->next = freeList;
+		freeList = freeBlock;
+
+		numAllocated--;
+	}
+}
+
+void Microphone_PDM_BlockPool::releaseFreeBlocks() {
+	if (mem) {
+		return;
+	}
+
+	while(freeList) {
+		FreeBlock *next = freeList->next;
+		delete[] (uint8_t *)freeList;
+		freeList = next;
+	}
+}
+
+// [static]
+Microphone_PDM_BlockPool &Microphone_PDM_BlockPool::defaultPool() {
+	static Microphone_PDM_BlockPool pool(DEFAULT_BLOCK_SIZE);
+	return pool;
+}
+
+
+Microphone_PDM_Arena::Microphone_PDM_Arena(uint8_t *mem, size_t memSize) : 
+	objectPool(OBJECT_SLOT_SIZE, mem, (memSize < NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE) ? memSize : NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE) {
+
+	if (memSize > NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE) {
+		dataMem = &mem[NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE];
+		dataSize = memSize - NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE;
+	}
+	else {
+		dataMem = NULL;
+		dataSize = 0;
+	}
+}
+
+Microphone_PDM_Arena::~Microphone_PDM_Arena() {
+}
+
+void *Microphone_PDM_Arena::allocObject(size_t size) {
+	if (size > OBJECT_SLOT_SIZE) {
+		allocFailures++;
+		return NULL;
+	}
+	return objectPool.alloc();
+}
+
+uint8_t *Microphone_PDM_Arena::allocBuffer(size_t size) {
+	// Keep buffers 8-byte aligned
+	size = (size + 7) & ~(size_t)7;
+
+	if (size > dataSize - dataOffset) {
+		allocFailures++;
+		return NULL;
+	}
+
+	uint8_t *buf = &dataMem[dataOffset];
+	dataOffset += size;
+	numBuffers++;
+
+	if (dataOffset > peakBufferBytes) {
+		peakBufferBytes = dataOffset;
+	}
+	return buf;
+}
+
+void Microphone_PDM_Arena::freeBuffer(uint8_t *buf) {
+	if (buf && numBuffers > 0) {
+		if (--numBuffers == 0) {
+			// Everything has been freed, start over at the beginning
+			dataOffset = 0;
+		}
+	}
+}
@@ -0,0 +1,256 @@
+#ifndef __Microphone_PDM_Pool_H
+#define __Microphone_PDM_Pool_H
+
+#include "Particle.h"
+
+/**
+ * @brief Allocator for fixed-size blocks of memory
+ * 
+ * Used for chunked buffer sampling (Microphone_PDM_BufferSampling_chunked). Allocating many small
+ * blocks succeeds on a fragmented heap where one large allocation would fail, and blocks are kept
+ * on a free list when released so repeated recordings reuse the same memory instead of fragmenting
+ * the heap further.
+ * 
+ * Blocks come from the heap, one at a time as needed, unless you pass a region of memory to the
+ * constructor, in which case blocks are only carved from that region.
+ * 
+ * This class is not thread-safe. Allocate and free blocks from the same thread.
+ */
+class Microphone_PDM_BlockPool {
+public:
+	/**
+	 * @brief Construct a pool that allocates blocks from the heap
+	 * 
+	 * @param blockSize Size of each block in bytes. Rounded up to a multiple of 4.
+	 */
+	explicit Microphone_PDM_BlockPool(size_t blockSize);
+
+	/**
+	 * @brief Construct a pool that allocates blocks only from a region of memory you provide
+	 * 
+	 * @param blockSize Size of each block in bytes. Rounded up to a multiple of 4.
+	 * 
+	 * @param mem Pointer to the memory. Must remain valid for the life of this object.
+	 * 
+	 * @param memSize Size of mem in bytes. The pool holds memSize / blockSize blocks.
+	 */
+	Microphone_PDM_BlockPool(size_t blockSize, uint8_t *mem, size_t memSize);
+
+	/**
+	 * @brief Destructor. Heap blocks on the free list are released. Blocks still allocated are not.
+	 */
+	virtual ~Microphone_PDM_BlockPool();
+
+	/**
+	 * @brief Allocate a block
+	 * 
+	 * @return uint8_t* Pointer to getBlockSize() bytes, or NULL if no memory is available
+	 */
+	uint8_t *alloc();
+
+	/**
+	 * @brief Return a block allocated by alloc() to the pool
+	 */
+	void free(uint8_t *block);
+
+	/**
+	 * @brief Release heap blocks on the free list back to the heap
+	 * 
+	 * Does nothing for a pool that uses memory you provided.
+	 */
+	void releaseFreeBlocks();
+
+	/**
+	 * @brief Returns true if block is in the memory region passed to the constructor
+	 */
+	bool owns(const void *block) const { return mem && (const uint8_t *)block >= mem && (const uint8_t *)block < &mem[memSize]; };
+
+	/**
+	 * @brief Size of each block in bytes
+	 */
+	size_t getBlockSize() const { return blockSize; };
+
+	/**
+	 * @brief Number of blocks currently allocated
+	 */
+	size_t getNumAllocated() const { return numAllocated; };
+
+	/**
+	 * @brief Largest number of blocks that were allocated at once
+	 */
+	size_t getPeakAllocated() const { return peakAllocated; };
+
+	/**
+	 * @brief Number of times alloc() returned NULL
+	 */
+	size_t getAllocFailures() const { return allocFailures; };
+
+	/**
+	 * @brief Get the pool used by default for chunked buffer sampling (4096 byte blocks from the heap)
+	 */
+	static Microphone_PDM_BlockPool &defaultPool();
+
+	/**
+	 * @brief Block size of the default pool
+	 */
+	static const size_t DEFAULT_BLOCK_SIZE = 4096;
+
+protected:
+	/**
+	 * @brief This class cannot be copied
+	 */
+	Microphone_PDM_BlockPool(const Microphone_PDM_BlockPool&) = delete;
+
+	/**
+	 * @brief This class cannot be copied
+	 */
+	Microphone_PDM_BlockPool& operator=(const Microphone_PDM_BlockPool&) = delete;
+
+	/**
+	 * @brief Free blocks are linked through their first bytes
+	 */
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	size_t blockSize;			//!< Size of each block in bytes
+	uint8_t *mem = NULL;		//!< Memory region to carve blocks from, or NULL to use the heap
+	size_t memSize = 0;			//!< Size of mem in bytes
+	size_t memOffset = 0;		//!< Offset in mem of the next block that has never been allocated
+	FreeBlock *freeList = NULL;	//!< Blocks that have been freed and can be reused
+	size_t numAllocated = 0;	//!< Number of blocks currently allocated
+	size_t peakAllocated = 0;	//!< Largest value of numAllocated
+	size_t allocFailures = 0;	//!< Number of times alloc() returned NULL
+};
+
+/**
+ * @brief Memory for buffer sampling objects and their buffers, so buffer sampling does not use the heap
+ * 
+ * Normally each bufferSamplingStart() allocates a Microphone_PDM_BufferSampling object and its
+ * data buffer on the heap, and releaseBufferSampling() deletes them. On a device that runs for a
+ * long time, repeated recordings can fragment the heap. If you pass an arena to 
+ * Microphone_PDM::withArena(), the objects and buffers come from the arena instead:
+ * 
+ * - Objects are allocated from NUM_OBJECT_SLOTS fixed slots of OBJECT_SLOT_SIZE bytes at the start of
+ * the arena. Two are needed because the new object is allocated before the old one is released.
+ * - Data buffers are allocated sequentially from the rest of the arena. When all buffers have been freed
+ * the arena is reset, so each recording starts at the beginning again.
+ * 
+ * Both allocating and freeing take constant time, and the arena never fragments. If an allocation does
+ * not fit, it fails rather than using the heap.
+ * 
+ * The easiest way to create one is as a global variable using Microphone_PDM_StaticArena.
+ */
+class Microphone_PDM_Arena {
+public:
+	/**
+	 * @brief Construct an arena using memory you provide
+	 * 
+	 * @param mem Pointer to the memory. Must be 8-byte aligned and remain valid for the life of this object.
+	 * 
+	 * @param memSize Size of mem in bytes. Must be larger than NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE to hold any buffers.
+	 */
+	Microphone_PDM_Arena(uint8_t *mem, size_t memSize);
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~Microphone_PDM_Arena();
+
+	/**
+	 * @brief Allocate an object slot. Used by Microphone_PDM_BufferSampling::operator new.
+	 * 
+	 * @return Pointer to the slot, or NULL if size is larger than OBJECT_SLOT_SIZE or all slots are in use
+	 */
+	void *allocObject(size_t size);
+
+	/**
+	 * @brief Free an object slot allocated by allocObject()
+	 */
+	void freeObject(void *ptr) { objectPool.free((uint8_t *)ptr); };
+
+	/**
+	 * @brief Returns true if ptr was allocated by allocObject()
+	 */
+	bool ownsObject(const void *ptr) const { return objectPool.owns(ptr); };
+
+	/**
+	 * @brief Allocate a data buffer
+	 * 
+	 * @return Pointer to the buffer (8-byte aligned) or NULL if there is not enough space
+	 */
+	uint8_t *allocBuffer(size_t size);
+
+	/**
+	 * @brief Free a data buffer allocated by allocBuffer()
+	 * 
+	 * The space is only reused after all buffers have been freed.
+	 */
+	void freeBuffer(uint8_t *buf);
+
+	/**
+	 * @brief Returns true if buf was allocated by allocBuffer()
+	 */
+	bool ownsBuffer(const void *buf) const { return (const uint8_t *)buf >= dataMem && (const uint8_t *)buf < &dataMem[dataSize]; };
+
+	/**
+	 * @brief Largest number of bytes of data buffers that were allocated at once
+	 */
+	size_t getPeakBufferBytes() const { return peakBufferBytes; };
+
+	/**
+	 * @brief Number of times allocObject() or allocBuffer() returned NULL
+	 */
+	size_t getAllocFailures() const { return allocFailures + objectPool.getAllocFailures(); };
+
+	/**
+	 * @brief Size of each object slot. This is larger than all of the buffer sampling classes in this library.
+	 */
+	static const size_t OBJECT_SLOT_SIZE = 256;
+
+	/**
+	 * @brief Number of object slots
+	 */
+	static const size_t NUM_OBJECT_SLOTS = 2;
+
+protected:
+	/**
+	 * @brief This class cannot be copied
+	 */
+	Microphone_PDM_Arena(const Microphone_PDM_Arena&) = delete;
+
+	/**
+	 * @brief This class cannot be copied
+	 */
+	Microphone_PDM_Arena& operator=(const Microphone_PDM_Arena&) = delete;
+
+	Microphone_PDM_BlockPool objectPool;	//!< Object slots at the start of the arena
+	uint8_t *dataMem;						//!< Start of the space for data buffers
+	size_t dataSize;						//!< Size of the space for data buffers
+	size_t dataOffset = 0;					//!< Offset of the next data buffer to allocate
+	size_t numBuffers = 0;					//!< Number of data buffers currently allocated
+	size_t peakBufferBytes = 0;				//!< Largest value of dataOffset
+	size_t allocFailures = 0;				//!< Number of times allocBuffer() returned NULL
+};
+
+/**
+ * @brief Microphone_PDM_Arena with statically allocated memory
+ * 
+ * @param SIZE Size of the arena in bytes, including NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE bytes for objects
+ * 
+ * For example, as a global variable:
+ * 
+ *   Microphone_PDM_StaticArena<70000> arena;
+ */
+template <size_t SIZE>
+class Microphone_PDM_StaticArena : public Microphone_PDM_Arena {
+public:
+	explicit Microphone_PDM_StaticArena() : Microphone_PDM_Arena(staticBuffer, SIZE) {};
+
+	static_assert(SIZE > NUM_OBJECT_SLOTS * OBJECT_SLOT_SIZE, "arena is too small to hold any buffers");
+
+private:
+	uint8_t staticBuffer[SIZE] __attribute__((aligned(8))); //!< static buffer to allocate from
+};
+
+#endif /* __Microphone_PDM_Pool_H */
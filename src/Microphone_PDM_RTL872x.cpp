@@ -26,15 +26,27 @@ int Microphone_PDM_RTL872x::init() {
             break;
     }
 
+    dmic_set_rx_callback(rxHandlerStatic);
     dmic_setup(sampleRate, stereoMode);
     return 0;
 }
 
 
 int Microphone_PDM_RTL872x::start() {
-    dmic_flush();
+    if (dmic_lent_count()) {
+        // A page from acquireSamples() was not released. It can't be given back to the DMA
+        // after the flush below, as the DMA takes pages in order.
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
 
-    running = true;
+    // Anything captured before this is discarded. The flush comes first so discarded pages don't use up
+    // sample indexes, which would look like a gap. Interrupts are disabled so no page can be filled
+    // between the flush and setting running, as it would be readable without having been tagged.
+    ATOMIC_BLOCK() {
+        dmic_flush();
+        resetTags();
+        running = true;
+    }
     return 0;
 }
 
@@ -61,7 +73,7 @@ bool Microphone_PDM_RTL872x::copySamples(void*pSamples) {
     int16_t *src = (int16_t *)dmic_ready();
 	if (src) {
 		copySamplesInternal(src, (uint8_t *)pSamples);
-        dmic_read(NULL, 0);
+        releaseReadyBuffer();
 		return true;
 	}
 	else {
@@ -70,15 +82,11 @@ bool Microphone_PDM_RTL872x::copySamples(void*pSamples) {
 }
 
 bool Microphone_PDM_RTL872x::noCopySamples(std::function<void(void *pSamples, size_t numSamples)>callback) {
-    if (!running) {
-        return false;
-    }
+    Microphone_PDM_Page page;
 
-    int16_t *src = (int16_t *)dmic_ready();
-	if (src) {
-		copySamplesInternal(src, (uint8_t *)src);
-		callback(src, BUFFER_SIZE_SAMPLES);
-        dmic_read(NULL, 0);
+	if (acquireSamples(page)) {
+		callback(page.pSamples, page.numSamples);
+        releaseSamples(page);
 		return true;
 	}
 	else {
@@ -86,5 +94,61 @@ bool Microphone_PDM_RTL872x::noCopySamples(std::function<void(void *pSamples, si
 	}
 }
 
+bool Microphone_PDM_RTL872x::acquireSamples(Microphone_PDM_Page &page) {
+    if (!running) {
+        return false;
+    }
+
+    unsigned char *buf;
+    int index = dmic_acquire(&buf);
+    if (index < 0) {
+        return false;
+    }
+
+    int16_t *src = (int16_t *)buf;
+    copySamplesInternal(src, (uint8_t *)src);
+
+    page.pSamples = src;
+    page.numSamples = BUFFER_SIZE_SAMPLES;
+    page.index = index;
+    setPageInfo(page, bufferInfo[index]);
+    return true;
+}
+
+void Microphone_PDM_RTL872x::releaseSamples(Microphone_PDM_Page &page) {
+    if (page.index >= 0) {
+        dmic_release(page.index);
+        statsBufferDelivered();
+    }
+    page.index = -1;
+}
+
+void Microphone_PDM_RTL872x::releaseReadyBuffer() {
+    dmic_read(NULL, 0);
+
+    statsBufferDelivered();
+}
+
+void Microphone_PDM_RTL872x::rxHandler(int page) {
+    if (!running) {
+        // Data is being ignored while stopped, so it doesn't count as dropped
+        return;
+    }
+
+    if (page >= 0) {
+        tagBuffer(&bufferInfo[page], BUFFER_SIZE_SAMPLES);
+        statsBufferProduced(dmic_ready_count());
+        notifySamplesAvailable();
+    }
+    else {
+        tagBuffer(NULL, SP_FULL_BUF_SIZE / 2);
+        statsBufferDropped(SP_FULL_BUF_SIZE / 2);
+    }
+}
+
+// [static]
+void Microphone_PDM_RTL872x::rxHandlerStatic(int page) {
+    Microphone_PDM::instance().rxHandler(page);
+}
 
 #endif // HAL_PLATFORM_RTL872X
@@ -13,8 +13,13 @@
 class Microphone_PDM_RTL872x : public Microphone_PDM_Base
 {
 public:
-    static const size_t BUFFER_SIZE_SAMPLES = SP_DMA_PAGE_SIZE / 2; //!< 512 bytes per buffer
-    static const size_t NUM_BUFFERS = SP_DMA_PAGE_NUM;  //!< 4 buffers, so 2048 bytes total
+    static constexpr size_t BUFFER_SIZE_SAMPLES = SP_DMA_PAGE_SIZE / 2; //!< 256 samples (512 bytes) per buffer by default
+    static constexpr size_t NUM_BUFFERS = SP_DMA_PAGE_NUM;  //!< 4 buffers by default, so 2048 bytes total
+
+    // The DMA buffers are cache-line aligned and the GDMA block size is in 32-bit words
+    static_assert(SP_DMA_PAGE_SIZE >= 32 && (SP_DMA_PAGE_SIZE % 32) == 0, "MICROPHONE_PDM_BUFFER_SIZE_SAMPLES must be a multiple of 16");
+    static_assert(SP_DMA_PAGE_SIZE <= 4096, "MICROPHONE_PDM_BUFFER_SIZE_SAMPLES must be 2048 or less");
+    static_assert(NUM_BUFFERS >= 2 && NUM_BUFFERS <= 255, "MICROPHONE_PDM_NUM_BUFFERS must be from 2 to 255");
 
 protected:
 	/**
@@ -102,6 +107,16 @@ protected:
 	 */
     virtual bool noCopySamples(std::function<void(void *pSamples, size_t numSamples)>callback);
 
+	/**
+	 * @brief Borrow the oldest DMA buffer without copying it. See Microphone_PDM::acquireSamples().
+	 */
+	virtual bool acquireSamples(Microphone_PDM_Page &page);
+
+	/**
+	 * @brief Return a buffer borrowed using acquireSamples(). See Microphone_PDM::releaseSamples().
+	 */
+	virtual void releaseSamples(Microphone_PDM_Page &page);
+
 	/**
 	 * @brief Return the number of int16_t samples that copySamples will copy
 	 * 
@@ -110,8 +125,8 @@ protected:
 	 * You will never get a partial buffer of data. The number of samples is a constant
 	 * that is determined by the MCU type at compile time and does not change. 
 	 * 
-	 * On the RTL872x, it's 256 samples (512 bytes). It's smaller because the are 4 buffers instead of the
-	 * 2 buffers used on the nRF52, and the optimal DMA size on the RTL872x is 512 bytes.
+	 * On the RTL872x, it's 256 samples (512 bytes), as the optimal DMA size on the RTL872x is 512 bytes.
+	 * This can be changed at compile time using MICROPHONE_PDM_BUFFER_SIZE_SAMPLES.
 	 */
 	size_t getNumberOfSamples() const {
 		return BUFFER_SIZE_SAMPLES;
@@ -119,10 +134,33 @@ protected:
 
 
 protected:
+	/**
+	 * @brief Returns the page from dmic_ready() to the DMA. Used internally.
+	 */
+	void releaseReadyBuffer();
+
 	/**
 	 * @brief Since the RTL872x cannot stop DMA, this is used to handle start() and stop().
 	 */
-	bool running = false;
+	volatile bool running = false;
+
+	/**
+	 * @brief Written by the interrupt when a page is filled
+	 */
+	BufferInfo bufferInfo[NUM_BUFFERS];
+
+private:
+	/**
+	 * @brief Used internally to handle notifications from the DMA completion interrupt
+	 *
+	 * @param page The page index that was filled, or -1 if the data was discarded
+	 */
+	void rxHandler(int page);
+
+	/**
+	 * @brief Used internally to handle notifications from the DMA completion interrupt (static function)
+	 */
+	static void rxHandlerStatic(int page);
 
 };
 
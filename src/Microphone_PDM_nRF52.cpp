@@ -45,18 +45,23 @@ int Microphone_PDM_nRF52::init() {
 }
 
 int Microphone_PDM_nRF52::uninit() {
-	currentSampleAvailable = NULL;
-
 	nrfx_pdm_uninit();
 
+	resetBuffers();
+
 	pinMode(clkPin, INPUT);
 
     return 0;
 }
 
 int Microphone_PDM_nRF52::start() {
-	useBufferA = true;
-	currentSampleAvailable = NULL;
+	if (bufferLend.load() != bufferTail.load()) {
+		// A buffer from acquireSamples() was not released. Resetting the ring now would let the
+		// DMA write into it.
+		return SYSTEM_ERROR_INVALID_STATE;
+	}
+
+	resetBuffers();
 
 	nrfx_err_t err = nrfx_pdm_start();
 
@@ -64,22 +69,28 @@ int Microphone_PDM_nRF52::start() {
 }
 
 int Microphone_PDM_nRF52::stop() {
-	currentSampleAvailable = NULL;
-
 	nrfx_err_t err = nrfx_pdm_stop();
 
+	// Discard anything that has not been read yet
+	int index;
+	while((index = acquireBuffer()) >= 0) {
+		returnBuffer(index);
+	}
+
 	return (int)err;
 }
 
 
 bool Microphone_PDM_nRF52::samplesAvailable() const {
-	return (currentSampleAvailable != NULL);
+	return bufferHead.load(std::memory_order_acquire) != bufferLend.load(std::memory_order_relaxed);
 }
 
 bool Microphone_PDM_nRF52::copySamples(void*pSamples) {
-	if (currentSampleAvailable) {
-		copySamplesInternal(currentSampleAvailable, (uint8_t *)pSamples);
-		currentSampleAvailable = NULL;
+	int index = acquireBuffer();
+	if (index >= 0) {
+		copySamplesInternal(&samples[index * BUFFER_SIZE_SAMPLES], (uint8_t *)pSamples);
+		returnBuffer(index);
+		statsBufferDelivered();
 		return true;
 	}
 	else {
@@ -88,10 +99,11 @@ bool Microphone_PDM_nRF52::copySamples(void*pSamples) {
 }
 
 bool Microphone_PDM_nRF52::noCopySamples(std::function<void(void *pSamples, size_t numSamples)>callback) {
-	if (currentSampleAvailable) {
-		copySamplesInternal(currentSampleAvailable, (uint8_t *)currentSampleAvailable);
-		callback(currentSampleAvailable, getNumberOfSamples());
-		currentSampleAvailable = NULL;
+	Microphone_PDM_Page page;
+
+	if (acquireSamples(page)) {
+		callback(page.pSamples, page.numSamples);
+		releaseSamples(page);
 		return true;
 	}
 	else {
@@ -100,6 +112,72 @@ bool Microphone_PDM_nRF52::noCopySamples(std::function<void(void *pSamples, size
 
 }
 
+bool Microphone_PDM_nRF52::acquireSamples(Microphone_PDM_Page &page) {
+	int index = acquireBuffer();
+	if (index < 0) {
+		return false;
+	}
+
+	int16_t *src = &samples[index * BUFFER_SIZE_SAMPLES];
+	copySamplesInternal(src, (uint8_t *)src);
+
+	page.pSamples = src;
+	page.numSamples = getNumberOfSamples();
+	page.index = index;
+	setPageInfo(page, bufferInfo[index]);
+	return true;
+}
+
+void Microphone_PDM_nRF52::releaseSamples(Microphone_PDM_Page &page) {
+	if (page.index >= 0 && page.index < (int)NUM_BUFFERS) {
+		returnBuffer(page.index);
+		statsBufferDelivered();
+	}
+	page.index = -1;
+}
+
+int Microphone_PDM_nRF52::acquireBuffer() {
+	uint32_t lend = bufferLend.load(std::memory_order_relaxed);
+
+	if (bufferHead.load(std::memory_order_acquire) == lend) {
+		return -1;
+	}
+	bufferLend.store(lend + 1, std::memory_order_relaxed);
+
+	return (int)(lend % NUM_BUFFERS);
+}
+
+void Microphone_PDM_nRF52::returnBuffer(int index) {
+	// Buffers can be returned from other threads, but advancing the tail must not be interleaved
+	SINGLE_THREADED_BLOCK() {
+		bufferReturned[index] = true;
+
+		// The DMA reuses buffers in order, so the tail can only move past buffers that have been returned
+		uint32_t tail = bufferTail.load(std::memory_order_relaxed);
+		uint32_t lend = bufferLend.load(std::memory_order_relaxed);
+
+		while(tail != lend && bufferReturned[tail % NUM_BUFFERS]) {
+			bufferReturned[tail % NUM_BUFFERS] = false;
+			tail++;
+		}
+
+		// The release ordering makes sure we're done with the buffer before the interrupt can hand it to the DMA
+		bufferTail.store(tail, std::memory_order_release);
+	}
+}
+
+void Microphone_PDM_nRF52::resetBuffers() {
+	bufferHead.store(0);
+	bufferLend.store(0);
+	bufferTail.store(0);
+	bufferSet = 0;
+	resetTags();
+
+	for(size_t ii = 0; ii < NUM_BUFFERS; ii++) {
+		bufferReturned[ii] = false;
+	}
+}
+
 size_t Microphone_PDM_nRF52::copySrcIncrement() const {
 	if (sampleRate == 8000) {
 		return 2;
@@ -119,17 +197,32 @@ void Microphone_PDM_nRF52::dataHandler(nrfx_pdm_evt_t const * const pEvent) {
 	 */
 
 	if (pEvent->buffer_released) {
-		currentSampleAvailable = (int16_t *)pEvent->buffer_released;;
+		if (pEvent->buffer_released != overrunSamples) {
+			// Ring buffers are always released in the order they were set, so this is the buffer at bufferHead
+			uint32_t head = bufferHead.load(std::memory_order_relaxed);
+			tagBuffer(&bufferInfo[head % NUM_BUFFERS], getNumberOfSamples());
+
+			bufferHead.store(++head, std::memory_order_release);
+
+			statsBufferProduced(head - bufferTail.load(std::memory_order_relaxed));
+			notifySamplesAvailable();
+		}
+		else {
+			tagBuffer(NULL, OVERRUN_BUFFER_SIZE_SAMPLES / copySrcIncrement());
+			statsBufferDropped(OVERRUN_BUFFER_SIZE_SAMPLES / copySrcIncrement());
+		}
 	}
 
 	if (pEvent->buffer_requested) {
-		if (useBufferA) {
-			nrfx_pdm_buffer_set(samples, BUFFER_SIZE_SAMPLES);
+		if (bufferSet - bufferTail.load(std::memory_order_acquire) < NUM_BUFFERS) {
+			nrfx_pdm_buffer_set(&samples[(bufferSet % NUM_BUFFERS) * BUFFER_SIZE_SAMPLES], BUFFER_SIZE_SAMPLES);
+			bufferSet++;
 		}
 		else {
-			nrfx_pdm_buffer_set(&samples[BUFFER_SIZE_SAMPLES], BUFFER_SIZE_SAMPLES);
+			// All of the ring buffers are either owned by the DMA or waiting to be consumed, so this
+			// data will be lost. Never hand a buffer the consumer may be reading to the DMA.
+			nrfx_pdm_buffer_set(overrunSamples, OVERRUN_BUFFER_SIZE_SAMPLES);
 		}
-		useBufferA = !useBufferA;
 	}
 }
 
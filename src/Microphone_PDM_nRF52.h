@@ -2,6 +2,30 @@
 
 #include "nrfx_pdm.h"
 
+#include <atomic>
+
+#ifndef MICROPHONE_PDM_BUFFER_SIZE_SAMPLES
+/**
+ * @brief Number of 16-bit samples in each DMA buffer
+ *
+ * At 16000 Hz, the default of 512 samples is 32 milliseconds of audio. Smaller buffers reduce
+ * latency at the cost of more frequent interrupts. Must be even and no larger than 32766.
+ */
+#define MICROPHONE_PDM_BUFFER_SIZE_SAMPLES 512
+#endif
+
+#ifndef MICROPHONE_PDM_NUM_BUFFERS
+/**
+ * @brief Number of DMA buffers in the queue between the PDM interrupt and your code
+ *
+ * The PDM peripheral always owns two of the buffers: the one it's writing and the next one. The
+ * rest can wait for your code, so the default of 4 allows loop() to be late by about two buffers
+ * (64 milliseconds with the default buffer size at 16000 Hz) without losing data. Must be a power
+ * of 2 and at least 4. With 2, there is never a free buffer when the peripheral asks for one, so
+ * every other transfer would be lost.
+ */
+#define MICROPHONE_PDM_NUM_BUFFERS 4
+#endif
 
 /**
  * @brief MCU-specific implementation of PDM for the nRF52
@@ -14,8 +38,15 @@
 class Microphone_PDM_nRF52  : public Microphone_PDM_Base
 {
 public:
-    static const size_t BUFFER_SIZE_SAMPLES = 512; //!< 1024 bytes per buffer
-    static const size_t NUM_BUFFERS = 2;  //!< 2 buffers, so 2048 bytes total
+    static constexpr size_t BUFFER_SIZE_SAMPLES = MICROPHONE_PDM_BUFFER_SIZE_SAMPLES; //!< 512 samples (1024 bytes) per buffer by default
+    static constexpr size_t NUM_BUFFERS = MICROPHONE_PDM_NUM_BUFFERS;  //!< 4 buffers by default, so 4096 bytes total
+    static constexpr size_t OVERRUN_BUFFER_SIZE_SAMPLES = (BUFFER_SIZE_SAMPLES < 64) ? BUFFER_SIZE_SAMPLES : 64; //!< Buffer the DMA writes to (and discards) when the ring is full
+
+    // EasyDMA requires word-aligned buffers, so each buffer must be an even number of 16-bit samples. This
+    // is also required to discard every other sample at 8000 Hz and to keep stereo pairs together.
+    static_assert(BUFFER_SIZE_SAMPLES >= 2 && (BUFFER_SIZE_SAMPLES % 2) == 0, "MICROPHONE_PDM_BUFFER_SIZE_SAMPLES must be even");
+    static_assert(BUFFER_SIZE_SAMPLES <= NRFX_PDM_MAX_BUFFER_SIZE, "MICROPHONE_PDM_BUFFER_SIZE_SAMPLES is larger than the PDM peripheral supports");
+    static_assert(NUM_BUFFERS >= 4 && (NUM_BUFFERS & (NUM_BUFFERS - 1)) == 0, "MICROPHONE_PDM_NUM_BUFFERS must be a power of 2 and at least 4");
 
 
 protected:
@@ -104,6 +135,16 @@ protected:
 	 */
 	virtual bool noCopySamples(std::function<void(void *pSamples, size_t numSamples)>callback);
 
+	/**
+	 * @brief Borrow the oldest DMA buffer without copying it. See Microphone_PDM::acquireSamples().
+	 */
+	virtual bool acquireSamples(Microphone_PDM_Page &page);
+
+	/**
+	 * @brief Return a buffer borrowed using acquireSamples(). See Microphone_PDM::releaseSamples().
+	 */
+	virtual void releaseSamples(Microphone_PDM_Page &page);
+
 	/**
 	 * @brief Return the number of int16_t samples that copySamples will copy
 	 * 
@@ -115,6 +156,8 @@ protected:
 	 * On the nRF52, it's 512 samples (1024 bytes), except in one case: If you set a sample rate of
 	 * 8000 Hz, it will be 256 samples because the hardware only samples at 16000 Hz but the code
 	 * will automatically discard every other sample so there will only be 256 samples.
+	 * 
+	 * The 512 sample buffer size can be changed at compile time using MICROPHONE_PDM_BUFFER_SIZE_SAMPLES.
 	 */	
 	size_t getNumberOfSamples() const {
 		return BUFFER_SIZE_SAMPLES / copySrcIncrement();
@@ -133,6 +176,25 @@ protected:
 	 */
 	size_t copySrcIncrement() const;
 
+	/**
+	 * @brief Takes the oldest buffer in the ring that has not been handed out yet
+	 *
+	 * @return int The buffer index (0 to NUM_BUFFERS - 1), or -1 if there is none
+	 */
+	int acquireBuffer();
+
+	/**
+	 * @brief Returns a buffer from acquireBuffer() to the ring so the DMA can reuse it
+	 *
+	 * Buffers can be returned in any order. This can be called from any thread.
+	 */
+	void returnBuffer(int index);
+
+	/**
+	 * @brief Discards all unconsumed buffers and resets the ring. Only call when the PDM is stopped.
+	 */
+	void resetBuffers();
+
 private:
 	/**
 	 * @brief Used internally to handle notifications from the PDM peripheral
@@ -152,10 +214,30 @@ private:
 	nrf_pdm_freq_t freq = NRF_PDM_FREQ_1032K;		//!< clock frequency
 	nrf_pdm_edge_t edge = NRF_PDM_EDGE_LEFTFALLING; //!< clock edge configuration
 
-	int16_t *currentSampleAvailable = NULL;
-	bool useBufferA = true;							//!< Which buffer we're reading from of the double buffers
-
-	int16_t samples[BUFFER_SIZE_SAMPLES * NUM_BUFFERS];
+	/**
+	 * The buffers form a single-producer, single-consumer ring. The counters are free-running
+	 * and the buffer index is the counter modulo NUM_BUFFERS.
+	 *
+	 * bufferHead is only written by the PDM interrupt; it's the number of buffers filled by the DMA.
+	 * bufferLend is only written by the consumer; it's the number of buffers handed to the consumer.
+	 * bufferTail is only written by the consumer; it's the number of buffers returned by the consumer, in order.
+	 * bufferSet is only used by the PDM interrupt; it's the number of ring buffers handed to the DMA.
+	 *
+	 * The interrupt never hands a buffer between bufferTail and bufferHead to the DMA. If the ring is full
+	 * it uses overrunSamples instead, and that data is discarded.
+	 *
+	 * Buffers between bufferTail and bufferLend are owned by the consumer. If one is returned out of order,
+	 * bufferReturned is set and bufferTail advances past it when all older buffers have been returned.
+	 */
+	std::atomic<uint32_t> bufferHead{0};
+	std::atomic<uint32_t> bufferLend{0};
+	std::atomic<uint32_t> bufferTail{0};
+	uint32_t bufferSet = 0;
+	bool bufferReturned[NUM_BUFFERS] = {0};
+	BufferInfo bufferInfo[NUM_BUFFERS];	//!< Written by the interrupt when a buffer is filled
+
+	int16_t samples[BUFFER_SIZE_SAMPLES * NUM_BUFFERS] __attribute__((aligned(4)));
+	int16_t overrunSamples[OVERRUN_BUFFER_SIZE_SAMPLES] __attribute__((aligned(4)));
 };
 
 /**
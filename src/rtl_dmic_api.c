@@ -8,15 +8,14 @@
 #define _PB_1		(0x21)	//0x484 = DMIC_CLK - A0
 #define _PB_2		(0x22)	//0x488 = DMIC_DATA - A1
 
-#define SP_FULL_BUF_SIZE		128
-
 typedef struct {
 	GDMA_InitTypeDef       	SpRxGdmaInitStruct;              //Pointer to GDMA_InitTypeDef	
 }SP_GDMA_STRUCT, *pSP_GDMA_STRUCT;
 
 
 typedef struct {
-	u8 rx_gdma_own;
+	volatile u8 rx_gdma_own;
+	volatile u8 rx_lent;		// page has been lent to the user by sp_acquire_rx_page
 	u32 rx_addr;
 	u32 rx_length;
 	
@@ -25,17 +24,24 @@ typedef struct {
 typedef struct {
 	RX_BLOCK rx_block[SP_DMA_PAGE_NUM];
 	RX_BLOCK rx_full_block;
-	u8 rx_gdma_cnt;
+	volatile u8 rx_gdma_cnt;
 	u8 rx_usr_cnt;
-	u8 rx_full_flag;
+	volatile u8 rx_full_flag;
 	
 }SP_RX_INFO, *pSP_RX_INFO;
 
+// The page flags are changed from thread context while the GDMA interrupt reads them and hands
+// pages to the DMA, so those changes are made with interrupts disabled. The previous state is
+// restored so these can be used when interrupts are already disabled.
+#define SP_ENTER_CRITICAL()	u32 sp_primask = __get_PRIMASK(); __disable_irq()
+#define SP_EXIT_CRITICAL()	__set_PRIMASK(sp_primask)
+
 
 
 static SP_InitTypeDef SP_InitStruct;
 static SP_GDMA_STRUCT SPGdmaStruct;
 static SP_RX_INFO sp_rx_info;
+static dmic_rx_callback_t sp_rx_callback = NULL;
 
 
 //The size of this buffer should be multiples of 32 and its head address should align to 32 
@@ -51,13 +57,49 @@ u8 *sp_get_ready_rx_page(void)
 {
 	pRX_BLOCK prx_block = &(sp_rx_info.rx_block[sp_rx_info.rx_usr_cnt]);
 	
-	if (prx_block->rx_gdma_own)
+	if (prx_block->rx_gdma_own || prx_block->rx_lent)
 		return NULL;
 	else{
 		return (u8*)prx_block->rx_addr;
 	}
 }
 
+int sp_acquire_rx_page(u8 **buf)
+{
+	int page = sp_rx_info.rx_usr_cnt;
+	pRX_BLOCK prx_block = &(sp_rx_info.rx_block[page]);
+	
+	SP_ENTER_CRITICAL();
+	if (prx_block->rx_gdma_own || prx_block->rx_lent){
+		SP_EXIT_CRITICAL();
+		return -1;
+	}
+	prx_block->rx_lent = 1;
+	SP_EXIT_CRITICAL();
+
+	*buf = (u8*)prx_block->rx_addr;
+	sp_rx_info.rx_usr_cnt++;
+	if (sp_rx_info.rx_usr_cnt == SP_DMA_PAGE_NUM){
+		sp_rx_info.rx_usr_cnt = 0;
+	}
+	return page;
+}
+
+void sp_return_rx_page(int page)
+{
+	// Pages can be returned out of order. The DMA still takes them in order as sp_get_free_rx_page
+	// only looks at the page at rx_gdma_cnt.
+	pRX_BLOCK prx_block = &(sp_rx_info.rx_block[page]);
+
+	// Finish with the page before the interrupt can give it to the DMA
+	__DMB();
+
+	SP_ENTER_CRITICAL();
+	prx_block->rx_lent = 0;
+	prx_block->rx_gdma_own = 1;
+	SP_EXIT_CRITICAL();
+}
+
 void sp_read_rx_page(u8 *dst, u32 length)
 {
 	pRX_BLOCK prx_block = &(sp_rx_info.rx_block[sp_rx_info.rx_usr_cnt]);
@@ -65,7 +107,12 @@ void sp_read_rx_page(u8 *dst, u32 length)
 	if (dst) {
 		memcpy(dst, (void const*)prx_block->rx_addr, length);
 	}
+	__DMB();
+
+	SP_ENTER_CRITICAL();
 	prx_block->rx_gdma_own = 1;
+	SP_EXIT_CRITICAL();
+
 	sp_rx_info.rx_usr_cnt++;
 	if (sp_rx_info.rx_usr_cnt == SP_DMA_PAGE_NUM){
 		sp_rx_info.rx_usr_cnt = 0;
@@ -120,12 +167,16 @@ void sp_rx_complete(void *Data)
 	PGDMA_InitTypeDef GDMA_InitStruct;
 	u32 rx_addr;
 	u32 rx_length;
+	int page;
 	
 	GDMA_InitStruct = &(gs->SpRxGdmaInitStruct);
 	DCache_Invalidate(GDMA_InitStruct->GDMA_DstAddr, GDMA_InitStruct->GDMA_BlockSize<<2);
 	/* Clear Pending ISR */
 	GDMA_ClearINT(GDMA_InitStruct->GDMA_Index, GDMA_InitStruct->GDMA_ChNum);
 
+	// If the full flag is set, this transfer went into rx_full_block and is discarded
+	page = sp_rx_info.rx_full_flag ? -1 : (int)sp_rx_info.rx_gdma_cnt;
+
 	sp_release_rx_page();
 	rx_addr = (u32)sp_get_free_rx_page();
 	rx_length = sp_get_free_rx_length();
@@ -134,6 +185,10 @@ void sp_rx_complete(void *Data)
 	
 	GDMA_Cmd(GDMA_InitStruct->GDMA_Index, GDMA_InitStruct->GDMA_ChNum, ENABLE);
 	//AUDIO_SP_RXGDMA_Restart(GDMA_InitStruct->GDMA_Index, GDMA_InitStruct->GDMA_ChNum, rx_addr, rx_length);
+
+	if (sp_rx_callback) {
+		sp_rx_callback(page);
+	}
 }
 
 static void sp_init_hal(pSP_OBJ psp_obj)
@@ -191,6 +246,7 @@ static void sp_init_rx_variables(void)
 	
 	for(i=0; i<SP_DMA_PAGE_NUM; i++){
 		sp_rx_info.rx_block[i].rx_gdma_own = 1;
+		sp_rx_info.rx_block[i].rx_lent = 0;
 		sp_rx_info.rx_block[i].rx_addr = (u32)sp_rx_buf+i*SP_DMA_PAGE_SIZE;
 		sp_rx_info.rx_block[i].rx_length = SP_DMA_PAGE_SIZE;
 	}
@@ -252,6 +308,10 @@ void dmic_setup(int sampleRate, bool stereoMode) {
 }
 
 
+void dmic_set_rx_callback(dmic_rx_callback_t callback) {
+	sp_rx_callback = callback;
+}
+
 void dmic_flush() {
 	while(sp_get_ready_rx_page() != NULL) {
         sp_read_rx_page(NULL, 0);
@@ -266,6 +326,40 @@ void dmic_read(unsigned char *buf, size_t len) {
 	sp_read_rx_page(buf, len);
 }
 
+int dmic_acquire(unsigned char **buf) {
+	return sp_acquire_rx_page(buf);
+}
+
+void dmic_release(int page) {
+	if (page >= 0 && page < SP_DMA_PAGE_NUM) {
+		sp_return_rx_page(page);
+	}
+}
+
+unsigned int dmic_lent_count() {
+	unsigned int count = 0;
+	int i;
+
+	for(i=0; i<SP_DMA_PAGE_NUM; i++){
+		if (sp_rx_info.rx_block[i].rx_lent) {
+			count++;
+		}
+	}
+	return count;
+}
+
+unsigned int dmic_ready_count() {
+	unsigned int count = 0;
+	int i;
+
+	for(i=0; i<SP_DMA_PAGE_NUM; i++){
+		if (!sp_rx_info.rx_block[i].rx_gdma_own) {
+			count++;
+		}
+	}
+	return count;
+}
+
 
 
 #endif
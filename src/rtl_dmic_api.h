@@ -4,8 +4,19 @@
 extern "C" {
 #endif
 
-#define SP_DMA_PAGE_SIZE	512   // 2 ~ 4096
-#define SP_DMA_PAGE_NUM    	4
+// The number of 16-bit samples per DMA page and number of pages can be overridden at compile time.
+// The page size in bytes must be a multiple of 32 (the cache line size) and no larger than 4096.
+#ifndef MICROPHONE_PDM_BUFFER_SIZE_SAMPLES
+#define MICROPHONE_PDM_BUFFER_SIZE_SAMPLES	256
+#endif
+
+#ifndef MICROPHONE_PDM_NUM_BUFFERS
+#define MICROPHONE_PDM_NUM_BUFFERS	4
+#endif
+
+#define SP_DMA_PAGE_SIZE	(MICROPHONE_PDM_BUFFER_SIZE_SAMPLES * 2)   // 2 ~ 4096
+#define SP_DMA_PAGE_NUM    	MICROPHONE_PDM_NUM_BUFFERS
+#define SP_FULL_BUF_SIZE	128	// DMA target when all pages are full, this data is discarded
 
 typedef struct {
 	unsigned int sample_rate;
@@ -14,11 +25,22 @@ typedef struct {
 	unsigned int direction;	
 }SP_OBJ, *pSP_OBJ;
 
+/**
+ * Called from the DMA completion interrupt. page is the index of the page that was just filled
+ * (0 to SP_DMA_PAGE_NUM - 1), or -1 if all pages were owned by the user and the data was discarded.
+ */
+typedef void (*dmic_rx_callback_t)(int page);
+
 void dmic_setup(int sampleRate, bool stereoMode);
+void dmic_set_rx_callback(dmic_rx_callback_t callback);
 
 void dmic_flush();
 unsigned char *dmic_ready();
 void dmic_read(unsigned char *buf, size_t len);
+int dmic_acquire(unsigned char **buf);
+void dmic_release(int page);
+unsigned int dmic_ready_count();
+unsigned int dmic_lent_count();
 
 
 #ifdef __cplusplus